@@ -0,0 +1,196 @@
+#define _GNU_SOURCE
+#include "../src/include/arena.h"
+#include "../src/include/ast.h"
+#include "../src/include/defines.h"
+#include "../src/include/interp.h"
+#include "../src/include/ir.h"
+#include "../src/include/lexer.h"
+#include "../src/include/parser.h"
+#include "../src/include/string.h"
+#include "../src/include/vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <time.h>
+
+// End-to-end front end throughput benchmark.
+//
+// Usage: bench <program.bz>
+//
+// Times the lexer on its own, then lexer+parser, then the emitter, then
+// running the program on the tree walker, the VM and the VM with --jit,
+// and prints one JSON object per input on stdout. Program output goes
+// nowhere. Parser numbers have the lex
+// time subtracted so each phase stands on its own. Run one process per
+// input so peak_rss_kb belongs to that input alone.
+
+// Small inputs are repeated until roughly this many bytes went through
+// each phase so the timings are not all noise
+#define BENCH_MIN_BYTES (64ull * 1024 * 1024)
+
+typedef struct {
+    u64 ns;
+    u64 iters;
+} PhaseTime;
+
+static u64 now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+}
+
+static ssize_t count_write(void* cookie, const char* buf, size_t size) {
+    (void)buf;
+    *(u64*)cookie += size;
+    return size;
+}
+
+static void print_phase(const char* name, PhaseTime t, u64 bytes, u64 tokens) {
+    f64 secs = (f64)t.ns / t.iters / 1e9;
+    printf("\"%s\":{\"ns\":%llu,\"mb_s\":%.2f,\"tok_s\":%.0f}", name,
+           (unsigned long long)(t.ns / t.iters),
+           secs > 0 ? bytes / secs / (1024.0 * 1024.0) : 0.0,
+           secs > 0 ? tokens / secs : 0.0);
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: bench <program.bz>\n");
+        return 5;
+    }
+
+    FILE* f = fopen(argv[1], "rb");
+    if (!f) {
+        fprintf(stderr, "Failed to open %s\n", argv[1]);
+        return 1;
+    }
+
+    fseek(f, 0L, SEEK_END);
+    usize sz = ftell(f);
+    rewind(f);
+
+    Arena* arena = arena_new_sized(ARENA_DEFAULT_SIZE + sz * ARENA_SRC_FACTOR);
+    String src = string_alloc(arena, sz);
+    fread(src.data, sizeof(char), src.len, f);
+    fclose(f);
+
+    u64 iters = sz ? BENCH_MIN_BYTES / sz : 1;
+    if (iters == 0) iters = 1;
+
+    u64 base = arena->pos_u64;
+    u64 tokens = 0;
+
+    PhaseTime lex = {0, iters};
+    for (u64 i = 0; i < iters; ++i) {
+        Lexer* lexer = lexer_new(arena, src);
+        tokens = 0;
+
+        u64 start = now_ns();
+        while (lexer_next_token(lexer).type != Token_EOF) {
+            tokens++;
+        }
+        lex.ns += now_ns() - start;
+
+        arena_set_pos_back(arena, base);
+    }
+
+    PhaseTime parse = {0, iters};
+    Parser* parser = 0;
+    for (u64 i = 0; i < iters; ++i) {
+        if (parser) arena_set_pos_back(arena, base);
+
+        u64 start = now_ns();
+        parser = parser_new(lexer_new(arena, src), arena);
+        parser_parse(parser);
+        parse.ns += now_ns() - start;
+    }
+    parse.ns = parse.ns > lex.ns ? parse.ns - lex.ns : 0;
+
+    u64 out_bytes = 0;
+    cookie_io_functions_t io = { .write = count_write };
+    FILE* sink = fopencookie(&out_bytes, "w", io);
+
+    u64 parsed = arena->pos_u64;
+    IrProgram ir = {0};
+
+    PhaseTime emit = {0, iters};
+    for (u64 i = 0; i < iters; ++i) {
+        arena_set_pos_back(arena, parsed);
+        ir = (IrProgram){ .syms = ir_symbols_new(arena) };
+
+        u64 start = now_ns();
+        ir_emit_header(sink);
+        ir_lower(arena, &ir, parser->ast, parser->var_map);
+        ir_emit(&ir, sink);
+        fflush(sink);
+        emit.ns += now_ns() - start;
+    }
+    fclose(sink);
+
+    u64 run_bytes = 0;
+    FILE* run_sink = fopencookie(&run_bytes, "w", io);
+
+    PhaseTime tree = {0, iters};
+    for (u64 i = 0; i < iters; ++i) {
+        Interp* interp = interp_new(run_sink);
+
+        u64 start = now_ns();
+        interp_run(interp, arena, parser->ast);
+        fflush(run_sink);
+        tree.ns += now_ns() - start;
+
+        interp_free(interp);
+    }
+
+    PhaseTime vm_time = {0, iters};
+    for (u64 i = 0; i < iters; ++i) {
+        Vm* vm = vm_new(ir.syms, run_sink);
+
+        u64 start = now_ns();
+        vm_run(vm, arena, &ir);
+        fflush(run_sink);
+        vm_time.ns += now_ns() - start;
+
+        vm_free(vm);
+    }
+
+    PhaseTime jit = {0, iters};
+    for (u64 i = 0; i < iters; ++i) {
+        Vm* vm = vm_new(ir.syms, run_sink);
+        vm_enable_jit(vm);
+
+        u64 start = now_ns();
+        vm_run(vm, arena, &ir);
+        fflush(run_sink);
+        jit.ns += now_ns() - start;
+
+        vm_free(vm);
+    }
+    fclose(run_sink);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("{\"file\":\"%s\",\"bytes\":%llu,\"tokens\":%llu,\"iters\":%llu,",
+           argv[1],
+           (unsigned long long)sz,
+           (unsigned long long)tokens,
+           (unsigned long long)iters);
+    print_phase("lex", lex, sz, tokens);
+    printf(",");
+    print_phase("parse", parse, sz, tokens);
+    printf(",");
+    print_phase("emit", emit, sz, tokens);
+    printf(",");
+    print_phase("tree", tree, sz, tokens);
+    printf(",");
+    print_phase("vm", vm_time, sz, tokens);
+    printf(",");
+    print_phase("jit", jit, sz, tokens);
+    printf(",\"out_bytes\":%llu,\"peak_rss_kb\":%ld}\n",
+           (unsigned long long)(out_bytes / iters),
+           usage.ru_maxrss);
+
+    arena_free(arena);
+    return 0;
+}
@@ -0,0 +1,224 @@
+#include "../src/include/defines.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Synthetic .bz program generator for the benchmark suite.
+//
+// Usage: bzgen <size>[K|M|G] [seed]
+//
+// Writes a program of roughly <size> bytes to stdout. The output mixes
+// deep expressions, lots of lets, long string literals and comment-heavy
+// stretches so every part of the front end gets exercised.
+
+#define MAX_EXPR_DEPTH 48
+#define MAX_STR_LEN    2048
+
+static u64 rng_state = 0x9e3779b97f4a7c15ull;
+
+static u64 rng_next(void) {
+    u64 x = rng_state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    rng_state = x;
+    return x;
+}
+
+static u64 rng_range(u64 n) {
+    return rng_next() % n;
+}
+
+static u64 written = 0;
+static u64 nums = 0;
+static u64 strs = 0;
+static u64 bools = 0;
+
+static void out(const char* s) {
+    written += strlen(s);
+    fputs(s, stdout);
+}
+
+static void outf(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    written += vprintf(fmt, args);
+    va_end(args);
+}
+
+static void gen_num_terminal(void) {
+    if (nums > 0 && rng_range(3) == 0) {
+        outf("n%llu", (unsigned long long)rng_range(nums));
+        return;
+    }
+
+    if (rng_range(4) == 0) {
+        outf("%llu.%02llu", (unsigned long long)rng_range(100000),
+                            (unsigned long long)rng_range(100));
+    } else {
+        outf("%llu", (unsigned long long)rng_range(1000));
+    }
+}
+
+static void gen_num_expr(u32 depth) {
+    if (depth == 0 || rng_range(8) == 0) {
+        gen_num_terminal();
+        return;
+    }
+
+    static const char* ops[] = { " + ", " - ", " * ", " / " };
+
+    switch (rng_range(4)) {
+        case 0: {
+            out("(");
+            gen_num_expr(depth - 1);
+            out(")");
+            break;
+        }
+        case 1: {
+            out("-");
+            gen_num_terminal();
+            out(ops[rng_range(4)]);
+            gen_num_expr(depth - 1);
+            break;
+        }
+        default: {
+            gen_num_expr(depth / 2);
+            out(ops[rng_range(4)]);
+            out("(");
+            gen_num_expr(depth - 1);
+            out(")");
+            break;
+        }
+    }
+}
+
+static void gen_bool_expr(u32 depth) {
+    static const char* cmps[] = { " == ", " > ", " >= ", " < ", " <= " };
+    static const char* logic[] = { " and ", " or " };
+
+    if (depth == 0 || rng_range(3) == 0) {
+        out("(");
+        gen_num_expr(2);
+        out(cmps[rng_range(5)]);
+        gen_num_expr(2);
+        out(")");
+        return;
+    }
+
+    if (rng_range(4) == 0) {
+        out(rng_range(2) ? "!true" : "!false");
+        out(logic[rng_range(2)]);
+    } else {
+        gen_bool_expr(depth - 1);
+        out(logic[rng_range(2)]);
+    }
+    gen_bool_expr(depth - 1);
+}
+
+static void gen_string(void) {
+    static const char words[] =
+        "the quick brown fox jumps over the lazy dog while the blaze "
+        "compiler chews through yet another synthetic benchmark input ";
+
+    u64 len = 8 + rng_range(MAX_STR_LEN);
+    out("\"");
+    for (u64 i = 0; i < len; ++i) {
+        char c = words[(i + len) % (sizeof(words) - 1)];
+        putchar(c);
+    }
+    written += len;
+    out("\"");
+}
+
+static void gen_comment_block(void) {
+    u64 lines = 1 + rng_range(12);
+    for (u64 i = 0; i < lines; ++i) {
+        outf("# comment line %llu: generated filler to stress comment skipping\n",
+             (unsigned long long)i);
+    }
+}
+
+static void gen_stmt(void) {
+    switch (rng_range(10)) {
+        case 0: {
+            gen_comment_block();
+            return;
+        }
+        case 1: {
+            outf("let s%llu = ", (unsigned long long)strs++);
+            gen_string();
+            break;
+        }
+        case 2: {
+            outf("let b%llu = ", (unsigned long long)bools++);
+            gen_bool_expr(4);
+            break;
+        }
+        case 3: {
+            if (nums == 0) goto let_num;
+            static const char* assigns[] = { " += ", " -= ", " *= ", " /= " };
+            outf("n%llu", (unsigned long long)rng_range(nums));
+            out(assigns[rng_range(4)]);
+            gen_num_expr(6);
+            break;
+        }
+        case 4: {
+            if (strs > 0 && rng_range(2)) {
+                outf("print s%llu", (unsigned long long)rng_range(strs));
+            } else if (nums > 0) {
+                outf("print n%llu", (unsigned long long)rng_range(nums));
+            } else {
+                out("print \"hello\"");
+            }
+            break;
+        }
+        case 5: {
+            outf("let n%llu = ", (unsigned long long)nums);
+            gen_num_expr(MAX_EXPR_DEPTH);
+            nums++;
+            break;
+        }
+        default: {
+        let_num:
+            outf("let n%llu = ", (unsigned long long)nums);
+            gen_num_expr(8);
+            nums++;
+            break;
+        }
+    }
+
+    out(";\n");
+}
+
+static u64 parse_size(const char* s) {
+    char* end;
+    u64 n = strtoull(s, &end, 10);
+    switch (*end) {
+        case 'k': case 'K': n *= 1024ull; break;
+        case 'm': case 'M': n *= 1024ull * 1024ull; break;
+        case 'g': case 'G': n *= 1024ull * 1024ull * 1024ull; break;
+        default: break;
+    }
+    return n;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: bzgen <size>[K|M|G] [seed]\n");
+        return 5;
+    }
+
+    u64 target = parse_size(argv[1]);
+    if (argc >= 3) {
+        rng_state ^= strtoull(argv[2], NULL, 10) * 0x2545f4914f6cdd1dull;
+    }
+
+    out("# synthetic blaze benchmark program\n");
+    while (written < target) {
+        gen_stmt();
+    }
+
+    return 0;
+}
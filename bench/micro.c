@@ -0,0 +1,326 @@
+#include "../src/include/arena.h"
+#include "../src/include/defines.h"
+#include "../src/include/hashmap.h"
+#include "../src/include/number.h"
+#include "../src/include/string.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Microbenchmarks for the core primitives.
+//
+// Usage: microbench [--baseline file] [--write-baseline file] [--threshold pct]
+//
+// Every case is warmed up, calibrated so one sample takes at least
+// MICRO_SAMPLE_NS, then sampled MICRO_SAMPLES times. Median and p99 are
+// reported in ns per op. With --baseline the medians are compared against
+// the stored ones and the run fails when any case got slower by more than
+// the threshold (default 25%). Cases that look regressed are re-measured
+// a few times and keep their best median before they fail the run.
+
+#define MICRO_SAMPLES   101
+#define MICRO_SAMPLE_NS 100000ull
+#define MICRO_WARMUP_NS 20000000ull
+#define MICRO_MAX_CASES 64
+#define MICRO_RETRIES   3
+
+static volatile u64 sink;
+
+static Arena* arena;
+static u64    arena_base;
+
+typedef void (*MicroFn)(u64 size, u64 iters);
+
+typedef struct {
+    const char* name;
+    u64 size;
+    f64 median;
+    f64 p99;
+} MicroResult;
+
+typedef struct {
+    char name[32];
+    u64  size;
+    f64  median;
+} BaselineEntry;
+
+static u64 now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+}
+
+static void arena_reset(void) {
+    arena_set_pos_back(arena, arena_base);
+}
+
+static String make_text(u64 len, const char* fill) {
+    String s = string_alloc(arena, len);
+    u64 fill_len = strlen(fill);
+    for (u64 i = 0; i < len; ++i) {
+        s.data[i] = fill[i % fill_len];
+    }
+    s.data[len] = '\0';
+    return s;
+}
+
+/*
+*  Cases
+*/
+
+static void micro_arena_alloc(u64 size, u64 iters) {
+    for (u64 i = 0; i < iters; ++i) {
+        if ((i & 1023) == 0) arena_reset();
+        sink += (u64)arena_alloc(arena, size);
+    }
+    arena_reset();
+}
+
+static void micro_string_concat(u64 size, u64 iters) {
+    String a = make_text(size / 2, "abcdefgh");
+    String b = make_text(size - size / 2, "ijklmnop");
+    u64 base = arena->pos_u64;
+
+    for (u64 i = 0; i < iters; ++i) {
+        String s = string_concat(arena, a, b);
+        sink += s.len;
+        arena_set_pos_back(arena, base);
+    }
+    arena_reset();
+}
+
+static void micro_string_index_of(u64 size, u64 iters) {
+    String hay = make_text(size, "the quick brown fox jumps over ");
+    memcpy(hay.data + size - 8, "lazy dog", 8);
+    String needle = string("lazy dog");
+
+    for (u64 i = 0; i < iters; ++i) {
+        sink += string_index_of(hay, needle);
+    }
+    arena_reset();
+}
+
+static void micro_string_replace(u64 size, u64 iters) {
+    String str = make_text(size, "let x = 1; print x; ");
+    String needle = string("print");
+    String replacement = string("emit");
+    u64 base = arena->pos_u64;
+
+    for (u64 i = 0; i < iters; ++i) {
+        String s = string_replace(arena, str, needle, replacement);
+        sink += s.len;
+        arena_set_pos_back(arena, base);
+    }
+    arena_reset();
+}
+
+static void micro_hash(u64 size, u64 iters) {
+    String key = make_text(size, "identifier_");
+
+    for (u64 i = 0; i < iters; ++i) {
+        sink += hash(key);
+    }
+    arena_reset();
+}
+
+static void micro_hashmap_get(u64 size, u64 iters) {
+    HashMap* map = hashmap_new(arena);
+    String key = make_text(size, "variable_");
+    hashmap_insert(map, key, TypeNum);
+
+    for (u64 i = 0; i < iters; ++i) {
+        sink += hashmap_get(map, key);
+    }
+    arena_reset();
+}
+
+// integers up to 8 digits, past that the point goes in the middle
+static void micro_number_parse(u64 size, u64 iters) {
+    String lit = make_text(size, "31415926535897932384");
+    if (size > 8) lit.data[size / 2] = '.';
+
+    for (u64 i = 0; i < iters; ++i) {
+        Number n = number_parse(lit);
+        sink += n.len;
+    }
+    arena_reset();
+}
+
+/*
+*  Harness
+*/
+
+static int cmp_f64(const void* a, const void* b) {
+    f64 x = *(const f64*)a;
+    f64 y = *(const f64*)b;
+    return (x > y) - (x < y);
+}
+
+static MicroResult measure(const char* name, MicroFn fn, u64 size) {
+    u64 iters = 1;
+    for (;;) {
+        u64 start = now_ns();
+        fn(size, iters);
+        if (now_ns() - start >= MICRO_SAMPLE_NS) break;
+        iters *= 2;
+    }
+
+    u64 warmup_start = now_ns();
+    while (now_ns() - warmup_start < MICRO_WARMUP_NS) {
+        fn(size, iters);
+    }
+
+    f64 samples[MICRO_SAMPLES];
+    for (u32 i = 0; i < MICRO_SAMPLES; ++i) {
+        u64 start = now_ns();
+        fn(size, iters);
+        samples[i] = (f64)(now_ns() - start) / iters;
+    }
+
+    qsort(samples, MICRO_SAMPLES, sizeof(f64), cmp_f64);
+
+    MicroResult r;
+    r.name = name;
+    r.size = size;
+    r.median = samples[MICRO_SAMPLES / 2];
+    r.p99 = samples[(MICRO_SAMPLES * 99 + 99) / 100 - 1];
+    return r;
+}
+
+static u32 baseline_load(const char* path, BaselineEntry* entries) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "Failed to open baseline %s\n", path);
+        exit(1);
+    }
+
+    u32 count = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), f) && count < MICRO_MAX_CASES) {
+        if (line[0] == '#' || line[0] == '\n') continue;
+
+        BaselineEntry* e = &entries[count];
+        unsigned long long size;
+        if (sscanf(line, "%31s %llu %lf", e->name, &size, &e->median) == 3) {
+            e->size = size;
+            count++;
+        }
+    }
+
+    fclose(f);
+    return count;
+}
+
+static BaselineEntry* baseline_find(BaselineEntry* entries, u32 count,
+                                    const char* name, u64 size) {
+    for (u32 i = 0; i < count; ++i) {
+        if (entries[i].size == size && strcmp(entries[i].name, name) == 0) {
+            return &entries[i];
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    const char* baseline_path = 0;
+    const char* write_path = 0;
+    f64 threshold = 25.0;
+
+    for (i32 i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            baseline_path = argv[++i];
+        } else if (strcmp(argv[i], "--write-baseline") == 0 && i + 1 < argc) {
+            write_path = argv[++i];
+        } else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+            threshold = atof(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: microbench [--baseline file] "
+                            "[--write-baseline file] [--threshold pct]\n");
+            return 5;
+        }
+    }
+
+    arena = arena_new_sized(256ull * 1024 * 1024);
+    arena_base = arena->pos_u64;
+
+    struct { const char* name; MicroFn fn; u64 sizes[3]; } cases[] = {
+        { "arena_alloc",     micro_arena_alloc,     { 8, 64, 4096 } },
+        { "string_concat",   micro_string_concat,   { 16, 1024, 65536 } },
+        { "string_index_of", micro_string_index_of, { 64, 4096, 262144 } },
+        { "string_replace",  micro_string_replace,  { 256, 16384, 262144 } },
+        { "hash",            micro_hash,            { 4, 32, 256 } },
+        { "hashmap_get",     micro_hashmap_get,     { 4, 32, 256 } },
+        { "number_parse",    micro_number_parse,    { 8, 16, 19 } },
+    };
+
+    BaselineEntry baseline[MICRO_MAX_CASES];
+    u32 baseline_count = baseline_path ? baseline_load(baseline_path, baseline) : 0;
+
+    MicroResult results[MICRO_MAX_CASES];
+    u32 result_count = 0;
+    u32 regressions = 0;
+
+    printf("%-16s %8s %12s %12s\n", "case", "size", "median ns", "p99 ns");
+    for (u32 c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c) {
+        for (u32 s = 0; s < 3; ++s) {
+            MicroResult r = measure(cases[c].name, cases[c].fn, cases[c].sizes[s]);
+            results[result_count++] = r;
+
+            if (baseline_path) {
+                BaselineEntry* e = baseline_find(baseline, baseline_count, r.name, r.size);
+                if (e) {
+                    f64 delta = (r.median - e->median) / e->median * 100.0;
+
+                    // a noisy neighbour can slow down a single run, so a case
+                    // only counts as regressed if it stays slow on a re-run
+                    for (u32 retry = 0; retry < MICRO_RETRIES && delta > threshold; ++retry) {
+                        MicroResult again = measure(cases[c].name, cases[c].fn, cases[c].sizes[s]);
+                        if (again.median < r.median) {
+                            r = again;
+                            results[result_count - 1] = r;
+                        }
+                        delta = (r.median - e->median) / e->median * 100.0;
+                    }
+
+                    if (delta > threshold) {
+                        printf("%-16s %8llu %12.2f %12.2f  REGRESSED %+.1f%%\n", r.name,
+                               (unsigned long long)r.size, r.median, r.p99, delta);
+                        regressions++;
+                    } else {
+                        printf("%-16s %8llu %12.2f %12.2f  %+.1f%%\n", r.name,
+                               (unsigned long long)r.size, r.median, r.p99, delta);
+                    }
+                    continue;
+                }
+            }
+
+            printf("%-16s %8llu %12.2f %12.2f%s\n", r.name, (unsigned long long)r.size,
+                   r.median, r.p99, baseline_path ? "  (no baseline)" : "");
+        }
+    }
+
+    if (write_path) {
+        FILE* f = fopen(write_path, "w");
+        if (!f) {
+            fprintf(stderr, "Failed to write baseline %s\n", write_path);
+            return 1;
+        }
+
+        fprintf(f, "# microbench baseline: case size median_ns\n");
+        for (u32 i = 0; i < result_count; ++i) {
+            fprintf(f, "%s %llu %.2f\n", results[i].name,
+                    (unsigned long long)results[i].size, results[i].median);
+        }
+        fclose(f);
+    }
+
+    arena_free(arena);
+
+    if (regressions) {
+        fprintf(stderr, "%u case(s) regressed more than %.0f%%\n", regressions, threshold);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,229 @@
+// Runtime for programs compiled with blazeit --asm. Link it next to the
+// generated assembly:
+//
+//   cc prog.s runtime/blaze_rt.c -o prog
+//
+// It stands alone on purpose so it can be linked without the compiler.
+// Values are NaN-boxed the same way as src/include/value.h and the two
+// have to stay in sync.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint64_t Value;
+
+#define VALUE_SIGN  0x8000000000000000ull
+#define VALUE_QNAN  0x7ffc000000000000ull
+#define VALUE_ARR   0x0001000000000000ull
+#define VALUE_PTR   0x0000ffffffffffffull
+
+#define VALUE_NIL   (VALUE_QNAN | 1)
+#define VALUE_FALSE (VALUE_QNAN | 2)
+#define VALUE_TRUE  (VALUE_QNAN | 3)
+
+// same layout as the compiler's String, literals are emitted as one
+typedef struct {
+    char*    data;
+    uint64_t len;
+} BzStr;
+
+// same as value.h's Array
+typedef struct {
+    uint64_t len;
+    Value    items[];
+} BzArr;
+
+static double as_num(Value v) {
+    double n = 0;
+    memcpy(&n, &v, sizeof(n));
+    return n;
+}
+
+static int is_num(Value v) {
+    return (v & VALUE_QNAN) != VALUE_QNAN;
+}
+
+static int is_str(Value v) {
+    return (v & (VALUE_SIGN | VALUE_QNAN | VALUE_ARR)) == (VALUE_SIGN | VALUE_QNAN);
+}
+
+static int is_arr(Value v) {
+    return (v & (VALUE_SIGN | VALUE_QNAN | VALUE_ARR)) == (VALUE_SIGN | VALUE_QNAN | VALUE_ARR);
+}
+
+static BzStr* as_str(Value v) {
+    return (BzStr*)(uintptr_t)(v & VALUE_PTR);
+}
+
+static BzArr* as_arr(Value v) {
+    return (BzArr*)(uintptr_t)(v & VALUE_PTR);
+}
+
+static int truthy(Value v) {
+    if (is_num(v)) return as_num(v) != 0;
+    return v != VALUE_NIL && v != VALUE_FALSE;
+}
+
+static const char* type_str(Value v) {
+    if (is_num(v)) return "Num";
+    if (is_str(v)) return "Str";
+    if (is_arr(v)) return "Array";
+    if (v == VALUE_TRUE || v == VALUE_FALSE) return "Bool";
+    return "Nil";
+}
+
+// same message as the compiler's err so both fail the same way
+static void fail(const char* msg) {
+    fflush(stdout);
+    printf("Error: %s. Line: 0 Column: 0\n", msg);
+    exit(1);
+}
+
+void bz_type_error(const char* op, Value l, Value r) {
+    char msg[64];
+    snprintf(msg, sizeof(msg), "'%s' expects Num, got %s", op, type_str(is_num(l) ? r : l));
+    fail(msg);
+}
+
+// slow path of the inlined arithmetic: string concatenation or an error
+Value bz_arith(int op, Value l, Value r) {
+    if (op == '+' && is_str(l) && is_str(r)) {
+        BzStr* ls = as_str(l);
+        BzStr* rs = as_str(r);
+
+        // strings live as long as the program does
+        BzStr* s = malloc(sizeof(BzStr) + ls->len + rs->len + 1);
+        if (!s) fail("Out of memory");
+        s->data = (char*)(s + 1);
+        s->len = ls->len + rs->len;
+        memcpy(s->data, ls->data, ls->len);
+        memcpy(s->data + ls->len, rs->data, rs->len);
+        s->data[s->len] = '\0';
+        return VALUE_SIGN | VALUE_QNAN | (uint64_t)(uintptr_t)s;
+    }
+
+    char name[2] = { (char)op, '\0' };
+    bz_type_error(name, l, r);
+    return VALUE_NIL;
+}
+
+// 0 or 1, the caller boxes it
+Value bz_eq(Value a, Value b) {
+    if (is_num(a) && is_num(b)) return as_num(a) == as_num(b);
+    if (is_str(a) && is_str(b)) {
+        BzStr* x = as_str(a);
+        BzStr* y = as_str(b);
+        return x->len == y->len && memcmp(x->data, y->data, x->len) == 0;
+    }
+    return a == b;
+}
+
+Value bz_logic(int op, Value l, Value r) {
+    int b = op == '&' ? truthy(l) && truthy(r) : truthy(l) || truthy(r);
+    return b ? VALUE_TRUE : VALUE_FALSE;
+}
+
+Value bz_not(Value v) {
+    return truthy(v) ? VALUE_FALSE : VALUE_TRUE;
+}
+
+// arrays live as long as the program does too
+Value bz_array(uint64_t len, const Value* items) {
+    BzArr* a = malloc(sizeof(BzArr) + sizeof(Value) * len);
+    if (!a) fail("Out of memory");
+    a->len = len;
+    memcpy(a->items, items, sizeof(Value) * len);
+    return VALUE_SIGN | VALUE_QNAN | VALUE_ARR | (uint64_t)(uintptr_t)a;
+}
+
+// the checked one, unchecked loads are inlined
+Value bz_index(Value arr, Value index) {
+    if (!is_arr(arr)) {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "Only arrays can be indexed, got %s", type_str(arr));
+        fail(msg);
+    }
+    if (!is_num(index)) {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "'[]' expects Num, got %s", type_str(index));
+        fail(msg);
+    }
+
+    BzArr* a = as_arr(arr);
+    double i = as_num(index);
+    if (!(i >= 0 && i < (double)a->len) || i != (double)(uint64_t)i) {
+        fail("Index out of bounds");
+    }
+    return a->items[(uint64_t)i];
+}
+
+Value bz_len(Value v) {
+    double n = 0;
+    if (is_arr(v)) {
+        n = (double)as_arr(v)->len;
+    } else if (is_str(v)) {
+        n = (double)as_str(v)->len;
+    } else {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "'len' expects Str or Array, got %s", type_str(v));
+        fail(msg);
+    }
+
+    Value r;
+    memcpy(&r, &n, sizeof(r));
+    return r;
+}
+
+static void put_value(Value v) {
+    if (is_num(v)) {
+        double n = as_num(v);
+        if (n != n) {
+            // x86 hands out a negative NaN for 0/0
+            fputs("nan", stdout);
+        } else {
+            // same as number_format: whole numbers as plain digits,
+            // anything else the shortest %g that reads back the same
+            char buf[32];
+            int whole = n > -1e21 && n < 1e21 &&
+                (n <= -9007199254740992.0 || n >= 9007199254740992.0 || n == (double)(int64_t)n);
+            if (whole) {
+                snprintf(buf, sizeof(buf), "%.0f", n);
+            } else {
+                for (int prec = 1; prec <= 17; ++prec) {
+                    snprintf(buf, sizeof(buf), "%.*g", prec, n);
+                    if (strtod(buf, 0) == n) break;
+                }
+            }
+            fputs(buf, stdout);
+        }
+    }
+    else if (is_str(v)) {
+        BzStr* s = as_str(v);
+        fwrite(s->data, 1, s->len, stdout);
+    }
+    else if (is_arr(v)) {
+        BzArr* a = as_arr(v);
+        fputc('[', stdout);
+        for (uint64_t i = 0; i < a->len; ++i) {
+            if (i) fputs(", ", stdout);
+            put_value(a->items[i]);
+        }
+        fputc(']', stdout);
+    }
+    else if (v == VALUE_TRUE) {
+        fputs("true", stdout);
+    }
+    else if (v == VALUE_FALSE) {
+        fputs("false", stdout);
+    }
+    else {
+        fputs("nil", stdout);
+    }
+}
+
+void bz_print(Value v) {
+    put_value(v);
+    fputc('\n', stdout);
+}
@@ -8,26 +8,109 @@
 // TODO: Change all of the asserts to actually handle potential error
 
 Arena* arena_new() {
-    u64 size = ARENA_DEFAULT_SIZE;
+    return arena_new_sized(ARENA_DEFAULT_SIZE);
+}
+
+struct ArenaChunk {
+    ArenaChunk* prev;
+    char*       data;
+    u64         base;   // pos_u64 at data[0]
+    u64         len;
+};
+
+// calloc lets the kernel hand out zeroed pages lazily, so big chunks only
+// cost what actually gets touched
+static ArenaChunk* chunk_new(u64 len) {
+    ArenaChunk* c = calloc(1, sizeof(ArenaChunk) + len);
+    if (!c) {
+        err("Arena out of memory", 0, 0);
+    }
+    c->data = (char*)(c + 1);
+    c->len = len;
+    return c;
+}
+
+static void arena_use(Arena* a, ArenaChunk* c, u64 pos) {
+    a->chunk = c;
+    a->mem = c->data;
+    a->mem_len = c->len;
+    a->pos = c->data + (pos - c->base);
+    a->pos_u64 = pos;
+}
+
+Arena* arena_new_sized(u64 size) {
     Arena* a = malloc(sizeof(Arena));
-    a->mem = (void*) malloc(size);
-    memset(a->mem, 0, size);
-    a->mem_len = size;
-    a->pos = a->mem;
-    a->pos_u64 = 0;
+    if (!a) {
+        err("Failed to allocate arena", 0, 0);
+    }
+
+    ArenaChunk* c = chunk_new(size);
+    arena_use(a, c, 0);
+    a->last_pos_u64 = 0;
+    a->spare = 0;
+    a->reserved = size;
+    a->tag = ArenaTag_None;
+    a->telemetry = 0;
 
     return a;
 }
 
 void arena_free(Arena *a) {
-    free(a->mem);
+    ArenaChunk* lists[] = { a->chunk, a->spare };
+    for (u32 i = 0; i < 2; ++i) {
+        ArenaChunk* c = lists[i];
+        while (c) {
+            ArenaChunk* prev = c->prev;
+            free(c);
+            c = prev;
+        }
+    }
+    free(a->telemetry);
     free(a);
 }
 
-void* arena_alloc(Arena* a, u64 size) {
-    if (a->mem_len - a->pos_u64 <= size) {
-        arena_free(a);
-        err("Arena out of memory", 0, 0);
+// starts a chunk at the current position; whatever was left at the end of
+// the old one goes unused
+static void arena_grow(Arena* a, u64 size) {
+    ArenaChunk** link = &a->spare;
+    while (*link && (*link)->len <= size) {
+        link = &(*link)->prev;
+    }
+
+    ArenaChunk* c = *link;
+    if (c) {
+        *link = c->prev;
+    } else {
+        u64 len = a->mem_len * 2;
+        if (len > ARENA_CHUNK_MAX) len = ARENA_CHUNK_MAX;
+        if (len <= size) len = size + 1;
+        c = chunk_new(len);
+        a->reserved += len;
+    }
+
+    c->prev = a->chunk;
+    c->base = a->pos_u64;
+    arena_use(a, c, a->pos_u64);
+}
+
+static inline void arena_record(Arena* a, u64 size, ArenaTag tag) {
+#ifndef BLAZE_NO_STATS
+    ArenaTelemetry* t = a->telemetry;
+    if (!t) return;
+
+    t->allocs++;
+    t->requested += size;
+    t->tag_allocs[tag]++;
+    t->tag_bytes[tag] += size;
+    if (a->pos_u64 > t->high_water) t->high_water = a->pos_u64;
+#else
+    (void)a; (void)size; (void)tag;
+#endif
+}
+
+void* arena_alloc_tagged(Arena* a, u64 size, ArenaTag tag) {
+    if ((u64)((char*)a->mem + a->mem_len - (char*)a->pos) <= size) {
+        arena_grow(a, size);
     }
 
     void* ret_mem = a->pos;
@@ -36,39 +119,101 @@ void* arena_alloc(Arena* a, u64 size) {
     a->last_pos_u64 = a->pos_u64;
     a->pos_u64 += size;
 
+    arena_record(a, size, tag);
+
     return ret_mem;
 }
 
+void* arena_alloc(Arena* a, u64 size) {
+    return arena_alloc_tagged(a, size, a->tag);
+}
+
+ArenaTag arena_set_tag(Arena* a, ArenaTag tag) {
+    ArenaTag prev = a->tag;
+    a->tag = tag;
+    return prev;
+}
+
+const char* arena_tag_str(ArenaTag tag) {
+    switch (tag) {
+        case ArenaTag_None:    return "other";
+        case ArenaTag_Lexer:   return "lexer";
+        case ArenaTag_Parser:  return "parser";
+        case ArenaTag_AST:     return "ast";
+        case ArenaTag_Strings: return "strings";
+        case ArenaTag_Emitter: return "emitter";
+        default:               return "unreachable";
+    }
+}
+
 void* arena_alloc_zero(Arena* a, u64 size) {
     void* mem = arena_alloc(a, size);  
     memset(mem, 0, size);
     return mem;
 }
 
+void* arena_realloc(Arena* a, void* ptr, u64 old_size, u64 new_size) {
+    // in place when it is the last allocation and still fits the chunk
+    if (ptr && (char*)ptr + old_size == (char*)a->pos &&
+        (u64)((char*)a->mem + a->mem_len - (char*)ptr) > new_size) {
+        u64 start = a->pos_u64 - old_size;
+
+        a->pos = (void*)((char*)ptr + new_size);
+        a->pos_u64 = start + new_size;
+        a->last_pos_u64 = start;
+        if (new_size > old_size) arena_record(a, new_size - old_size, a->tag);
+        return ptr;
+    }
+
+    void* mem = arena_alloc(a, new_size);
+    if (ptr) memcpy(mem, ptr, old_size < new_size ? old_size : new_size);
+    return mem;
+}
+
 void arena_dealloc(Arena* a, u64 size) {
     assert((i64)(a->pos_u64 - size) >= 0);
-    a->pos_u64 -= size; 
-
-    a->pos = (void*)((char*)a->pos - size);
+    arena_set_pos_back(a, a->pos_u64 - size);
 }
 
 void arena_dealloc_last(Arena *a) {
     arena_dealloc(a, a->pos_u64-a->last_pos_u64);  
 }
 
+// chunks past pos go to the spare list instead of being freed, so a loop
+// that keeps rewinding over a chunk boundary doesn't keep asking malloc
 void arena_set_pos_back(Arena* a, u64 pos) {
-    assert(pos < a->pos_u64); 
-    arena_dealloc(a, a->pos_u64 - pos); 
+    assert(pos <= a->pos_u64); 
+
+    ArenaChunk* c = a->chunk;
+    while (c->base > pos) {
+        ArenaChunk* prev = c->prev;
+        c->prev = a->spare;
+        a->spare = c;
+        c = prev;
+    }
+    arena_use(a, c, pos);
+}
+
+u64 arena_pos_of(Arena* a, const void* ptr) {
+    const char* p = ptr;
+    u64 end = a->pos_u64;
+    for (ArenaChunk* c = a->chunk; c; c = c->prev) {
+        if (p >= c->data && p < c->data + (end - c->base)) {
+            return c->base + (u64)(p - c->data);
+        }
+        end = c->base;
+    }
+    return ARENA_NO_POS;
 }
 
 void arena_clear(Arena* a) {
-    memset(a->mem, 0, a->mem_len);
     arena_set_pos_back(a, 0);
+    memset(a->mem, 0, a->mem_len);
 }
 
 void arena_dump_mem(Arena* a) {
-    for (u64 i = 0; i < a->pos_u64; ++i) {
-        if (i == a->pos_u64) printf("^");
+    u64 used = (char*)a->pos - (char*)a->mem;
+    for (u64 i = 0; i < used; ++i) {
         printf("%02hhx ", ((char*)a->mem)[i]);
 
 
@@ -79,3 +224,57 @@ void arena_dump_mem(Arena* a) {
 
     printf("\n");
 }
+
+void arena_enable_telemetry(Arena* a) {
+#ifndef BLAZE_NO_STATS
+    if (!a->telemetry) {
+        a->telemetry = calloc(1, sizeof(ArenaTelemetry));
+        a->telemetry->high_water = a->pos_u64;
+    }
+#else
+    (void)a;
+#endif
+}
+
+void arena_report(Arena* a, FILE* f, bool json) {
+    ArenaTelemetry* t = a->telemetry;
+    if (!t) {
+        fprintf(f, json ? "null" : "  arena telemetry disabled\n");
+        return;
+    }
+
+    if (json) {
+        fprintf(f, "{\"allocs\":%llu,\"requested\":%llu,\"reserved\":%llu,"
+                   "\"in_use\":%llu,\"high_water\":%llu,\"tags\":{",
+                (unsigned long long)t->allocs,
+                (unsigned long long)t->requested,
+                (unsigned long long)a->reserved,
+                (unsigned long long)a->pos_u64,
+                (unsigned long long)t->high_water);
+
+        bool first = true;
+        for (u32 tag = 0; tag < ArenaTagCount; ++tag) {
+            if (!t->tag_allocs[tag]) continue;
+            fprintf(f, "%s\"%s\":{\"allocs\":%llu,\"bytes\":%llu}",
+                    first ? "" : ",", arena_tag_str(tag),
+                    (unsigned long long)t->tag_allocs[tag],
+                    (unsigned long long)t->tag_bytes[tag]);
+            first = false;
+        }
+        fprintf(f, "}}");
+        return;
+    }
+
+    fprintf(f, "  arena:\n");
+    fprintf(f, "    %-12s %12llu\n", "allocs", (unsigned long long)t->allocs);
+    fprintf(f, "    %-12s %12llu\n", "requested", (unsigned long long)t->requested);
+    fprintf(f, "    %-12s %12llu\n", "reserved", (unsigned long long)a->reserved);
+    fprintf(f, "    %-12s %12llu\n", "in use", (unsigned long long)a->pos_u64);
+    fprintf(f, "    %-12s %12llu\n", "high water", (unsigned long long)t->high_water);
+    for (u32 tag = 0; tag < ArenaTagCount; ++tag) {
+        if (!t->tag_allocs[tag]) continue;
+        fprintf(f, "    %-12s %12llu bytes in %llu allocs\n", arena_tag_str(tag),
+                (unsigned long long)t->tag_bytes[tag],
+                (unsigned long long)t->tag_allocs[tag]);
+    }
+}
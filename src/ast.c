@@ -2,9 +2,9 @@
 #include "include/hashmap.h"
 #include "include/string.h"
 #include <assert.h>
+#include <math.h>
 #include <stdio.h>
-
-#define emitf fprintf
+#include <string.h>
 
 String vartype_str(VarType type) {
     switch (type) {
@@ -12,442 +12,710 @@ String vartype_str(VarType type) {
         case TypeNum: return string("Num");
         case TypeStr: return string("Str");
         case TypeBool: return string("Bool");
+        case TypeArrNum: return string("[Num]");
+        case TypeArrStr: return string("[Str]");
+        case TypeArrBool: return string("[Bool]");
         default: assert(0 && "Unreachable");
     }
 }
 
 AST* ast_new(Arena* a, AST ast) {
-    AST* ptr = (AST*)arena_alloc(a, sizeof(AST));
+    AST* ptr = (AST*)arena_alloc_tagged(a, sizeof(AST), ArenaTag_AST);
     if (ptr) *ptr = ast;
     return ptr;
 }
 
-void ast_print(AST* ast, HashMap* map) {
-    if (!ast) {
+String ast_tag_str(u32 tag) {
+    switch (tag) {
+        case AST_PROGRAM: return string("AST_PROGRAM");
+        case AST_BLOCK:   return string("AST_BLOCK");
+        case AST_NUMBER:  return string("AST_NUMBER");
+        case AST_STR:     return string("AST_STR");
+        case AST_IDENT:   return string("AST_IDENT");
+        case AST_BOOL:    return string("AST_BOOL");
+        case AST_NIL:     return string("AST_NIL");
+        case AST_EQ:      return string("AST_EQ");
+        case AST_NEQ:     return string("AST_NEQ");
+        case AST_GT:      return string("AST_GT");
+        case AST_GTE:     return string("AST_GTE");
+        case AST_LT:      return string("AST_LT");
+        case AST_LTE:     return string("AST_LTE");
+        case AST_NOT:     return string("AST_NOT");
+        case AST_AND:     return string("AST_AND");
+        case AST_OR:      return string("AST_OR");
+        case AST_ADD:     return string("AST_ADD");
+        case AST_ADDEQ:   return string("AST_ADDEQ");
+        case AST_SUB:     return string("AST_SUB");
+        case AST_SUBEQ:   return string("AST_SUBEQ");
+        case AST_MUL:     return string("AST_MUL");
+        case AST_MULEQ:   return string("AST_MULEQ");
+        case AST_DIV:     return string("AST_DIV");
+        case AST_DIVEQ:   return string("AST_DIVEQ");
+        case AST_NEGATE:  return string("AST_NEGATE");
+        case AST_LET:     return string("AST_LET");
+        case AST_PRINT:   return string("AST_PRINT");
+        case AST_IF:      return string("AST_IF");
+        case AST_RANGE:   return string("AST_RANGE");
+        case AST_FOR:     return string("AST_FOR");
+        case AST_WHILE:   return string("AST_WHILE");
+        case AST_ARRAY:   return string("AST_ARRAY");
+        case AST_INDEX:   return string("AST_INDEX");
+        case AST_LEN:     return string("AST_LEN");
+        case AST_FUNC:    return string("AST_FUNC");
+        case AST_CALL:    return string("AST_CALL");
+        case AST_RETURN:  return string("AST_RETURN");
+        case AST_VASM:    return string("AST_VASM");
+        default:          return string("Unreachable");
+    }
+}
+
+u32 ast_child_count(AST* ast) {
+    switch (ast->tag) {
+        case AST_PROGRAM: return ast->data.AST_PROGRAM.stmt_count;
+        case AST_BLOCK:   return ast->data.AST_BLOCK.stmt_count;
+        case AST_IF:      return ast->data.AST_IF.stmt_count + ast->data.AST_IF.else_count + 1;
+        case AST_FOR:     return ast->data.AST_FOR.stmt_count + 2;
+        case AST_WHILE:   return ast->data.AST_WHILE.stmt_count + 1;
+        case AST_ARRAY:   return ast->data.AST_ARRAY.count;
+        case AST_FUNC:    return ast->data.AST_FUNC.stmt_count;
+        case AST_CALL:    return ast->data.AST_CALL.argc;
+        case AST_VASM:    return ast->data.AST_VASM.var_count;
+
+        case AST_EQ: case AST_NEQ: case AST_GT: case AST_GTE:
+        case AST_LT: case AST_LTE: case AST_AND: case AST_OR:
+        case AST_ADD: case AST_SUB: case AST_MUL: case AST_DIV:
+        case AST_RANGE: case AST_INDEX: return 2;
+
+        case AST_ADDEQ: case AST_SUBEQ: case AST_MULEQ: case AST_DIVEQ:
+        case AST_NOT: case AST_NEGATE: case AST_LET: case AST_PRINT:
+        case AST_LEN: case AST_RETURN: return 1;
+
+        case AST_NUMBER: case AST_STR: case AST_IDENT:
+        case AST_BOOL: case AST_NIL: return 0;
+    }
+
+    return 0;
+}
+
+AST** ast_child(AST* ast, u32 i) {
+    switch (ast->tag) {
+        case AST_PROGRAM: return &ast->data.AST_PROGRAM.body[i];
+        case AST_BLOCK:   return &ast->data.AST_BLOCK.stmts[i];
+        case AST_IF: {
+            struct AST_IF* data = &ast->data.AST_IF;
+            return i == 0 ? &data->expr :
+                   i <= data->stmt_count ? &data->body[i-1] : &data->else_body[i-1-data->stmt_count];
+        }
+        case AST_FOR: {
+            struct AST_FOR* data = &ast->data.AST_FOR;
+            return i == 0 ? &data->start : i == 1 ? &data->end : &data->body[i-2];
+        }
+        case AST_WHILE:   return i == 0 ? &ast->data.AST_WHILE.expr : &ast->data.AST_WHILE.body[i-1];
+        case AST_ARRAY:   return &ast->data.AST_ARRAY.items[i];
+        case AST_FUNC:    return &ast->data.AST_FUNC.body[i];
+        case AST_CALL:    return &ast->data.AST_CALL.args[i];
+        case AST_VASM:    return &ast->data.AST_VASM.vars[i];
+
+        case AST_EQ: case AST_NEQ: case AST_GT: case AST_GTE:
+        case AST_LT: case AST_LTE: case AST_AND: case AST_OR:
+        case AST_ADD: case AST_SUB: case AST_MUL: case AST_DIV:
+        case AST_RANGE: case AST_INDEX: {
+            // every binary node shares the { left, right } layout
+            return i == 0 ? &ast->data.AST_ADD.left : &ast->data.AST_ADD.right;
+        }
+
+        case AST_ADDEQ:  return &ast->data.AST_ADDEQ.expr;
+        case AST_SUBEQ:  return &ast->data.AST_SUBEQ.expr;
+        case AST_MULEQ:  return &ast->data.AST_MULEQ.expr;
+        case AST_DIVEQ:  return &ast->data.AST_DIVEQ.expr;
+        case AST_NOT:    return &ast->data.AST_NOT.expr;
+        case AST_NEGATE: return &ast->data.AST_NEGATE.expr;
+        case AST_LET:    return &ast->data.AST_LET.expr;
+        case AST_PRINT:  return &ast->data.AST_PRINT.expr;
+        case AST_LEN:    return &ast->data.AST_LEN.expr;
+        case AST_RETURN: return &ast->data.AST_RETURN.expr;
+
+        case AST_NUMBER: case AST_STR: case AST_IDENT:
+        case AST_BOOL: case AST_NIL: break;
+    }
+
+    assert(0 && "Node has no children");
+    return 0;
+}
+
+typedef struct {
+    AST* node;
+    u32  child;
+} WalkFrame;
+
+#define WALK_STACK_INIT 64
+
+void ast_walk(Arena* a, AST* root, AstVisitor* v) {
+    if (!root || (v->pre && !v->pre(v, root))) {
+        return;
+    }
+
+    u64 start = a->pos_u64;
+    usize cap = WALK_STACK_INIT;
+    usize count = 0;
+    WalkFrame* stack = AllocArray(a, WalkFrame, cap);
+
+    stack[count++] = (WalkFrame){root, 0};
+
+    while (count) {
+        WalkFrame* top = &stack[count-1];
+        AST* node = top->node;
+
+        // coming back up from the previous child
+        if (top->child > 0 && v->mid) {
+            v->mid(v, node, top->child - 1);
+        }
+
+        if (top->child == ast_child_count(node)) {
+            if (v->post) v->post(v, node);
+            count--;
+            continue;
+        }
+
+        AST* child = *ast_child(node, top->child++);
+        if (!child || (v->pre && !v->pre(v, child))) {
+            continue;
+        }
+
+        if (count == cap) {
+            stack = arena_realloc(a, stack, sizeof(WalkFrame) * cap,
+                                            sizeof(WalkFrame) * cap * 2);
+            cap *= 2;
+        }
+        stack[count++] = (WalkFrame){child, 0};
+    }
+
+    // hand the stack back unless a callback allocated on top of it
+    if (arena_pos_of(a, stack) == start && 
+        (char*)(stack + cap) == (char*)a->pos) {
+        arena_set_pos_back(a, start);
+    }
+}
+
+/*
+*  Cloning
+*/
+
+typedef struct {
+    AstVisitor v;
+    Arena* a;
+    AST**  done;    // copies of finished children, waiting for their parent
+    u32    count;
+    u32    cap;
+} CloneVisitor;
+
+static String clone_str(Arena* a, String s) {
+    String copy = string_alloc(a, s.len);
+    memcpy(copy.data, s.data, s.len);
+    copy.data[s.len] = '\0';
+    return copy;
+}
+
+static AST** clone_list(Arena* a, u32 count) {
+    return AllocArray(a, AST*, count ? count : 1);
+}
+
+static void clone_post(AstVisitor* v, AST* ast) {
+    CloneVisitor* cv = (CloneVisitor*)v;
+    Arena* a = cv->a;
+    AST* copy = ast_new(a, *ast);
+    u32 n = ast_child_count(ast);
+
+    switch (copy->tag) {
+        case AST_PROGRAM: {
+            copy->data.AST_PROGRAM.body = clone_list(a, n);
+            copy->data.AST_PROGRAM.stmt_cap = n;
+            break;
+        }
+        case AST_BLOCK: copy->data.AST_BLOCK.stmts = clone_list(a, n); break;
+        case AST_IF: {
+            struct AST_IF* data = &copy->data.AST_IF;
+            data->body = clone_list(a, data->stmt_count);
+            data->else_body = clone_list(a, data->else_count);
+            break;
+        }
+        case AST_WHILE: copy->data.AST_WHILE.body = clone_list(a, n - 1); break;
+        case AST_ARRAY: copy->data.AST_ARRAY.items = clone_list(a, n); break;
+        case AST_STR:   copy->data.AST_STR.str = clone_str(a, ast->data.AST_STR.str); break;
+        case AST_IDENT: copy->data.AST_IDENT.ident = clone_str(a, ast->data.AST_IDENT.ident); break;
+        case AST_LET:   copy->data.AST_LET.ident = clone_str(a, ast->data.AST_LET.ident); break;
+        case AST_FOR: {
+            struct AST_FOR* data = &copy->data.AST_FOR;
+            data->ident = clone_str(a, data->ident);
+            data->end_var = clone_str(a, data->end_var);
+            data->body = clone_list(a, n - 2);
+            break;
+        }
+        case AST_ADDEQ: case AST_SUBEQ: case AST_MULEQ: case AST_DIVEQ: {
+            copy->data.AST_ADDEQ.ident = clone_str(a, ast->data.AST_ADDEQ.ident);
+            break;
+        }
+        case AST_FUNC: {
+            struct AST_FUNC* data = &copy->data.AST_FUNC;
+            data->name = clone_str(a, data->name);
+            data->params = AllocArray(a, String, data->param_count ? data->param_count : 1);
+            for (u32 i = 0; i < data->param_count; ++i) {
+                data->params[i] = clone_str(a, ast->data.AST_FUNC.params[i]);
+            }
+            data->body = clone_list(a, n);
+            break;
+        }
+        case AST_CALL: {
+            copy->data.AST_CALL.name = clone_str(a, ast->data.AST_CALL.name);
+            copy->data.AST_CALL.token.lexeme = copy->data.AST_CALL.name;
+            copy->data.AST_CALL.args = clone_list(a, n);
+            break;
+        }
+        case AST_VASM: {
+            struct AST_VASM* data = &copy->data.AST_VASM;
+            data->vars = clone_list(a, n);
+            data->written = AllocArray(a, bool, n ? n : 1);
+            memcpy(data->written, ast->data.AST_VASM.written, n);
+
+            data->code = AllocArray(a, VasmInst, data->count ? data->count : 1);
+            for (u32 i = 0; i < data->count; ++i) {
+                VasmInst* inst = &data->code[i];
+                *inst = ast->data.AST_VASM.code[i];
+                if (inst->str.len) inst->str = clone_str(a, inst->str);
+                if (inst->dst.name.len) inst->dst.name = clone_str(a, inst->dst.name);
+                for (u32 arg = 0; arg < 2; ++arg) {
+                    if (inst->args[arg].name.len) inst->args[arg].name = clone_str(a, inst->args[arg].name);
+                }
+            }
+            break;
+        }
+        default: break;
+    }
+
+    cv->count -= n;
+    for (u32 i = 0; i < n; ++i) {
+        *ast_child(copy, i) = cv->done[cv->count + i];
+    }
+
+    if (cv->count == cv->cap) {
+        cv->done = arena_realloc(a, cv->done, sizeof(AST*) * cv->cap, sizeof(AST*) * cv->cap * 2);
+        cv->cap *= 2;
+    }
+    cv->done[cv->count++] = copy;
+}
+
+// bottom up, every node is copied once all of its children are
+AST* ast_clone(Arena* a, AST* ast) {
+    CloneVisitor cv = {{0, 0, clone_post}, a, 0, 0, WALK_STACK_INIT};
+    cv.done = AllocArray(a, AST*, cv.cap);
+    ast_walk(a, ast, &cv.v);
+
+    assert(cv.count == 1);
+    return cv.done[0];
+}
+
+bool ast_assigns_to(AST* ast, String name) {
+    switch (ast->tag) {
+        case AST_LET: return string_eq(ast->data.AST_LET.ident, name);
+        case AST_FOR: return string_eq(ast->data.AST_FOR.ident, name);
+        // all four share the { ident, expr } layout
+        case AST_ADDEQ: case AST_SUBEQ: case AST_MULEQ: case AST_DIVEQ:
+            return string_eq(ast->data.AST_ADDEQ.ident, name);
+        case AST_VASM: {
+            struct AST_VASM* data = &ast->data.AST_VASM;
+            for (u32 i = 0; i < data->var_count; ++i) {
+                if (data->written[i] && string_eq(data->vars[i]->data.AST_IDENT.ident, name)) return true;
+            }
+            return false;
+        }
+        default: return false;
+    }
+}
+
+#define AST_LIST_INIT 8
+
+void ast_list_push(Arena* a, AstList* list, AST* stmt) {
+    if (list->count == list->cap) {
+        u32 cap = list->cap ? list->cap * 2 : AST_LIST_INIT;
+        list->stmts = arena_realloc(a, list->stmts, sizeof(AST*) * list->cap, sizeof(AST*) * cap);
+        list->cap = cap;
+    }
+    list->stmts[list->count++] = stmt;
+}
+
+bool ast_ends_with_block(AST* ast) {
+    switch (ast->tag) {
+        case AST_FOR: case AST_WHILE: case AST_IF: case AST_FUNC: return true;
+        default: return false;
+    }
+}
+
+/*
+*  Folding
+*/
+
+bool ast_is_literal(AST* ast) {
+    switch (ast->tag) {
+        case AST_NUMBER: case AST_STR: case AST_BOOL: case AST_NIL: return true;
+        default: return false;
+    }
+}
+
+// Folds into a Num literal the way the VM would compute it. Integer
+// results stay integers as long as the double holds them exactly, and
+// -0, inf and nan are left for run time.
+static void fold_num(AST* ast, f64 val, bool ints) {
+    if (!isfinite(val) || (val == 0 && signbit(val))) return;
+
+    bool is_int = ints && val > -9007199254740992.0 && val < 9007199254740992.0 &&
+                  val == (f64)(i64)val;
+    *ast = (AST){ AST_NUMBER, { .AST_NUMBER = { val, is_int ? (i64)val : 0, is_int } } };
+}
+
+static void fold_bool(AST* ast, bool val) {
+    *ast = (AST){ AST_BOOL, { .AST_BOOL = { val } } };
+}
+
+// same as value_truthy
+static bool literal_truthy(AST* ast) {
+    switch (ast->tag) {
+        case AST_NUMBER: return ast->data.AST_NUMBER.val != 0;
+        case AST_BOOL:   return ast->data.AST_BOOL.val;
+        case AST_NIL:    return false;
+        default:         return true;
+    }
+}
+
+// -1 when it can't tell: strings with different lexemes might still be
+// the same once the escapes are resolved
+static i32 literal_eq(AST* l, AST* r) {
+    if (l->tag != r->tag) return 0;
+
+    switch (l->tag) {
+        case AST_BOOL: return l->data.AST_BOOL.val == r->data.AST_BOOL.val;
+        case AST_NIL:  return 1;
+        case AST_STR:  return string_eq(l->data.AST_STR.str, r->data.AST_STR.str) ? 1 : -1;
+        default:       return -1;
+    }
+}
+
+void ast_fold_node(AST* ast) {
+    if (ast->tag == AST_NEGATE) {
+        AST* expr = ast->data.AST_NEGATE.expr;
+        if (expr->tag == AST_NUMBER) {
+            fold_num(ast, -expr->data.AST_NUMBER.val, expr->data.AST_NUMBER.is_int);
+        }
+        return;
+    }
+    if (ast->tag == AST_NOT) {
+        AST* expr = ast->data.AST_NOT.expr;
+        if (ast_is_literal(expr)) fold_bool(ast, !literal_truthy(expr));
+        return;
+    }
+
+    switch (ast->tag) {
+        case AST_ADD: case AST_SUB: case AST_MUL: case AST_DIV:
+        case AST_GT: case AST_GTE: case AST_LT: case AST_LTE:
+        case AST_EQ: case AST_NEQ: case AST_AND: case AST_OR: break;
+        default: return;
+    }
+
+    // every binary node shares the { left, right } layout
+    AST* left = ast->data.AST_ADD.left;
+    AST* right = ast->data.AST_ADD.right;
+    if (!ast_is_literal(left) || !ast_is_literal(right)) return;
+
+    // both sides always run, so these never fail
+    if (ast->tag == AST_AND) {
+        fold_bool(ast, literal_truthy(left) && literal_truthy(right));
         return;
     }
+    if (ast->tag == AST_OR) {
+        fold_bool(ast, literal_truthy(left) || literal_truthy(right));
+        return;
+    }
+
+    if (left->tag != AST_NUMBER || right->tag != AST_NUMBER) {
+        i32 eq = literal_eq(left, right);
+        if (eq < 0) return;
+        if (ast->tag == AST_EQ) fold_bool(ast, eq);
+        if (ast->tag == AST_NEQ) fold_bool(ast, !eq);
+        return;
+    }
+
+    f64 l = left->data.AST_NUMBER.val;
+    f64 r = right->data.AST_NUMBER.val;
+    bool ints = left->data.AST_NUMBER.is_int && right->data.AST_NUMBER.is_int;
+
+    switch (ast->tag) {
+        case AST_ADD: fold_num(ast, l + r, ints); break;
+        case AST_SUB: fold_num(ast, l - r, ints); break;
+        case AST_MUL: fold_num(ast, l * r, ints); break;
+        case AST_DIV: fold_num(ast, l / r, false); break;
+        case AST_GT:  fold_bool(ast, l > r); break;
+        case AST_GTE: fold_bool(ast, l >= r); break;
+        case AST_LT:  fold_bool(ast, l < r); break;
+        case AST_LTE: fold_bool(ast, l <= r); break;
+        case AST_EQ:  fold_bool(ast, l == r); break;
+        case AST_NEQ: fold_bool(ast, l != r); break;
+        default: break;
+    }
+}
+
+static void fold_post(AstVisitor* v, AST* ast) {
+    (void)v;
+    ast_fold_node(ast);
+}
+
+void ast_fold(Arena* a, AST* ast) {
+    AstVisitor fv = {0, 0, fold_post};
+    ast_walk(a, ast, &fv);
+}
+
+/*
+*  Counting
+*/
+
+typedef struct {
+    AstVisitor v;
+    u64* counts;
+} CountVisitor;
+
+static bool count_pre(AstVisitor* v, AST* ast) {
+    ((CountVisitor*)v)->counts[ast->tag]++;
+    return true;
+}
+
+// counts[tag] += number of reachable nodes with that tag
+void ast_count(Arena* a, AST* ast, u64* counts) {
+    CountVisitor cv = {{count_pre, 0, 0}, counts};
+    ast_walk(a, ast, &cv.v);
+}
+
+/*
+*  Printing
+*/
+
+typedef struct {
+    AstVisitor v;
+    HashMap* map;
+} PrintVisitor;
+
+static const char* binary_op_str(u32 tag) {
+    switch (tag) {
+        case AST_EQ:  return " == ";
+        case AST_NEQ: return " != ";
+        case AST_GT:  return " > ";
+        case AST_GTE: return " >= ";
+        case AST_LT:  return " < ";
+        case AST_LTE: return " <= ";
+        case AST_AND: return " and ";
+        case AST_OR:  return " or ";
+        case AST_ADD: return " + ";
+        case AST_SUB: return " - ";
+        case AST_MUL: return " * ";
+        case AST_DIV: return " / ";
+        case AST_RANGE: return "..";
+        default:      return 0;
+    }
+}
+
+static bool print_pre(AstVisitor* v, AST* ast) {
+    HashMap* map = ((PrintVisitor*)v)->map;
 
     switch (ast->tag) {
         case AST_PROGRAM: {
-            struct AST_PROGRAM data = ast->data.AST_PROGRAM;
             printf("Program: \n");
             printf("addr_0:\n");
-            for (i32 i = 0; i < (i32)data.stmt_count; ++i) {
-                ast_print(data.body[i], map);
-                printf("\n");
-                printf("addr_%d:\n", i+1);
-            }
-            printf("-*- End of Program -*-\n");
-            return;
+            return true;
         }
         case AST_NIL: {
             printf("nil");
-            return;
+            return true;
         }
         case AST_NUMBER: {
-            struct AST_NUMBER data = ast->data.AST_NUMBER;
-            printf("%.2f",data.val);
-            return;
+            struct AST_NUMBER* data = &ast->data.AST_NUMBER;
+            if (data->is_int) {
+                printf("%lld", (long long)data->i);
+            } else {
+                printf("%.17g", data->val);
+            }
+            return true;
         }
         case AST_STR: {
-            struct AST_STR data = ast->data.AST_STR;
-            printf("\"%s\"", data.str.data);
-            return;
+            struct AST_STR* data = &ast->data.AST_STR;
+            printf("\"%s\"", data->str.data);
+            return true;
         }
         case AST_IDENT: {
-            struct AST_IDENT data = ast->data.AST_IDENT;
-            char* type = vartype_str(hashmap_get(map, data.ident)).data;
-            printf("(%s) %s", type, data.ident.data);
-            return;
+            struct AST_IDENT* data = &ast->data.AST_IDENT;
+            char* type = vartype_str(hashmap_get(map, data->ident)).data;
+            printf("(%s) %s", type, data->ident.data);
+            return true;
         }
         case AST_BOOL: {
-            struct AST_BOOL data = ast->data.AST_BOOL;
-            printf("%s", data.val ? "true" : "false");
-            return;
+            struct AST_BOOL* data = &ast->data.AST_BOOL;
+            printf("%s", data->val ? "true" : "false");
+            return true;
         }
         case AST_NOT: {
-            struct AST_NOT data = ast->data.AST_NOT;
             printf("!(");
-            ast_print(data.expr, map);
-            printf(")");
-            return;
+            return true;
         }
-        case AST_AND: {
-            struct AST_AND data = ast->data.AST_AND;
-            printf("(");
-            ast_print(data.left, map);
-            printf(" and ");
-            ast_print(data.right, map);
-            printf(")");
-            return;
-        }
-        case AST_OR: {
-            struct AST_OR data = ast->data.AST_OR;
-            printf("(");
-            ast_print(data.left, map);
-            printf(" or ");
-            ast_print(data.right, map);
-            printf(")");
-            return;
-        }
-        case AST_EQ: {
-            struct AST_EQ data = ast->data.AST_EQ;
-            printf("(");
-            ast_print(data.left, map);
-            printf(" == ");
-            ast_print(data.right, map);
-            printf(")");
-            return;
-        }
-        case AST_NEQ: {
-            struct AST_NEQ data = ast->data.AST_NEQ;
-            printf("(");
-            ast_print(data.left, map);
-            printf(" != ");
-            ast_print(data.right, map);
-            printf(")");
-            return;
-        }
-        case AST_GT: {
-            struct AST_GT data = ast->data.AST_GT;
+        case AST_EQ: case AST_NEQ: case AST_GT: case AST_GTE:
+        case AST_LT: case AST_LTE: case AST_AND: case AST_OR:
+        case AST_ADD: case AST_SUB: case AST_MUL: case AST_DIV:
+        case AST_RANGE: {
             printf("(");
-            ast_print(data.left, map);
-            printf(" > ");
-            ast_print(data.right, map);
-            printf(")");
-            return;
-        }
-        case AST_GTE: {
-            struct AST_GTE data = ast->data.AST_GTE;
-            printf("(");
-            ast_print(data.left, map);
-            printf(" >= ");
-            ast_print(data.right, map);
-            printf(")");
-            return;
-        }
-        case AST_LT: {
-            struct AST_LT data = ast->data.AST_LT;
-            printf("(");
-            ast_print(data.left, map);
-            printf(" < ");
-            ast_print(data.right, map);
-            printf(")");
-            return;
-        }
-        case AST_LTE: {
-            struct AST_LTE data = ast->data.AST_LTE;
-            printf("(");
-            ast_print(data.left, map);
-            printf(" >= ");
-            ast_print(data.right, map);
-            printf(")");
-            return;
-        }
-        case AST_ADD: {
-            struct AST_ADD data = ast->data.AST_ADD;
-            printf("(");
-            ast_print(data.left, map);
-            printf(" + ");
-            ast_print(data.right, map);
-            printf(")");
-            return;
-        }
-        case AST_ADDEQ: {
-            struct AST_ADDEQ data = ast->data.AST_ADDEQ;
-            printf("%s += ", data.ident.data);
-            ast_print(data.expr, map);
-            return;
+            return true;
         }
-        case AST_SUB: {
-            struct AST_SUB data = ast->data.AST_SUB;
-            printf("(");
-            ast_print(data.left, map);
-            printf(" - ");
-            ast_print(data.right, map);
-            printf(")");
-            return;
+        case AST_FOR: {
+            printf("for %s : ", ast->data.AST_FOR.ident.data);
+            return true;
         }
-        case AST_SUBEQ: {
-            struct AST_SUBEQ data = ast->data.AST_SUBEQ;
-            printf("%s -= ", data.ident.data);
-            ast_print(data.expr, map);
-            return;
+        case AST_WHILE: {
+            printf("while ");
+            return true;
         }
-        case AST_MUL: {
-            struct AST_MUL data = ast->data.AST_MUL;
-            printf("(");
-            ast_print(data.left, map);
-            printf(" * ");
-            ast_print(data.right, map);
-            printf(")");
-            return;
+        case AST_IF: {
+            printf("if ");
+            return true;
         }
-        case AST_MULEQ: {
-            struct AST_MULEQ data = ast->data.AST_MULEQ;
-            printf("%s *= ", data.ident.data);
-            ast_print(data.expr, map);
-            return;
+        case AST_ARRAY: {
+            printf("[");
+            return true;
         }
-        case AST_DIV: {
-            struct AST_DIV data = ast->data.AST_DIV;
+        case AST_INDEX: {
             printf("(");
-            ast_print(data.left, map);
-            printf(" / ");
-            ast_print(data.right, map);
-            printf(")");
-            return;
+            return true;
         }
-        case AST_DIVEQ: {
-            struct AST_DIVEQ data = ast->data.AST_DIVEQ;
-            printf("%s /= ", data.ident.data);
-            ast_print(data.expr, map);
-            return;
+        case AST_LEN: {
+            printf("len ");
+            return true;
         }
-        case AST_NEGATE: {
-            struct AST_NEGATE data = ast->data.AST_NEGATE;
-            printf("-");
-            ast_print(data.expr, map);
-            return;
-        }
-        case AST_LET: {
-            struct AST_LET data = ast->data.AST_LET;
-            char* type = vartype_str(hashmap_get(map, data.ident)).data;
-            printf("let %s: %s = ", data.ident.data, type);
-            ast_print(data.expr, map);
-            return;
-        }
-        case AST_PRINT: {
-            struct AST_PRINT data = ast->data.AST_PRINT;
-            printf("print(");
-            ast_print(data.expr, map);
-            printf(")");
-            return;
-        }
-    }
-}
-
-void ast_emit(AST* ast, HashMap* map, FILE* f) {
-    if (!ast) {
-        return;
-    }
-
-    switch (ast->tag) {
-        case AST_PROGRAM: {
-            struct AST_PROGRAM data = ast->data.AST_PROGRAM;
-            emitf(f, "import \"stdlib.mv\"\n\n");
-            emitf(f, "jmp init_stdlib\n\n");
-            emitf(f, "start__:\n");
-
-            emitf(f, "addr_0:\n");
-            for (i32 i = 0; i < (i32)data.stmt_count; ++i) {
-                ast_emit(data.body[i], map, f);
-                emitf(f, "\n");
-                emitf(f, "addr_%d:\n" ,i+1);
+        case AST_FUNC: {
+            struct AST_FUNC* data = &ast->data.AST_FUNC;
+            printf("func %s", data->name.data);
+            for (u32 i = 0; i < data->param_count; ++i) {
+                printf(" %s", data->params[i].data);
             }
-            emitf(f, "stop\n");
-            return;
-        }
-        case AST_NIL: {
-            emitf(f, "push 0\n");
-            return;
-        }
-        case AST_NUMBER: {
-            struct AST_NUMBER data = ast->data.AST_NUMBER;
-            emitf(f, "push %.2f\n", data.val);
-            return;
+            printf(" {\n");
+            return true;
         }
-        case AST_STR: {
-            struct AST_STR data = ast->data.AST_STR;
-            emitf(f, "str \"%s\"\n", data.str.data);
-            return;
-        }
-        case AST_IDENT: {
-            struct AST_IDENT data = ast->data.AST_IDENT;
-            emitf(f, "push %s\n", data.ident.data);
-            return;
+        case AST_CALL: {
+            printf("%s(", ast->data.AST_CALL.name.data);
+            return true;
         }
-        case AST_BOOL: {
-            struct AST_BOOL data = ast->data.AST_BOOL;
-            emitf(f, "push %d\n", data.val);
-            return;
+        case AST_RETURN: {
+            printf("return ");
+            return true;
         }
-        case AST_NOT: {
-            struct AST_NOT data = ast->data.AST_NOT;
-            ast_emit(data.expr, map, f);
-            emitf(f, "pop tmp\n");
-            emitf(f, "call not tmp\n");
-            emitf(f, "del tmp\n");
-            return;
-        }
-        case AST_AND: {
-            struct AST_AND data = ast->data.AST_AND;
-            ast_emit(data.left, map, f);
-            emitf(f, "pop a\n");
-            ast_emit(data.right, map, f);
-            emitf(f, "pop b\n");
-            emitf(f, "call and a b\n");
-            return;
-        }
-        case AST_OR: {
-            struct AST_OR data = ast->data.AST_OR;
-            ast_emit(data.left, map, f);
-            emitf(f, "pop a\n");
-            ast_emit(data.right, map, f);
-            emitf(f, "pop b\n");
-            emitf(f, "call or a b\n");
-            return;
-        }
-        case AST_EQ: {
-            struct AST_EQ data = ast->data.AST_EQ;
-            ast_emit(data.left, map, f);
-            emitf(f, "pop a\n");
-            ast_emit(data.right, map, f);
-            emitf(f, "pop b\n");
-            emitf(f, "call eq a b\n");
-            return;
-        }
-        case AST_NEQ: {
-            struct AST_NEQ data = ast->data.AST_NEQ;
-            ast_emit(data.left, map, f);
-            emitf(f, "pop a\n");
-            ast_emit(data.right, map, f);
-            emitf(f, "pop b\n");
-            emitf(f, "call neq a b\n");
-            return;
-        }
-        case AST_GT: {
-            struct AST_GT data = ast->data.AST_GT;
-            ast_emit(data.left, map, f);
-            emitf(f, "pop a\n");
-            ast_emit(data.right, map, f);
-            emitf(f, "pop b\n");
-            emitf(f, "call gt a b\n");
-            return;
-        }
-        case AST_GTE: {
-            struct AST_GTE data = ast->data.AST_GTE;
-            ast_emit(data.left, map, f);
-            emitf(f, "pop a\n");
-            ast_emit(data.right, map, f);
-            emitf(f, "pop b\n");
-            emitf(f, "call gte a b\n");
-            return;
-        }
-        case AST_LT: {
-            struct AST_LT data = ast->data.AST_LT;
-            ast_emit(data.left, map, f);
-            emitf(f, "pop a\n");
-            ast_emit(data.right, map, f);
-            emitf(f, "pop b\n");
-            emitf(f, "call lt a b\n");
-            return;
-        }
-        case AST_LTE: {
-            struct AST_LTE data = ast->data.AST_LTE;
-            ast_emit(data.left, map, f);
-            emitf(f, "pop a\n");
-            ast_emit(data.right, map, f);
-            emitf(f, "pop b\n");
-            emitf(f, "call lte a b\n");
-            return;
-        }
-        case AST_ADD: {
-            struct AST_ADD data = ast->data.AST_ADD;
-            ast_emit(data.left, map, f);
-            ast_emit(data.right, map, f);
-            emitf(f, "add\n");
-            return;
+        case AST_VASM: {
+            printf("vasm %u (", ast->data.AST_VASM.count);
+            return true;
         }
         case AST_ADDEQ: {
-            struct AST_ADDEQ data = ast->data.AST_ADDEQ;
-            ast_emit(data.expr, map, f);
-            emitf(f, "pop tmp\n");
-            emitf(f, "call Add %s tmp | %s\n", data.ident.data, data.ident.data);
-            return;
-        }
-        case AST_SUB: {
-            struct AST_SUB data = ast->data.AST_SUB;
-            ast_emit(data.left, map, f);
-            ast_emit(data.right, map, f);
-            emitf(f, "swap\n");
-            emitf(f, "sub\n");
-            return;
+            printf("%s += ", ast->data.AST_ADDEQ.ident.data);
+            return true;
         }
         case AST_SUBEQ: {
-            struct AST_SUBEQ data = ast->data.AST_SUBEQ;
-            ast_emit(data.expr, map, f);
-            emitf(f, "pop tmp\n");
-            emitf(f, "call Sub %s tmp | %s\n", data.ident.data, data.ident.data);
-            emitf(f, "push %s\n", data.ident.data);
-            return;
-        }
-        case AST_MUL: {
-            struct AST_MUL data = ast->data.AST_MUL;
-            ast_emit(data.left, map, f);
-            ast_emit(data.right, map, f);
-            emitf(f, "mult\n");
-            return;
+            printf("%s -= ", ast->data.AST_SUBEQ.ident.data);
+            return true;
         }
         case AST_MULEQ: {
-            struct AST_MULEQ data = ast->data.AST_MULEQ;
-            ast_emit(data.expr, map, f);
-            emitf(f, "pop tmp\n");
-            emitf(f, "call Mult %s tmp | %s\n", data.ident.data, data.ident.data);
-            emitf(f, "push %s\n", data.ident.data);
-            return;
-        }
-        case AST_DIV: {
-            struct AST_DIV data = ast->data.AST_DIV;
-            ast_emit(data.left, map, f);
-            ast_emit(data.right, map, f);
-            emitf(f, "swap\n");
-            emitf(f, "div\n");
-            return;
+            printf("%s *= ", ast->data.AST_MULEQ.ident.data);
+            return true;
         }
         case AST_DIVEQ: {
-            struct AST_DIVEQ data = ast->data.AST_DIVEQ;
-            ast_emit(data.expr, map, f);
-            emitf(f, "pop tmp\n");
-            emitf(f, "call Div %s tmp | %s\n", data.ident.data, data.ident.data);
-            return;
+            printf("%s /= ", ast->data.AST_DIVEQ.ident.data);
+            return true;
         }
         case AST_NEGATE: {
-            struct AST_NEGATE data = ast->data.AST_NEGATE;
-            ast_emit(data.expr, map, f);
-            emitf(f, "push -1\n");
-            emitf(f, "mult\n");
-            return;
+            printf("-");
+            return true;
         }
         case AST_LET: {
-            struct AST_LET data = ast->data.AST_LET;
-            ast_emit(data.expr, map, f);
-            emitf(f, "pop %s\n", data.ident.data);
-            return;
+            struct AST_LET* data = &ast->data.AST_LET;
+            char* type = vartype_str(hashmap_get(map, data->ident)).data;
+            printf("let %s: %s = ", data->ident.data, type);
+            return true;
         }
         case AST_PRINT: {
-            struct AST_PRINT data = ast->data.AST_PRINT;
-            ast_emit(data.expr, map, f);
-            emitf(f, "pop tmp_var\n");
-
-            VarType type;
-            if (data.expr->tag == AST_IDENT) {
-                type = hashmap_get(map, data.expr->data.AST_IDENT.ident);
-                if (type == TypeStr) {
-                    emitf(f, "call print_str tmp_var\n");
-                    goto del;
-                } 
-            } 
-            else if (data.expr->tag == AST_STR) {
-                emitf(f, "call print_str tmp_var\n");
-                goto del;
-            }
+            printf("print(");
+            return true;
+        }
+        case AST_BLOCK: return false;
+    }
+
+    return false;
+}
 
-            emitf(f, "print tmp_var\n");
+static void print_mid(AstVisitor* v, AST* ast, u32 child) {
+    (void)v;
 
-        del:
-            emitf(f, "del tmp_var\n");
-            return;
+    if (ast->tag == AST_PROGRAM) {
+        printf("\n");
+        printf("addr_%d:\n", child+1);
+    } 
+    else if (ast->tag == AST_FOR) {
+        if (child < 2) {
+            printf("%s", child == 0 ? ".." : " {\n");
+        } else {
+            // nested blocks end on their own brace
+            printf("%s", ast_ends_with_block(ast->data.AST_FOR.body[child-2]) ? "\n" : ";\n");
         }
     }
+    else if (ast->tag == AST_WHILE || ast->tag == AST_IF) {
+        if (child == 0) {
+            printf(" {\n");
+        } else {
+            printf("%s", ast_ends_with_block(*ast_child(ast, child)) ? "\n" : ";\n");
+        }
+        if (ast->tag == AST_IF && child == ast->data.AST_IF.stmt_count && ast->data.AST_IF.else_count) {
+            printf("} else {\n");
+        }
+    }
+    else if (ast->tag == AST_FUNC) {
+        printf("%s", ast_ends_with_block(ast->data.AST_FUNC.body[child]) ? "\n" : ";\n");
+    }
+    else if (ast->tag == AST_ARRAY) {
+        if (child + 1 < ast->data.AST_ARRAY.count) printf(", ");
+    }
+    else if (ast->tag == AST_CALL) {
+        if (child + 1 < ast->data.AST_CALL.argc) printf(", ");
+    }
+    else if (ast->tag == AST_VASM) {
+        if (child + 1 < ast->data.AST_VASM.var_count) printf(", ");
+    }
+    else if (ast->tag == AST_INDEX) {
+        if (child == 0) printf(")[");
+    }
+    else if (child == 0 && binary_op_str(ast->tag)) {
+        printf("%s", binary_op_str(ast->tag));
+    }
+}
+
+static void print_post(AstVisitor* v, AST* ast) {
+    (void)v;
+
+    switch (ast->tag) {
+        case AST_PROGRAM: printf("-*- End of Program -*-\n"); return;
+        case AST_NOT:
+        case AST_PRINT: printf(")"); return;
+        case AST_FOR: case AST_WHILE: case AST_IF: case AST_FUNC: printf("}"); return;
+        case AST_ARRAY: printf("]"); return;
+        case AST_CALL: case AST_VASM: printf(")"); return;
+        // ! marks an index proven to be in bounds
+        case AST_INDEX: printf("%s", ast->data.AST_INDEX.unchecked ? "]!" : "]"); return;
+        default: break;
+    }
+
+    if (binary_op_str(ast->tag)) {
+        printf(")");
+    }
+}
+
+void ast_print(Arena* a, AST* ast, HashMap* map) {
+    PrintVisitor pv = {{print_pre, print_mid, print_post}, map};
+    ast_walk(a, ast, &pv.v);
 }
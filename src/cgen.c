@@ -0,0 +1,1008 @@
+#include "include/cgen.h"
+#include "include/arena.h"
+#include "include/ast.h"
+#include "include/err.h"
+#include "include/ir.h"
+#include "include/stats.h"
+#include "include/string.h"
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+// emitf is one C statement, emitl anything else
+#define emitf(cg, ...) \
+    (STATS_ADD(instructions, 1), STATS_ADD(out_bytes, fprintf((cg)->out, __VA_ARGS__)))
+#define emitl(cg, ...) STATS_ADD(out_bytes, fprintf((cg)->out, __VA_ARGS__))
+
+#define CGEN_NODES_INIT 64
+
+static const char* prelude =
+    "#include <stdint.h>\n"
+    "#include <stdio.h>\n"
+    "#include <stdlib.h>\n"
+    "#include <string.h>\n"
+    "\n"
+    "typedef uint8_t  u8;\n"
+    "typedef uint64_t u64;\n"
+    "typedef double   f64;\n"
+    "typedef u8       bool;\n"
+    "\n"
+    "#define true  1\n"
+    "#define false 0\n"
+    "\n"
+    "typedef u8 Nil;\n"
+    "\n"
+    "typedef struct {\n"
+    "    u64 len;\n"
+    "    const char* data;\n"
+    "} Str;\n"
+    "\n"
+    "// strings live as long as the program does\n"
+    "static inline Str str_concat(Str a, Str b) {\n"
+    "    char* data = malloc(a.len + b.len + 1);\n"
+    "    if (!data) {\n"
+    "        puts(\"Error: Out of memory. Line: 0 Column: 0\");\n"
+    "        exit(1);\n"
+    "    }\n"
+    "    memcpy(data, a.data, a.len);\n"
+    "    memcpy(data + a.len, b.data, b.len);\n"
+    "    data[a.len + b.len] = '\\0';\n"
+    "    return (Str){ a.len + b.len, data };\n"
+    "}\n"
+    "\n"
+    "static inline bool str_eq(Str a, Str b) {\n"
+    "    return a.len == b.len && memcmp(a.data, b.data, a.len) == 0;\n"
+    "}\n"
+    "\n"
+    "// arrays hold one type and are copied off the literal, they never\n"
+    "// change after that\n"
+    "typedef struct {\n"
+    "    u64 len;\n"
+    "    const f64* data;\n"
+    "} ArrNum;\n"
+    "\n"
+    "typedef struct {\n"
+    "    u64 len;\n"
+    "    const Str* data;\n"
+    "} ArrStr;\n"
+    "\n"
+    "typedef struct {\n"
+    "    u64 len;\n"
+    "    const bool* data;\n"
+    "} ArrBool;\n"
+    "\n"
+    "static inline void* arr_copy(const void* items, u64 size) {\n"
+    "    void* data = malloc(size);\n"
+    "    if (!data) {\n"
+    "        puts(\"Error: Out of memory. Line: 0 Column: 0\");\n"
+    "        exit(1);\n"
+    "    }\n"
+    "    return memcpy(data, items, size);\n"
+    "}\n"
+    "\n"
+    "static inline ArrNum arr_num(u64 len, const f64* items) {\n"
+    "    return (ArrNum){ len, arr_copy(items, sizeof(f64) * len) };\n"
+    "}\n"
+    "\n"
+    "static inline ArrStr arr_str(u64 len, const Str* items) {\n"
+    "    return (ArrStr){ len, arr_copy(items, sizeof(Str) * len) };\n"
+    "}\n"
+    "\n"
+    "static inline ArrBool arr_bool(u64 len, const bool* items) {\n"
+    "    return (ArrBool){ len, arr_copy(items, sizeof(bool) * len) };\n"
+    "}\n"
+    "\n"
+    "// the checked index, loops the compiler proved in bounds skip it\n"
+    "static inline u64 arr_index(u64 len, f64 i) {\n"
+    "    if (!(i >= 0 && i < (f64)len) || i != (f64)(u64)i) {\n"
+    "        fflush(stdout);\n"
+    "        puts(\"Error: Index out of bounds. Line: 0 Column: 0\");\n"
+    "        exit(1);\n"
+    "    }\n"
+    "    return (u64)i;\n"
+    "}\n"
+    "\n"
+    "static inline f64 at_num(ArrNum a, f64 i) { return a.data[arr_index(a.len, i)]; }\n"
+    "static inline Str at_str(ArrStr a, f64 i) { return a.data[arr_index(a.len, i)]; }\n"
+    "static inline bool at_bool(ArrBool a, f64 i) { return a.data[arr_index(a.len, i)]; }\n"
+    "\n"
+    "// whole numbers as plain digits, anything else the shortest %g that\n"
+    "// reads back as the same double\n"
+    "static inline void put_num(f64 n) {\n"
+    "    char buf[32];\n"
+    "    if (n != n) {\n"
+    "        fputs(\"nan\", stdout);\n"
+    "        return;\n"
+    "    }\n"
+    "    if (n > -1e21 && n < 1e21 &&\n"
+    "        (n <= -9007199254740992.0 || n >= 9007199254740992.0 || n == (f64)(int64_t)n)) {\n"
+    "        printf(\"%.0f\", n);\n"
+    "        return;\n"
+    "    }\n"
+    "    for (int prec = 1; prec <= 17; ++prec) {\n"
+    "        snprintf(buf, sizeof(buf), \"%.*g\", prec, n);\n"
+    "        if (strtod(buf, 0) == n) break;\n"
+    "    }\n"
+    "    fputs(buf, stdout);\n"
+    "}\n"
+    "\n"
+    "static inline void put_str(Str s) {\n"
+    "    fwrite(s.data, 1, s.len, stdout);\n"
+    "}\n"
+    "\n"
+    "static inline void put_bool(bool b) {\n"
+    "    fputs(b ? \"true\" : \"false\", stdout);\n"
+    "}\n"
+    "\n"
+    "static inline void print_num(f64 n) {\n"
+    "    put_num(n);\n"
+    "    putchar('\\n');\n"
+    "}\n"
+    "\n"
+    "static inline void print_str(Str s) {\n"
+    "    put_str(s);\n"
+    "    putchar('\\n');\n"
+    "}\n"
+    "\n"
+    "static inline void print_bool(bool b) {\n"
+    "    put_bool(b);\n"
+    "    putchar('\\n');\n"
+    "}\n"
+    "\n"
+    "#define PRINT_ARR(name, Arr, put)             \\\n"
+    "    static inline void name(Arr a) {         \\\n"
+    "        putchar('[');                        \\\n"
+    "        for (u64 i = 0; i < a.len; ++i) {    \\\n"
+    "            if (i) fputs(\", \", stdout);     \\\n"
+    "            put(a.data[i]);                  \\\n"
+    "        }                                    \\\n"
+    "        puts(\"]\");                          \\\n"
+    "    }\n"
+    "\n"
+    "PRINT_ARR(print_arr_num, ArrNum, put_num)\n"
+    "PRINT_ARR(print_arr_str, ArrStr, put_str)\n"
+    "PRINT_ARR(print_arr_bool, ArrBool, put_bool)\n"
+    "\n"
+    "static inline void print_nil(Nil n) {\n"
+    "    (void)n;\n"
+    "    puts(\"nil\");\n"
+    "}\n"
+    "\n"
+    "int main(void) {\n";
+
+Cgen* cgen_new(Arena* a, FILE* out) {
+    Cgen* cg = AllocArrayZero(a, Cgen, 1);
+    cg->arena = a;
+    cg->out = out;
+    cg->syms = ir_symbols_new(a);
+
+    cg->node_cap = CGEN_NODES_INIT;
+    cg->nodes = AllocArray(a, CgenNode, cg->node_cap);
+    cg->stamps = AllocArrayZero(a, u32, cg->node_cap);
+
+    emitl(cg, "// generated by blazeit\n");
+    emitl(cg, "%s", prelude);
+    return cg;
+}
+
+void cgen_finish(Cgen* cg) {
+    emitf(cg, "    return 0;\n");
+    emitl(cg, "}\n");
+}
+
+/*
+*  Bindings
+*/
+
+static u32 cgen_symbol(Cgen* cg, String name) {
+    u32 slot = ir_symbol(cg->syms, name);
+    if (slot < cg->cap) return slot;
+
+    u32 cap = cg->cap ? cg->cap : 64;
+    while (cap <= slot) cap *= 2;
+
+    VarType* types = AllocArray(cg->arena, VarType, cap);
+    u32* lets = AllocArrayZero(cg->arena, u32, cap);
+    u32* scopes = AllocArrayZero(cg->arena, u32, cap);
+    if (cg->cap) {
+        memcpy(types, cg->types, sizeof(VarType) * cg->cap);
+        memcpy(lets, cg->lets, sizeof(u32) * cg->cap);
+        memcpy(scopes, cg->scopes, sizeof(u32) * cg->cap);
+    }
+
+    cg->types = types;
+    cg->lets = lets;
+    cg->scopes = scopes;
+    cg->cap = cap;
+    return slot;
+}
+
+// A hidden name that is still nil outside of a block and gets a real
+// type inside one is given a new local, declared ahead of the statement.
+// Only the inliner makes names like that, and it assigns them on every
+// way through before they're read, so the zero they start out as is
+// never seen.
+static u32 cgen_hoist(Cgen* cg, u32 slot, VarType type, bool* decl) {
+    if (cg->hoisted_count == cg->hoisted_cap) {
+        u32 cap = cg->hoisted_cap ? cg->hoisted_cap * 2 : 8;
+        cg->hoisted = arena_realloc(cg->arena, cg->hoisted, sizeof(CgenHoist) * cg->hoisted_cap,
+                                                            sizeof(CgenHoist) * cap);
+        cg->hoisted_cap = cap;
+    }
+    cg->hoisted[cg->hoisted_count++] = (CgenHoist){ slot, cg->lets[slot], type };
+
+    cg->types[slot] = type;
+    *decl = false;
+    return cg->lets[slot]++;
+}
+
+// A let outside of loops and ifs always gets a fresh local. Inside one, a
+// name bound outside of it has to keep its local, the value is read
+// again the next time around and after the block. Returns the local,
+// decl says whether it's a new one.
+static u32 cgen_bind(Cgen* cg, String name, VarType type, bool* decl) {
+    u32 slot = cgen_symbol(cg, name);
+
+    if (cg->blocks && cg->lets[slot] && cg->scopes[slot] < cg->blocks) {
+        if (cg->types[slot] != type) {
+            if (cg->types[slot] == TypeNil && name.data[0] == '_') {
+                return cgen_hoist(cg, slot, type, decl);
+            }
+
+            char msg[128];
+            snprintf(msg, sizeof(msg), "'%.*s' can't change type inside a loop or an if",
+                     (int)name.len, name.data);
+            err(msg, 0, 0);
+        }
+        *decl = false;
+        return cg->lets[slot] - 1;
+    }
+
+    if (!cg->lets[slot]) {
+        cg->scopes[slot] = cg->blocks;
+        if (cg->blocks) {
+            if (cg->scoped_count == cg->scoped_cap) {
+                u32 cap = cg->scoped_cap ? cg->scoped_cap * 2 : 16;
+                cg->scoped = arena_realloc(cg->arena, cg->scoped, sizeof(u32) * cg->scoped_cap,
+                                                                  sizeof(u32) * cap);
+                cg->scoped_cap = cap;
+            }
+            cg->scoped[cg->scoped_count++] = slot;
+        }
+    }
+
+    cg->types[slot] = type;
+    *decl = true;
+    return cg->lets[slot]++;
+}
+
+// the block that's ending takes the names it brought in with it. They
+// were declared inside its braces, so starting their count over is fine.
+static void cgen_unscope(Cgen* cg) {
+    while (cg->scoped_count && cg->scopes[cg->scoped[cg->scoped_count-1]] == cg->blocks) {
+        cg->lets[cg->scoped[--cg->scoped_count]] = 0;
+    }
+}
+
+static u32 cgen_bound(Cgen* cg, String name) {
+    u32 slot = cgen_symbol(cg, name);
+    if (!cg->lets[slot]) {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "Undefined variable '%.*s'", (int)name.len, name.data);
+        err(msg, 0, 0);
+    }
+    return slot;
+}
+
+/*
+*  Per statement node table
+*/
+
+static u32 node_hash(AST* node, u32 cap) {
+    return (u32)(((uintptr_t)node >> 4) * 0x9E3779B97F4A7C15ull >> 32) & (cap - 1);
+}
+
+static CgenNode* node_find(Cgen* cg, AST* node) {
+    u32 i = node_hash(node, cg->node_cap);
+    while (cg->stamps[i] == cg->stamp) {
+        if (cg->nodes[i].node == node) return &cg->nodes[i];
+        i = (i + 1) & (cg->node_cap - 1);
+    }
+
+    return 0;
+}
+
+static void node_grow(Cgen* cg);
+
+static CgenNode* node_set(Cgen* cg, AST* node, VarType type, u32 local) {
+    if ((cg->node_count + 1) * 2 > cg->node_cap) {
+        node_grow(cg);
+    }
+
+    u32 i = node_hash(node, cg->node_cap);
+    while (cg->stamps[i] == cg->stamp) {
+        i = (i + 1) & (cg->node_cap - 1);
+    }
+
+    cg->stamps[i] = cg->stamp;
+    cg->nodes[i] = (CgenNode){ node, type, local, false };
+    cg->node_count++;
+    return &cg->nodes[i];
+}
+
+static void node_grow(Cgen* cg) {
+    CgenNode* nodes = cg->nodes;
+    u32* stamps = cg->stamps;
+    u32 cap = cg->node_cap;
+
+    cg->node_cap = cap * 2;
+    cg->nodes = AllocArray(cg->arena, CgenNode, cg->node_cap);
+    cg->stamps = AllocArrayZero(cg->arena, u32, cg->node_cap);
+    cg->node_count = 0;
+
+    for (u32 i = 0; i < cap; ++i) {
+        if (stamps[i] == cg->stamp) {
+            node_set(cg, nodes[i].node, nodes[i].type, nodes[i].local)->decl = nodes[i].decl;
+        }
+    }
+}
+
+static VarType type_of(Cgen* cg, AST* node) {
+    CgenNode* n = node_find(cg, node);
+    assert(n && "Node wasn't typed");
+    return n->type;
+}
+
+/*
+*  Typing
+*/
+
+typedef struct {
+    AstVisitor v;
+    Cgen*      cg;
+} TypeVisitor;
+
+static const char* type_str(VarType type) {
+    switch (type) {
+        case TypeNum:  return "Num";
+        case TypeStr:  return "Str";
+        case TypeBool: return "Bool";
+        case TypeArrNum: case TypeArrStr: case TypeArrBool: return "Array";
+        default:       return "Nil";
+    }
+}
+
+static bool is_arr(VarType type) {
+    return type == TypeArrNum || type == TypeArrStr || type == TypeArrBool;
+}
+
+static VarType item_type(VarType arr) {
+    switch (arr) {
+        case TypeArrNum: return TypeNum;
+        case TypeArrStr: return TypeStr;
+        default:         return TypeBool;
+    }
+}
+
+static void expect_nums(const char* op, VarType l, VarType r) {
+    if (l != TypeNum || r != TypeNum) {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "'%s' expects Num, got %s", op, type_str(l != TypeNum ? l : r));
+        err(msg, 0, 0);
+    }
+}
+
+// the VM's value_add: Str + Str concatenates, anything else wants Nums
+static VarType add_type(VarType l, VarType r) {
+    if (l == TypeStr && r == TypeStr) return TypeStr;
+    expect_nums("+", l, r);
+    return TypeNum;
+}
+
+// x op= expr keeps x's type
+static void type_compound(Cgen* cg, AST* ast, const char* op, String ident, AST* expr) {
+    u32 slot = cgen_bound(cg, ident);
+    VarType var = cg->types[slot];
+    VarType val = type_of(cg, expr);
+
+    if (op[0] == '+') {
+        add_type(var, val);
+    } else {
+        expect_nums(op, var, val);
+    }
+
+    node_set(cg, ast, var, cg->lets[slot] - 1);
+}
+
+static bool type_pre(AstVisitor* v, AST* ast) {
+    (void)v;
+    if (ast->tag == AST_BLOCK) {
+        err("Blocks are not supported by the C backend", 0, 0);
+    }
+    if (ast->tag == AST_VASM) {
+        err("vasm is not supported by the C backend", 0, 0);
+    }
+    if (ast->tag == AST_RANGE) {
+        err("Ranges can only be looped over or indexed", 0, 0);
+    }
+    return true;
+}
+
+// a loop's variable is bound once both bounds are typed, before the body.
+// The body of a while or an if starts right after the condition, and the
+// else starts over from what was there before the if.
+static void type_mid(AstVisitor* v, AST* ast, u32 child) {
+    Cgen* cg = ((TypeVisitor*)v)->cg;
+    if ((ast->tag == AST_WHILE || ast->tag == AST_IF) && child == 0) {
+        cg->blocks++;
+    }
+    if (ast->tag == AST_IF && child == ast->data.AST_IF.stmt_count) {
+        cgen_unscope(cg);
+    }
+    if (ast->tag != AST_FOR || child != 1) return;
+
+    struct AST_FOR* data = &ast->data.AST_FOR;
+    expect_nums("<", type_of(cg, data->start), type_of(cg, data->end));
+
+    bool decl;
+    u32 local = cgen_bind(cg, data->ident, TypeNum, &decl);
+    node_set(cg, ast, TypeNum, local)->decl = decl;
+
+    // the end variable's name is unique to the loop, so this is always
+    // its first binding and local 0
+    cgen_bind(cg, data->end_var, TypeNum, &decl);
+    cg->blocks++;
+}
+
+static void type_post(AstVisitor* v, AST* ast) {
+    Cgen* cg = ((TypeVisitor*)v)->cg;
+
+    switch (ast->tag) {
+        case AST_NUMBER: node_set(cg, ast, TypeNum, 0); return;
+        case AST_STR:    node_set(cg, ast, TypeStr, 0); return;
+        case AST_BOOL:   node_set(cg, ast, TypeBool, 0); return;
+        case AST_NIL:    node_set(cg, ast, TypeNil, 0); return;
+        case AST_IDENT: {
+            u32 slot = cgen_bound(cg, ast->data.AST_IDENT.ident);
+            node_set(cg, ast, cg->types[slot], cg->lets[slot] - 1);
+            return;
+        }
+        case AST_ADD: {
+            struct AST_ADD* data = &ast->data.AST_ADD;
+            node_set(cg, ast, add_type(type_of(cg, data->left), type_of(cg, data->right)), 0);
+            return;
+        }
+        case AST_SUB: case AST_MUL: case AST_DIV:
+        case AST_GT: case AST_GTE: case AST_LT: case AST_LTE: {
+            static const char* ops[AST_TAG_COUNT] = {
+                [AST_SUB] = "-", [AST_MUL] = "*", [AST_DIV] = "/",
+                [AST_GT] = ">", [AST_GTE] = ">=", [AST_LT] = "<", [AST_LTE] = "<=",
+            };
+            expect_nums(ops[ast->tag], type_of(cg, *ast_child(ast, 0)), type_of(cg, *ast_child(ast, 1)));
+            bool cmp = ast->tag == AST_GT || ast->tag == AST_GTE ||
+                       ast->tag == AST_LT || ast->tag == AST_LTE;
+            node_set(cg, ast, cmp ? TypeBool : TypeNum, 0);
+            return;
+        }
+        case AST_NEGATE: {
+            // lowered as a multiply by -1, so it fails like one
+            expect_nums("*", type_of(cg, ast->data.AST_NEGATE.expr), TypeNum);
+            node_set(cg, ast, TypeNum, 0);
+            return;
+        }
+        case AST_EQ: case AST_NEQ: {
+            // value_eq compares the pointers, a C struct can't be compared
+            VarType l = type_of(cg, *ast_child(ast, 0));
+            if (is_arr(l) && l == type_of(cg, *ast_child(ast, 1))) {
+                err("Comparing arrays is not supported by the C backend", 0, 0);
+            }
+            node_set(cg, ast, TypeBool, 0);
+            return;
+        }
+        case AST_AND: case AST_OR: case AST_NOT: {
+            node_set(cg, ast, TypeBool, 0);
+            return;
+        }
+        case AST_ARRAY: {
+            struct AST_ARRAY* data = &ast->data.AST_ARRAY;
+            if (data->count == 0) {
+                err("Empty arrays are not supported by the C backend", 0, 0);
+            }
+
+            VarType type = type_of(cg, data->items[0]);
+            for (u32 i = 1; i < data->count; ++i) {
+                if (type_of(cg, data->items[i]) != type) type = TypeNil;
+            }
+
+            static const VarType arrs[] = {
+                [TypeNum] = TypeArrNum, [TypeStr] = TypeArrStr, [TypeBool] = TypeArrBool,
+            };
+            if (type != TypeNum && type != TypeStr && type != TypeBool) {
+                err("Arrays have to hold only Nums, Strs or Bools in the C backend", 0, 0);
+            }
+            node_set(cg, ast, arrs[type], 0);
+            return;
+        }
+        case AST_INDEX: {
+            // same checks in the same order as value_index
+            VarType arr = type_of(cg, ast->data.AST_INDEX.left);
+            if (!is_arr(arr)) {
+                char msg[64];
+                snprintf(msg, sizeof(msg), "Only arrays can be indexed, got %s", type_str(arr));
+                err(msg, 0, 0);
+            }
+            expect_nums("[]", type_of(cg, ast->data.AST_INDEX.right), TypeNum);
+            node_set(cg, ast, item_type(arr), 0);
+            return;
+        }
+        case AST_LEN: {
+            VarType type = type_of(cg, ast->data.AST_LEN.expr);
+            if (type != TypeStr && !is_arr(type)) {
+                char msg[64];
+                snprintf(msg, sizeof(msg), "'len' expects Str or Array, got %s", type_str(type));
+                err(msg, 0, 0);
+            }
+            node_set(cg, ast, TypeNum, 0);
+            return;
+        }
+        case AST_LET: {
+            struct AST_LET* data = &ast->data.AST_LET;
+            VarType type = type_of(cg, data->expr);
+            bool decl;
+            u32 local = cgen_bind(cg, data->ident, type, &decl);
+            node_set(cg, ast, type, local)->decl = decl;
+            return;
+        }
+        case AST_FOR: case AST_WHILE: case AST_IF: {
+            cgen_unscope(cg);
+            cg->blocks--;
+            return;
+        }
+        case AST_ADDEQ: type_compound(cg, ast, "+", ast->data.AST_ADDEQ.ident, ast->data.AST_ADDEQ.expr); return;
+        case AST_SUBEQ: type_compound(cg, ast, "-", ast->data.AST_SUBEQ.ident, ast->data.AST_SUBEQ.expr); return;
+        case AST_MULEQ: type_compound(cg, ast, "*", ast->data.AST_MULEQ.ident, ast->data.AST_MULEQ.expr); return;
+        case AST_DIVEQ: type_compound(cg, ast, "/", ast->data.AST_DIVEQ.ident, ast->data.AST_DIVEQ.expr); return;
+        default: return;
+    }
+}
+
+/*
+*  Emitting
+*/
+
+typedef struct {
+    AstVisitor v;
+    Cgen*      cg;
+} EmitVisitor;
+
+static const char* c_type(VarType type) {
+    switch (type) {
+        case TypeNum:  return "f64";
+        case TypeStr:  return "Str";
+        case TypeBool: return "bool";
+        case TypeArrNum:  return "ArrNum";
+        case TypeArrStr:  return "ArrStr";
+        case TypeArrBool: return "ArrBool";
+        default:       return "Nil";
+    }
+}
+
+static void emit_indent(Cgen* cg) {
+    emitl(cg, "%*s", (int)(cg->blocks + 1) * 4, "");
+}
+
+static void emit_local(Cgen* cg, String name, u32 local) {
+    emitl(cg, "%.*s_%u", (int)name.len, name.data, local);
+}
+
+// literals come out as doubles, never as C ints
+static void emit_number(Cgen* cg, f64 n) {
+    if (isinf(n)) {
+        emitl(cg, "%s(1.0 / 0.0)", n < 0 ? "-" : "");
+        return;
+    }
+
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.17g", n);
+    emitl(cg, "%s%s", buf, strpbrk(buf, ".en") ? "" : ".0");
+}
+
+// escapes resolved the way value_str_lit does it
+static void emit_str(Cgen* cg, String lexeme) {
+    emitl(cg, "(Str){ ");
+
+    u64 len = 0;
+    for (u64 i = 0; i < lexeme.len; ++i) {
+        if (lexeme.data[i] == '\\' && i + 1 < lexeme.len && strchr("ntrb", lexeme.data[i+1])) i++;
+        len++;
+    }
+    emitl(cg, "%llu, \"", (unsigned long long)len);
+
+    for (u64 i = 0; i < lexeme.len; ++i) {
+        unsigned char c = lexeme.data[i];
+        if (c == '\\' && i + 1 < lexeme.len) {
+            switch (lexeme.data[i+1]) {
+                case 'n': c = '\n'; i++; break;
+                case 't': c = '\t'; i++; break;
+                case 'r': c = '\r'; i++; break;
+                case 'b': c = '\b'; i++; break;
+                default: break;
+            }
+        }
+
+        if (c == '"' || c == '\\' || c == '?' || c < 0x20 || c >= 0x7f) {
+            emitl(cg, "\\%03o", c);
+        } else {
+            emitl(cg, "%c", c);
+        }
+    }
+    emitl(cg, "\" }");
+}
+
+// wraps a child of any type into a C truth value, same rules as
+// value_truthy
+static void truthy_open(Cgen* cg, VarType type) {
+    switch (type) {
+        case TypeNum:  emitl(cg, "(0 != "); break;
+        case TypeBool: emitl(cg, "("); break;
+        default:       emitl(cg, "((void)"); break;
+    }
+}
+
+static void truthy_close(Cgen* cg, VarType type) {
+    switch (type) {
+        case TypeNum:
+        case TypeBool: emitl(cg, ")"); break;
+        case TypeNil:  emitl(cg, ", false)"); break;
+        default:       emitl(cg, ", true)"); break;
+    }
+}
+
+// Eq and Neq on two children of different types are constant, value_eq
+// compares the raw bits there
+static bool same_types(Cgen* cg, AST* ast) {
+    return type_of(cg, *ast_child(ast, 0)) == type_of(cg, *ast_child(ast, 1));
+}
+
+static bool emit_pre(AstVisitor* v, AST* ast) {
+    Cgen* cg = ((EmitVisitor*)v)->cg;
+
+    switch (ast->tag) {
+        case AST_NUMBER: emit_number(cg, ast->data.AST_NUMBER.val); break;
+        case AST_STR:    emit_str(cg, ast->data.AST_STR.str); break;
+        case AST_BOOL:   emitl(cg, "%s", ast->data.AST_BOOL.val ? "true" : "false"); break;
+        case AST_NIL:    emitl(cg, "(Nil)0"); break;
+        case AST_IDENT:  emit_local(cg, ast->data.AST_IDENT.ident, node_find(cg, ast)->local); break;
+
+        case AST_ADD:
+            emitl(cg, "%s", type_of(cg, ast) == TypeStr ? "str_concat(" : "(");
+            break;
+        case AST_SUB: case AST_MUL: case AST_DIV:
+        case AST_GT: case AST_GTE: case AST_LT: case AST_LTE:
+            emitl(cg, "(");
+            break;
+        case AST_NEGATE:
+            emitl(cg, "(-");
+            break;
+        case AST_ARRAY: {
+            VarType item = item_type(type_of(cg, ast));
+            emitl(cg, "arr_%s(%u, (%s[]){ ", item == TypeNum ? "num" : item == TypeStr ? "str" : "bool",
+                  ast->data.AST_ARRAY.count, c_type(item));
+            break;
+        }
+        case AST_INDEX: {
+            VarType item = type_of(cg, ast);
+            if (ast->data.AST_INDEX.unchecked) {
+                emitl(cg, "(");
+            } else {
+                emitl(cg, "at_%s(", item == TypeNum ? "num" : item == TypeStr ? "str" : "bool");
+            }
+            break;
+        }
+        case AST_LEN:
+            emitl(cg, "((f64)(");
+            break;
+        case AST_EQ: case AST_NEQ: {
+            if (!same_types(cg, ast)) {
+                emitl(cg, "((void)");
+            } else if (type_of(cg, *ast_child(ast, 0)) == TypeStr) {
+                emitl(cg, "%sstr_eq(", ast->tag == AST_NEQ ? "!" : "");
+            } else {
+                emitl(cg, "(");
+            }
+            break;
+        }
+        case AST_NOT: {
+            emitl(cg, "(!");
+            truthy_open(cg, type_of(cg, ast->data.AST_NOT.expr));
+            break;
+        }
+        case AST_AND: case AST_OR: {
+            emitl(cg, "(");
+            truthy_open(cg, type_of(cg, *ast_child(ast, 0)));
+            break;
+        }
+
+        case AST_LET: {
+            CgenNode* n = node_find(cg, ast);
+            emit_indent(cg);
+            if (n->decl) emitl(cg, "%s ", c_type(n->type));
+            emit_local(cg, ast->data.AST_LET.ident, n->local);
+            emitl(cg, " = ");
+            break;
+        }
+        case AST_WHILE: case AST_IF: {
+            emit_indent(cg);
+            emitl(cg, "%s (", ast->tag == AST_IF ? "if" : "while");
+            truthy_open(cg, type_of(cg, *ast_child(ast, 0)));
+            break;
+        }
+        case AST_FOR: {
+            CgenNode* n = node_find(cg, ast);
+            emit_indent(cg);
+            if (n->decl) emitl(cg, "f64 ");
+            emit_local(cg, ast->data.AST_FOR.ident, n->local);
+            emitl(cg, " = ");
+            break;
+        }
+        case AST_ADDEQ: {
+            CgenNode* n = node_find(cg, ast);
+            String ident = ast->data.AST_ADDEQ.ident;
+            emit_indent(cg);
+            emit_local(cg, ident, n->local);
+            if (n->type == TypeStr) {
+                emitl(cg, " = str_concat(");
+                emit_local(cg, ident, n->local);
+                emitl(cg, ", ");
+            } else {
+                emitl(cg, " += ");
+            }
+            break;
+        }
+        case AST_SUBEQ: case AST_MULEQ: case AST_DIVEQ: {
+            static const char* ops[AST_TAG_COUNT] = {
+                [AST_SUBEQ] = "-=", [AST_MULEQ] = "*=", [AST_DIVEQ] = "/=",
+            };
+            // the ident sits at the same spot in all three
+            emit_indent(cg);
+            emit_local(cg, ast->data.AST_SUBEQ.ident, node_find(cg, ast)->local);
+            emitl(cg, " %s ", ops[ast->tag]);
+            break;
+        }
+        case AST_PRINT: {
+            static const char* print[] = {
+                [TypeNil] = "print_nil", [TypeStr] = "print_str",
+                [TypeNum] = "print_num", [TypeBool] = "print_bool",
+                [TypeArrNum] = "print_arr_num", [TypeArrStr] = "print_arr_str",
+                [TypeArrBool] = "print_arr_bool",
+            };
+            emit_indent(cg);
+            emitl(cg, "%s(", print[type_of(cg, ast->data.AST_PRINT.expr)]);
+            break;
+        }
+        default: break;
+    }
+
+    return true;
+}
+
+static bool is_stmt(AST* ast);
+
+// closes the bare expression before a gap between two statements and
+// opens the one after it, the same way top level ones are wrapped
+static void emit_gap(Cgen* cg, AST* prev, AST* next) {
+    if (prev && !is_stmt(prev)) {
+        emitf(cg, ");\n");
+    }
+    if (next && !is_stmt(next)) {
+        emit_indent(cg);
+        emitl(cg, "(void)(");
+    }
+}
+
+// i = start; end = stop; for (; i < end; i += 1) { body }
+static void emit_for_mid(Cgen* cg, AST* ast, u32 child) {
+    struct AST_FOR* data = &ast->data.AST_FOR;
+
+    if (child == 0) {
+        emitf(cg, ";\n");
+        emit_indent(cg);
+        emitl(cg, "f64 ");
+        emit_local(cg, data->end_var, 0);
+        emitl(cg, " = ");
+        return;
+    }
+
+    if (child == 1) {
+        u32 local = node_find(cg, ast)->local;
+        emitf(cg, ";\n");
+        emit_indent(cg);
+        emitl(cg, "for (; ");
+        emit_local(cg, data->ident, local);
+        emitl(cg, " < ");
+        emit_local(cg, data->end_var, 0);
+        emitl(cg, "; ");
+        emit_local(cg, data->ident, local);
+        emitl(cg, " += 1) {\n");
+        cg->blocks++;
+    }
+
+    emit_gap(cg, child > 1 ? data->body[child-2] : 0,
+                 child - 1 < data->stmt_count ? data->body[child-1] : 0);
+}
+
+// while (cond) { body } and if (cond) { body } else { body }
+static void emit_block_mid(Cgen* cg, AST* ast, u32 child) {
+    u32 count = ast_child_count(ast);
+
+    if (child == 0) {
+        truthy_close(cg, type_of(cg, *ast_child(ast, 0)));
+        emitl(cg, ") {\n");
+        cg->blocks++;
+    }
+    emit_gap(cg, child ? *ast_child(ast, child) : 0, 0);
+
+    if (ast->tag == AST_IF && child == ast->data.AST_IF.stmt_count && ast->data.AST_IF.else_count) {
+        cg->blocks--;
+        emit_indent(cg);
+        emitl(cg, "} else {\n");
+        cg->blocks++;
+    }
+    emit_gap(cg, 0, child + 1 < count ? *ast_child(ast, child + 1) : 0);
+}
+
+static void emit_mid(AstVisitor* v, AST* ast, u32 child) {
+    Cgen* cg = ((EmitVisitor*)v)->cg;
+    if (ast->tag == AST_FOR) {
+        emit_for_mid(cg, ast, child);
+        return;
+    }
+    if (ast->tag == AST_WHILE || ast->tag == AST_IF) {
+        emit_block_mid(cg, ast, child);
+        return;
+    }
+    if (ast->tag == AST_ARRAY) {
+        if (child + 1 < ast->data.AST_ARRAY.count) emitl(cg, ", ");
+        return;
+    }
+    if (child != 0) return;
+
+    switch (ast->tag) {
+        case AST_ADD: emitl(cg, "%s", type_of(cg, ast) == TypeStr ? ", " : " + "); break;
+        case AST_SUB: emitl(cg, " - "); break;
+        case AST_MUL: emitl(cg, " * "); break;
+        case AST_DIV: emitl(cg, " / "); break;
+        case AST_GT:  emitl(cg, " > "); break;
+        case AST_GTE: emitl(cg, " >= "); break;
+        case AST_LT:  emitl(cg, " < "); break;
+        case AST_LTE: emitl(cg, " <= "); break;
+        case AST_INDEX: emitl(cg, "%s", ast->data.AST_INDEX.unchecked ? ").data[(u64)(" : ", "); break;
+        case AST_EQ: case AST_NEQ: {
+            if (!same_types(cg, ast)) {
+                emitl(cg, ", (void)");
+            } else if (type_of(cg, *ast_child(ast, 0)) == TypeStr) {
+                emitl(cg, ", ");
+            } else {
+                emitl(cg, ast->tag == AST_EQ ? " == " : " != ");
+            }
+            break;
+        }
+        case AST_AND: case AST_OR: {
+            truthy_close(cg, type_of(cg, *ast_child(ast, 0)));
+            emitl(cg, ast->tag == AST_AND ? " && " : " || ");
+            truthy_open(cg, type_of(cg, *ast_child(ast, 1)));
+            break;
+        }
+        default: break;
+    }
+}
+
+static void emit_post(AstVisitor* v, AST* ast) {
+    Cgen* cg = ((EmitVisitor*)v)->cg;
+
+    switch (ast->tag) {
+        case AST_ADD: case AST_SUB: case AST_MUL: case AST_DIV:
+        case AST_GT: case AST_GTE: case AST_LT: case AST_LTE:
+        case AST_NEGATE:
+            emitl(cg, ")");
+            break;
+        case AST_ARRAY:
+            emitl(cg, " })");
+            break;
+        case AST_INDEX:
+            emitl(cg, "%s", ast->data.AST_INDEX.unchecked ? ")]" : ")");
+            break;
+        case AST_LEN:
+            emitl(cg, ").len)");
+            break;
+        case AST_EQ: case AST_NEQ: {
+            if (!same_types(cg, ast)) {
+                emitl(cg, ", %s)", ast->tag == AST_NEQ ? "true" : "false");
+            } else {
+                emitl(cg, ")");
+            }
+            break;
+        }
+        case AST_NOT: {
+            truthy_close(cg, type_of(cg, ast->data.AST_NOT.expr));
+            emitl(cg, ")");
+            break;
+        }
+        case AST_AND: case AST_OR: {
+            truthy_close(cg, type_of(cg, *ast_child(ast, 1)));
+            emitl(cg, ")");
+            break;
+        }
+        // a let can be dead after the passes, split records and arrays
+        // leave a lot of them, so it's marked used to keep -Wall quiet
+        case AST_LET: {
+            CgenNode* n = node_find(cg, ast);
+            if (n->decl) {
+                emitl(cg, "; (void)");
+                emit_local(cg, ast->data.AST_LET.ident, n->local);
+            }
+            emitf(cg, ";\n");
+            break;
+        }
+        case AST_SUBEQ: case AST_MULEQ: case AST_DIVEQ:
+            emitf(cg, ";\n");
+            break;
+        case AST_ADDEQ:
+            emitf(cg, "%s;\n", node_find(cg, ast)->type == TypeStr ? ")" : "");
+            break;
+        case AST_PRINT:
+            emitf(cg, ");\n");
+            break;
+        case AST_FOR: case AST_WHILE: case AST_IF:
+            cg->blocks--;
+            emit_indent(cg);
+            emitl(cg, "}\n");
+            break;
+        default: break;
+    }
+}
+
+static bool is_stmt(AST* ast) {
+    switch (ast->tag) {
+        case AST_LET: case AST_PRINT: case AST_ADDEQ:
+        case AST_SUBEQ: case AST_MULEQ: case AST_DIVEQ:
+        case AST_FOR: case AST_WHILE: case AST_IF: return true;
+        default: return false;
+    }
+}
+
+void cgen_stmt(Cgen* cg, Arena* scratch, AST* stmt) {
+    ArenaTag prev_tag = arena_set_tag(scratch, ArenaTag_Emitter);
+
+    cg->stamp++;
+    cg->node_count = 0;
+
+    TypeVisitor tv = {{type_pre, type_mid, type_post}, cg};
+    ast_walk(scratch, stmt, &tv.v);
+
+    for (u32 i = 0; i < cg->hoisted_count; ++i) {
+        CgenHoist* h = &cg->hoisted[i];
+        emit_indent(cg);
+        emitl(cg, "%s ", c_type(h->type));
+        emit_local(cg, cg->syms->names[h->slot], h->local);
+        emitl(cg, " = {0}; (void)");
+        emit_local(cg, cg->syms->names[h->slot], h->local);
+        emitf(cg, ";\n");
+    }
+    cg->hoisted_count = 0;
+
+    // a bare expression is evaluated for nothing, like on the VM
+    bool bare = !is_stmt(stmt);
+    if (bare) {
+        emit_indent(cg);
+        emitl(cg, "(void)(");
+    }
+
+    EmitVisitor ev = {{emit_pre, emit_mid, emit_post}, cg};
+    ast_walk(scratch, stmt, &ev.v);
+
+    if (bare) emitf(cg, ");\n");
+
+    arena_set_tag(scratch, prev_tag);
+}
@@ -0,0 +1,380 @@
+#include <string.h>
+
+#include "include/cse.h"
+#include "include/arena.h"
+#include "include/ast.h"
+#include "include/ir.h"
+#include "include/string.h"
+
+#define CSE_TABLE_INIT 64
+
+Cse* cse_new(Arena* a) {
+    return AllocArrayZero(a, Cse, 1);
+}
+
+/*
+*  Hash consing
+*/
+
+// what makes two nodes the same value, ids start at 1
+typedef struct {
+    u32  tag;
+    u32  block;
+    u32  left;   // child ids, an IDENT's slot and version go here too
+    u32  right;
+    u64  bits;   // a literal's payload
+    AST* node;   // the first node with this id, strings compare by content
+} Key;
+
+typedef struct {
+    Cse*       c;
+    Arena*     a;
+    IrSymbols* names;
+    u32*       version;  // per slot, bumped on every assignment
+    u32        version_cap;
+    u32        versions;
+    u32        block;
+
+    Key*       keys;     // by id
+    u32*       counts;
+    String*    temps;    // the _cse name an id got, empty until it has one
+    u32        id_count;
+    u32        id_cap;
+
+    u32*       table;    // open addressing over ids, 0 is empty
+    u32        table_cap;
+
+    // node to id, open addressing again
+    AST**      nodes;
+    u32*       ids;
+    u32        node_count;
+    u32        node_cap;
+
+    AstList*   out;
+} Numbering;
+
+static u64 mix(u64 h, u64 v) {
+    h ^= v + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+    return h;
+}
+
+static u64 key_hash(Key* k) {
+    u64 h = mix(k->tag, k->block);
+    h = mix(h, k->left);
+    h = mix(h, k->right);
+    h = mix(h, k->bits);
+
+    // a double's bits all sit at the top, the table only looks at the bottom
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    return h ^ (h >> 33);
+}
+
+static bool key_eq(Key* l, Key* r) {
+    if (l->tag != r->tag || l->block != r->block || l->left != r->left ||
+        l->right != r->right || l->bits != r->bits) {
+        return false;
+    }
+    return l->tag != AST_STR || string_eq(l->node->data.AST_STR.str, r->node->data.AST_STR.str);
+}
+
+static void table_grow(Numbering* n) {
+    u32 cap = n->table_cap ? n->table_cap * 2 : CSE_TABLE_INIT;
+    n->table = AllocArrayZero(n->a, u32, cap);
+    n->table_cap = cap;
+
+    for (u32 id = 1; id <= n->id_count; ++id) {
+        u32 i = key_hash(&n->keys[id]) & (cap - 1);
+        while (n->table[i]) i = (i + 1) & (cap - 1);
+        n->table[i] = id;
+    }
+}
+
+static u32 intern(Numbering* n, Key k) {
+    if ((n->id_count + 1) * 2 >= n->table_cap) table_grow(n);
+
+    u32 i = key_hash(&k) & (n->table_cap - 1);
+    while (n->table[i]) {
+        if (key_eq(&n->keys[n->table[i]], &k)) return n->table[i];
+        i = (i + 1) & (n->table_cap - 1);
+    }
+
+    if (n->id_count + 1 >= n->id_cap) {
+        u32 cap = n->id_cap ? n->id_cap * 2 : CSE_TABLE_INIT;
+        n->keys = arena_realloc(n->a, n->keys, sizeof(Key) * n->id_cap, sizeof(Key) * cap);
+        n->counts = arena_realloc(n->a, n->counts, sizeof(u32) * n->id_cap, sizeof(u32) * cap);
+        n->temps = arena_realloc(n->a, n->temps, sizeof(String) * n->id_cap, sizeof(String) * cap);
+        n->id_cap = cap;
+    }
+
+    u32 id = ++n->id_count;
+    n->keys[id] = k;
+    n->counts[id] = 0;
+    n->temps[id] = (String){0};
+    n->table[i] = id;
+    return id;
+}
+
+static u32 node_slot(Numbering* n, AST* node) {
+    u32 i = (u32)(((uintptr_t)node >> 3) * 0x9e3779b1u) & (n->node_cap - 1);
+    while (n->nodes[i] && n->nodes[i] != node) i = (i + 1) & (n->node_cap - 1);
+    return i;
+}
+
+static void node_set(Numbering* n, AST* node, u32 id) {
+    if ((n->node_count + 1) * 2 >= n->node_cap) {
+        AST** nodes = n->nodes;
+        u32* ids = n->ids;
+        u32 old = n->node_cap;
+
+        n->node_cap = old ? old * 2 : CSE_TABLE_INIT;
+        n->nodes = AllocArrayZero(n->a, AST*, n->node_cap);
+        n->ids = AllocArray(n->a, u32, n->node_cap);
+        for (u32 i = 0; i < old; ++i) {
+            if (!nodes[i]) continue;
+            u32 at = node_slot(n, nodes[i]);
+            n->nodes[at] = nodes[i];
+            n->ids[at] = ids[i];
+        }
+    }
+
+    u32 i = node_slot(n, node);
+    if (!n->nodes[i]) n->node_count++;
+    n->nodes[i] = node;
+    n->ids[i] = id;
+}
+
+static u32 node_id(Numbering* n, AST* node) {
+    return n->ids[node_slot(n, node)];
+}
+
+static u32 slot_of(Numbering* n, String name) {
+    u32 slot = ir_symbol(n->names, name);
+    if (slot < n->version_cap) return slot;
+
+    u32 cap = n->version_cap;
+    while (cap <= slot) cap = cap ? cap * 2 : CSE_TABLE_INIT;
+    n->version = arena_realloc(n->a, n->version, sizeof(u32) * n->version_cap, sizeof(u32) * cap);
+    memset(n->version + n->version_cap, 0, sizeof(u32) * (cap - n->version_cap));
+    n->version_cap = cap;
+    return slot;
+}
+
+static void assign(Numbering* n, String name) {
+    u32 slot = slot_of(n, name);
+    n->version[slot] = ++n->versions;
+}
+
+// Worth a temp: nothing but a pure computation, with a name somewhere in
+// it, the rest sccp folded already
+static bool shareable(AST* ast) {
+    switch (ast->tag) {
+        case AST_EQ: case AST_NEQ: case AST_GT: case AST_GTE: case AST_LT: case AST_LTE:
+        case AST_NOT: case AST_AND: case AST_OR:
+        case AST_ADD: case AST_SUB: case AST_MUL: case AST_DIV: case AST_NEGATE:
+        case AST_INDEX: case AST_LEN: break;
+        default: return false;
+    }
+
+    for (u32 i = 0; i < ast_child_count(ast); ++i) {
+        if (!ast_is_literal(*ast_child(ast, i))) return true;
+    }
+    return false;
+}
+
+// bottom up, every node gets an id
+static u32 number(Numbering* n, AST* ast) {
+    Key k = { ast->tag, n->block, 0, 0, 0, ast };
+
+    switch (ast->tag) {
+        case AST_NUMBER: {
+            f64 val = ast->data.AST_NUMBER.val;
+            memcpy(&k.bits, &val, sizeof(val));
+            k.left = ast->data.AST_NUMBER.is_int;
+            break;
+        }
+        case AST_STR:  k.bits = string_hash(ast->data.AST_STR.str); break;
+        case AST_BOOL: k.left = ast->data.AST_BOOL.val; break;
+        case AST_NIL:  break;
+        case AST_IDENT: {
+            k.left = slot_of(n, ast->data.AST_IDENT.ident);
+            k.right = n->version[k.left];
+            break;
+        }
+        default: {
+            u32 count = ast_child_count(ast);
+            for (u32 i = 0; i < count; ++i) {
+                u32 id = number(n, *ast_child(ast, i));
+                if (i == 0) k.left = id;
+                if (i == 1) k.right = id;
+            }
+
+            // arrays are a new one every time, nothing matches them
+            if (!shareable(ast)) k.bits = (u64)(uintptr_t)ast;
+            break;
+        }
+    }
+
+    u32 id = intern(n, k);
+    node_set(n, ast, id);
+    return id;
+}
+
+// Top down. A tree that repeated already is going to be replaced whole,
+// what's under it doesn't count again.
+static void count(Numbering* n, AST* ast) {
+    u32 id = node_id(n, ast);
+    if (n->counts[id]++ && shareable(ast)) return;
+
+    for (u32 i = 0; i < ast_child_count(ast); ++i) {
+        count(n, *ast_child(ast, i));
+    }
+}
+
+static void rewrite(Numbering* n, AST* ast) {
+    u32 id = node_id(n, ast);
+    bool shared = shareable(ast) && n->counts[id] > 1;
+
+    if (shared && n->temps[id].len) {
+        *ast = (AST){ AST_IDENT, { .AST_IDENT = { n->temps[id] } } };
+        n->c->shared++;
+        return;
+    }
+
+    // the temp's own expression gets its repeats out first
+    for (u32 i = 0; i < ast_child_count(ast); ++i) {
+        rewrite(n, *ast_child(ast, i));
+    }
+    if (!shared) return;
+
+    String name = string_format(n->a, "_cse%u", n->c->temps++);
+    ast_list_push(n->a, n->out, AST_NEW(n->a, AST_LET, ast_new(n->a, *ast), name));
+    n->temps[id] = name;
+    *ast = (AST){ AST_IDENT, { .AST_IDENT = { name } } };
+}
+
+/*
+*  Blocks
+*/
+
+typedef enum { Pass_Number, Pass_Count, Pass_Rewrite } Pass;
+
+static void visit(Numbering* n, AST* ast, Pass pass) {
+    switch (pass) {
+        case Pass_Number:  number(n, ast); break;
+        case Pass_Count:   count(n, ast); break;
+        case Pass_Rewrite: rewrite(n, ast); break;
+    }
+}
+
+// the expressions a statement runs once, then what it assigns
+static void visit_stmt(Numbering* n, AST* stmt, Pass pass) {
+    switch (stmt->tag) {
+        case AST_LET: {
+            visit(n, stmt->data.AST_LET.expr, pass);
+            if (pass == Pass_Number) assign(n, stmt->data.AST_LET.ident);
+            break;
+        }
+        // all four share the { ident, expr } layout
+        case AST_ADDEQ: case AST_SUBEQ: case AST_MULEQ: case AST_DIVEQ: {
+            visit(n, stmt->data.AST_ADDEQ.expr, pass);
+            if (pass == Pass_Number) assign(n, stmt->data.AST_ADDEQ.ident);
+            break;
+        }
+        // a vasm block's names in the order it gets to them
+        case AST_VASM: {
+            struct AST_VASM* data = &stmt->data.AST_VASM;
+            for (u32 i = 0; i < data->var_count; ++i) {
+                if (!data->written[i]) {
+                    visit(n, data->vars[i], pass);
+                } else if (pass == Pass_Number) {
+                    assign(n, data->vars[i]->data.AST_IDENT.ident);
+                }
+            }
+            break;
+        }
+        case AST_PRINT: visit(n, stmt->data.AST_PRINT.expr, pass); break;
+        case AST_IF:    visit(n, stmt->data.AST_IF.expr, pass); break;
+        case AST_FOR: {
+            visit(n, stmt->data.AST_FOR.start, pass);
+            visit(n, stmt->data.AST_FOR.end, pass);
+            break;
+        }
+        case AST_WHILE: case AST_FUNC: break;
+        default: visit(n, stmt, pass); break;
+    }
+}
+
+static bool ends_block(AST* stmt) {
+    switch (stmt->tag) {
+        case AST_IF: case AST_WHILE: case AST_FOR: return true;
+        default: return false;
+    }
+}
+
+static void cse_body(Numbering* n, AST*** stmts, u32* count);
+
+static void cse_nested(Numbering* n, AST* stmt) {
+    switch (stmt->tag) {
+        case AST_IF: {
+            struct AST_IF* data = &stmt->data.AST_IF;
+            cse_body(n, &data->body, &data->stmt_count);
+            cse_body(n, &data->else_body, &data->else_count);
+            break;
+        }
+        case AST_WHILE: {
+            struct AST_WHILE* data = &stmt->data.AST_WHILE;
+            cse_body(n, &data->body, &data->stmt_count);
+            break;
+        }
+        case AST_FOR: {
+            struct AST_FOR* data = &stmt->data.AST_FOR;
+            cse_body(n, &data->body, &data->stmt_count);
+            break;
+        }
+        default: break;
+    }
+}
+
+static void cse_body(Numbering* n, AST*** stmts, u32* count) {
+    AstList out = {0};
+
+    u32 start = 0;
+    while (start < *count) {
+        u32 end = start;
+        while (end + 1 < *count && !ends_block((*stmts)[end])) end++;
+
+        n->block++;
+        for (u32 i = start; i <= end; ++i) visit_stmt(n, (*stmts)[i], Pass_Number);
+        for (u32 i = start; i <= end; ++i) visit_stmt(n, (*stmts)[i], Pass_Count);
+
+        AstList* outer = n->out;
+        n->out = &out;
+        for (u32 i = start; i <= end; ++i) {
+            visit_stmt(n, (*stmts)[i], Pass_Rewrite);
+            ast_list_push(n->a, &out, (*stmts)[i]);
+        }
+        n->out = outer;
+
+        // a block's ids are done with, a nested body starts its own
+        cse_nested(n, (*stmts)[end]);
+        start = end + 1;
+    }
+
+    *stmts = out.stmts;
+    *count = out.count;
+}
+
+void cse_stmts(Cse* c, Arena* a, AST*** stmts, u32* count) {
+    Numbering n = {0};
+    n.c = c;
+    n.a = a;
+    n.names = ir_symbols_new(a);
+    cse_body(&n, stmts, count);
+}
+
+void cse_program(Cse* c, Arena* a, AST* program) {
+    struct AST_PROGRAM* data = &program->data.AST_PROGRAM;
+    cse_stmts(c, a, &data->body, &data->stmt_count);
+    data->stmt_cap = data->stmt_count;
+}
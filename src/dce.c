@@ -0,0 +1,369 @@
+#include "include/dce.h"
+#include "include/arena.h"
+#include "include/ast.h"
+#include "include/ir.h"
+#include "include/string.h"
+#include <string.h>
+
+Dce* dce_new(Arena* a, bool stream) {
+    Dce* d = AllocArrayZero(a, Dce, 1);
+    d->stream = stream;
+    return d;
+}
+
+/*
+*  Live sets
+*/
+
+// one bit per name that shows up anywhere in the statements
+typedef struct {
+    Dce*       d;
+    Arena*     a;
+    IrSymbols* names;
+    u32        words;
+} Liveness;
+
+static u64* live_new(Liveness* lv) {
+    return AllocArrayZero(lv->a, u64, lv->words ? lv->words : 1);
+}
+
+static u64* live_copy(Liveness* lv, u64* set) {
+    u64* copy = live_new(lv);
+    memcpy(copy, set, sizeof(u64) * lv->words);
+    return copy;
+}
+
+static void live_or(Liveness* lv, u64* dst, u64* src) {
+    for (u32 i = 0; i < lv->words; ++i) dst[i] |= src[i];
+}
+
+static bool live_has(Liveness* lv, u64* set, String name) {
+    i32 slot = ir_symbol_find(lv->names, name);
+    return slot >= 0 && (set[slot / 64] >> (slot % 64)) & 1;
+}
+
+static void live_set(Liveness* lv, u64* set, String name, bool live) {
+    u32 slot = ir_symbol(lv->names, name);
+    if (live) {
+        set[slot / 64] |= 1ull << (slot % 64);
+    } else {
+        set[slot / 64] &= ~(1ull << (slot % 64));
+    }
+}
+
+// every name read: identifiers and the x in x += y
+typedef struct {
+    AstVisitor v;
+    Liveness*  lv;
+    u64*       set;    // NULL only collects the names
+} NameVisitor;
+
+static bool name_pre(AstVisitor* v, AST* ast) {
+    NameVisitor* nv = (NameVisitor*)v;
+
+    String name;
+    switch (ast->tag) {
+        case AST_IDENT: name = ast->data.AST_IDENT.ident; break;
+        // all four share the { ident, expr } layout
+        case AST_ADDEQ: case AST_SUBEQ: case AST_MULEQ: case AST_DIVEQ: {
+            name = ast->data.AST_ADDEQ.ident;
+            break;
+        }
+        case AST_LET: {
+            if (!nv->set) ir_symbol(nv->lv->names, ast->data.AST_LET.ident);
+            return true;
+        }
+        case AST_FOR: {
+            if (!nv->set) {
+                ir_symbol(nv->lv->names, ast->data.AST_FOR.ident);
+                ir_symbol(nv->lv->names, ast->data.AST_FOR.end_var);
+            }
+            return true;
+        }
+        default: return true;
+    }
+
+    if (nv->set) {
+        live_set(nv->lv, nv->set, name, true);
+    } else {
+        ir_symbol(nv->lv->names, name);
+    }
+    return true;
+}
+
+static void live_reads(Liveness* lv, u64* set, AST* ast) {
+    NameVisitor nv = {{name_pre, 0, 0}, lv, set};
+    ast_walk(lv->a, ast, &nv.v);
+}
+
+/*
+*  What can go
+*/
+
+typedef struct {
+    AstVisitor v;
+    u64 count;
+} SizeVisitor;
+
+static bool size_pre(AstVisitor* v, AST* ast) {
+    (void)ast;
+    ((SizeVisitor*)v)->count++;
+    return true;
+}
+
+static void drop(Liveness* lv, AST* ast) {
+    SizeVisitor sv = {{size_pre, 0, 0}, 0};
+    ast_walk(lv->a, ast, &sv.v);
+    lv->d->removed += sv.count;
+}
+
+static void drop_list(Liveness* lv, AST** stmts, u32 count) {
+    for (u32 i = 0; i < count; ++i) drop(lv, stmts[i]);
+}
+
+// Can't fail whatever the names hold. Arithmetic, ordering, len and
+// indexing all fail on the wrong types, unless it's all literals.
+static bool pure(AST* ast) {
+    switch (ast->tag) {
+        case AST_NUMBER: case AST_STR: case AST_BOOL: case AST_NIL: case AST_IDENT: return true;
+        case AST_NOT: return pure(ast->data.AST_NOT.expr);
+        case AST_NEGATE: return ast->data.AST_NEGATE.expr->tag == AST_NUMBER;
+        case AST_LEN: {
+            AST* expr = ast->data.AST_LEN.expr;
+            return (expr->tag == AST_STR || expr->tag == AST_ARRAY) && pure(expr);
+        }
+        // every binary node shares the { left, right } layout
+        case AST_EQ: case AST_NEQ: case AST_AND: case AST_OR: {
+            return pure(ast->data.AST_ADD.left) && pure(ast->data.AST_ADD.right);
+        }
+        case AST_ADD: case AST_SUB: case AST_MUL: case AST_DIV:
+        case AST_GT: case AST_GTE: case AST_LT: case AST_LTE: {
+            return ast->data.AST_ADD.left->tag == AST_NUMBER && ast->data.AST_ADD.right->tag == AST_NUMBER;
+        }
+        case AST_ARRAY: {
+            for (u32 i = 0; i < ast->data.AST_ARRAY.count; ++i) {
+                if (!pure(ast->data.AST_ARRAY.items[i])) return false;
+            }
+            return true;
+        }
+        default: return false;
+    }
+}
+
+// 1 or 0 for a literal condition, -1 when it takes running
+static i32 truth(AST* ast) {
+    switch (ast->tag) {
+        case AST_BOOL:   return ast->data.AST_BOOL.val;
+        case AST_NIL:    return 0;
+        case AST_NUMBER: return ast->data.AST_NUMBER.val != 0;
+        case AST_STR: case AST_ARRAY: return 1;
+        default: return -1;
+    }
+}
+
+static bool is_expr(AST* ast) {
+    switch (ast->tag) {
+        case AST_LET: case AST_PRINT: case AST_IF: case AST_FOR: case AST_WHILE:
+        case AST_ADDEQ: case AST_SUBEQ: case AST_MULEQ: case AST_DIVEQ:
+        case AST_FUNC: case AST_RETURN: case AST_BLOCK: case AST_PROGRAM: return false;
+        default: return true;
+    }
+}
+
+// A branch that gets taken for sure can stand in for its if, unless it
+// binds names, which would outlive the branch then
+static bool binds(AST** stmts, u32 count) {
+    for (u32 i = 0; i < count; ++i) {
+        if (stmts[i]->tag == AST_LET) return true;
+    }
+    return false;
+}
+
+// A let in a branch only reassigns the name when it's bound before the
+// if, otherwise the name is gone after it. So the let before the if has
+// to stay whenever the name is read after it.
+static void keep_bound(Liveness* lv, u64* live, u64* out, AST** stmts, u32 count) {
+    for (u32 i = 0; i < count; ++i) {
+        if (stmts[i]->tag != AST_LET) continue;
+
+        String name = stmts[i]->data.AST_LET.ident;
+        if (live_has(lv, out, name)) live_set(lv, live, name, true);
+    }
+}
+
+/*
+*  Elimination
+*/
+
+static u64* dce_body(Liveness* lv, AST*** body, u32* count, u64* out);
+
+// a loop reads everything it reads on every way around
+static u64* loop_head(Liveness* lv, AST* loop, u64* out) {
+    u64* head = live_copy(lv, out);
+    live_reads(lv, head, loop);
+    return head;
+}
+
+// Backwards from what's live after the statement to what's live before
+// it. Whatever stands in for stmt goes onto rev, reversed.
+static void dce_stmt(Liveness* lv, AST* stmt, u64* live, AstList* rev) {
+    Arena* a = lv->a;
+
+    switch (stmt->tag) {
+        case AST_LET: {
+            struct AST_LET* data = &stmt->data.AST_LET;
+            if (!live_has(lv, live, data->ident) && pure(data->expr)) {
+                drop(lv, stmt);
+                return;
+            }
+            live_set(lv, live, data->ident, false);
+            live_reads(lv, live, data->expr);
+            break;
+        }
+        case AST_IF: {
+            struct AST_IF* data = &stmt->data.AST_IF;
+            i32 taken = truth(data->expr);
+            u64* out = live_copy(lv, live);
+
+            if (taken >= 0) {
+                AST*** branch = taken ? &data->body : &data->else_body;
+                u32* branch_count = taken ? &data->stmt_count : &data->else_count;
+                drop_list(lv, taken ? data->else_body : data->body, taken ? data->else_count : data->stmt_count);
+
+                u64* in = dce_body(lv, branch, branch_count, live);
+                memcpy(live, in, sizeof(u64) * lv->words);
+
+                if (!binds(*branch, *branch_count)) {
+                    for (u32 i = *branch_count; i-- > 0;) ast_list_push(a, rev, (*branch)[i]);
+                    lv->d->removed += 2;
+                    return;
+                }
+
+                data->expr = AST_NEW(a, AST_BOOL, true);
+                data->body = *branch;
+                data->stmt_count = *branch_count;
+                data->else_body = 0;
+                data->else_count = 0;
+                keep_bound(lv, live, out, data->body, data->stmt_count);
+                break;
+            }
+
+            u64* in = dce_body(lv, &data->body, &data->stmt_count, live);
+            u64* in_else = dce_body(lv, &data->else_body, &data->else_count, live);
+            if (!data->stmt_count && !data->else_count && pure(data->expr)) {
+                drop(lv, stmt);
+                return;
+            }
+
+            memcpy(live, in, sizeof(u64) * lv->words);
+            live_or(lv, live, in_else);
+            live_reads(lv, live, data->expr);
+            keep_bound(lv, live, out, data->body, data->stmt_count);
+            keep_bound(lv, live, out, data->else_body, data->else_count);
+            break;
+        }
+        case AST_WHILE: {
+            struct AST_WHILE* data = &stmt->data.AST_WHILE;
+            if (truth(data->expr) == 0) {
+                drop(lv, stmt);
+                return;
+            }
+
+            u64* head = loop_head(lv, stmt, live);
+            dce_body(lv, &data->body, &data->stmt_count, head);
+            memcpy(live, head, sizeof(u64) * lv->words);
+            break;
+        }
+        case AST_FOR: {
+            struct AST_FOR* data = &stmt->data.AST_FOR;
+            bool pure_bounds = pure(data->start) && pure(data->end);
+            bool empty_range = data->start->tag == AST_NUMBER && data->end->tag == AST_NUMBER &&
+                               data->start->data.AST_NUMBER.val >= data->end->data.AST_NUMBER.val;
+            bool used_after = live_has(lv, live, data->ident);
+
+            if (pure_bounds && !used_after && empty_range) {
+                drop(lv, stmt);
+                return;
+            }
+
+            u64* head = loop_head(lv, stmt, live);
+            dce_body(lv, &data->body, &data->stmt_count, head);
+            if (pure_bounds && !used_after && !data->stmt_count) {
+                drop(lv, stmt);
+                return;
+            }
+
+            // the loop sets its variable before reading it, but when it's
+            // read after the loop it has to have been bound before
+            if (!used_after) live_set(lv, head, data->ident, false);
+            live_set(lv, head, data->end_var, false);
+            live_reads(lv, head, data->start);
+            live_reads(lv, head, data->end);
+            memcpy(live, head, sizeof(u64) * lv->words);
+            break;
+        }
+        default: {
+            if (is_expr(stmt) && pure(stmt)) {
+                drop(lv, stmt);
+                return;
+            }
+            live_reads(lv, live, stmt);
+            break;
+        }
+    }
+
+    ast_list_push(a, rev, stmt);
+}
+
+// rewrites body and hands back what's live before it
+static u64* dce_body(Liveness* lv, AST*** body, u32* count, u64* out) {
+    // nothing after a while true ever runs
+    for (u32 i = 0; i < *count; ++i) {
+        AST* stmt = (*body)[i];
+        if (stmt->tag == AST_WHILE && truth(stmt->data.AST_WHILE.expr) == 1) {
+            drop_list(lv, *body + i + 1, *count - i - 1);
+            *count = i + 1;
+            break;
+        }
+    }
+
+    u64* live = live_copy(lv, out);
+    AstList rev = {0};
+    for (u32 i = *count; i-- > 0;) {
+        dce_stmt(lv, (*body)[i], live, &rev);
+    }
+
+    for (u32 i = 0; i < rev.count / 2; ++i) {
+        AST* tmp = rev.stmts[i];
+        rev.stmts[i] = rev.stmts[rev.count - 1 - i];
+        rev.stmts[rev.count - 1 - i] = tmp;
+    }
+    *body = rev.stmts;
+    *count = rev.count;
+    return live;
+}
+
+void dce_stmts(Dce* d, Arena* a, AST*** stmts, u32* count) {
+    Liveness lv = { d, a, ir_symbols_new(a), 0 };
+
+    NameVisitor nv = {{name_pre, 0, 0}, &lv, 0};
+    for (u32 i = 0; i < *count; ++i) {
+        ast_walk(a, (*stmts)[i], &nv.v);
+    }
+    lv.words = (lv.names->count + 63) / 64;
+
+    // names made up by the passes start with '_', nothing from the source
+    // does
+    u64* out = live_new(&lv);
+    for (u32 slot = 0; d->stream && slot < lv.names->count; ++slot) {
+        if (lv.names->names[slot].data[0] != '_') out[slot / 64] |= 1ull << (slot % 64);
+    }
+
+    dce_body(&lv, stmts, count, out);
+}
+
+void dce_program(Dce* d, Arena* a, AST* program) {
+    struct AST_PROGRAM* data = &program->data.AST_PROGRAM;
+    dce_stmts(d, a, &data->body, &data->stmt_count);
+    data->stmt_cap = data->stmt_count;
+}
@@ -0,0 +1,462 @@
+#include "include/gas.h"
+#include "include/arena.h"
+#include "include/err.h"
+#include "include/ir.h"
+#include "include/stats.h"
+#include "include/value.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+// same split as the .mv emitter, emitf is one instruction
+#define emitf(g, ...) \
+    (STATS_ADD(instructions, 1), STATS_ADD(out_bytes, fprintf((g)->out, __VA_ARGS__)))
+#define emitl(g, ...) STATS_ADD(out_bytes, fprintf((g)->out, __VA_ARGS__))
+
+// The value stack is a static array since its depth at every instruction
+// is known here, S(d) being entry d. rbx holds VALUE_QNAN for the Num
+// checks and rsp stays 16 byte aligned so the runtime can be called
+// from anywhere.
+#define S "bz_stack+%u(%%rip)"
+
+Gas* gas_new(Arena* a, IrSymbols* syms, FILE* out) {
+    Gas* gas = AllocArrayZero(a, Gas, 1);
+    gas->arena = a;
+    gas->out = out;
+    gas->syms = syms;
+
+    emitl(gas, "\t.text\n");
+    emitl(gas, "\t.globl\tmain\n");
+    emitl(gas, "\t.type\tmain, @function\n");
+    emitl(gas, "main:\n");
+    emitf(gas, "\tpushq\t%%rbp\n");
+    emitf(gas, "\tmovq\t%%rsp, %%rbp\n");
+    emitf(gas, "\tpushq\t%%rbx\n");
+    emitf(gas, "\tsubq\t$8, %%rsp\n");
+    emitf(gas, "\tmovabsq\t$0x%llx, %%rbx\n", (unsigned long long)VALUE_QNAN);
+    return gas;
+}
+
+static void gas_ensure_defined(Gas* gas) {
+    u32 count = gas->syms->count;
+    if (count <= gas->defined_cap) return;
+
+    u32 cap = gas->defined_cap ? gas->defined_cap : 64;
+    while (cap < count) cap *= 2;
+
+    bool* defined = AllocArrayZero(gas->arena, bool, cap);
+    if (gas->defined) memcpy(defined, gas->defined, gas->defined_cap);
+    gas->defined = defined;
+    gas->defined_cap = cap;
+}
+
+static const char* var(Gas* gas, u32 slot) {
+    return gas->syms->names[slot].data;
+}
+
+static void use(Gas* gas, u32 slot) {
+    if (!gas->defined[slot]) {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "Undefined variable '%s'", var(gas, slot));
+        err(msg, 0, 0);
+    }
+}
+
+static void load_imm(Gas* gas, const char* reg, Value v) {
+    emitf(gas, "\tmovabsq\t$0x%llx, %%%s\n", (unsigned long long)v, reg);
+}
+
+static void load_arg(Gas* gas, const char* reg, IrArg arg) {
+    if (arg.imm) {
+        load_imm(gas, reg, value_num(arg.num));
+    } else {
+        use(gas, arg.slot);
+        emitf(gas, "\tmovq\tbz_v_%s(%%rip), %%%s\n", var(gas, arg.slot), reg);
+    }
+}
+
+// jumps to 1f unless rax and rcx are both Num
+static void check_nums(Gas* gas) {
+    emitf(gas, "\tmovq\t%%rax, %%rdx\n");
+    emitf(gas, "\tandq\t%%rbx, %%rdx\n");
+    emitf(gas, "\tcmpq\t%%rbx, %%rdx\n");
+    emitf(gas, "\tje\t1f\n");
+    emitf(gas, "\tmovq\t%%rcx, %%rdx\n");
+    emitf(gas, "\tandq\t%%rbx, %%rdx\n");
+    emitf(gas, "\tcmpq\t%%rbx, %%rdx\n");
+    emitf(gas, "\tje\t1f\n");
+}
+
+static const char* sse_op(IrFn fn) {
+    switch (fn) {
+        case IrFn_Add:  return "addsd";
+        case IrFn_Sub:  return "subsd";
+        case IrFn_Mult: return "mulsd";
+        case IrFn_Div:  return "divsd";
+        default:        return 0;
+    }
+}
+
+static char op_char(IrFn fn) {
+    switch (fn) {
+        case IrFn_Add:  return '+';
+        case IrFn_Sub:  return '-';
+        case IrFn_Mult: return '*';
+        default:        return '/';
+    }
+}
+
+// rax <fn> rcx into rax, the runtime handles strings and type errors.
+// Unchecked when the compiler already knows both are integers.
+static void arith(Gas* gas, IrFn fn, bool checked) {
+    if (checked) check_nums(gas);
+    emitf(gas, "\tmovq\t%%rax, %%xmm0\n");
+    emitf(gas, "\tmovq\t%%rcx, %%xmm1\n");
+    emitf(gas, "\t%s\t%%xmm1, %%xmm0\n", sse_op(fn));
+    emitf(gas, "\tmovq\t%%xmm0, %%rax\n");
+    if (!checked) return;
+
+    emitf(gas, "\tjmp\t2f\n");
+    emitl(gas, "1:\n");
+    emitf(gas, "\tmovq\t%%rcx, %%rdx\n");
+    emitf(gas, "\tmovq\t%%rax, %%rsi\n");
+    emitf(gas, "\tmovl\t$%d, %%edi\n", op_char(fn));
+    emitf(gas, "\tcall\tbz_arith\n");
+    emitl(gas, "2:\n");
+}
+
+// rax <fn> rcx into rax as a boxed bool
+static void compare(Gas* gas, IrFn fn) {
+    switch (fn) {
+        case IrFn_Eq:
+        case IrFn_Neq: {
+            emitf(gas, "\tmovq\t%%rcx, %%rsi\n");
+            emitf(gas, "\tmovq\t%%rax, %%rdi\n");
+            emitf(gas, "\tcall\tbz_eq\n");
+            if (fn == IrFn_Neq) emitf(gas, "\txorq\t$1, %%rax\n");
+            break;
+        }
+        case IrFn_And:
+        case IrFn_Or: {
+            emitf(gas, "\tmovq\t%%rcx, %%rdx\n");
+            emitf(gas, "\tmovq\t%%rax, %%rsi\n");
+            emitf(gas, "\tmovl\t$%d, %%edi\n", fn == IrFn_And ? '&' : '|');
+            emitf(gas, "\tcall\tbz_logic\n");
+            return;
+        }
+        default: {
+            static const char* names[IrFnCount] = {
+                [IrFn_Gt] = "gt", [IrFn_Gte] = "gte", [IrFn_Lt] = "lt", [IrFn_Lte] = "lte",
+            };
+            check_nums(gas);
+            // unordered sets CF, so NaNs come out false for all four
+            bool flip = fn == IrFn_Lt || fn == IrFn_Lte;
+            emitf(gas, "\tmovq\t%%rax, %%xmm0\n");
+            emitf(gas, "\tmovq\t%%rcx, %%xmm1\n");
+            emitf(gas, "\tucomisd\t%s, %s\n", flip ? "%xmm0" : "%xmm1", flip ? "%xmm1" : "%xmm0");
+            emitf(gas, "\t%s\t%%al\n", fn == IrFn_Gt || fn == IrFn_Lt ? "seta" : "setae");
+            emitf(gas, "\tmovzbl\t%%al, %%eax\n");
+            emitf(gas, "\tjmp\t2f\n");
+            emitl(gas, "1:\n");
+            emitf(gas, "\tmovq\t%%rcx, %%rdx\n");
+            emitf(gas, "\tmovq\t%%rax, %%rsi\n");
+            emitf(gas, "\tleaq\t.Lop_%s(%%rip), %%rdi\n", names[fn]);
+            emitf(gas, "\tcall\tbz_type_error\n");
+            emitl(gas, "2:\n");
+            break;
+        }
+    }
+
+    // 0/1 into a boxed bool
+    emitf(gas, "\tmovabsq\t$0x%llx, %%rcx\n", (unsigned long long)VALUE_FALSE);
+    emitf(gas, "\taddq\t%%rcx, %%rax\n");
+}
+
+// jumps to .Lblk<block> if rax is falsy: nil, false, 0 or -0. NaN sets
+// PF and is truthy.
+static void jump_falsy(Gas* gas, u32 block) {
+    emitf(gas, "\tmovabsq\t$0x%llx, %%rcx\n", (unsigned long long)VALUE_FALSE);
+    emitf(gas, "\tcmpq\t%%rcx, %%rax\n");
+    emitf(gas, "\tje\t.Lblk%u\n", block);
+    emitf(gas, "\tmovabsq\t$0x%llx, %%rcx\n", (unsigned long long)VALUE_NIL);
+    emitf(gas, "\tcmpq\t%%rcx, %%rax\n");
+    emitf(gas, "\tje\t.Lblk%u\n", block);
+    emitf(gas, "\tmovq\t%%rax, %%rdx\n");
+    emitf(gas, "\tandq\t%%rbx, %%rdx\n");
+    emitf(gas, "\tcmpq\t%%rbx, %%rdx\n");
+    emitf(gas, "\tje\t1f\n");
+    emitf(gas, "\tmovq\t%%rax, %%xmm0\n");
+    emitf(gas, "\txorpd\t%%xmm1, %%xmm1\n");
+    emitf(gas, "\tucomisd\t%%xmm1, %%xmm0\n");
+    emitf(gas, "\tjp\t1f\n");
+    emitf(gas, "\tje\t.Lblk%u\n", block);
+    emitl(gas, "1:\n");
+}
+
+// string literals keep the runtime's { data, len } layout, escapes are
+// resolved here the way value_str_lit does it
+static void string_lit(Gas* gas, String lexeme, u32 id) {
+    emitl(gas, "\t.section\t.rodata\n");
+    emitl(gas, ".Lstr_data_%u:\n\t.ascii\t\"", id);
+
+    u64 len = 0;
+    for (u64 i = 0; i < lexeme.len; ++i) {
+        unsigned char c = lexeme.data[i];
+        if (c == '\\' && i + 1 < lexeme.len) {
+            switch (lexeme.data[i+1]) {
+                case 'n': c = '\n'; i++; break;
+                case 't': c = '\t'; i++; break;
+                case 'r': c = '\r'; i++; break;
+                case 'b': c = '\b'; i++; break;
+                default: break;
+            }
+        }
+
+        if (c == '"' || c == '\\' || c < 0x20 || c >= 0x7f) {
+            emitl(gas, "\\%03o", c);
+        } else {
+            emitl(gas, "%c", c);
+        }
+        len++;
+    }
+    emitl(gas, "\\0\"\n");
+
+    emitl(gas, "\t.data\n");
+    emitl(gas, "\t.balign\t8\n");
+    emitl(gas, ".Lstr_%u:\n", id);
+    emitl(gas, "\t.quad\t.Lstr_data_%u, %llu\n", id, (unsigned long long)len);
+    emitl(gas, "\t.text\n");
+}
+
+void gas_emit(Gas* gas, IrProgram* ir) {
+    gas_ensure_defined(gas);
+
+    // what's defined at each jmpf, which is what's defined at its target,
+    // same as the VM
+    u32 lo = UINT32_MAX, hi = 0;
+    for (u32 i = 0; i < ir->count; ++i) {
+        if (ir->code[i].op != Ir_Target) continue;
+        if (ir->code[i].as.label < lo) lo = ir->code[i].as.label;
+        if (ir->code[i].as.label > hi) hi = ir->code[i].as.label;
+    }
+    u64 start = gas->arena->pos_u64;
+    bool** exits = AllocArrayZero(gas->arena, bool*, lo <= hi ? hi - lo + 1 : 0);
+    u32* open = AllocArray(gas->arena, u32, lo <= hi ? hi - lo + 1 : 0);
+    u32 open_count = 0;
+
+    u32 d = 0;
+    for (u32 i = 0; i < ir->count; ++i) {
+        IrInst* inst = &ir->code[i];
+
+        switch (inst->op) {
+            case Ir_Push:
+            case Ir_Int:
+            case Ir_Bool:
+            case Ir_Nil: {
+                Value v = inst->op == Ir_Push ? value_num(inst->as.num) :
+                          inst->op == Ir_Int  ? value_num((f64)inst->as.i) :
+                          inst->op == Ir_Bool ? value_bool(inst->as.val) : VALUE_NIL;
+                load_imm(gas, "rax", v);
+                emitf(gas, "\tmovq\t%%rax, " S "\n", d++ * 8);
+                break;
+            }
+            case Ir_Str: {
+                u32 id = gas->strings++;
+                string_lit(gas, inst->as.str, id);
+                emitf(gas, "\tleaq\t.Lstr_%u(%%rip), %%rax\n", id);
+                emitf(gas, "\tmovabsq\t$0x%llx, %%rcx\n", (unsigned long long)(VALUE_SIGN | VALUE_QNAN));
+                emitf(gas, "\torq\t%%rcx, %%rax\n");
+                emitf(gas, "\tmovq\t%%rax, " S "\n", d++ * 8);
+                break;
+            }
+            case Ir_Load: {
+                use(gas, inst->as.slot);
+                emitf(gas, "\tmovq\tbz_v_%s(%%rip), %%rax\n", var(gas, inst->as.slot));
+                emitf(gas, "\tmovq\t%%rax, " S "\n", d++ * 8);
+                break;
+            }
+            case Ir_Pop: {
+                gas->defined[inst->as.slot] = true;
+                emitf(gas, "\tmovq\t" S ", %%rax\n", --d * 8);
+                emitf(gas, "\tmovq\t%%rax, bz_v_%s(%%rip)\n", var(gas, inst->as.slot));
+                break;
+            }
+            case Ir_Del: {
+                gas->defined[inst->as.slot] = false;
+                load_imm(gas, "rax", VALUE_NIL);
+                emitf(gas, "\tmovq\t%%rax, bz_v_%s(%%rip)\n", var(gas, inst->as.slot));
+                break;
+            }
+            case Ir_Swap: {
+                emitf(gas, "\tmovq\t" S ", %%rax\n", (d-1) * 8);
+                emitf(gas, "\tmovq\t" S ", %%rcx\n", (d-2) * 8);
+                emitf(gas, "\tmovq\t%%rax, " S "\n", (d-2) * 8);
+                emitf(gas, "\tmovq\t%%rcx, " S "\n", (d-1) * 8);
+                break;
+            }
+            case Ir_Add:
+            case Ir_Sub:
+            case Ir_Mult:
+            case Ir_Div:
+            case Ir_IAdd:
+            case Ir_ISub:
+            case Ir_IMult: {
+                static const IrFn fns[IrOpCount] = {
+                    [Ir_Add] = IrFn_Add, [Ir_Sub] = IrFn_Sub,
+                    [Ir_Mult] = IrFn_Mult, [Ir_Div] = IrFn_Div,
+                    [Ir_IAdd] = IrFn_Add, [Ir_ISub] = IrFn_Sub, [Ir_IMult] = IrFn_Mult,
+                };
+                // sub and div are top OP below, same as the VM
+                bool top_first = inst->op == Ir_Sub || inst->op == Ir_ISub || inst->op == Ir_Div;
+                bool checked = inst->op != Ir_IAdd && inst->op != Ir_ISub && inst->op != Ir_IMult;
+                emitf(gas, "\tmovq\t" S ", %%rax\n", (top_first ? d-1 : d-2) * 8);
+                emitf(gas, "\tmovq\t" S ", %%rcx\n", (top_first ? d-2 : d-1) * 8);
+                arith(gas, fns[inst->op], checked);
+                emitf(gas, "\tmovq\t%%rax, " S "\n", (d-2) * 8);
+                d--;
+                break;
+            }
+            case Ir_Array: {
+                // the items are already laid out on the stack, the runtime
+                // copies them out
+                d -= inst->as.count;
+                emitf(gas, "\tleaq\t" S ", %%rsi\n", d * 8);
+                emitf(gas, "\tmovl\t$%u, %%edi\n", inst->as.count);
+                emitf(gas, "\tcall\tbz_array\n");
+                emitf(gas, "\tmovq\t%%rax, " S "\n", d++ * 8);
+                break;
+            }
+            case Ir_Index: {
+                emitf(gas, "\tmovq\t" S ", %%rdi\n", (d-2) * 8);
+                emitf(gas, "\tmovq\t" S ", %%rsi\n", (d-1) * 8);
+                emitf(gas, "\tcall\tbz_index\n");
+                emitf(gas, "\tmovq\t%%rax, " S "\n", (d-2) * 8);
+                d--;
+                break;
+            }
+            case Ir_IndexU: {
+                // in bounds already, only the type is left to check
+                emitf(gas, "\tmovq\t" S ", %%rax\n", (d-2) * 8);
+                emitf(gas, "\tmovq\t" S ", %%rcx\n", (d-1) * 8);
+                emitf(gas, "\tmovabsq\t$0x%llx, %%rsi\n", (unsigned long long)(VALUE_SIGN | VALUE_QNAN | VALUE_ARR));
+                emitf(gas, "\tmovq\t%%rax, %%rdx\n");
+                emitf(gas, "\tandq\t%%rsi, %%rdx\n");
+                emitf(gas, "\tcmpq\t%%rsi, %%rdx\n");
+                emitf(gas, "\tjne\t1f\n");
+                emitf(gas, "\tmovabsq\t$0x%llx, %%rdx\n", (unsigned long long)VALUE_PTR);
+                emitf(gas, "\tandq\t%%rdx, %%rax\n");
+                emitf(gas, "\tmovq\t%%rcx, %%xmm0\n");
+                emitf(gas, "\tcvttsd2si\t%%xmm0, %%rcx\n");
+                emitf(gas, "\tmovq\t8(%%rax,%%rcx,8), %%rax\n");
+                emitf(gas, "\tjmp\t2f\n");
+                emitl(gas, "1:\n");
+                emitf(gas, "\tmovq\t%%rcx, %%rsi\n");
+                emitf(gas, "\tmovq\t%%rax, %%rdi\n");
+                emitf(gas, "\tcall\tbz_index\n");
+                emitl(gas, "2:\n");
+                emitf(gas, "\tmovq\t%%rax, " S "\n", (d-2) * 8);
+                d--;
+                break;
+            }
+            case Ir_Len: {
+                emitf(gas, "\tmovq\t" S ", %%rdi\n", (d-1) * 8);
+                emitf(gas, "\tcall\tbz_len\n");
+                emitf(gas, "\tmovq\t%%rax, " S "\n", (d-1) * 8);
+                break;
+            }
+            case Ir_Print: {
+                use(gas, inst->as.slot);
+                emitf(gas, "\tmovq\tbz_v_%s(%%rip), %%rdi\n", var(gas, inst->as.slot));
+                emitf(gas, "\tcall\tbz_print\n");
+                break;
+            }
+            case Ir_Call: {
+                IrFn fn = inst->as.call.fn;
+                load_arg(gas, "rax", inst->as.call.args[0]);
+                if (inst->as.call.argc > 1) {
+                    load_arg(gas, "rcx", inst->as.call.args[1]);
+                }
+
+                switch (fn) {
+                    case IrFn_Add: case IrFn_Sub: case IrFn_Mult: case IrFn_Div: {
+                        arith(gas, fn, true);
+                        break;
+                    }
+                    case IrFn_Not: {
+                        emitf(gas, "\tmovq\t%%rax, %%rdi\n");
+                        emitf(gas, "\tcall\tbz_not\n");
+                        break;
+                    }
+                    case IrFn_PrintStr: {
+                        emitf(gas, "\tmovq\t%%rax, %%rdi\n");
+                        emitf(gas, "\tcall\tbz_print\n");
+                        continue;
+                    }
+                    default: compare(gas, fn); break;
+                }
+
+                if (inst->as.call.dst != IR_NO_DST) {
+                    gas->defined[inst->as.call.dst] = true;
+                    emitf(gas, "\tmovq\t%%rax, bz_v_%s(%%rip)\n", var(gas, inst->as.call.dst));
+                } else {
+                    emitf(gas, "\tmovq\t%%rax, " S "\n", d++ * 8);
+                }
+                break;
+            }
+            case Ir_Label: emitl(gas, ".Laddr_%u:\n", inst->as.label); break;
+            case Ir_Target: {
+                if (open_count && open[open_count-1] == inst->as.label - lo) open_count--;
+                bool* defined = exits[inst->as.label - lo];
+                if (defined) memcpy(gas->defined, defined, gas->defined_cap);
+                emitl(gas, ".Lblk%u:\n", inst->as.label);
+                break;
+            }
+            case Ir_Jmp: {
+                bool** defined = &exits[inst->as.label - lo];
+                if (!*defined && open_count) *defined = exits[open[open_count-1]];
+                emitf(gas, "\tjmp\t.Lblk%u\n", inst->as.label);
+                break;
+            }
+            case Ir_JmpF: {
+                bool** defined = &exits[inst->as.label - lo];
+                *defined = AllocArray(gas->arena, bool, gas->defined_cap);
+                memcpy(*defined, gas->defined, gas->defined_cap);
+                open[open_count++] = inst->as.label - lo;
+
+                emitf(gas, "\tmovq\t" S ", %%rax\n", --d * 8);
+                jump_falsy(gas, inst->as.label);
+                break;
+            }
+            case Ir_Stop:  emitf(gas, "\tjmp\t.Lexit\n"); break;
+            default: assert(0 && "Unreachable");
+        }
+
+        if (d > gas->max_depth) gas->max_depth = d;
+    }
+
+    arena_set_pos_back(gas->arena, start);
+}
+
+void gas_finish(Gas* gas) {
+    emitl(gas, ".Lexit:\n");
+    emitf(gas, "\txorl\t%%eax, %%eax\n");
+    emitf(gas, "\taddq\t$8, %%rsp\n");
+    emitf(gas, "\tpopq\t%%rbx\n");
+    emitf(gas, "\tpopq\t%%rbp\n");
+    emitf(gas, "\tret\n");
+    emitl(gas, "\t.size\tmain, .-main\n");
+
+    emitl(gas, "\n\t.section\t.rodata\n");
+    emitl(gas, ".Lop_gt:\n\t.string\t\">\"\n");
+    emitl(gas, ".Lop_gte:\n\t.string\t\">=\"\n");
+    emitl(gas, ".Lop_lt:\n\t.string\t\"<\"\n");
+    emitl(gas, ".Lop_lte:\n\t.string\t\"<=\"\n");
+
+    emitl(gas, "\n\t.bss\n");
+    emitl(gas, "\t.balign\t8\n");
+    for (u32 slot = 0; slot < gas->syms->count; ++slot) {
+        emitl(gas, "bz_v_%s:\n\t.zero\t8\n", var(gas, slot));
+    }
+    emitl(gas, "bz_stack:\n\t.zero\t%u\n", (gas->max_depth ? gas->max_depth : 1) * 8);
+    emitl(gas, "\n\t.section\t.note.GNU-stack,\"\",@progbits\n");
+}
@@ -17,7 +17,7 @@ u64 hash(String key) {
 }
 
 HashMap* hashmap_new(Arena* arena) {
-    HashMap* map = arena_alloc(arena, sizeof(HashMap));
+    HashMap* map = arena_alloc_zero(arena, sizeof(HashMap));
     map->len = HASH_MAP_LEN;
     return map;
 }
@@ -27,5 +27,10 @@ VarType hashmap_get(HashMap* map, String key) {
 }
 
 void hashmap_insert(HashMap* map, String key, VarType val) {
-    map->data[hash(key)] = val;
+    u64 index = hash(key);
+    if (!map->used[index]) {
+        map->used[index] = true;
+        map->count++;
+    }
+    map->data[index] = val;
 }
@@ -2,25 +2,90 @@
 #define __ARENA_H_
 
 #include "defines.h"
+#include <stdio.h>
 
 #ifndef ARENA_DEFAULT_SIZE
 #define ARENA_DEFAULT_SIZE (1 * 1024 * 1024)
 #endif
 
+// bytes of arena reserved up front per byte of source; tokens and AST nodes
+// are several times bigger than the text they come from. Only a first guess,
+// the arena grows past it
+#ifndef ARENA_SRC_FACTOR
+#define ARENA_SRC_FACTOR 64
+#endif
+
+// each new chunk doubles the last one up to this
+#ifndef ARENA_CHUNK_MAX
+#define ARENA_CHUNK_MAX (64 * 1024 * 1024)
+#endif
+
+// what arena_pos_of says about memory the arena doesn't hold
+#define ARENA_NO_POS ((u64)-1)
+
+// Which part of the compiler asked for the memory. Allocations are charged
+// to the arena's current tag unless they pass one explicitly.
+typedef enum {
+    ArenaTag_None,
+    ArenaTag_Lexer,
+    ArenaTag_Parser,
+    ArenaTag_AST,
+    ArenaTag_Strings,
+    ArenaTag_Emitter,
+    ArenaTagCount,
+} ArenaTag;
+
+typedef struct {
+    u64 allocs;
+    u64 requested;
+    u64 high_water;
+
+    u64 tag_allocs[ArenaTagCount];
+    u64 tag_bytes[ArenaTagCount];
+} ArenaTelemetry;
+
+typedef struct ArenaChunk ArenaChunk;
+
+// The arena is a chain of chunks. pos_u64 counts across all of them, so a
+// position saved before a new chunk was started can still be rewound to.
 typedef struct {
+    // the chunk being allocated from
     void* mem;
     u64   mem_len;
 
     void* pos;
     u64   pos_u64;
     u64   last_pos_u64;
+
+    ArenaChunk* chunk;
+    // chunks a rewind gave back, kept around for the next time it grows
+    ArenaChunk* spare;
+    u64         reserved;
+
+    ArenaTag tag;
+    // only recorded once arena_enable_telemetry is called, and never when
+    // built with BLAZE_NO_STATS
+    ArenaTelemetry* telemetry;
 } Arena;
 
 Arena* arena_new();
+Arena* arena_new_sized(u64 size);
 void   arena_free(Arena* a);
 
 void* arena_alloc(Arena* a, u64 size);
 void* arena_alloc_zero(Arena* a, u64 size);
+void* arena_alloc_tagged(Arena* a, u64 size, ArenaTag tag);
+
+// returns the previous tag so callers can put it back
+ArenaTag arena_set_tag(Arena* a, ArenaTag tag);
+const char* arena_tag_str(ArenaTag tag);
+
+void arena_enable_telemetry(Arena* a);
+void arena_report(Arena* a, FILE* f, bool json);
+
+// grows the allocation at ptr in place when it is the last one made,
+// otherwise copies it to a fresh block
+void* arena_realloc(Arena* a, void* ptr, u64 old_size, u64 new_size);
 
 // some macro helpers that I've found nice:
 #define AllocArray(arena, type, count) (type*)arena_alloc((arena), sizeof(type)*(count))
@@ -34,6 +99,9 @@ void arena_dealloc_last(Arena* a);
 void arena_resize(Arena* a);
 
 void arena_set_pos_back(Arena* a, u64 pos);
+
+// where ptr sits in the arena, or ARENA_NO_POS when it isn't below pos
+u64 arena_pos_of(Arena* a, const void* ptr);
 void arena_clear(Arena* a);
 
 void arena_dump_mem(Arena* a);
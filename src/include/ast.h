@@ -7,11 +7,36 @@
 
 #include "arena.h"
 #include "defines.h"
+#include "lexer.h"
 #include "string.h"
 #include <stdio.h>
 
 typedef struct AST AST;
 
+// One operand of a vasm instruction: a number, one of the block's own
+// scratch names or a {name} from the program, which is vars[var]
+typedef struct {
+    enum { VasmArg_Num, VasmArg_Name, VasmArg_Var } kind;
+    f64    num;
+    i64    i;
+    bool   is_int;
+    String name;
+    u32    var;
+} VasmArg;
+
+// One line of a vasm block, op is an IrOp and fn an IrFn. push, pop, del
+// and print keep their operand in args[0], call its arguments.
+typedef struct {
+    u32     op;
+    u32     fn;
+    u32     argc;
+    VasmArg args[2];
+    bool    has_dst;
+    VasmArg dst;
+    u32     count;   // arr <n>
+    String  str;     // str "<lit>"
+} VasmInst;
+
 struct AST {
     enum {
         AST_PROGRAM,
@@ -47,11 +72,24 @@ struct AST {
         AST_PRINT,
 
         AST_IF,
+        AST_RANGE,
+        AST_FOR,
+        AST_WHILE,
+
+        AST_ARRAY,
+        AST_INDEX,
+        AST_LEN,
+
+        AST_FUNC,
+        AST_CALL,
+        AST_RETURN,
+
+        AST_VASM,
     } tag;
 
     union {
         struct AST_PROGRAM 
-        { AST* body[15]; u32 stmt_count;} AST_PROGRAM;
+        { AST** body; u32 stmt_count; u32 stmt_cap; } AST_PROGRAM;
 
         struct AST_BLOCK
         { AST** stmts; usize stmt_count; } AST_BLOCK;
@@ -59,8 +97,9 @@ struct AST {
         struct AST_NIL
         {void* p; } AST_NIL;
 
+        // val is always set, i as well when the literal is an integer
         struct AST_NUMBER 
-        { f32 val; } AST_NUMBER;
+        { f64 val; i64 i; bool is_int; } AST_NUMBER;
 
         struct AST_STR 
         { String str; } AST_STR;
@@ -131,13 +170,108 @@ struct AST {
         struct AST_PRINT
         { AST* expr; } AST_PRINT;
 
+        // if expr { body } else { else_body }, an elif is an if alone in
+        // the else
         struct AST_IF
-        {AST* expr; AST* body[15]; usize stmt_count; } AST_IF;
+        { AST* expr; AST** body; u32 stmt_count; AST** else_body; u32 else_count; } AST_IF;
+
+        // a..b, only lives until the parser folds it into a for loop or an
+        // index
+        struct AST_RANGE
+        { AST* left; AST* right; } AST_RANGE;
+
+        // for ident : start..end { body }, counts up by one while ident < end.
+        // end is evaluated once into the hidden variable end_var.
+        struct AST_FOR
+        { String ident; String end_var; AST* start; AST* end; AST** body; u32 stmt_count; } AST_FOR;
+
+        struct AST_WHILE
+        { AST* expr; AST** body; u32 stmt_count; } AST_WHILE;
+
+        struct AST_ARRAY
+        { AST** items; u32 count; } AST_ARRAY;
+
+        // left[right], unchecked once the parser proved it's in bounds
+        struct AST_INDEX
+        { AST* left; AST* right; bool unchecked; } AST_INDEX;
+
+        struct AST_LEN
+        { AST* expr; } AST_LEN;
+
+        // func name params { body }, only ever seen by the inliner
+        struct AST_FUNC
+        { String name; String* params; u32 param_count; AST** body; u32 stmt_count; } AST_FUNC;
+
+        // name a, b or name(a, b)
+        struct AST_CALL
+        { String name; AST** args; u32 argc; Token token; } AST_CALL;
+
+        struct AST_RETURN
+        { AST* expr; } AST_RETURN;
+
+        // vasm "line", ... parsed into VM instructions up front. vars has
+        // a node per {name} in the order the code gets to them, written
+        // says which of them get assigned instead of read.
+        struct AST_VASM
+        { VasmInst* code; u32 count; AST** vars; bool* written; u32 var_count; } AST_VASM;
     } data;
 };
 
-AST* ast_new(Arena* a, AST ast);
-void ast_print(AST* ast, HashMap* map);
-void ast_emit(AST* ast, HashMap* map, FILE* f);
+#define AST_TAG_COUNT (AST_VASM + 1)
+
+AST*   ast_new(Arena* a, AST ast);
+String ast_tag_str(u32 tag);
+
+// deep copy into a, names included so the copy outlives the source
+AST*   ast_clone(Arena* a, AST* ast);
+
+// whether the statement binds or assigns name: let, for, x op= y and a
+// vasm block writing {name}
+bool   ast_assigns_to(AST* ast, String name);
+
+// for, while, if and func end on their own '}'
+bool   ast_ends_with_block(AST* ast);
+
+// number, string, bool or nil
+bool   ast_is_literal(AST* ast);
+
+// Turns ast into a literal when its operands are literals already and the
+// VM would get the same thing out of them. Whatever could fail at run time
+// stays the way it is.
+void   ast_fold_node(AST* ast);
+
+// same bottom up over a whole tree
+void   ast_fold(Arena* a, AST* ast);
+
+// a statement list the passes build up as they rewrite bodies
+typedef struct {
+    AST** stmts;
+    u32   count;
+    u32   cap;
+} AstList;
+
+void   ast_list_push(Arena* a, AstList* list, AST* stmt);
+
+// Children in evaluation order. ast_child hands back the slot so passes
+// can swap a child out in place.
+u32    ast_child_count(AST* ast);
+AST**  ast_child(AST* ast, u32 i);
+
+// Non-recursive traversal over an explicit stack kept in the arena.
+// pre runs when a node is reached and returns false to skip its children
+// (post is skipped too), mid runs after each child returns, post runs
+// after the last child. Any callback may be NULL. Embed the visitor as the
+// first member of a bigger struct to carry state around.
+typedef struct AstVisitor AstVisitor;
+struct AstVisitor {
+    bool (*pre)(AstVisitor* v, AST* ast);
+    void (*mid)(AstVisitor* v, AST* ast, u32 child);
+    void (*post)(AstVisitor* v, AST* ast);
+};
+
+void   ast_walk(Arena* a, AST* root, AstVisitor* v);
+
+void   ast_count(Arena* a, AST* ast, u64* counts);
+void   ast_print(Arena* a, AST* ast, HashMap* map);
 
 #endif  //__AST_H
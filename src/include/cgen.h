@@ -0,0 +1,81 @@
+#ifndef __CGEN_H
+#define __CGEN_H
+
+#include "arena.h"
+#include "ast.h"
+#include "defines.h"
+#include "hashmap.h"
+#include "ir.h"
+#include "string.h"
+#include <stdio.h>
+
+// Transpiles the AST to C99 for ahead of time builds with the system
+// compiler:
+//
+//   blazeit prog.bz --c
+//   gcc -O2 prog.c -o prog
+//
+// Every expression gets a static type, Num is a double and Str a length
+// prefixed struct, and every let becomes a fresh local suffixed with how
+// many times the name has been bound, so rebinding to another type is
+// fine. Type errors the VM would hit at run time are compile errors here.
+//
+// Loops and ifs are the exception: inside one a name from outside keeps
+// its local and its type, and names the body brings in are scoped to it.
+
+// what the per statement type pass worked out for one node
+typedef struct {
+    AST*    node;
+    VarType type;
+    u32     local;  // for lets, loops, identifiers and compound assignments
+    bool    decl;   // lets and loops: local is new here and needs a type
+} CgenNode;
+
+// a local declared ahead of the statement, see cgen_hoist
+typedef struct {
+    u32     slot;
+    u32     local;
+    VarType type;
+} CgenHoist;
+
+typedef struct {
+    Arena*     arena;   // has to outlive every cgen_stmt call
+    FILE*      out;
+
+    // name -> slot, and per slot the type and count of its bindings and
+    // the loop depth it was first bound at
+    IrSymbols* syms;
+    VarType*   types;
+    u32*       lets;
+    u32*       scopes;
+    u32        cap;
+
+    // loops and ifs the walk is in, and the slots first bound inside one
+    // of them
+    u32        blocks;
+    u32*       scoped;
+    u32        scoped_count;
+    u32        scoped_cap;
+
+    CgenHoist* hoisted;
+    u32        hoisted_count;
+    u32        hoisted_cap;
+
+    // open addressing on the node pointer, only entries stamped with the
+    // current statement count
+    CgenNode*  nodes;
+    u32*       stamps;
+    u32        node_cap;
+    u32        node_count;
+    u32        stamp;
+} Cgen;
+
+// writes the prelude and opens main
+Cgen* cgen_new(Arena* a, FILE* out);
+
+// one top level statement, scratch only holds the walker's stack
+void  cgen_stmt(Cgen* cg, Arena* scratch, AST* stmt);
+
+void  cgen_finish(Cgen* cg);
+
+#endif  //__CGEN_H
@@ -0,0 +1,45 @@
+#ifndef __CSE_H
+#define __CSE_H
+
+#include "arena.h"
+#include "ast.h"
+#include "defines.h"
+
+// Common subexpression elimination on the AST, last of the passes.
+//
+//   let d = (x + y) * (x + y); print d + x * y; print x * y;
+//
+// becomes
+//
+//   let _cse0 = x + y; let d = _cse0 * _cse0;
+//   let _cse1 = x * y; print d + _cse1; print _cse1;
+//
+// A run of statements up to the next if, while or for is a basic block.
+// Inside one, every expression gets hash-consed into a DAG: a node is
+// keyed on its tag and the ids of its children, a name on which
+// assignment of it is current, so two nodes with the same id always
+// compute the same value. A non-leaf id that shows up more than once is
+// computed once into a _cse temp, right before the statement that first
+// needs it, and every use reads the temp. Only the biggest repeated trees
+// are taken, what's inside one is only shared when it repeats on its own.
+//
+// Expressions don't have side effects after inlining, so the only thing
+// that moves is when a failing one fails, and it always fails in the same
+// statement it would have. A while condition runs every time around, so
+// it's left alone.
+
+typedef struct {
+    u32 temps;   // _cse names handed out so far
+    u64 shared;  // repeated nodes replaced by a temp so far
+} Cse;
+
+Cse* cse_new(Arena* a);
+
+// Rewrites a list of statements in place, count of them, nested bodies
+// included. New nodes go into a.
+void cse_stmts(Cse* c, Arena* a, AST*** stmts, u32* count);
+
+// Same over a whole AST_PROGRAM
+void cse_program(Cse* c, Arena* a, AST* program);
+
+#endif  //__CSE_H
@@ -0,0 +1,37 @@
+#ifndef __DCE_H
+#define __DCE_H
+
+#include "arena.h"
+#include "ast.h"
+#include "defines.h"
+
+// Dead code elimination on the AST once calls are inlined. Liveness runs
+// backwards over each body, and what nothing can observe goes:
+//
+//   - a let whose name isn't read again and whose value can't fail
+//   - an if on a literal condition turns into the branch it takes, and an
+//     if whose branches end up empty goes when its condition can't fail
+//   - while false, and a for over an empty literal range
+//   - a bare expression that can't fail
+//   - everything after a while true, nothing gets out of one
+//
+// Inside a loop every name the loop reads counts as live all the way
+// through, which saves iterating to a fixpoint. When streaming, later
+// statements can still read any name from the source, so only the hidden
+// ones the inliner and loops make up can die at the top level.
+
+typedef struct {
+    bool stream;
+    u64  removed;   // nodes eliminated so far
+} Dce;
+
+Dce* dce_new(Arena* a, bool stream);
+
+// Rewrites a list of statements in place, count of them. New nodes go
+// into a.
+void dce_stmts(Dce* d, Arena* a, AST*** stmts, u32* count);
+
+// Same over a whole AST_PROGRAM
+void dce_program(Dce* d, Arena* a, AST* program);
+
+#endif  //__DCE_H
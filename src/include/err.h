@@ -3,6 +3,6 @@
 
 #include "defines.h"
 
-void err(const char* msg, i32 line, i32 col);
+__attribute__((noreturn)) void err(const char* msg, i32 line, i32 col);
 
 #endif  //__ERR_H
@@ -0,0 +1,41 @@
+#ifndef __GAS_H
+#define __GAS_H
+
+#include "arena.h"
+#include "defines.h"
+#include "ir.h"
+#include <stdio.h>
+
+// Second backend next to the .mv text: lowers the IR to GNU assembler for
+// x86-64 Linux. The output defines main and leans on runtime/blaze_rt.c for
+// printing, strings and the type errors, so
+//
+//   blazeit prog.bz --asm
+//   cc prog.s runtime/blaze_rt.c -o prog
+//
+// gives a native binary. Values are NaN-boxed exactly like value.h, Num
+// arithmetic is inlined and anything else calls into the runtime.
+
+typedef struct {
+    Arena*     arena;   // has to outlive every gas_emit call
+    FILE*      out;
+    IrSymbols* syms;
+
+    // same compile time undefined variable check as the VM
+    bool*      defined;
+    u32        defined_cap;
+
+    u32        strings;
+    u32        max_depth;
+} Gas;
+
+// writes the prologue of main
+Gas* gas_new(Arena* a, IrSymbols* syms, FILE* out);
+
+// can be called once per statement when streaming
+void gas_emit(Gas* gas, IrProgram* ir);
+
+// epilogue, variables and the value stack
+void gas_finish(Gas* gas);
+
+#endif  //__GAS_H
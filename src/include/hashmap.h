@@ -9,6 +9,9 @@ typedef enum {
     TypeStr,
     TypeNum,
     TypeBool, 
+    TypeArrNum,
+    TypeArrStr,
+    TypeArrBool,
 } VarType;
 
 
@@ -16,7 +19,9 @@ typedef enum {
 
 typedef struct hashmap_t {
     VarType data[HASH_MAP_LEN];
+    bool    used[HASH_MAP_LEN];
     u64 len;
+    u64 count;
 } HashMap;
 
 u64      hash(String key);
@@ -0,0 +1,90 @@
+#ifndef __INLINE_H
+#define __INLINE_H
+
+#include "arena.h"
+#include "ast.h"
+#include "defines.h"
+#include "ir.h"
+#include "string.h"
+
+// Functions only exist at compile time: none of the backends have call
+// frames, so every call is replaced by the body of the function it calls.
+//
+//   func add a b { return a + b; }
+//   print add 42, 27;
+//
+// becomes print 69. The arguments are bound to fresh names first, and so
+// are the body's own lets and loop variables, so nothing in the body can
+// clash with the caller. An argument that is a literal or a name neither
+// side touches is substituted straight into the body instead, then the
+// result is constant folded.
+//
+// A return can only come last, in the function or in an if that comes
+// last, so every way through a function ends on one. An if that returns
+// on one side gets the rest of the function moved into its other side. A call a return
+// makes right away is a tail call, and functions that only ever call back
+// into themselves through tail calls, directly or round a cycle, are
+// expanded as a loop:
+//
+//   func fact n acc { if n <= 1 { return acc; } return fact(n - 1, acc * n); }
+//
+// binds n and acc once and then reassigns them and goes around again for
+// every tail call, so it runs in constant space however deep it recurses.
+// A cycle of functions shares one loop that switches between their bodies.
+//
+// Recursion through any other call, and functions that grow past
+// INLINE_BUDGET nodes once their own calls are inlined, can't be expanded
+// and are compile errors.
+
+// AST nodes a function may grow to with its own calls inlined
+#define INLINE_BUDGET 512
+
+typedef struct {
+    String name;
+    bool   tail;
+    Token  token;   // where the call is, for errors
+} InlineCall;
+
+typedef struct {
+    AST*   func;        // a copy in the inliner's arena
+    InlineCall* calls;  // every call in the body, repeats included
+    u32    call_count;
+    u32    call_cap;
+
+    // Functions in a cycle of calls share a group and its size, the nodes
+    // of all of them with the calls out of the group inlined. Set once the
+    // call graph walk gets to them, group 0 is not visited yet.
+    u32    group;
+    u32    size;
+    bool   loops;       // a cycle that only goes around through tail calls
+    bool   recursive;   // one that goes around through some other call
+
+    // Tarjan's walk
+    u32    index;
+    u32    low;
+    bool   on_stack;
+} InlineFunc;
+
+typedef struct {
+    Arena*      arena;  // function copies, has to outlive every statement
+    IrSymbols*  names;  // function name -> index into funcs
+    InlineFunc* funcs;
+    u32         cap;
+
+    u32         sites;  // calls expanded so far, names the fresh locals
+    u32         groups;
+    u32         visits;
+    u32         conds;  // while conditions with calls in them
+} Inliner;
+
+Inliner* inliner_new(Arena* a);
+
+// One top level statement. Function declarations are taken in and leave
+// nothing behind, anything else comes back as the statements to run in
+// its place, count of them. New nodes go into a.
+AST**    inliner_stmt(Inliner* in, Arena* a, AST* stmt, u32* count);
+
+// Same over a whole AST_PROGRAM, in place
+void     inliner_program(Inliner* in, Arena* a, AST* program);
+
+#endif  //__INLINE_H
@@ -0,0 +1,43 @@
+#ifndef __INTERP_H
+#define __INTERP_H
+
+#include "arena.h"
+#include "ast.h"
+#include "defines.h"
+#include "string.h"
+#include "value.h"
+#include <stdio.h>
+
+// In-process tree walking interpreter behind -r. It owns its own arena for
+// globals and runtime strings, so the compiler's arena can be rewound
+// underneath it while streaming.
+
+typedef struct {
+    String name;
+    Value  val;
+} Global;
+
+typedef struct {
+    Arena* arena;
+    FILE*  out;
+
+    // open addressing, cap is always a power of two
+    Global* globals;
+    u32     global_count;
+    u32     global_cap;
+
+    Value*  stack;
+    usize   sp;
+    usize   stack_cap;
+} Interp;
+
+Interp* interp_new(FILE* out);
+void    interp_free(Interp* in);
+
+// Runs a whole AST_PROGRAM or a single top level statement. scratch is
+// only used for the walker's stack.
+void    interp_run(Interp* in, Arena* scratch, AST* ast);
+
+Value*  interp_global(Interp* in, String name, bool create);
+
+#endif  //__INTERP_H
@@ -0,0 +1,143 @@
+#ifndef __IR_H
+#define __IR_H
+
+#include "arena.h"
+#include "ast.h"
+#include "defines.h"
+#include "hashmap.h"
+#include "string.h"
+#include <stdio.h>
+
+// The compiler's instruction encoding. One IrInst is one line of .mv
+// assembly, so the text emitter just prints them and the VM can run the
+// exact same program. Variables are numbered slots into IrSymbols.
+
+typedef enum {
+    Ir_Push,    // push <num>
+    Ir_Int,     // push <int>
+    Ir_Bool,    // push 0|1
+    Ir_Nil,     // push 0
+    Ir_Str,     // str "<lit>"
+    Ir_Load,    // push <var>
+    Ir_Pop,     // pop <var>
+    Ir_Del,     // del <var>
+    Ir_Swap,
+    Ir_Add,
+    Ir_Sub,     // top - below, hence the swap in front of it
+    Ir_Mult,
+    Ir_Div,     // top / below
+    Ir_IAdd,    // same as the above when both sides are known integers
+    Ir_ISub,
+    Ir_IMult,
+    Ir_Array,   // arr <n>, pops n values into a new array, first one deepest
+    Ir_Index,   // index, top is the index and below it the array
+    Ir_IndexU,  // uindex, same without the bounds check
+    Ir_Len,     // len
+    Ir_Print,   // print <var>
+    Ir_Call,    // call <fn> <args> [| <var>]
+    Ir_Label,   // addr_<n>:
+    Ir_Target,  // blk_<n>:, somewhere to jump to inside a statement
+    Ir_Jmp,     // jmp blk_<n>
+    Ir_JmpF,    // jmpf blk_<n>, pops and jumps if it was falsy
+    Ir_Stop,
+    IrOpCount,
+} IrOp;
+
+// stdlib.mv functions the compiler calls into
+typedef enum {
+    IrFn_Eq,
+    IrFn_Neq,
+    IrFn_Gt,
+    IrFn_Gte,
+    IrFn_Lt,
+    IrFn_Lte,
+    IrFn_And,
+    IrFn_Or,
+    IrFn_Not,
+    IrFn_Add,
+    IrFn_Sub,
+    IrFn_Mult,
+    IrFn_Div,
+    IrFn_PrintStr,
+    IrFnCount,
+} IrFn;
+
+#define IR_MAX_ARGS 2
+#define IR_NO_DST   (-1)
+
+typedef struct {
+    bool imm;
+    bool is_int;    // an imm that was written without a point
+    u32  slot;
+    f64  num;
+    i64  i;
+} IrArg;
+
+typedef struct {
+    IrOp op;
+    union {
+        f64    num;     // Ir_Push
+        i64    i;       // Ir_Int
+        bool   val;     // Ir_Bool
+        String str;     // Ir_Str
+        u32    slot;    // Ir_Load, Ir_Pop, Ir_Del, Ir_Print
+        u32    label;   // Ir_Label, Ir_Target, Ir_Jmp, Ir_JmpF
+        u32    count;   // Ir_Array
+        struct {
+            IrFn  fn;
+            u32   argc;
+            i32   dst;  // IR_NO_DST pushes the result instead
+            IrArg args[IR_MAX_ARGS];
+        } call;
+    } as;
+} IrInst;
+
+// Variable names to slots. Everything lives in the arena it was made with,
+// so when streaming give it one that doesn't get rewound.
+typedef struct {
+    Arena*  arena;
+    String* names;
+    bool*   ints;   // lowering only: the variable holds an integer right now
+    u32     count;
+    u32     cap;
+
+    // open addressing over slot+1, 0 is empty
+    u32*    table;
+    u32     table_cap;
+} IrSymbols;
+
+typedef struct {
+    IrInst*    code;
+    u32        count;
+    u32        cap;
+    IrSymbols* syms;
+    u32        blocks;  // jump targets handed out so far, kept when streaming
+} IrProgram;
+
+// the compiler's scratch registers. The program's own names start with a
+// letter, so like _end and _vasm_ these never land on one of its variables.
+#define IR_TMP_A   "_a"
+#define IR_TMP_B   "_b"
+#define IR_TMP     "_tmp"
+#define IR_TMP_VAR "_tmpv"
+
+IrSymbols* ir_symbols_new(Arena* a);
+u32        ir_symbol(IrSymbols* syms, String name);
+i32        ir_symbol_find(IrSymbols* syms, String name);  // -1 if it has no slot
+
+const char* ir_fn_str(IrFn fn);
+
+void ir_push(Arena* a, IrProgram* ir, IrInst inst);
+
+// Lowers a whole AST_PROGRAM, or one top level statement at index when
+// streaming. Code is appended to ir and allocated in a.
+void ir_lower(Arena* a, IrProgram* ir, AST* program, HashMap* map);
+void ir_lower_begin(Arena* a, IrProgram* ir);
+void ir_lower_stmt(Arena* a, IrProgram* ir, AST* stmt, HashMap* map, u32 index);
+void ir_lower_end(Arena* a, IrProgram* ir);
+
+// .mv text
+void ir_emit_header(FILE* f);
+void ir_emit(IrProgram* ir, FILE* f);
+
+#endif  //__IR_H
@@ -0,0 +1,52 @@
+#ifndef __JIT_H
+#define __JIT_H
+
+#include "arena.h"
+#include "defines.h"
+#include "ir.h"
+#include "value.h"
+
+// x86-64 tier for the VM. Runs of whole statements that only do Num
+// arithmetic, comparisons and stores are compiled to SSE2 code working
+// straight on the VM's slots. Every slot the region reads before writing
+// is checked up front; if one isn't a Num the region returns false and
+// the VM runs its own code for it instead.
+//
+// The VM only asks for regions that have run often enough to pay for
+// themselves, and asks for all of them at once. Code lives in one mmap'd
+// area, reserved the first time something gets compiled, whose pages are
+// only ever writable or executable, never both.
+
+typedef bool (*JitFn)(Value* slots);
+
+typedef struct {
+    IrInst* code;
+    u32     count;  // IR instructions, 0 once it turned out not to fit
+    JitFn   fn;
+} JitRegion;
+
+typedef struct {
+    Arena* arena;
+
+    u8*   mem;
+    usize cap;
+    usize used;
+
+    // per slot state while scanning a region, reset after each one
+    u8*   state;
+    u32   state_cap;
+} Jit;
+
+// NULL when the platform can't do it, callers just don't JIT then
+Jit* jit_new(Arena* a);
+void jit_free(Jit* jit);
+
+// How long a region starting at code[0] would be: the longest run that
+// ends on a statement boundary. 0 when it's too short to bother.
+u32  jit_scan(Jit* jit, Arena* scratch, IrSymbols* syms, IrInst* code, u32 count);
+
+// Compiles regions jit_scan measured. The whole batch is written with a
+// single switch of its pages to writable and back.
+void jit_compile(Jit* jit, Arena* scratch, IrSymbols* syms, JitRegion** regions, u32 count);
+
+#endif  //__JIT_H
@@ -0,0 +1,38 @@
+#ifndef __LICM_H
+#define __LICM_H
+
+#include "arena.h"
+#include "ast.h"
+#include "defines.h"
+
+// Loop invariant code motion, on the AST once calls are inlined so every
+// backend gets it.
+//
+//   for i : 0..n { total += x * scale; }
+//
+// becomes
+//
+//   if 0 < n { let _licm0 = x * scale; for i : 0..n { total += _licm0; } }
+//
+// An expression moves out when none of its names are assigned anywhere in
+// the loop and it's made of nothing but arithmetic, comparisons, len and
+// indexing. Expressions don't have side effects, but they can fail, so
+// only the ones that run on every time around before anything gets
+// printed are taken, and they go behind a check that the loop runs at
+// all. A while condition runs at least once, its invariant parts go right
+// before the loop without the check.
+
+typedef struct {
+    u32 temps;  // _licm names handed out so far
+} Licm;
+
+Licm* licm_new(Arena* a);
+
+// Rewrites a list of statements in place, count of them, loops anywhere in
+// them included. New nodes go into a.
+void  licm_stmts(Licm* l, Arena* a, AST*** stmts, u32* count);
+
+// Same over a whole AST_PROGRAM
+void  licm_program(Licm* l, Arena* a, AST* program);
+
+#endif  //__LICM_H
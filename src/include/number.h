@@ -0,0 +1,31 @@
+#ifndef __NUMBER_H
+#define __NUMBER_H
+
+#include "defines.h"
+#include "string.h"
+
+// Number parsing straight off a source slice. Nothing has to be NUL
+// terminated and the locale is never consulted, so the lexer can hand out
+// number lexemes that point into the source.
+//
+// Accepts an optional sign, digits, an optional '.' with more digits and an
+// optional exponent. Parsing stops at the first character that doesn't fit.
+
+typedef struct {
+    f64  val;       // always set, correctly rounded
+    i64  i;         // set when is_int
+    bool is_int;    // no '.' or exponent and fits in an i64
+    u64  len;       // how much of the slice was used, 0 when there was no number
+} Number;
+
+Number number_parse(String s);
+
+// Shortest text that reads back as n. Whole numbers are plain digits, so
+// 10 is 10 and not 1e+01; anything else is the shortest %g, so 0.1 stays
+// 0.1 and 1e21 doesn't turn into a wall of digits. buf wants
+// NUMBER_FMT_LEN bytes, the length written comes back.
+#define NUMBER_FMT_LEN 32
+
+u64    number_format(char* buf, f64 n);
+
+#endif  //__NUMBER_H
@@ -7,6 +7,7 @@
 
 typedef enum {
     Precedence_Min,
+    Precedence_Range,
     Precedence_Or,
     Precedence_And,
     Precedence_Not,
@@ -16,20 +17,91 @@ typedef enum {
     Precedence_Factor,
 } Precedence;
 
+typedef enum {
+    ExprOp_Prefix,
+    ExprOp_Paren,
+    ExprOp_Infix,
+} ExprOpKind;
+
+typedef struct {
+    ExprOpKind kind;
+    TokenType  type;
+    Precedence prec;
+} ExprOp;
+
+#define RECORD_NONE ((u32)-1)
+
+// type Name { field: Type, ... }. A record is laid out as an array with a
+// slot per field in declaration order, so a field is just a constant index.
+typedef struct {
+    String  name;
+    String* fields;
+    u32*    field_records;  // RECORD_NONE for a field that isn't a record
+    u32     field_count;
+} Record;
+
+// a name and the record it holds from here on
+typedef struct {
+    String name;
+    u32    record;
+} RecordVar;
+
+// a function with the records its parameters take, for literals passed
+// straight to it
+typedef struct {
+    String name;
+    u32*   param_records;
+    u32    param_count;
+} RecordFunc;
+
 typedef struct parser_t {
     AST*   ast;
     Arena* arena;
     Lexer* lexer;   
     HashMap* var_map;
 
+    // for naming the hidden end variable of each loop
+    u32 fors;
+
+    // Records, the names holding them and the functions taking them. These
+    // outlive every statement, so they live in an arena that never gets
+    // rewound when streaming.
+    Arena*      types;
+    Record*     records;
+    u32         record_count;
+    u32         record_cap;
+    RecordVar*  record_vars;
+    u32         record_var_count;
+    u32         record_var_cap;
+    RecordFunc* record_funcs;
+    u32         record_func_count;
+    u32         record_func_cap;
+
+    // explicit operator and operand stacks for parse_expr, so nesting depth
+    // is bounded by the arena instead of the C stack
+    ExprOp* ops;
+    usize   op_count;
+    usize   op_cap;
+
+    AST**   vals;
+    usize   val_count;
+    usize   val_cap;
+
     Token prev;
     Token curr;
     Token next;
 } Parser;
 
-Parser* parser_new(Lexer* lexer);
+// types has to outlive every statement, it's where records are kept
+Parser* parser_new(Lexer* lexer, Arena* types);
 void    parser_free(Parser* p);
 void    parser_advance(Parser* p);
 void    parser_parse(Parser* p);
 
+// Statement at a time interface for streaming. parser_parse_stmt returns
+// NULL at EOF, parser_rewind frees everything allocated since pos while
+// keeping the lookahead tokens alive.
+AST*    parser_parse_stmt(Parser* p);
+void    parser_rewind(Parser* p, u64 pos);
+
 #endif  //__PARSER_H
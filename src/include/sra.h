@@ -0,0 +1,44 @@
+#ifndef __SRA_H
+#define __SRA_H
+
+#include "arena.h"
+#include "ast.h"
+#include "defines.h"
+
+// Scalar replacement of aggregates, on the AST once calls are inlined so a
+// function's records and arrays are part of the body they were called
+// from.
+//
+//   let p: Point = {i, i * 2}; total += p.x * p.y;
+//
+// becomes
+//
+//   let _sra0_0 = i; let _sra0_1 = i * 2; total += _sra0_0 * _sra0_1;
+//
+// An array or record doesn't escape when its name is only ever bound to a
+// literal of the same length and only ever read through a constant index
+// in bounds or len. Nothing else can see it then, so every slot turns
+// into a name of its own and the array is never built: no allocation, no
+// indirection, and sccp gets to see through the slots. Printing it,
+// comparing it, putting it in another array, copying it to another name
+// or indexing it with anything but a literal keeps it whole.
+//
+// When streaming, later statements can read any name from the source, so
+// only the hidden ones the inliner makes up get split.
+
+typedef struct {
+    bool stream;
+    u32  temps;   // _sra ids handed out so far
+    u64  split;   // aggregates replaced by their slots so far
+} Sra;
+
+Sra* sra_new(Arena* a, bool stream);
+
+// Rewrites a list of statements in place, count of them, nested bodies
+// included. New nodes go into a.
+void sra_stmts(Sra* s, Arena* a, AST*** stmts, u32* count);
+
+// Same over a whole AST_PROGRAM
+void sra_program(Sra* s, Arena* a, AST* program);
+
+#endif  //__SRA_H
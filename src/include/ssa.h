@@ -0,0 +1,55 @@
+#ifndef __SSA_H
+#define __SSA_H
+
+#include "arena.h"
+#include "ast.h"
+#include "defines.h"
+#include "ir.h"
+
+// SSA over the AST once calls are inlined, and sparse conditional
+// constant propagation over that.
+//
+//   let x = 32; let y = 2;
+//   if x > 10 { let y = x; }
+//   print (x + y) * x;
+//
+// Every let and compound assignment makes a new value. Where control comes
+// back together, after an if and at the top of a loop, a phi picks between
+// the values coming in. A value is a literal, an operation on other
+// values, a phi, or unknown: loop counters, and names from earlier
+// statements that didn't end up constant.
+//
+// Propagation is Wegman and Zadeck's. Everything starts out undecided, a
+// branch only makes a side reachable once its condition could go that
+// way, and a phi only listens to the sides that are reachable. Whatever
+// settles on a single literal gets replaced by it in the tree, so the
+// print above becomes print 1088 and the if's condition true. dce takes
+// the dead lets and branches from there.
+
+// A top level name's literal, kept across statements. It gets
+// overwritten in place, so streaming holds one per name however many
+// statements go by.
+typedef struct {
+    AST  literal;
+    u64  room;      // bytes the kept string has
+    bool set;       // false when the name isn't known to be constant
+} SsaKnown;
+
+typedef struct {
+    Arena*     arena;   // outlives every statement
+    IrSymbols* names;   // top level names from earlier statements
+    SsaKnown*  known;   // per slot
+    u32        cap;
+    u64        folded;  // nodes replaced by literals so far
+} Ssa;
+
+Ssa* ssa_new(Arena* a);
+
+// Folds what it can in a list of statements, in place. Scratch goes into
+// a, and top level names that end up constant stay known to the next call.
+void ssa_stmts(Ssa* s, Arena* a, AST** stmts, u32 count);
+
+// Same over a whole AST_PROGRAM
+void ssa_program(Ssa* s, Arena* a, AST* program);
+
+#endif  //__SSA_H
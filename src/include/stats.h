@@ -0,0 +1,72 @@
+#ifndef __STATS_H
+#define __STATS_H
+
+#include "arena.h"
+#include "ast.h"
+#include "defines.h"
+#include <stdio.h>
+
+// Compile time statistics behind --stats. Build with -DBLAZE_NO_STATS and
+// every STATS_* macro below turns into nothing (or just its side effects).
+
+typedef enum {
+    Phase_Read,
+    Phase_Lex,
+    Phase_Parse,
+    Phase_Emit,
+    Phase_Run,
+    PhaseCount,
+} Phase;
+
+#define STATS_MAX_PASSES 32
+
+typedef struct {
+    bool enabled;
+
+    // Phase_Parse includes the lexer calls the parser makes along the way,
+    // stats_print takes Phase_Lex back out of it
+    u64 phase_ns[PhaseCount];
+
+    const char* pass_names[STATS_MAX_PASSES];
+    u64         pass_ns[STATS_MAX_PASSES];
+    u32         pass_count;
+
+    u64 bytes;
+    u64 tokens;
+    u64 symbols;
+    u64 instructions;
+    u64 out_bytes;
+    u64 scalarized;
+    u64 folded_nodes;
+    u64 dead_nodes;
+    u64 shared_nodes;
+    u64 ast_nodes[AST_TAG_COUNT];
+} Stats;
+
+extern Stats stats;
+
+u64  stats_now(void);
+void stats_pass(const char* name, u64 ns);
+void stats_print(FILE* f, bool json, Arena* arena);
+
+#ifndef BLAZE_NO_STATS
+
+#define STATS_BEGIN(var) u64 var = stats.enabled ? stats_now() : 0
+#define STATS_END(phase, var) do {\
+    if (stats.enabled) stats.phase_ns[phase] += stats_now() - (var);\
+} while (0)
+#define STATS_PASS_END(name, var) do {\
+    if (stats.enabled) stats_pass(name, stats_now() - (var));\
+} while (0)
+#define STATS_ADD(field, n) (stats.field += (n))
+
+#else
+
+#define STATS_BEGIN(var)          do {} while (0)
+#define STATS_END(phase, var)     do {} while (0)
+#define STATS_PASS_END(name, var) do {} while (0)
+#define STATS_ADD(field, n)       ((void)(n))
+
+#endif // BLAZE_NO_STATS
+
+#endif  //__STATS_H
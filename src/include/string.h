@@ -24,5 +24,6 @@ String string_replace(Arena* a, String str, String needle, String replacement);
 u64    string_index_of(String str, String substr);
 f64    string_to_number(String str);
 bool   string_eq(String a, String b);
+u64    string_hash(String s);
 
 #endif  //__STRING_H
@@ -0,0 +1,108 @@
+#ifndef __VALUE_H
+#define __VALUE_H
+
+#include "arena.h"
+#include "defines.h"
+#include "string.h"
+#include <stdio.h>
+#include <string.h>
+
+// Runtime values, NaN-boxed into 64 bits. Any double that isn't one of our
+// quiet NaNs is a Num as is. nil and the bools live in the low bits of the
+// quiet NaN, and heap objects set the sign bit too and keep their pointer
+// in the low 48 bits. Bit 48 tells arrays apart from strings.
+typedef u64 Value;
+
+#define VALUE_SIGN  0x8000000000000000ull
+#define VALUE_QNAN  0x7ffc000000000000ull
+#define VALUE_CANON 0x7ff8000000000000ull
+#define VALUE_ARR   0x0001000000000000ull
+#define VALUE_PTR   0x0000ffffffffffffull
+
+// contiguous and length prefixed, never changes once it's built
+typedef struct {
+    u64   len;
+    Value items[];
+} Array;
+
+#define VALUE_NIL   (VALUE_QNAN | 1)
+#define VALUE_FALSE (VALUE_QNAN | 2)
+#define VALUE_TRUE  (VALUE_QNAN | 3)
+
+static inline Value value_num(f64 n) {
+    Value v;
+    memcpy(&v, &n, sizeof(v));
+    // a NaN coming out of arithmetic must not look like a boxed value
+    return n != n ? VALUE_CANON : v;
+}
+
+static inline f64 value_as_num(Value v) {
+    f64 n;
+    memcpy(&n, &v, sizeof(n));
+    return n;
+}
+
+static inline Value value_bool(bool b) {
+    return b ? VALUE_TRUE : VALUE_FALSE;
+}
+
+static inline Value value_str(String* s) {
+    return VALUE_SIGN | VALUE_QNAN | (u64)(uintptr_t)s;
+}
+
+static inline String* value_as_str(Value v) {
+    return (String*)(uintptr_t)(v & VALUE_PTR);
+}
+
+static inline Value value_arr(Array* a) {
+    return VALUE_SIGN | VALUE_QNAN | VALUE_ARR | (u64)(uintptr_t)a;
+}
+
+static inline Array* value_as_arr(Value v) {
+    return (Array*)(uintptr_t)(v & VALUE_PTR);
+}
+
+static inline bool value_is_num(Value v) {
+    return (v & VALUE_QNAN) != VALUE_QNAN;
+}
+
+static inline bool value_is_str(Value v) {
+    return (v & (VALUE_SIGN | VALUE_QNAN | VALUE_ARR)) == (VALUE_SIGN | VALUE_QNAN);
+}
+
+static inline bool value_is_arr(Value v) {
+    return (v & (VALUE_SIGN | VALUE_QNAN | VALUE_ARR)) == (VALUE_SIGN | VALUE_QNAN | VALUE_ARR);
+}
+
+static inline bool value_is_bool(Value v) {
+    return v == VALUE_TRUE || v == VALUE_FALSE;
+}
+
+// nil, false and 0 are falsy, everything else is truthy
+static inline bool value_truthy(Value v) {
+    if (value_is_num(v)) return value_as_num(v) != 0;
+    return v != VALUE_NIL && v != VALUE_FALSE;
+}
+
+// makes a runtime string out of a literal's lexeme, resolving the escapes
+// the lexer left in for the VM
+Value value_str_lit(Arena* a, String lexeme);
+Value value_concat(Arena* a, Value l, Value r);
+
+// the slow paths shared by the interpreter and the VM. Type errors go
+// through err like every other error.
+f64   value_expect_num(Value v, const char* op);
+Value value_add(Arena* a, Value l, Value r);
+
+// copies len values off items
+Value value_array(Arena* a, Value* items, u64 len);
+// bounds checked, the index has to be a whole number below len
+Value value_index(Value arr, Value index);
+// of a Str or an Array
+Value value_len(Value v);
+
+bool  value_eq(Value a, Value b);
+void  value_print(FILE* f, Value v);
+const char* value_type_str(Value v);
+
+#endif  //__VALUE_H
@@ -0,0 +1,55 @@
+#ifndef __VM_H
+#define __VM_H
+
+#include "arena.h"
+#include "defines.h"
+#include "ir.h"
+#include "jit.h"
+#include "value.h"
+#include <stdio.h>
+
+// Direct threaded VM for the compiler's own IR. Each IrProgram is turned
+// into an array of { handler address, operand } pairs, fusing the usual
+// instruction sequences into superinstructions, and run with GCC computed
+// goto. Variables are fixed slots, the top of the stack stays in a local.
+
+typedef struct VmInst VmInst;
+typedef struct VmJit VmJit;
+
+typedef struct {
+    Arena*     arena;   // slots, stack and runtime strings
+    FILE*      out;
+    IrSymbols* syms;
+
+    Value*     slots;
+    bool*      defined; // set by the compiler pass, not at run time
+    u32        slot_cap;
+
+    Value*     stack;
+    usize      stack_cap;
+
+    Jit*       jit;     // NULL unless --jit
+
+    // loop bodies of the program being run that the JIT could take
+    VmJit*     jits;
+    u32        jit_count;
+    Arena*     jit_scratch;
+
+    // scratch registers whose stores can be fused away
+    u32        tmp_a;
+    u32        tmp_b;
+    u32        tmp;
+    u32        tmp_var;
+} Vm;
+
+Vm*  vm_new(IrSymbols* syms, FILE* out);
+void vm_free(Vm* vm);
+
+// turns on the native tier, quietly stays off where it isn't supported
+void vm_enable_jit(Vm* vm);
+
+// Compiles ir into scratch and runs it. Globals carry over between calls,
+// so statements can be fed in one at a time.
+void vm_run(Vm* vm, Arena* scratch, IrProgram* ir);
+
+#endif  //__VM_H
@@ -0,0 +1,837 @@
+#include "include/inline.h"
+#include "include/arena.h"
+#include "include/ast.h"
+#include "include/err.h"
+#include "include/ir.h"
+#include "include/string.h"
+#include <stdio.h>
+#include <string.h>
+
+#define INLINE_FUNCS_INIT 16
+#define INLINE_LIST_INIT  8
+
+Inliner* inliner_new(Arena* a) {
+    Inliner* in = AllocArrayZero(a, Inliner, 1);
+    in->arena = a;
+    in->names = ir_symbols_new(a);
+    in->cap = INLINE_FUNCS_INIT;
+    in->funcs = AllocArrayZero(a, InlineFunc, in->cap);
+    return in;
+}
+
+static void process_stmt(Inliner* in, Arena* a, AST* stmt, AstList* out, bool top);
+
+/*
+*  Declarations
+*/
+
+typedef struct {
+    AstVisitor  v;
+    Arena*      a;
+    InlineFunc* f;
+} CallVisitor;
+
+static void add_call(Arena* a, InlineFunc* f, AST* call, bool tail) {
+    if (f->call_count == f->call_cap) {
+        u32 cap = f->call_cap ? f->call_cap * 2 : INLINE_LIST_INIT;
+        f->calls = arena_realloc(a, f->calls, sizeof(InlineCall) * f->call_cap,
+                                              sizeof(InlineCall) * cap);
+        f->call_cap = cap;
+    }
+    f->calls[f->call_count++] = (InlineCall){ call->data.AST_CALL.name, tail, call->data.AST_CALL.token };
+}
+
+static bool call_pre(AstVisitor* v, AST* ast) {
+    CallVisitor* cv = (CallVisitor*)v;
+    if (ast->tag == AST_CALL) add_call(cv->a, cv->f, ast, false);
+    return true;
+}
+
+// Goes through a body the way control does. tail says the body is the
+// last thing on its way through the function, where a return can go.
+static void scan_body(CallVisitor* cv, AST** body, u32 count, bool tail) {
+    for (u32 i = 0; i < count; ++i) {
+        AST* stmt = body[i];
+        bool last = tail && i + 1 == count;
+
+        switch (stmt->tag) {
+            case AST_FUNC: err("Functions can only be declared at the top level", 0, 0);
+            case AST_RETURN: {
+                if (!last) err("'return' has to be the last statement of a function or of an if at its end", 0, 0);
+
+                AST* expr = stmt->data.AST_RETURN.expr;
+                if (expr->tag == AST_CALL) {
+                    add_call(cv->a, cv->f, expr, true);
+                    for (u32 k = 0; k < expr->data.AST_CALL.argc; ++k) {
+                        ast_walk(cv->a, expr->data.AST_CALL.args[k], &cv->v);
+                    }
+                } else {
+                    ast_walk(cv->a, expr, &cv->v);
+                }
+                break;
+            }
+            case AST_IF: {
+                struct AST_IF* data = &stmt->data.AST_IF;
+                ast_walk(cv->a, data->expr, &cv->v);
+                scan_body(cv, data->body, data->stmt_count, last);
+                scan_body(cv, data->else_body, data->else_count, last);
+                break;
+            }
+            case AST_FOR: {
+                struct AST_FOR* data = &stmt->data.AST_FOR;
+                ast_walk(cv->a, data->start, &cv->v);
+                ast_walk(cv->a, data->end, &cv->v);
+                scan_body(cv, data->body, data->stmt_count, false);
+                break;
+            }
+            case AST_WHILE: {
+                struct AST_WHILE* data = &stmt->data.AST_WHILE;
+                ast_walk(cv->a, data->expr, &cv->v);
+                scan_body(cv, data->body, data->stmt_count, false);
+                break;
+            }
+            default: ast_walk(cv->a, stmt, &cv->v); break;
+        }
+    }
+}
+
+static bool always_returns(AST** body, u32 count) {
+    AST* last = count ? body[count - 1] : 0;
+    if (!last) return false;
+    if (last->tag == AST_RETURN) return true;
+    if (last->tag != AST_IF) return false;
+
+    struct AST_IF* data = &last->data.AST_IF;
+    return always_returns(data->body, data->stmt_count) &&
+           always_returns(data->else_body, data->else_count);
+}
+
+// if n <= 1 { return 1; } return n * 2;
+//
+// An if that returns on one side has the rest of the body moved into the
+// other side, so every return ends up at the end.
+static void move_guards(Arena* a, AST*** body, u32* count) {
+    for (u32 i = 0; i < *count; ++i) {
+        AST* stmt = (*body)[i];
+        if (stmt->tag != AST_IF) continue;
+
+        struct AST_IF* data = &stmt->data.AST_IF;
+        move_guards(a, &data->body, &data->stmt_count);
+        move_guards(a, &data->else_body, &data->else_count);
+        if (i + 1 == *count) return;
+
+        bool left = always_returns(data->body, data->stmt_count);
+        bool right = always_returns(data->else_body, data->else_count);
+        if (!left && !right) continue;
+        if (left && right) err("Nothing after an if that returns either way can run", 0, 0);
+
+        AST*** side = left ? &data->else_body : &data->body;
+        u32* side_count = left ? &data->else_count : &data->stmt_count;
+        u32 rest = *count - i - 1;
+
+        *side = arena_realloc(a, *side, sizeof(AST*) * *side_count, sizeof(AST*) * (*side_count + rest));
+        memcpy(*side + *side_count, *body + i + 1, sizeof(AST*) * rest);
+        *side_count += rest;
+        *count = i + 1;
+
+        move_guards(a, side, side_count);
+        return;
+    }
+}
+
+// A return nil goes wherever a way through would fall off the end
+static void add_returns(Arena* a, AST*** body, u32* count) {
+    AST* last = *count ? (*body)[*count - 1] : 0;
+    if (last && last->tag == AST_RETURN) return;
+
+    if (last && last->tag == AST_IF) {
+        struct AST_IF* data = &last->data.AST_IF;
+        add_returns(a, &data->body, &data->stmt_count);
+        add_returns(a, &data->else_body, &data->else_count);
+        return;
+    }
+
+    *body = arena_realloc(a, *body, sizeof(AST*) * *count, sizeof(AST*) * (*count + 1));
+    (*body)[(*count)++] = AST_NEW(a, AST_RETURN, AST_NEW(a, AST_NIL, 0));
+}
+
+static void declare(Inliner* in, AST* func) {
+    String name = func->data.AST_FUNC.name;
+    if (ir_symbol_find(in->names, name) >= 0) {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "Function '%.*s' is already declared", (int)name.len, name.data);
+        err(msg, 0, 0);
+    }
+
+    u32 index = ir_symbol(in->names, name);
+    if (index == in->cap) {
+        in->funcs = arena_realloc(in->arena, in->funcs, sizeof(InlineFunc) * in->cap,
+                                                        sizeof(InlineFunc) * in->cap * 2);
+        memset(in->funcs + in->cap, 0, sizeof(InlineFunc) * in->cap);
+        in->cap *= 2;
+    }
+
+    // statements get rewound when streaming, the declaration has to stay
+    InlineFunc* f = &in->funcs[index];
+    f->func = ast_clone(in->arena, func);
+
+    struct AST_FUNC* data = &f->func->data.AST_FUNC;
+    move_guards(in->arena, &data->body, &data->stmt_count);
+
+    CallVisitor cv = {{call_pre, 0, 0}, in->arena, f};
+    scan_body(&cv, data->body, data->stmt_count, true);
+    add_returns(in->arena, &data->body, &data->stmt_count);
+}
+
+/*
+*  Call graph
+*/
+
+typedef struct {
+    AstVisitor v;
+    u32 count;
+} SizeVisitor;
+
+static bool size_pre(AstVisitor* v, AST* ast) {
+    (void)ast;
+    ((SizeVisitor*)v)->count++;
+    return true;
+}
+
+static InlineFunc* find(Inliner* in, String name, Token at) {
+    i32 index = ir_symbol_find(in->names, name);
+    if (index < 0) {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "Undefined function '%.*s'", (int)name.len, name.data);
+        err(msg, at.line, at.col);
+    }
+    return &in->funcs[index];
+}
+
+typedef struct {
+    InlineFunc** stack;
+    u32          count;
+} GraphWalk;
+
+static u32 own_size(Arena* a, InlineFunc* f) {
+    SizeVisitor sv = {{size_pre, 0, 0}, 0};
+    ast_walk(a, f->func, &sv.v);
+    return sv.count;
+}
+
+// Tarjan's strongly connected components over the calls, so a function
+// is finished only after everything it calls out of its own cycle is.
+// The group's size adds up every call out of it, and stops counting past
+// the budget. Tail calls around the cycle cost nothing, they become the
+// loop's way back around.
+static void graph_visit(Inliner* in, Arena* a, InlineFunc* f, GraphWalk* w) {
+    f->index = f->low = ++in->visits;
+    w->stack[w->count++] = f;
+    f->on_stack = true;
+
+    for (u32 i = 0; i < f->call_count; ++i) {
+        InlineFunc* g = find(in, f->calls[i].name, f->calls[i].token);
+        if (!g->index) {
+            graph_visit(in, a, g, w);
+            if (g->low < f->low) f->low = g->low;
+        } else if (g->on_stack && g->index < f->low) {
+            f->low = g->index;
+        }
+    }
+    if (f->low != f->index) return;
+
+    u32 group = ++in->groups;
+    u32 first = w->count;
+    do {
+        InlineFunc* m = w->stack[--first];
+        m->on_stack = false;
+        m->group = group;
+    } while (w->stack[first] != f);
+
+    u32 size = 0;
+    bool cycle = w->count - first > 1;
+    bool recursive = false;
+    for (u32 k = first; k < w->count; ++k) {
+        InlineFunc* m = w->stack[k];
+        size += own_size(a, m);
+
+        for (u32 i = 0; i < m->call_count; ++i) {
+            InlineFunc* g = find(in, m->calls[i].name, m->calls[i].token);
+            if (g->group == group) {
+                cycle = true;
+                recursive |= !m->calls[i].tail;
+            } else {
+                size += g->size;
+            }
+            if (size > INLINE_BUDGET) size = INLINE_BUDGET + 1;
+        }
+    }
+
+    for (u32 k = first; k < w->count; ++k) {
+        InlineFunc* m = w->stack[k];
+        m->size = size;
+        m->recursive = recursive;
+        m->loops = cycle && !recursive;
+    }
+    w->count = first;
+}
+
+static void check_arity(InlineFunc* f, AST* call) {
+    String name = call->data.AST_CALL.name;
+    u32 params = f->func->data.AST_FUNC.param_count;
+    if (call->data.AST_CALL.argc != params) {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "'%.*s' expects %u arguments, got %u",
+                 (int)name.len, name.data, params, call->data.AST_CALL.argc);
+        err(msg, call->data.AST_CALL.token.line, call->data.AST_CALL.token.col);
+    }
+}
+
+static InlineFunc* callee(Inliner* in, Arena* a, AST* call) {
+    String name = call->data.AST_CALL.name;
+    InlineFunc* f = find(in, name, call->data.AST_CALL.token);
+
+    if (!f->group) {
+        u64 start = a->pos_u64;
+        GraphWalk w = { AllocArray(a, InlineFunc*, in->names->count), 0 };
+        graph_visit(in, a, f, &w);
+        arena_set_pos_back(a, start);
+    }
+
+    // reported where the call is, the declaration is long gone by now
+    Token at = call->data.AST_CALL.token;
+    char msg[128];
+    if (f->recursive) {
+        snprintf(msg, sizeof(msg), "Can't inline '%.*s', it recurses through a call that isn't a tail call",
+                 (int)name.len, name.data);
+        err(msg, at.line, at.col);
+    }
+    if (f->size > INLINE_BUDGET) {
+        snprintf(msg, sizeof(msg), "Can't inline '%.*s', it's over the inlining budget", (int)name.len, name.data);
+        err(msg, at.line, at.col);
+    }
+
+    check_arity(f, call);
+    return f;
+}
+
+/*
+*  Renaming
+*/
+
+typedef struct {
+    String from;
+    String to;
+} Rename;
+
+typedef struct {
+    AstVisitor v;
+    Arena*  a;
+    String  func;
+    u32     site;
+    Rename* map;
+    u32     count;
+    u32     cap;
+} RenameVisitor;
+
+// not a valid identifier, so it can't clash with anything in the source
+static String fresh_name(RenameVisitor* rv, String name) {
+    return string_format(rv->a, "_%.*s_%.*s_%u", (int)rv->func.len, rv->func.data,
+                         (int)name.len, name.data, rv->site);
+}
+
+static String rename_lookup(RenameVisitor* rv, String name) {
+    for (u32 i = rv->count; i-- > 0;) {
+        if (string_eq(rv->map[i].from, name)) return rv->map[i].to;
+    }
+    return name;
+}
+
+// from here on name is the function's own
+static String rename_bind(RenameVisitor* rv, String name) {
+    if (rv->count == rv->cap) {
+        u32 cap = rv->cap ? rv->cap * 2 : INLINE_LIST_INIT;
+        rv->map = arena_realloc(rv->a, rv->map, sizeof(Rename) * rv->cap, sizeof(Rename) * cap);
+        rv->cap = cap;
+    }
+    String to = fresh_name(rv, name);
+    rv->map[rv->count++] = (Rename){ name, to };
+    return to;
+}
+
+static bool rename_pre(AstVisitor* v, AST* ast) {
+    RenameVisitor* rv = (RenameVisitor*)v;
+
+    switch (ast->tag) {
+        case AST_IDENT: {
+            ast->data.AST_IDENT.ident = rename_lookup(rv, ast->data.AST_IDENT.ident);
+            break;
+        }
+        // all four share the { ident, expr } layout
+        case AST_ADDEQ: case AST_SUBEQ: case AST_MULEQ: case AST_DIVEQ: {
+            ast->data.AST_ADDEQ.ident = rename_lookup(rv, ast->data.AST_ADDEQ.ident);
+            break;
+        }
+        default: break;
+    }
+    return true;
+}
+
+// a loop's variable is bound once both bounds are in
+static void rename_mid(AstVisitor* v, AST* ast, u32 child) {
+    RenameVisitor* rv = (RenameVisitor*)v;
+    if (ast->tag != AST_FOR || child != 1) return;
+
+    struct AST_FOR* data = &ast->data.AST_FOR;
+    data->ident = rename_bind(rv, data->ident);
+    data->end_var = rename_bind(rv, data->end_var);
+}
+
+static void rename_post(AstVisitor* v, AST* ast) {
+    RenameVisitor* rv = (RenameVisitor*)v;
+    if (ast->tag == AST_LET) {
+        ast->data.AST_LET.ident = rename_bind(rv, ast->data.AST_LET.ident);
+    }
+}
+
+/*
+*  Substitution
+*/
+
+typedef struct {
+    AstVisitor v;
+    String name;
+    AST*   with;    // NULL only checks for assignments
+    bool   assigned;
+} SubstVisitor;
+
+static bool subst_pre(AstVisitor* v, AST* ast) {
+    SubstVisitor* sv = (SubstVisitor*)v;
+    if (!sv->with) {
+        sv->assigned |= ast_assigns_to(ast, sv->name);
+        return !sv->assigned;
+    }
+
+    if (ast->tag == AST_IDENT && string_eq(ast->data.AST_IDENT.ident, sv->name)) {
+        *ast = *sv->with;
+    }
+    return true;
+}
+
+static bool assigned_in(Arena* a, AST** stmts, u32 count, String name) {
+    SubstVisitor sv = {{subst_pre, 0, 0}, name, 0, false};
+    for (u32 i = 0; i < count && !sv.assigned; ++i) {
+        ast_walk(a, stmts[i], &sv.v);
+    }
+    return sv.assigned;
+}
+
+/*
+*  Expanding
+*/
+
+typedef struct {
+    AstVisitor v;
+    Inliner*   in;
+    Arena*     a;
+    AstList*   out;
+} ExpandVisitor;
+
+static void expand_post(AstVisitor* v, AST* ast);
+
+// names for the expansion itself rather than anything in the function,
+// they don't end on the site like the renamed ones do
+static String hidden_name(Arena* a, String func, u32 site, const char* what) {
+    return string_format(a, "_%.*s_%u_%s", (int)func.len, func.data, site, what);
+}
+
+static AST* let_ident(Arena* a, String name, AST* expr) {
+    return AST_NEW(a, AST_LET, expr, name);
+}
+
+// Turns the returns at the end of every way through a body into lets of
+// ret, and with a group, the tail calls into it as well, see tail_call
+typedef struct {
+    Inliner*    in;
+    Arena*      a;
+    String      ret;
+    u32         group;      // 0 for a plain expansion
+    InlineFunc** members;
+    String**    params;     // per member, their names at this site
+    u32         count;
+    String      go;
+    String      entry;
+    u32         site;
+} Returns;
+
+typedef struct {
+    AstVisitor v;
+    String name;
+    bool   found;
+} ReadVisitor;
+
+static bool read_pre(AstVisitor* v, AST* ast) {
+    ReadVisitor* rv = (ReadVisitor*)v;
+    rv->found |= ast->tag == AST_IDENT && string_eq(ast->data.AST_IDENT.ident, rv->name);
+    return !rv->found;
+}
+
+static bool reads(Arena* a, AST* ast, String name) {
+    ReadVisitor rv = {{read_pre, 0, 0}, name, false};
+    ast_walk(a, ast, &rv.v);
+    return rv.found;
+}
+
+static AST* go_value(Arena* a, Returns* r, u32 member) {
+    return r->count == 1 ? AST_NEW(a, AST_BOOL, member != 0)
+                         : AST_NEW(a, AST_NUMBER, (f64)member, (i64)member, true);
+}
+
+// return g(a, b) becomes the params of g taking the arguments, all of
+// them computed from the values before, and the loop going around into
+// g. An argument only goes through a temporary when a later one reads
+// the param it's about to replace.
+static void tail_call(Returns* r, AST* call, AstList* out) {
+    Arena* a = r->a;
+    u32 member = 0;
+    while (!string_eq(r->members[member]->func->data.AST_FUNC.name, call->data.AST_CALL.name)) {
+        member++;
+    }
+    check_arity(r->members[member], call);
+
+    String* params = r->params[member];
+    AST** args = call->data.AST_CALL.args;
+    u32 argc = call->data.AST_CALL.argc;
+
+    AstList moves = {0};
+    for (u32 i = 0; i < argc; ++i) {
+        if (args[i]->tag == AST_IDENT && string_eq(args[i]->data.AST_IDENT.ident, params[i])) {
+            continue;
+        }
+
+        bool direct = true;
+        for (u32 j = i + 1; j < argc && direct; ++j) {
+            direct = !reads(a, args[j], params[i]);
+        }
+        if (direct) {
+            ast_list_push(a, out, let_ident(a, params[i], args[i]));
+            continue;
+        }
+
+        String tmp = hidden_name(a, r->entry, r->site, string_format(a, "t%u", i).data);
+        ast_list_push(a, out, let_ident(a, tmp, args[i]));
+        ast_list_push(a, &moves, let_ident(a, params[i], AST_NEW(a, AST_IDENT, tmp)));
+    }
+    for (u32 i = 0; i < moves.count; ++i) {
+        ast_list_push(a, out, moves.stmts[i]);
+    }
+
+    ast_list_push(a, out, let_ident(a, r->go, go_value(a, r, member + 1)));
+}
+
+static bool is_group_call(Returns* r, AST* expr) {
+    if (!r->group || expr->tag != AST_CALL) return false;
+    return find(r->in, expr->data.AST_CALL.name, expr->data.AST_CALL.token)->group == r->group;
+}
+
+static void rewrite_returns(Returns* r, AST*** body, u32* count) {
+    AST* last = (*body)[*count - 1];
+
+    if (last->tag == AST_IF) {
+        struct AST_IF* data = &last->data.AST_IF;
+        rewrite_returns(r, &data->body, &data->stmt_count);
+        rewrite_returns(r, &data->else_body, &data->else_count);
+        return;
+    }
+
+    AST* expr = last->data.AST_RETURN.expr;
+    if (!is_group_call(r, expr)) {
+        (*body)[*count - 1] = let_ident(r->a, r->ret, expr);
+        return;
+    }
+
+    AstList out = { *body, *count - 1, *count };
+    tail_call(r, expr, &out);
+    *body = out.stmts;
+    *count = out.count;
+}
+
+// Renamed copies of a function's body, processed into out. The renamer
+// has the params bound already.
+static void expand_body(Arena* a, InlineFunc* f, RenameVisitor* rv, AstList* out) {
+    struct AST_FUNC* func = &f->func->data.AST_FUNC;
+    for (u32 i = 0; i < func->stmt_count; ++i) {
+        AST* stmt = ast_clone(a, func->body[i]);
+        ast_walk(a, stmt, &rv->v);
+        ast_list_push(a, out, stmt);
+    }
+}
+
+// A group is expanded into one loop, with a flag for whether to go
+// around again or, for a cycle of several functions, the number of the
+// one to go into next:
+//
+//   let n = <arg>; let acc = <arg>; let ret = nil; let go = true;
+//   while go { let go = false; <body> }
+//
+// where every return assigns ret, and every tail call the params and go.
+// Several functions take turns in one if per body, in the order they are
+// first reached from the one called, and the params of all of them are
+// bound up front.
+static AST* expand_loop(Inliner* in, Arena* a, AST* call, InlineFunc* f, AstList* out) {
+    u32 site = in->sites++;
+    String entry = f->func->data.AST_FUNC.name;
+
+    InlineFunc** members = AllocArray(a, InlineFunc*, in->names->count);
+    u32 count = 1;
+    members[0] = f;
+    for (u32 k = 0; k < count; ++k) {
+        for (u32 i = 0; i < members[k]->call_count; ++i) {
+            InlineFunc* g = find(in, members[k]->calls[i].name, members[k]->calls[i].token);
+            if (g->group != f->group) continue;
+
+            u32 j = 0;
+            while (j < count && members[j] != g) j++;
+            if (j == count) members[count++] = g;
+        }
+    }
+
+    Returns r = { in, a, hidden_name(a, entry, site, "ret"), f->group, members, 0, count,
+                  hidden_name(a, entry, site, "go"), entry, site };
+    r.params = AllocArray(a, String*, count);
+    RenameVisitor* rvs = AllocArrayZero(a, RenameVisitor, count);
+
+    AstList body = {0};
+    for (u32 k = 0; k < count; ++k) {
+        struct AST_FUNC* func = &members[k]->func->data.AST_FUNC;
+        rvs[k] = (RenameVisitor){{rename_pre, rename_mid, rename_post}, a, func->name, site, 0, 0, 0};
+        r.params[k] = AllocArray(a, String, func->param_count ? func->param_count : 1);
+
+        for (u32 i = 0; i < func->param_count; ++i) {
+            r.params[k][i] = rename_bind(&rvs[k], func->params[i]);
+            AST* val = k == 0 ? call->data.AST_CALL.args[i] : AST_NEW(a, AST_NIL, 0);
+            ast_list_push(a, &body, let_ident(a, r.params[k][i], val));
+        }
+    }
+    ast_list_push(a, &body, let_ident(a, r.ret, AST_NEW(a, AST_NIL, 0)));
+    ast_list_push(a, &body, let_ident(a, r.go, go_value(a, &r, 1)));
+
+    // every body starts by saying it's done, a tail call takes that back
+    AstList* branches = AllocArrayZero(a, AstList, count);
+    for (u32 k = 0; k < count; ++k) {
+        ast_list_push(a, &branches[k], let_ident(a, r.go, go_value(a, &r, 0)));
+        expand_body(a, members[k], &rvs[k], &branches[k]);
+        rewrite_returns(&r, &branches[k].stmts, &branches[k].count);
+    }
+
+    // if go == 1 { ... } elif go == 2 { ... } else { ... }, built from
+    // the back
+    AstList loop = branches[count - 1];
+    for (u32 k = count - 1; k-- > 0;) {
+        AST* cond = AST_NEW(a, AST_EQ, AST_NEW(a, AST_IDENT, r.go), go_value(a, &r, k + 1));
+        AST* branch = AST_NEW(a, AST_IF, cond, branches[k].stmts, branches[k].count, loop.stmts, loop.count);
+        loop = (AstList){0};
+        ast_list_push(a, &loop, branch);
+    }
+
+    AST* cond = count == 1 ? AST_NEW(a, AST_IDENT, r.go)
+                           : AST_NEW(a, AST_NEQ, AST_NEW(a, AST_IDENT, r.go), go_value(a, &r, 0));
+    process_stmt(in, a, AST_NEW(a, AST_WHILE, cond, loop.stmts, loop.count), &body, false);
+
+    for (u32 i = 0; i < body.count; ++i) {
+        ast_list_push(a, out, body.stmts[i]);
+    }
+    return AST_NEW(a, AST_IDENT, r.ret);
+}
+
+// Param lets go first, then the body, then the call turns into whatever
+// the body returned. When that's decided in an if, the returns assign a
+// hidden name instead and the call turns into that. The arguments and
+// everything the body does run before the rest of the calling statement,
+// which only shows when the body assigns a name the statement reads.
+static void expand_call(Inliner* in, Arena* a, AST* call, AstList* out) {
+    InlineFunc* f = callee(in, a, call);
+    struct AST_FUNC* func = &f->func->data.AST_FUNC;
+
+    if (f->loops) {
+        AST* result = expand_loop(in, a, call, f, out);
+        *call = *result;
+        return;
+    }
+
+    u32 site = in->sites++;
+    RenameVisitor rv = {{rename_pre, rename_mid, rename_post}, a, func->name, site, 0, 0, 0};
+    AstList body = {0};
+
+    for (u32 i = 0; i < func->param_count; ++i) {
+        String param = rename_bind(&rv, func->params[i]);
+        ast_list_push(a, &body, let_ident(a, param, call->data.AST_CALL.args[i]));
+    }
+
+    AstList stmts = {0};
+    expand_body(a, f, &rv, &stmts);
+
+    AST* result;
+    AST* last = stmts.stmts[stmts.count - 1];
+    if (last->tag == AST_RETURN) {
+        result = last->data.AST_RETURN.expr;
+        stmts.count--;
+    } else {
+        Returns r = { .in = in, .a = a, .ret = hidden_name(a, func->name, site, "ret") };
+        ast_list_push(a, &body, let_ident(a, r.ret, AST_NEW(a, AST_NIL, 0)));
+        rewrite_returns(&r, &stmts.stmts, &stmts.count);
+        result = AST_NEW(a, AST_IDENT, r.ret);
+    }
+
+    for (u32 i = 0; i < stmts.count; ++i) {
+        process_stmt(in, a, stmts.stmts[i], &body, false);
+    }
+    ExpandVisitor ev = {{0, 0, expand_post}, in, a, &body};
+    ast_walk(a, result, &ev.v);
+
+    // A param bound to a literal, or to a name, goes straight into the
+    // body when nothing in there assigns either of them
+    AST** rest = body.stmts + func->param_count;
+    u32 rest_count = body.count - func->param_count;
+    for (u32 i = 0; i < func->param_count; ++i) {
+        AST* let = body.stmts[i];
+        AST* arg = let->data.AST_LET.expr;
+        String param = let->data.AST_LET.ident;
+
+        if (!ast_is_literal(arg) && arg->tag != AST_IDENT) continue;
+        if (assigned_in(a, rest, rest_count, param)) continue;
+        if (arg->tag == AST_IDENT && assigned_in(a, rest, rest_count, arg->data.AST_IDENT.ident)) continue;
+
+        SubstVisitor sv = {{subst_pre, 0, 0}, param, arg, false};
+        for (u32 k = 0; k < rest_count; ++k) {
+            ast_walk(a, rest[k], &sv.v);
+        }
+        ast_walk(a, result, &sv.v);
+        body.stmts[i] = 0;
+    }
+
+    for (u32 i = 0; i < body.count; ++i) {
+        if (!body.stmts[i]) continue;
+        ast_fold(a, body.stmts[i]);
+        ast_list_push(a, out, body.stmts[i]);
+    }
+    ast_fold(a, result);
+
+    *call = *result;
+}
+
+// calls are replaced in place, innermost first
+static void expand_post(AstVisitor* v, AST* ast) {
+    ExpandVisitor* ev = (ExpandVisitor*)v;
+    if (ast->tag == AST_CALL) {
+        expand_call(ev->in, ev->a, ast, ev->out);
+    }
+}
+
+typedef struct {
+    AstVisitor v;
+    bool found;
+} HasCallVisitor;
+
+static bool has_call_pre(AstVisitor* v, AST* ast) {
+    HasCallVisitor* hv = (HasCallVisitor*)v;
+    hv->found |= ast->tag == AST_CALL;
+    return !hv->found;
+}
+
+static bool has_call(Arena* a, AST* ast) {
+    HasCallVisitor hv = {{has_call_pre, 0, 0}, false};
+    ast_walk(a, ast, &hv.v);
+    return hv.found;
+}
+
+static void process_body(Inliner* in, Arena* a, AST*** body, u32* count) {
+    AstList out = {0};
+    for (u32 i = 0; i < *count; ++i) {
+        process_stmt(in, a, (*body)[i], &out, false);
+    }
+    *body = out.stmts;
+    *count = out.count;
+}
+
+static void process_stmt(Inliner* in, Arena* a, AST* stmt, AstList* out, bool top) {
+    switch (stmt->tag) {
+        case AST_FUNC: {
+            if (!top) err("Functions can only be declared at the top level", 0, 0);
+            declare(in, stmt);
+            return;
+        }
+        case AST_RETURN: err("'return' outside of a function", 0, 0);
+        default: break;
+    }
+
+    u32 sites = in->sites;
+    u32 at = out->count;
+    ExpandVisitor ev = {{0, 0, expand_post}, in, a, out};
+
+    switch (stmt->tag) {
+        case AST_FOR: {
+            struct AST_FOR* data = &stmt->data.AST_FOR;
+            ast_walk(a, data->start, &ev.v);
+            ast_walk(a, data->end, &ev.v);
+            process_body(in, a, &data->body, &data->stmt_count);
+            break;
+        }
+        // an elif's calls expand into the else, right before it
+        case AST_IF: {
+            struct AST_IF* data = &stmt->data.AST_IF;
+            ast_walk(a, data->expr, &ev.v);
+            process_body(in, a, &data->body, &data->stmt_count);
+            process_body(in, a, &data->else_body, &data->else_count);
+            break;
+        }
+        // A condition with calls is worked out before the loop and again
+        // at the end of every time around:
+        //
+        //   let _cond0 = c; while _cond0 { body; let _cond0 = c; }
+        case AST_WHILE: {
+            struct AST_WHILE* data = &stmt->data.AST_WHILE;
+            if (has_call(a, data->expr)) {
+                String name = string_format(a, "_cond%u", in->conds++);
+                AST** body = AllocArray(a, AST*, data->stmt_count + 1);
+                memcpy(body, data->body, sizeof(AST*) * data->stmt_count);
+                body[data->stmt_count] = let_ident(a, name, ast_clone(a, data->expr));
+
+                process_stmt(in, a, let_ident(a, name, data->expr), out, false);
+                data->expr = AST_NEW(a, AST_IDENT, name);
+                data->body = body;
+                data->stmt_count++;
+            }
+            process_body(in, a, &data->body, &data->stmt_count);
+            break;
+        }
+        default: ast_walk(a, stmt, &ev.v); break;
+    }
+    ast_list_push(a, out, stmt);
+
+    if (in->sites != sites) {
+        for (u32 i = at; i < out->count; ++i) {
+            ast_fold(a, out->stmts[i]);
+        }
+    }
+}
+
+AST** inliner_stmt(Inliner* in, Arena* a, AST* stmt, u32* count) {
+    AstList out = {0};
+    process_stmt(in, a, stmt, &out, true);
+    *count = out.count;
+    return out.stmts;
+}
+
+void inliner_program(Inliner* in, Arena* a, AST* program) {
+    struct AST_PROGRAM* data = &program->data.AST_PROGRAM;
+
+    AstList out = {0};
+    for (u32 i = 0; i < data->stmt_count; ++i) {
+        process_stmt(in, a, data->body[i], &out, true);
+    }
+
+    data->body = out.stmts;
+    data->stmt_count = out.count;
+    data->stmt_cap = out.cap;
+}
@@ -0,0 +1,379 @@
+#include "include/interp.h"
+#include "include/arena.h"
+#include "include/ast.h"
+#include "include/err.h"
+#include "include/string.h"
+#include "include/value.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// first chunk of the heap, it grows from there
+#define INTERP_ARENA_SIZE  (4 * 1024 * 1024)
+#define INTERP_GLOBALS     64
+#define INTERP_STACK_INIT  256
+
+Interp* interp_new(FILE* out) {
+    Arena* a = arena_new_sized(INTERP_ARENA_SIZE);
+    Interp* in = AllocArrayZero(a, Interp, 1);
+
+    in->arena = a;
+    in->out = out;
+
+    in->global_cap = INTERP_GLOBALS;
+    in->globals = AllocArrayZero(a, Global, in->global_cap);
+
+    in->stack_cap = INTERP_STACK_INIT;
+    in->stack = AllocArray(a, Value, in->stack_cap);
+
+    return in;
+}
+
+void interp_free(Interp* in) {
+    arena_free(in->arena);
+}
+
+/*
+*  Globals
+*/
+
+static void globals_grow(Interp* in) {
+    Global* old = in->globals;
+    u32 old_cap = in->global_cap;
+
+    in->global_cap *= 2;
+    in->globals = AllocArrayZero(in->arena, Global, in->global_cap);
+
+    for (u32 i = 0; i < old_cap; ++i) {
+        if (!old[i].name.data) continue;
+
+        u32 j = string_hash(old[i].name) & (in->global_cap - 1);
+        while (in->globals[j].name.data) {
+            j = (j + 1) & (in->global_cap - 1);
+        }
+        in->globals[j] = old[i];
+    }
+}
+
+Value* interp_global(Interp* in, String name, bool create) {
+    if (create && (in->global_count + 1) * 2 > in->global_cap) {
+        globals_grow(in);
+    }
+
+    u32 i = string_hash(name) & (in->global_cap - 1);
+    while (in->globals[i].name.data) {
+        if (string_eq(in->globals[i].name, name)) {
+            return &in->globals[i].val;
+        }
+        i = (i + 1) & (in->global_cap - 1);
+    }
+
+    if (!create) {
+        return 0;
+    }
+
+    // the name may point into the compiler's arena, which gets rewound
+    String copy = string_alloc(in->arena, name.len);
+    memcpy(copy.data, name.data, name.len);
+    copy.data[name.len] = '\0';
+
+    in->globals[i].name = copy;
+    in->globals[i].val = VALUE_NIL;
+    in->global_count++;
+    return &in->globals[i].val;
+}
+
+// backward shift deletion, so no probe chain ever runs into a hole
+static void global_forget(Interp* in, String name) {
+    u32 mask = in->global_cap - 1;
+    u32 i = string_hash(name) & mask;
+    while (in->globals[i].name.data && !string_eq(in->globals[i].name, name)) {
+        i = (i + 1) & mask;
+    }
+    if (!in->globals[i].name.data) {
+        return;
+    }
+
+    u32 hole = i;
+    for (u32 j = (i + 1) & mask; in->globals[j].name.data; j = (j + 1) & mask) {
+        u32 home = string_hash(in->globals[j].name) & mask;
+        // j can fill the hole unless its home lies cyclically in (hole, j]
+        bool stays = hole <= j ? (home > hole && home <= j) : (home > hole || home <= j);
+        if (!stays) {
+            in->globals[hole] = in->globals[j];
+            hole = j;
+        }
+    }
+
+    in->globals[hole] = (Global){0};
+    in->global_count--;
+}
+
+static Value* global_ref(Interp* in, String name) {
+    Value* v = interp_global(in, name, false);
+    if (!v) {
+        String msg = string_format(in->arena, "Undefined variable '%s'", name.data);
+        err(msg.data, 0, 0);
+    }
+    return v;
+}
+
+/*
+*  Evaluation
+*/
+
+static void push(Interp* in, Value v) {
+    if (in->sp == in->stack_cap) {
+        in->stack = arena_realloc(in->arena, in->stack, sizeof(Value) * in->stack_cap,
+                                                        sizeof(Value) * in->stack_cap * 2);
+        in->stack_cap *= 2;
+    }
+    in->stack[in->sp++] = v;
+}
+
+static Value pop(Interp* in) {
+    return in->stack[--in->sp];
+}
+
+static Value arith(Interp* in, u32 tag, Value l, Value r) {
+    switch (tag) {
+        case AST_ADD: case AST_ADDEQ: return value_add(in->arena, l, r);
+        case AST_SUB: case AST_SUBEQ:
+            return value_num(value_expect_num(l, "-") - value_expect_num(r, "-"));
+        case AST_MUL: case AST_MULEQ:
+            return value_num(value_expect_num(l, "*") * value_expect_num(r, "*"));
+        case AST_DIV: case AST_DIVEQ:
+            return value_num(value_expect_num(l, "/") / value_expect_num(r, "/"));
+        case AST_GT:  return value_bool(value_expect_num(l, ">") >  value_expect_num(r, ">"));
+        case AST_GTE: return value_bool(value_expect_num(l, ">=") >= value_expect_num(r, ">="));
+        case AST_LT:  return value_bool(value_expect_num(l, "<") <  value_expect_num(r, "<"));
+        case AST_LTE: return value_bool(value_expect_num(l, "<=") <= value_expect_num(r, "<="));
+        case AST_EQ:  return value_bool(value_eq(l, r));
+        case AST_NEQ: return value_bool(!value_eq(l, r));
+        // the VM evaluates both sides too, there's nothing with side
+        // effects in an expression yet
+        case AST_AND: return value_bool(value_truthy(l) && value_truthy(r));
+        case AST_OR:  return value_bool(value_truthy(l) || value_truthy(r));
+        default: break;
+    }
+
+    err("Unreachable binary operator", 0, 0);
+}
+
+typedef struct {
+    AstVisitor v;
+    Interp* in;
+    Arena*  scratch;
+} InterpVisitor;
+
+// names a loop body binds that didn't exist before the loop
+typedef struct {
+    AstVisitor v;
+    Interp* in;
+    Arena*  a;
+    String* names;
+    u32     count;
+    u32     cap;
+} ScopeVisitor;
+
+static bool scope_pre(AstVisitor* v, AST* ast) {
+    ScopeVisitor* sv = (ScopeVisitor*)v;
+
+    String name;
+    if (ast->tag == AST_LET) name = ast->data.AST_LET.ident;
+    else if (ast->tag == AST_FOR) name = ast->data.AST_FOR.ident;
+    else return true;
+
+    if (interp_global(sv->in, name, false)) {
+        return true;
+    }
+
+    if (sv->count == sv->cap) {
+        u32 cap = sv->cap ? sv->cap * 2 : 8;
+        sv->names = arena_realloc(sv->a, sv->names, sizeof(String) * sv->cap, sizeof(String) * cap);
+        sv->cap = cap;
+    }
+    sv->names[sv->count++] = name;
+    return true;
+}
+
+static void scope_collect(InterpVisitor* iv, ScopeVisitor* sv, AST** body, u32 count) {
+    *sv = (ScopeVisitor){{scope_pre, 0, 0}, iv->in, iv->scratch, 0, 0, 0};
+    for (u32 i = 0; i < count; ++i) {
+        ast_walk(iv->scratch, body[i], &sv->v);
+    }
+}
+
+static void scope_forget(ScopeVisitor* sv) {
+    for (u32 i = 0; i < sv->count; ++i) {
+        global_forget(sv->in, sv->names[i]);
+    }
+}
+
+static void interp_body(InterpVisitor* iv, AST** body, u32 count) {
+    for (u32 i = 0; i < count; ++i) {
+        usize sp = iv->in->sp;
+        ast_walk(iv->scratch, body[i], &iv->v);
+        iv->in->sp = sp;
+    }
+}
+
+// Counts i up from start while it's below the end, which is evaluated once.
+// Whatever the body brings in is gone again afterwards, same as the
+// compiled backends.
+static void interp_for(InterpVisitor* iv, AST* ast) {
+    Interp* in = iv->in;
+    struct AST_FOR* data = &ast->data.AST_FOR;
+    u64 start = iv->scratch->pos_u64;
+
+    ast_walk(iv->scratch, data->start, &iv->v);
+    *interp_global(in, data->ident, true) = pop(in);
+    ast_walk(iv->scratch, data->end, &iv->v);
+    Value end = pop(in);
+
+    ScopeVisitor sv;
+    scope_collect(iv, &sv, data->body, data->stmt_count);
+
+    // the body can grow the globals, so i gets looked up every time around
+    while (value_truthy(arith(in, AST_LT, *global_ref(in, data->ident), end))) {
+        interp_body(iv, data->body, data->stmt_count);
+
+        Value* var = global_ref(in, data->ident);
+        *var = arith(in, AST_ADD, *var, value_num(1));
+    }
+
+    scope_forget(&sv);
+
+    // a nested loop runs once per time around the outer one
+    arena_set_pos_back(iv->scratch, start);
+}
+
+static bool interp_cond(InterpVisitor* iv, AST* expr) {
+    ast_walk(iv->scratch, expr, &iv->v);
+    return value_truthy(pop(iv->in));
+}
+
+static void interp_while(InterpVisitor* iv, AST* ast) {
+    struct AST_WHILE* data = &ast->data.AST_WHILE;
+    u64 start = iv->scratch->pos_u64;
+
+    ScopeVisitor sv;
+    scope_collect(iv, &sv, data->body, data->stmt_count);
+
+    while (interp_cond(iv, data->expr)) {
+        interp_body(iv, data->body, data->stmt_count);
+    }
+
+    scope_forget(&sv);
+    arena_set_pos_back(iv->scratch, start);
+}
+
+// names the branch that ran brings in are gone after it, like a loop's
+static void interp_if(InterpVisitor* iv, AST* ast) {
+    struct AST_IF* data = &ast->data.AST_IF;
+    u64 start = iv->scratch->pos_u64;
+
+    bool taken = interp_cond(iv, data->expr);
+    AST** body = taken ? data->body : data->else_body;
+    u32 count = taken ? data->stmt_count : data->else_count;
+
+    ScopeVisitor sv;
+    scope_collect(iv, &sv, body, count);
+    interp_body(iv, body, count);
+    scope_forget(&sv);
+
+    arena_set_pos_back(iv->scratch, start);
+}
+
+static bool interp_pre(AstVisitor* v, AST* ast) {
+    Interp* in = ((InterpVisitor*)v)->in;
+
+    switch (ast->tag) {
+        case AST_NIL:    push(in, VALUE_NIL); return true;
+        case AST_NUMBER: push(in, value_num(ast->data.AST_NUMBER.val)); return true;
+        case AST_BOOL:   push(in, value_bool(ast->data.AST_BOOL.val)); return true;
+        case AST_STR: {
+            push(in, value_str_lit(in->arena, ast->data.AST_STR.str));
+            return true;
+        }
+        case AST_IDENT: {
+            push(in, *global_ref(in, ast->data.AST_IDENT.ident));
+            return true;
+        }
+        case AST_FOR: {
+            interp_for((InterpVisitor*)v, ast);
+            return false;
+        }
+        case AST_WHILE: {
+            interp_while((InterpVisitor*)v, ast);
+            return false;
+        }
+        case AST_IF: {
+            interp_if((InterpVisitor*)v, ast);
+            return false;
+        }
+        case AST_RANGE: err("Ranges can only be looped over or indexed", 0, 0);
+        case AST_BLOCK: err("Blocks are not supported by the interpreter", 0, 0);
+        case AST_VASM:  err("vasm is not supported by the interpreter", 0, 0);
+        default: return true;
+    }
+}
+
+static void interp_post(AstVisitor* v, AST* ast) {
+    Interp* in = ((InterpVisitor*)v)->in;
+
+    switch (ast->tag) {
+        case AST_EQ: case AST_NEQ: case AST_GT: case AST_GTE:
+        case AST_LT: case AST_LTE: case AST_AND: case AST_OR:
+        case AST_ADD: case AST_SUB: case AST_MUL: case AST_DIV: {
+            Value r = pop(in);
+            Value l = pop(in);
+            push(in, arith(in, ast->tag, l, r));
+            return;
+        }
+        case AST_ADDEQ: case AST_SUBEQ: case AST_MULEQ: case AST_DIVEQ: {
+            // all four share the { ident, expr } layout
+            Value* var = global_ref(in, ast->data.AST_ADDEQ.ident);
+            Value r = pop(in);
+            *var = arith(in, ast->tag, *var, r);
+            return;
+        }
+        case AST_NOT: {
+            push(in, value_bool(!value_truthy(pop(in))));
+            return;
+        }
+        case AST_NEGATE: {
+            push(in, value_num(-value_expect_num(pop(in), "-")));
+            return;
+        }
+        case AST_ARRAY: {
+            u32 count = ast->data.AST_ARRAY.count;
+            in->sp -= count;
+            push(in, value_array(in->arena, in->stack + in->sp, count));
+            return;
+        }
+        case AST_INDEX: {
+            Value index = pop(in);
+            push(in, value_index(pop(in), index));
+            return;
+        }
+        case AST_LEN: {
+            push(in, value_len(pop(in)));
+            return;
+        }
+        case AST_LET: {
+            *interp_global(in, ast->data.AST_LET.ident, true) = pop(in);
+            return;
+        }
+        case AST_PRINT: {
+            value_print(in->out, pop(in));
+            fputc('\n', in->out);
+            return;
+        }
+        default: return;
+    }
+}
+
+void interp_run(Interp* in, Arena* scratch, AST* ast) {
+    InterpVisitor iv = {{interp_pre, 0, interp_post}, in, scratch};
+    ast_walk(scratch, ast, &iv.v);
+}
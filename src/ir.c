@@ -0,0 +1,859 @@
+#include "include/ir.h"
+#include "include/arena.h"
+#include "include/ast.h"
+#include "include/err.h"
+#include "include/hashmap.h"
+#include "include/number.h"
+#include "include/stats.h"
+#include "include/string.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define IR_CODE_INIT 64
+#define IR_SYMS_INIT 64
+
+// emitf writes one instruction, emitl anything else (labels, spacing)
+#define emitf(f, ...) \
+    (STATS_ADD(instructions, 1), STATS_ADD(out_bytes, fprintf(f, __VA_ARGS__)))
+#define emitl(f, ...) STATS_ADD(out_bytes, fprintf(f, __VA_ARGS__))
+
+/*
+*  Symbols
+*/
+
+IrSymbols* ir_symbols_new(Arena* a) {
+    IrSymbols* syms = AllocArrayZero(a, IrSymbols, 1);
+    syms->arena = a;
+
+    syms->cap = IR_SYMS_INIT;
+    syms->names = AllocArray(a, String, syms->cap);
+    syms->ints = AllocArrayZero(a, bool, syms->cap);
+
+    syms->table_cap = IR_SYMS_INIT * 2;
+    syms->table = AllocArrayZero(a, u32, syms->table_cap);
+    return syms;
+}
+
+static void symbols_rehash(IrSymbols* syms) {
+    syms->table_cap *= 2;
+    syms->table = AllocArrayZero(syms->arena, u32, syms->table_cap);
+
+    for (u32 slot = 0; slot < syms->count; ++slot) {
+        u32 i = string_hash(syms->names[slot]) & (syms->table_cap - 1);
+        while (syms->table[i]) {
+            i = (i + 1) & (syms->table_cap - 1);
+        }
+        syms->table[i] = slot + 1;
+    }
+}
+
+// the table index name sits at, or the empty one it would go in
+static u32 symbols_probe(IrSymbols* syms, String name) {
+    u32 i = string_hash(name) & (syms->table_cap - 1);
+    while (syms->table[i]) {
+        u32 slot = syms->table[i] - 1;
+        if (string_eq(syms->names[slot], name)) {
+            return i;
+        }
+        i = (i + 1) & (syms->table_cap - 1);
+    }
+    return i;
+}
+
+i32 ir_symbol_find(IrSymbols* syms, String name) {
+    return (i32)syms->table[symbols_probe(syms, name)] - 1;
+}
+
+u32 ir_symbol(IrSymbols* syms, String name) {
+    u32 i = symbols_probe(syms, name);
+    if (syms->table[i]) {
+        return syms->table[i] - 1;
+    }
+
+    if (syms->count == syms->cap) {
+        syms->names = arena_realloc(syms->arena, syms->names,
+                                    sizeof(String) * syms->cap,
+                                    sizeof(String) * syms->cap * 2);
+        syms->ints = arena_realloc(syms->arena, syms->ints,
+                                   sizeof(bool) * syms->cap,
+                                   sizeof(bool) * syms->cap * 2);
+        syms->cap *= 2;
+    }
+
+    // names can point into a statement that is about to be rewound
+    String copy = string_alloc(syms->arena, name.len);
+    memcpy(copy.data, name.data, name.len);
+    copy.data[name.len] = '\0';
+
+    u32 slot = syms->count++;
+    syms->names[slot] = copy;
+    syms->ints[slot] = false;
+    syms->table[i] = slot + 1;
+
+    if (syms->count * 2 > syms->table_cap) {
+        symbols_rehash(syms);
+    }
+
+    return slot;
+}
+
+const char* ir_fn_str(IrFn fn) {
+    switch (fn) {
+        case IrFn_Eq:       return "eq";
+        case IrFn_Neq:      return "neq";
+        case IrFn_Gt:       return "gt";
+        case IrFn_Gte:      return "gte";
+        case IrFn_Lt:       return "lt";
+        case IrFn_Lte:      return "lte";
+        case IrFn_And:      return "and";
+        case IrFn_Or:       return "or";
+        case IrFn_Not:      return "not";
+        case IrFn_Add:      return "Add";
+        case IrFn_Sub:      return "Sub";
+        case IrFn_Mult:     return "Mult";
+        case IrFn_Div:      return "Div";
+        case IrFn_PrintStr: return "print_str";
+        default:            return "unreachable";
+    }
+}
+
+void ir_push(Arena* a, IrProgram* ir, IrInst inst) {
+    if (ir->count == ir->cap) {
+        u32 cap = ir->cap ? ir->cap * 2 : IR_CODE_INIT;
+        ir->code = arena_realloc(a, ir->code, sizeof(IrInst) * ir->cap,
+                                              sizeof(IrInst) * cap);
+        ir->cap = cap;
+    }
+    ir->code[ir->count++] = inst;
+}
+
+/*
+*  Lowering
+*/
+
+typedef struct {
+    AstVisitor v;
+    Arena*     a;
+    IrProgram* ir;
+    HashMap*   map;
+
+    // one flag per finished subexpression: is it known to be an integer
+    bool*      ints;
+    u32        int_count;
+    u32        int_cap;
+} LowerVisitor;
+
+static IrInst ir_op(IrOp op) {
+    return (IrInst){ .op = op };
+}
+
+static IrInst ir_slot(IrOp op, IrSymbols* syms, String name) {
+    return (IrInst){ .op = op, .as.slot = ir_symbol(syms, name) };
+}
+
+static IrInst ir_call(IrFn fn, i32 dst, u32 argc, u32 arg0, u32 arg1) {
+    IrInst inst = { .op = Ir_Call };
+    inst.as.call.fn = fn;
+    inst.as.call.dst = dst;
+    inst.as.call.argc = argc;
+    inst.as.call.args[0] = (IrArg){ .slot = arg0 };
+    inst.as.call.args[1] = (IrArg){ .slot = arg1 };
+    return inst;
+}
+
+static void ints_push(LowerVisitor* lv, bool is_int) {
+    if (lv->int_count == lv->int_cap) {
+        u32 cap = lv->int_cap * 2;
+        lv->ints = arena_realloc(lv->a, lv->ints, lv->int_cap, cap);
+        lv->int_cap = cap;
+    }
+    lv->ints[lv->int_count++] = is_int;
+}
+
+static bool ints_pop(LowerVisitor* lv) {
+    assert(lv->int_count > 0);
+    return lv->ints[--lv->int_count];
+}
+
+static IrFn binary_fn(u32 tag) {
+    switch (tag) {
+        case AST_EQ:  return IrFn_Eq;
+        case AST_NEQ: return IrFn_Neq;
+        case AST_GT:  return IrFn_Gt;
+        case AST_GTE: return IrFn_Gte;
+        case AST_LT:  return IrFn_Lt;
+        case AST_LTE: return IrFn_Lte;
+        case AST_AND: return IrFn_And;
+        case AST_OR:  return IrFn_Or;
+        default:      return IrFnCount;
+    }
+}
+
+static void lower_for(LowerVisitor* lv, AST* ast);
+static void lower_while(LowerVisitor* lv, AST* ast);
+static void lower_if(LowerVisitor* lv, AST* ast);
+
+// The block's own scratch. Its names come out as _vasm_ and a letter, so
+// these can't be one of them, or one of the program's variables.
+#define VASM_TMP   "_vasm__tmp"
+#define VASM_TMP_A "_vasm__a"
+#define VASM_TMP_B "_vasm__b"
+
+// A {name} the block reads can have been folded into a literal or
+// substituted by the time it gets here, anything but a name gets
+// evaluated into scratch first
+static bool vasm_folded(struct AST_VASM* data, VasmArg* arg) {
+    return arg->kind == VasmArg_Var && data->vars[arg->var]->tag != AST_IDENT;
+}
+
+static u32 vasm_slot(LowerVisitor* lv, struct AST_VASM* data, VasmArg* arg, const char* scratch) {
+    IrSymbols* syms = lv->ir->syms;
+    if (arg->kind == VasmArg_Name) return ir_symbol(syms, arg->name);
+
+    AST* var = data->vars[arg->var];
+    if (var->tag == AST_IDENT) return ir_symbol(syms, var->data.AST_IDENT.ident);
+
+    u32 slot = ir_symbol(syms, string((char*)scratch));
+    ast_walk(lv->a, var, &lv->v);
+    ints_pop(lv);
+    ir_push(lv->a, lv->ir, (IrInst){ .op = Ir_Pop, .as.slot = slot });
+    return slot;
+}
+
+static bool vasm_imm(struct AST_VASM* data, VasmArg* arg) {
+    return arg->kind == VasmArg_Num || (vasm_folded(data, arg) && data->vars[arg->var]->tag == AST_NUMBER);
+}
+
+// a name the block assigns, which isn't known to hold an integer after
+static u32 vasm_dst(LowerVisitor* lv, struct AST_VASM* data, VasmArg* arg) {
+    IrSymbols* syms = lv->ir->syms;
+    String name = arg->kind == VasmArg_Var ? data->vars[arg->var]->data.AST_IDENT.ident : arg->name;
+    u32 slot = ir_symbol(syms, name);
+    syms->ints[slot] = false;
+    return slot;
+}
+
+// remembers whether a block's own scratch name still holds something
+static void vasm_track(u32* names, bool* live, u32* count, u32 slot, bool alive) {
+    for (u32 i = 0; i < *count; ++i) {
+        if (names[i] == slot) {
+            live[i] = alive;
+            return;
+        }
+    }
+    names[*count] = slot;
+    live[(*count)++] = alive;
+}
+
+// the block's instructions go in as they are, so the peephole and the
+// backends get them the same as anything the compiler made
+static void lower_vasm(LowerVisitor* lv, AST* ast) {
+    struct AST_VASM* data = &ast->data.AST_VASM;
+    Arena* a = lv->a;
+    IrProgram* ir = lv->ir;
+    IrSymbols* syms = ir->syms;
+
+    // the _vasm_ names only mean something inside the block, so whatever
+    // is still in them gets dropped at the end. Two more for the scratch.
+    u32* names = AllocArray(a, u32, data->count + 2);
+    bool* live = AllocArray(a, bool, data->count + 2);
+    u32 name_count = 0;
+
+    for (u32 i = 0; i < data->count; ++i) {
+        VasmInst* inst = &data->code[i];
+
+        switch ((IrOp)inst->op) {
+            case Ir_Int:   ir_push(a, ir, (IrInst){ .op = Ir_Int, .as.i = inst->args[0].i }); break;
+            case Ir_Push:  ir_push(a, ir, (IrInst){ .op = Ir_Push, .as.num = inst->args[0].num }); break;
+            case Ir_Str:   ir_push(a, ir, (IrInst){ .op = Ir_Str, .as.str = inst->str }); break;
+            case Ir_Array: ir_push(a, ir, (IrInst){ .op = Ir_Array, .as.count = inst->count }); break;
+            case Ir_Load: {
+                // a folded read is pushed the way any expression is
+                if (vasm_folded(data, &inst->args[0])) {
+                    ast_walk(a, data->vars[inst->args[0].var], &lv->v);
+                    ints_pop(lv);
+                    break;
+                }
+                u32 slot = vasm_slot(lv, data, &inst->args[0], VASM_TMP);
+                ir_push(a, ir, (IrInst){ .op = Ir_Load, .as.slot = slot });
+                break;
+            }
+            case Ir_Pop: {
+                u32 slot = vasm_dst(lv, data, &inst->args[0]);
+                if (inst->args[0].kind == VasmArg_Name) vasm_track(names, live, &name_count, slot, true);
+                ir_push(a, ir, (IrInst){ .op = Ir_Pop, .as.slot = slot });
+                break;
+            }
+            case Ir_Del: {
+                u32 slot = ir_symbol(syms, inst->args[0].name);
+                vasm_track(names, live, &name_count, slot, false);
+                ir_push(a, ir, (IrInst){ .op = Ir_Del, .as.slot = slot });
+                break;
+            }
+            case Ir_Print: {
+                u32 slot = vasm_slot(lv, data, &inst->args[0], VASM_TMP);
+                ir_push(a, ir, (IrInst){ .op = Ir_Print, .as.slot = slot });
+                if (vasm_folded(data, &inst->args[0])) {
+                    ir_push(a, ir, (IrInst){ .op = Ir_Del, .as.slot = slot });
+                }
+                break;
+            }
+            // numbers are immediates. Anything else that got folded goes
+            // on the stack before any of it gets popped, so working out b
+            // can't clobber a.
+            case Ir_Call: {
+                IrInst call = ir_call(inst->fn, IR_NO_DST, inst->argc, 0, 0);
+                const char* scratch[IR_MAX_ARGS] = { VASM_TMP_A, VASM_TMP_B };
+
+                for (u32 arg = 0; arg < inst->argc; ++arg) {
+                    VasmArg* from = &inst->args[arg];
+                    if (vasm_imm(data, from) || !vasm_folded(data, from)) continue;
+                    ast_walk(a, data->vars[from->var], &lv->v);
+                    ints_pop(lv);
+                }
+                for (u32 arg = inst->argc; arg-- > 0;) {
+                    VasmArg* from = &inst->args[arg];
+                    IrArg* to = &call.as.call.args[arg];
+                    if (from->kind == VasmArg_Num) {
+                        *to = (IrArg){ .imm = true, .is_int = from->is_int, .num = from->num, .i = from->i };
+                    } else if (vasm_imm(data, from)) {
+                        struct AST_NUMBER* n = &data->vars[from->var]->data.AST_NUMBER;
+                        *to = (IrArg){ .imm = true, .is_int = n->is_int, .num = n->val, .i = n->i };
+                    } else if (vasm_folded(data, from)) {
+                        *to = (IrArg){ .slot = ir_symbol(syms, string((char*)scratch[arg])) };
+                        vasm_track(names, live, &name_count, to->slot, true);
+                        ir_push(a, ir, (IrInst){ .op = Ir_Pop, .as.slot = to->slot });
+                    } else {
+                        *to = (IrArg){ .slot = vasm_slot(lv, data, from, 0) };
+                    }
+                }
+
+                if (inst->has_dst) {
+                    call.as.call.dst = vasm_dst(lv, data, &inst->dst);
+                    if (inst->dst.kind == VasmArg_Name) {
+                        vasm_track(names, live, &name_count, call.as.call.dst, true);
+                    }
+                }
+                ir_push(a, ir, call);
+                break;
+            }
+            default: ir_push(a, ir, ir_op(inst->op)); break;
+        }
+    }
+
+    for (u32 i = 0; i < name_count; ++i) {
+        if (live[i]) ir_push(a, ir, (IrInst){ .op = Ir_Del, .as.slot = names[i] });
+    }
+}
+
+static bool lower_pre(AstVisitor* v, AST* ast) {
+    LowerVisitor* lv = (LowerVisitor*)v;
+
+    switch (ast->tag) {
+        case AST_NIL: {
+            ir_push(lv->a, lv->ir, ir_op(Ir_Nil));
+            return true;
+        }
+        case AST_NUMBER: {
+            struct AST_NUMBER* data = &ast->data.AST_NUMBER;
+            if (data->is_int) {
+                ir_push(lv->a, lv->ir, (IrInst){ .op = Ir_Int, .as.i = data->i });
+            } else {
+                ir_push(lv->a, lv->ir, (IrInst){ .op = Ir_Push, .as.num = data->val });
+            }
+            return true;
+        }
+        case AST_STR: {
+            ir_push(lv->a, lv->ir, (IrInst){ .op = Ir_Str, .as.str = ast->data.AST_STR.str });
+            return true;
+        }
+        case AST_IDENT: {
+            ir_push(lv->a, lv->ir, ir_slot(Ir_Load, lv->ir->syms, ast->data.AST_IDENT.ident));
+            return true;
+        }
+        case AST_BOOL: {
+            ir_push(lv->a, lv->ir, (IrInst){ .op = Ir_Bool, .as.val = ast->data.AST_BOOL.val });
+            return true;
+        }
+        case AST_FOR: {
+            lower_for(lv, ast);
+            return false;
+        }
+        case AST_WHILE: {
+            lower_while(lv, ast);
+            return false;
+        }
+        case AST_IF: {
+            lower_if(lv, ast);
+            return false;
+        }
+        case AST_VASM: {
+            lower_vasm(lv, ast);
+            return false;
+        }
+        case AST_RANGE: err("Ranges can only be looped over or indexed", 0, 0);
+        case AST_BLOCK: return false;
+        default: return true;
+    }
+}
+
+// x op= expr: pop tmp, call Op x tmp | x
+static void lower_compound(LowerVisitor* lv, IrFn fn, String ident) {
+    IrSymbols* syms = lv->ir->syms;
+    u32 tmp = ir_symbol(syms, string(IR_TMP));
+    u32 var = ir_symbol(syms, ident);
+
+    ir_push(lv->a, lv->ir, (IrInst){ .op = Ir_Pop, .as.slot = tmp });
+    ir_push(lv->a, lv->ir, ir_call(fn, var, 2, var, tmp));
+}
+
+// x op= expr keeps x an integer only if expr is one too, and never past a
+// division
+static void lower_compound_ints(LowerVisitor* lv, String ident, bool div) {
+    IrSymbols* syms = lv->ir->syms;
+    u32 var = ir_symbol(syms, ident);
+    bool is_int = ints_pop(lv);
+    syms->ints[var] = syms->ints[var] && is_int && !div;
+}
+
+static void lower_post(AstVisitor* v, AST* ast) {
+    LowerVisitor* lv = (LowerVisitor*)v;
+    Arena* a = lv->a;
+    IrProgram* ir = lv->ir;
+    IrSymbols* syms = ir->syms;
+
+    switch (ast->tag) {
+        case AST_NUMBER: ints_push(lv, ast->data.AST_NUMBER.is_int); return;
+        case AST_IDENT:  ints_push(lv, syms->ints[ir_symbol(syms, ast->data.AST_IDENT.ident)]); return;
+        case AST_STR: case AST_BOOL: case AST_NIL: ints_push(lv, false); return;
+        case AST_NOT: {
+            u32 tmp = ir_symbol(syms, string(IR_TMP));
+            ir_push(a, ir, (IrInst){ .op = Ir_Pop, .as.slot = tmp });
+            ir_push(a, ir, ir_call(IrFn_Not, IR_NO_DST, 1, tmp, 0));
+            ir_push(a, ir, (IrInst){ .op = Ir_Del, .as.slot = tmp });
+            ints_pop(lv);
+            ints_push(lv, false);
+            return;
+        }
+        case AST_EQ: case AST_NEQ: case AST_GT: case AST_GTE:
+        case AST_LT: case AST_LTE: case AST_AND: case AST_OR: {
+            // both sides are on the stack before either gets popped, so a
+            // comparison nested on the right can't clobber a
+            u32 ra = ir_symbol(syms, string(IR_TMP_A));
+            u32 rb = ir_symbol(syms, string(IR_TMP_B));
+            ir_push(a, ir, (IrInst){ .op = Ir_Pop, .as.slot = rb });
+            ir_push(a, ir, (IrInst){ .op = Ir_Pop, .as.slot = ra });
+            ir_push(a, ir, ir_call(binary_fn(ast->tag), IR_NO_DST, 2, ra, rb));
+            ints_pop(lv);
+            ints_pop(lv);
+            ints_push(lv, false);
+            return;
+        }
+        case AST_ADD: case AST_SUB: case AST_MUL: {
+            bool is_int = ints_pop(lv) & ints_pop(lv);
+            if (ast->tag == AST_ADD) {
+                ir_push(a, ir, ir_op(is_int ? Ir_IAdd : Ir_Add));
+            } else if (ast->tag == AST_SUB) {
+                ir_push(a, ir, ir_op(Ir_Swap));
+                ir_push(a, ir, ir_op(is_int ? Ir_ISub : Ir_Sub));
+            } else {
+                ir_push(a, ir, ir_op(is_int ? Ir_IMult : Ir_Mult));
+            }
+            ints_push(lv, is_int);
+            return;
+        }
+        case AST_DIV: {
+            ir_push(a, ir, ir_op(Ir_Swap));
+            ir_push(a, ir, ir_op(Ir_Div));
+            ints_pop(lv);
+            ints_pop(lv);
+            ints_push(lv, false);
+            return;
+        }
+        case AST_ADDEQ: {
+            lower_compound(lv, IrFn_Add, ast->data.AST_ADDEQ.ident);
+            lower_compound_ints(lv, ast->data.AST_ADDEQ.ident, false);
+            return;
+        }
+        case AST_SUBEQ: {
+            lower_compound(lv, IrFn_Sub, ast->data.AST_SUBEQ.ident);
+            lower_compound_ints(lv, ast->data.AST_SUBEQ.ident, false);
+            return;
+        }
+        case AST_MULEQ: {
+            lower_compound(lv, IrFn_Mult, ast->data.AST_MULEQ.ident);
+            lower_compound_ints(lv, ast->data.AST_MULEQ.ident, false);
+            return;
+        }
+        case AST_DIVEQ: {
+            lower_compound(lv, IrFn_Div, ast->data.AST_DIVEQ.ident);
+            lower_compound_ints(lv, ast->data.AST_DIVEQ.ident, true);
+            return;
+        }
+        case AST_ARRAY: {
+            u32 count = ast->data.AST_ARRAY.count;
+            ir_push(a, ir, (IrInst){ .op = Ir_Array, .as.count = count });
+            lv->int_count -= count;
+            ints_push(lv, false);
+            return;
+        }
+        case AST_INDEX: {
+            ir_push(a, ir, ir_op(ast->data.AST_INDEX.unchecked ? Ir_IndexU : Ir_Index));
+            ints_pop(lv);
+            ints_pop(lv);
+            ints_push(lv, false);
+            return;
+        }
+        case AST_LEN: {
+            ir_push(a, ir, ir_op(Ir_Len));
+            ints_pop(lv);
+            ints_push(lv, true);
+            return;
+        }
+        case AST_NEGATE: {
+            bool is_int = ints_pop(lv);
+            ir_push(a, ir, (IrInst){ .op = Ir_Int, .as.i = -1 });
+            ir_push(a, ir, ir_op(is_int ? Ir_IMult : Ir_Mult));
+            ints_push(lv, is_int);
+            return;
+        }
+        case AST_LET: {
+            u32 var = ir_symbol(syms, ast->data.AST_LET.ident);
+            ir_push(a, ir, (IrInst){ .op = Ir_Pop, .as.slot = var });
+            syms->ints[var] = ints_pop(lv);
+            return;
+        }
+        case AST_PRINT: {
+            struct AST_PRINT* data = &ast->data.AST_PRINT;
+            u32 tmp = ir_symbol(syms, string(IR_TMP_VAR));
+            ir_push(a, ir, (IrInst){ .op = Ir_Pop, .as.slot = tmp });
+            ints_pop(lv);
+
+            bool is_str = data->expr->tag == AST_STR ||
+                (data->expr->tag == AST_IDENT &&
+                 hashmap_get(lv->map, data->expr->data.AST_IDENT.ident) == TypeStr);
+
+            if (is_str) {
+                ir_push(a, ir, ir_call(IrFn_PrintStr, IR_NO_DST, 1, tmp, 0));
+            } else {
+                ir_push(a, ir, (IrInst){ .op = Ir_Print, .as.slot = tmp });
+            }
+
+            ir_push(a, ir, (IrInst){ .op = Ir_Del, .as.slot = tmp });
+            return;
+        }
+        default: return;
+    }
+}
+
+static IrInst ir_jump(IrOp op, u32 block) {
+    return (IrInst){ .op = op, .as.label = block };
+}
+
+static void lower_body(LowerVisitor* lv, AST** body, u32 count) {
+    u32 tmp = ir_symbol(lv->ir->syms, string(IR_TMP));
+
+    for (u32 i = 0; i < count; ++i) {
+        lv->int_count = 0;
+        ast_walk(lv->a, body[i], &lv->v);
+
+        // a bare expression leaves its value behind, which would pile up
+        if (lv->int_count) {
+            ir_push(lv->a, lv->ir, (IrInst){ .op = Ir_Pop, .as.slot = tmp });
+        }
+    }
+}
+
+// One pass over the loop: the condition, the body and for a for loop the
+// increment.
+//
+//   blk_top:
+//   push i, push end, pop _b, pop _a, call lt _a _b
+//   jmpf blk_exit
+//   <body>
+//   push 1, pop _tmp, call Add i _tmp | i
+//   jmp blk_top
+//   blk_exit:
+static void lower_loop(LowerVisitor* lv, AST* ast, u32 var, u32 end) {
+    Arena* a = lv->a;
+    IrProgram* ir = lv->ir;
+    IrSymbols* syms = ir->syms;
+    u32 ra = ir_symbol(syms, string(IR_TMP_A));
+    u32 rb = ir_symbol(syms, string(IR_TMP_B));
+    u32 tmp = ir_symbol(syms, string(IR_TMP));
+
+    u32 top = ir->blocks++;
+    u32 exit = ir->blocks++;
+
+    ir_push(a, ir, ir_jump(Ir_Target, top));
+    if (ast->tag == AST_FOR) {
+        ir_push(a, ir, (IrInst){ .op = Ir_Load, .as.slot = var });
+        ir_push(a, ir, (IrInst){ .op = Ir_Load, .as.slot = end });
+        ir_push(a, ir, (IrInst){ .op = Ir_Pop, .as.slot = rb });
+        ir_push(a, ir, (IrInst){ .op = Ir_Pop, .as.slot = ra });
+        ir_push(a, ir, ir_call(IrFn_Lt, IR_NO_DST, 2, ra, rb));
+    } else {
+        lv->int_count = 0;
+        ast_walk(a, ast->data.AST_WHILE.expr, &lv->v);
+        ints_pop(lv);
+    }
+    ir_push(a, ir, ir_jump(Ir_JmpF, exit));
+
+    if (ast->tag == AST_FOR) {
+        lower_body(lv, ast->data.AST_FOR.body, ast->data.AST_FOR.stmt_count);
+        ir_push(a, ir, (IrInst){ .op = Ir_Int, .as.i = 1 });
+        ir_push(a, ir, (IrInst){ .op = Ir_Pop, .as.slot = tmp });
+        ir_push(a, ir, ir_call(IrFn_Add, var, 2, var, tmp));
+    } else {
+        lower_body(lv, ast->data.AST_WHILE.body, ast->data.AST_WHILE.stmt_count);
+    }
+
+    ir_push(a, ir, ir_jump(Ir_Jmp, top));
+    ir_push(a, ir, ir_jump(Ir_Target, exit));
+}
+
+// Integer flags have to hold on the way back around too, so the loop is
+// lowered until they stop changing: every pass can only clear flags, so
+// that's at most one pass per variable.
+static void lower_repeat(LowerVisitor* lv, AST* ast, u32 var, u32 end) {
+    IrProgram* ir = lv->ir;
+    IrSymbols* syms = ir->syms;
+
+    u32 count = syms->count;
+    bool* entry = AllocArray(lv->a, bool, count);
+    memcpy(entry, syms->ints, count);
+
+    u32 at = ir->count;
+    u32 blocks = ir->blocks;
+    for (;;) {
+        lower_loop(lv, ast, var, end);
+
+        bool changed = false;
+        for (u32 slot = 0; slot < count; ++slot) {
+            if (entry[slot] && !syms->ints[slot]) {
+                entry[slot] = false;
+                changed = true;
+            }
+        }
+        memcpy(syms->ints, entry, count);
+        if (!changed) break;
+
+        ir->count = at;
+        ir->blocks = blocks;
+    }
+
+    // names the body brought in are gone after the loop
+    for (u32 slot = count; slot < syms->count; ++slot) {
+        syms->ints[slot] = false;
+    }
+    lv->int_count = 0;
+}
+
+// The range is never built, i counts from start up to the end, which is
+// evaluated once into a hidden variable
+static void lower_for(LowerVisitor* lv, AST* ast) {
+    struct AST_FOR* data = &ast->data.AST_FOR;
+    IrProgram* ir = lv->ir;
+    IrSymbols* syms = ir->syms;
+
+    lv->int_count = 0;
+    ast_walk(lv->a, data->start, &lv->v);
+    bool start_int = ints_pop(lv);
+    u32 var = ir_symbol(syms, data->ident);
+    ir_push(lv->a, ir, (IrInst){ .op = Ir_Pop, .as.slot = var });
+
+    ast_walk(lv->a, data->end, &lv->v);
+    ints_pop(lv);
+    u32 end = ir_symbol(syms, data->end_var);
+    ir_push(lv->a, ir, (IrInst){ .op = Ir_Pop, .as.slot = end });
+
+    syms->ints[var] = start_int;
+    lower_repeat(lv, ast, var, end);
+}
+
+static void lower_while(LowerVisitor* lv, AST* ast) {
+    lower_repeat(lv, ast, 0, 0);
+}
+
+//   <expr>
+//   jmpf blk_else
+//   <body>
+//   jmp blk_end
+//   blk_else:
+//   <else body>
+//   blk_end:
+//
+// without an else it's just the jmpf over the body. A name comes out an
+// integer only if it is one at the end of both ways through.
+static void lower_if(LowerVisitor* lv, AST* ast) {
+    struct AST_IF* data = &ast->data.AST_IF;
+    Arena* a = lv->a;
+    IrProgram* ir = lv->ir;
+    IrSymbols* syms = ir->syms;
+
+    lv->int_count = 0;
+    ast_walk(a, data->expr, &lv->v);
+    ints_pop(lv);
+
+    u32 other = ir->blocks++;
+    ir_push(a, ir, ir_jump(Ir_JmpF, other));
+
+    u32 count = syms->count;
+    bool* entry = AllocArray(a, bool, count);
+    memcpy(entry, syms->ints, count);
+
+    lower_body(lv, data->body, data->stmt_count);
+
+    if (data->else_count) {
+        u32 end = ir->blocks++;
+        ir_push(a, ir, ir_jump(Ir_Jmp, end));
+        ir_push(a, ir, ir_jump(Ir_Target, other));
+
+        bool* then = AllocArray(a, bool, count);
+        memcpy(then, syms->ints, count);
+        memcpy(syms->ints, entry, count);
+
+        lower_body(lv, data->else_body, data->else_count);
+        ir_push(a, ir, ir_jump(Ir_Target, end));
+        entry = then;
+    } else {
+        ir_push(a, ir, ir_jump(Ir_Target, other));
+    }
+
+    for (u32 slot = 0; slot < count; ++slot) {
+        syms->ints[slot] = syms->ints[slot] && entry[slot];
+    }
+
+    // same as loops, whatever a branch brings in is gone after it
+    for (u32 slot = count; slot < syms->count; ++slot) {
+        syms->ints[slot] = false;
+    }
+    lv->int_count = 0;
+}
+
+void ir_lower_begin(Arena* a, IrProgram* ir) {
+    ir_push(a, ir, (IrInst){ .op = Ir_Label, .as.label = 0 });
+}
+
+static void lower_stmt(LowerVisitor* lv, AST* stmt, u32 index) {
+    ArenaTag prev_tag = arena_set_tag(lv->a, ArenaTag_Emitter);
+
+    // a bare expression statement leaves its flag behind
+    lv->int_count = 0;
+    ast_walk(lv->a, stmt, &lv->v);
+    ir_push(lv->a, lv->ir, (IrInst){ .op = Ir_Label, .as.label = index + 1 });
+
+    arena_set_tag(lv->a, prev_tag);
+}
+
+void ir_lower_stmt(Arena* a, IrProgram* ir, AST* stmt, HashMap* map, u32 index) {
+    // ahead of the code so the code can keep growing in place
+    LowerVisitor lv = {{lower_pre, 0, lower_post}, a, ir, map, 0, 0, IR_CODE_INIT};
+    lv.ints = AllocArray(a, bool, lv.int_cap);
+    lower_stmt(&lv, stmt, index);
+}
+
+void ir_lower_end(Arena* a, IrProgram* ir) {
+    ir_push(a, ir, ir_op(Ir_Stop));
+}
+
+void ir_lower(Arena* a, IrProgram* ir, AST* program, HashMap* map) {
+    assert(program->tag == AST_PROGRAM);
+    struct AST_PROGRAM* data = &program->data.AST_PROGRAM;
+
+    LowerVisitor lv = {{lower_pre, 0, lower_post}, a, ir, map, 0, 0, IR_CODE_INIT};
+    lv.ints = AllocArray(a, bool, lv.int_cap);
+
+    ir_lower_begin(a, ir);
+    for (u32 i = 0; i < data->stmt_count; ++i) {
+        lower_stmt(&lv, data->body[i], i);
+    }
+    ir_lower_end(a, ir);
+}
+
+/*
+*  Text
+*/
+
+void ir_emit_header(FILE* f) {
+    emitf(f, "import \"stdlib.mv\"\n\n");
+    emitf(f, "jmp init_stdlib\n\n");
+    emitl(f, "start__:\n");
+}
+
+// shortest digits that read back as the same double, with a point so the
+// VM doesn't take it for an integer
+static const char* num_str(char* buf, f64 n) {
+    number_format(buf, n);
+    if (!strpbrk(buf, ".eni")) strcat(buf, ".0");
+    return buf;
+}
+
+static void emit_arg(IrSymbols* syms, IrArg arg, FILE* f) {
+    char buf[NUMBER_FMT_LEN + 2];
+    if (arg.imm && arg.is_int) {
+        emitl(f, " %lld", (long long)arg.i);
+    } else if (arg.imm) {
+        emitl(f, " %s", num_str(buf, arg.num));
+    } else {
+        emitl(f, " %s", syms->names[arg.slot].data);
+    }
+}
+
+void ir_emit(IrProgram* ir, FILE* f) {
+    IrSymbols* syms = ir->syms;
+    char buf[NUMBER_FMT_LEN + 2];
+
+    for (u32 i = 0; i < ir->count; ++i) {
+        IrInst* inst = &ir->code[i];
+
+        switch (inst->op) {
+            case Ir_Push:  emitf(f, "push %s\n", num_str(buf, inst->as.num)); break;
+            case Ir_Int:   emitf(f, "push %lld\n", (long long)inst->as.i); break;
+            case Ir_Bool:  emitf(f, "push %d\n", inst->as.val); break;
+            case Ir_Nil:   emitf(f, "push 0\n"); break;
+            case Ir_Str:   emitf(f, "str \"%s\"\n", inst->as.str.data); break;
+            case Ir_Load:  emitf(f, "push %s\n", syms->names[inst->as.slot].data); break;
+            case Ir_Pop:   emitf(f, "pop %s\n", syms->names[inst->as.slot].data); break;
+            case Ir_Del:   emitf(f, "del %s\n", syms->names[inst->as.slot].data); break;
+            case Ir_Swap:  emitf(f, "swap\n"); break;
+            case Ir_Add:   emitf(f, "add\n"); break;
+            case Ir_Sub:   emitf(f, "sub\n"); break;
+            case Ir_Mult:  emitf(f, "mult\n"); break;
+            case Ir_Div:   emitf(f, "div\n"); break;
+            case Ir_IAdd:  emitf(f, "iadd\n"); break;
+            case Ir_ISub:  emitf(f, "isub\n"); break;
+            case Ir_IMult: emitf(f, "imult\n"); break;
+            case Ir_Array:  emitf(f, "arr %u\n", inst->as.count); break;
+            case Ir_Index:  emitf(f, "index\n"); break;
+            case Ir_IndexU: emitf(f, "uindex\n"); break;
+            case Ir_Len:    emitf(f, "len\n"); break;
+            case Ir_Print: emitf(f, "print %s\n", syms->names[inst->as.slot].data); break;
+            case Ir_Call: {
+                emitf(f, "call %s", ir_fn_str(inst->as.call.fn));
+                for (u32 arg = 0; arg < inst->as.call.argc; ++arg) {
+                    emit_arg(syms, inst->as.call.args[arg], f);
+                }
+                if (inst->as.call.dst != IR_NO_DST) {
+                    emitl(f, " | %s", syms->names[inst->as.call.dst].data);
+                }
+                emitl(f, "\n");
+                break;
+            }
+            case Ir_Label: {
+                // addr_0 sits right under start__, the rest close off the
+                // statement before them
+                if (inst->as.label) emitl(f, "\n");
+                emitl(f, "addr_%d:\n", inst->as.label);
+                break;
+            }
+            case Ir_Target: emitl(f, "blk_%d:\n", inst->as.label); break;
+            case Ir_Jmp:    emitf(f, "jmp blk_%d\n", inst->as.label); break;
+            case Ir_JmpF:   emitf(f, "jmpf blk_%d\n", inst->as.label); break;
+            case Ir_Stop: emitf(f, "stop\n"); break;
+            default: assert(0 && "Unreachable");
+        }
+    }
+}
@@ -0,0 +1,527 @@
+#include "include/jit.h"
+#include "include/arena.h"
+#include "include/ir.h"
+#include "include/value.h"
+#include <string.h>
+#include <math.h>
+
+#if defined(__x86_64__) && defined(__linux__)
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define JIT_SIZE       (16 * 1024 * 1024)
+#define JIT_MIN_INSTS  8
+#define JIT_REGS       14   // xmm0-13 hold the stack, xmm14/15 are scratch
+#define JIT_INST_BYTES 64   // more than any one IR instruction turns into
+#define JIT_GUARD_BYTES 24
+
+enum {
+    Slot_Untouched,
+    Slot_Num,
+    Slot_Bool,
+    Slot_Other,
+};
+
+Jit* jit_new(Arena* a) {
+    Jit* jit = AllocArrayZero(a, Jit, 1);
+    jit->arena = a;
+    return jit;
+}
+
+void jit_free(Jit* jit) {
+    if (jit->mem) munmap(jit->mem, jit->cap);
+}
+
+/*
+*  Encoding
+*/
+
+typedef struct {
+    u8* data;
+    u32 len;
+} Buf;
+
+static void b1(Buf* b, u8 x) {
+    b->data[b->len++] = x;
+}
+
+static void b4(Buf* b, u32 x) {
+    memcpy(b->data + b->len, &x, 4);
+    b->len += 4;
+}
+
+static void b8(Buf* b, u64 x) {
+    memcpy(b->data + b->len, &x, 8);
+    b->len += 8;
+}
+
+// <prefix> 0F <op> between two xmm registers
+static void sse_rr(Buf* b, u8 prefix, u8 op, u32 reg, u32 rm) {
+    b1(b, prefix);
+    if (reg >= 8 || rm >= 8) b1(b, 0x40 | ((reg >= 8) << 2) | (rm >= 8));
+    b1(b, 0x0F);
+    b1(b, op);
+    b1(b, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+// <prefix> 0F <op> between an xmm register and [rdi + slot*8]
+static void sse_rm(Buf* b, u8 prefix, u8 op, u32 reg, u32 slot) {
+    b1(b, prefix);
+    if (reg >= 8) b1(b, 0x44);
+    b1(b, 0x0F);
+    b1(b, op);
+    b1(b, 0x80 | ((reg & 7) << 3) | 7);
+    b4(b, slot * sizeof(Value));
+}
+
+#define movsd_load(b, x, slot)  sse_rm(b, 0xF2, 0x10, x, slot)
+#define movsd_store(b, x, slot) sse_rm(b, 0xF2, 0x11, x, slot)
+#define movapd(b, dst, src)     sse_rr(b, 0x66, 0x28, dst, src)
+#define ucomisd(b, x, y)        sse_rr(b, 0x66, 0x2E, x, y)
+
+// mov r64, imm64 for rax (0) or rcx (1)
+static void mov_imm(Buf* b, u32 gpr, u64 imm) {
+    b1(b, 0x48);
+    b1(b, 0xB8 + gpr);
+    b8(b, imm);
+}
+
+// movq xmm, r64
+static void movq_xmm(Buf* b, u32 x, u32 gpr) {
+    b1(b, 0x66);
+    b1(b, 0x48 | ((x >= 8) << 2));
+    b1(b, 0x0F);
+    b1(b, 0x6E);
+    b1(b, 0xC0 | ((x & 7) << 3) | gpr);
+}
+
+static void load_const(Buf* b, u32 x, Value v) {
+    mov_imm(b, 0, v);
+    movq_xmm(b, x, 0);
+}
+
+// x86 makes a negative NaN out of 0/0 and friends, value_num always
+// hands out the positive one
+static void canon_nan(Buf* b, u32 x) {
+    ucomisd(b, x, x);
+    b1(b, 0x7B); b1(b, 15);     // jnp over the next 15 bytes
+    load_const(b, x, value_num(NAN));
+}
+
+static void load_arg(Buf* b, u32 x, IrArg arg) {
+    if (arg.imm) {
+        load_const(b, x, value_num(arg.num));
+    } else {
+        movsd_load(b, x, arg.slot);
+    }
+}
+
+static u8 arith_op(IrFn fn) {
+    switch (fn) {
+        case IrFn_Add:  return 0x58;
+        case IrFn_Mult: return 0x59;
+        case IrFn_Sub:  return 0x5C;
+        case IrFn_Div:  return 0x5E;
+        default:        return 0;
+    }
+}
+
+static bool is_cmp(IrFn fn) {
+    return fn == IrFn_Eq || fn == IrFn_Neq || fn == IrFn_Gt ||
+           fn == IrFn_Gte || fn == IrFn_Lt || fn == IrFn_Lte;
+}
+
+// x <fn> y into xmm dst as a boxed bool
+static void emit_cmp(Buf* b, IrFn fn, u32 dst, u32 x, u32 y) {
+    switch (fn) {
+        // unordered sets CF, so NaNs come out false for all four
+        case IrFn_Gt:  ucomisd(b, x, y); b1(b, 0x0F); b1(b, 0x97); b1(b, 0xC0); break;
+        case IrFn_Gte: ucomisd(b, x, y); b1(b, 0x0F); b1(b, 0x93); b1(b, 0xC0); break;
+        case IrFn_Lt:  ucomisd(b, y, x); b1(b, 0x0F); b1(b, 0x97); b1(b, 0xC0); break;
+        case IrFn_Lte: ucomisd(b, y, x); b1(b, 0x0F); b1(b, 0x93); b1(b, 0xC0); break;
+        case IrFn_Eq: {
+            // sete al; setnp cl; and al, cl
+            ucomisd(b, x, y);
+            b1(b, 0x0F); b1(b, 0x94); b1(b, 0xC0);
+            b1(b, 0x0F); b1(b, 0x9B); b1(b, 0xC1);
+            b1(b, 0x20); b1(b, 0xC8);
+            break;
+        }
+        case IrFn_Neq: {
+            // setne al; setp cl; or al, cl
+            ucomisd(b, x, y);
+            b1(b, 0x0F); b1(b, 0x95); b1(b, 0xC0);
+            b1(b, 0x0F); b1(b, 0x9A); b1(b, 0xC1);
+            b1(b, 0x08); b1(b, 0xC8);
+            break;
+        }
+        default: break;
+    }
+
+    // movzx eax, al; rcx = false + eax; true is false + 1
+    b1(b, 0x0F); b1(b, 0xB6); b1(b, 0xC0);
+    mov_imm(b, 1, VALUE_FALSE);
+    b1(b, 0x48); b1(b, 0x01); b1(b, 0xC1);
+    movq_xmm(b, dst, 1);
+}
+
+/*
+*  Scanning
+*/
+
+typedef struct {
+    Jit* jit;
+    u8   types[JIT_REGS];
+    u32  depth;
+
+    u32* touched;
+    u32  touched_count;
+
+    u32* guards;
+    u32  guard_count;
+} Scan;
+
+static u8 slot_read(Scan* s, u32 slot) {
+    u8* state = &s->jit->state[slot];
+    if (*state == Slot_Untouched) {
+        *state = Slot_Num;
+        s->touched[s->touched_count++] = slot;
+        s->guards[s->guard_count++] = slot;
+    }
+    return *state;
+}
+
+static void slot_write(Scan* s, u32 slot, u8 type) {
+    u8* state = &s->jit->state[slot];
+    if (*state == Slot_Untouched) {
+        s->touched[s->touched_count++] = slot;
+    }
+    *state = type;
+}
+
+static bool arg_num(Scan* s, IrArg arg) {
+    return arg.imm || slot_read(s, arg.slot) == Slot_Num;
+}
+
+static bool push_type(Scan* s, u8 type) {
+    if (s->depth == JIT_REGS) return false;
+    s->types[s->depth++] = type;
+    return true;
+}
+
+// Type checks one instruction. false ends the region in front of it.
+static bool scan_inst(Scan* s, IrInst* inst) {
+    switch (inst->op) {
+        case Ir_Push:
+        case Ir_Int:   return push_type(s, Slot_Num);
+        case Ir_Bool:  return push_type(s, Slot_Bool);
+        case Ir_Nil:   return push_type(s, Slot_Other);
+        case Ir_Load:  return push_type(s, slot_read(s, inst->as.slot));
+        case Ir_Pop: {
+            if (!s->depth) return false;
+            slot_write(s, inst->as.slot, s->types[--s->depth]);
+            return true;
+        }
+        case Ir_Del: {
+            slot_write(s, inst->as.slot, Slot_Other);
+            return true;
+        }
+        case Ir_Swap: {
+            if (s->depth < 2) return false;
+            u8 t = s->types[s->depth-1];
+            s->types[s->depth-1] = s->types[s->depth-2];
+            s->types[s->depth-2] = t;
+            return true;
+        }
+        case Ir_Add: case Ir_Sub: case Ir_Mult: case Ir_Div:
+        case Ir_IAdd: case Ir_ISub: case Ir_IMult: {
+            if (s->depth < 2 ||
+                s->types[s->depth-1] != Slot_Num ||
+                s->types[s->depth-2] != Slot_Num) return false;
+            s->depth--;
+            return true;
+        }
+        case Ir_Call: {
+            IrFn fn = inst->as.call.fn;
+            if (inst->as.call.argc != 2) return false;
+            if (!arg_num(s, inst->as.call.args[0]) ||
+                !arg_num(s, inst->as.call.args[1])) return false;
+
+            if (is_cmp(fn) && inst->as.call.dst == IR_NO_DST) {
+                return push_type(s, Slot_Bool);
+            }
+            if (arith_op(fn) && inst->as.call.dst != IR_NO_DST) {
+                slot_write(s, inst->as.call.dst, Slot_Num);
+                return true;
+            }
+            return false;
+        }
+        case Ir_Label: return true;
+        default:       return false;
+    }
+}
+
+/*
+*  Emitting
+*/
+
+static void emit_inst(Buf* b, IrInst* inst, u32* depth) {
+    u32 d = *depth;
+
+    switch (inst->op) {
+        case Ir_Push:  load_const(b, d, value_num(inst->as.num)); d++; break;
+        case Ir_Int:   load_const(b, d, value_num((f64)inst->as.i)); d++; break;
+        case Ir_Bool:  load_const(b, d, value_bool(inst->as.val)); d++; break;
+        case Ir_Nil:   load_const(b, d, VALUE_NIL); d++; break;
+        case Ir_Load:  movsd_load(b, d, inst->as.slot); d++; break;
+        case Ir_Pop:   d--; movsd_store(b, d, inst->as.slot); break;
+        case Ir_Del: {
+            // mov rax, nil; mov [rdi + slot*8], rax
+            mov_imm(b, 0, VALUE_NIL);
+            b1(b, 0x48); b1(b, 0x89); b1(b, 0x87);
+            b4(b, inst->as.slot * sizeof(Value));
+            break;
+        }
+        case Ir_Swap: {
+            movapd(b, 15, d-1);
+            movapd(b, d-1, d-2);
+            movapd(b, d-2, 15);
+            break;
+        }
+        case Ir_Add:
+        case Ir_IAdd:  sse_rr(b, 0xF2, 0x58, d-2, d-1); canon_nan(b, d-2); d--; break;
+        case Ir_Mult:
+        case Ir_IMult: sse_rr(b, 0xF2, 0x59, d-2, d-1); canon_nan(b, d-2); d--; break;
+        case Ir_Sub:
+        case Ir_ISub:
+        case Ir_Div: {
+            // top op below, same as the VM
+            movapd(b, 15, d-1);
+            sse_rr(b, 0xF2, inst->op == Ir_Div ? 0x5E : 0x5C, 15, d-2);
+            movapd(b, d-2, 15);
+            canon_nan(b, d-2);
+            d--;
+            break;
+        }
+        case Ir_Call: {
+            IrFn fn = inst->as.call.fn;
+            load_arg(b, 14, inst->as.call.args[0]);
+            load_arg(b, 15, inst->as.call.args[1]);
+
+            if (is_cmp(fn)) {
+                emit_cmp(b, fn, d, 14, 15);
+                d++;
+            } else {
+                sse_rr(b, 0xF2, arith_op(fn), 14, 15);
+                canon_nan(b, 14);
+                movsd_store(b, 14, (u32)inst->as.call.dst);
+            }
+            break;
+        }
+        default: break;
+    }
+
+    *depth = d;
+}
+
+static usize page_size(void) {
+    static usize size;
+    if (!size) size = sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+// Finds where a region starting at code[0] has to end and which slots it
+// guards, into s. Returns how many IR instructions it covers.
+static u32 scan_region(Jit* jit, Arena* scratch, IrInst* code, u32 count, Scan* s, u32* guards) {
+    // every instruction touches at most three slots
+    *s = (Scan){ .jit = jit };
+    s->touched = AllocArray(scratch, u32, count * 3);
+    s->guards = AllocArray(scratch, u32, count * 3);
+
+    u32 end = 0;
+    *guards = 0;
+    u32 i = 0;
+    for (; i < count; ++i) {
+        // loop bodies have no statement labels, so a region in one runs up
+        // to the jump back. Nothing in the VM fuses across a jump or a
+        // target either.
+        if ((code[i].op == Ir_Target || code[i].op == Ir_Jmp) && s->depth == 0) {
+            end = i;
+            *guards = s->guard_count;
+            break;
+        }
+        if (!scan_inst(s, &code[i])) break;
+
+        // regions end on statement boundaries, where the stack is empty
+        // and no superinstruction in the VM's copy spans the cut
+        if (code[i].op == Ir_Label && s->depth == 0) {
+            end = i + 1;
+            *guards = s->guard_count;
+        }
+    }
+
+    // running out of code with an empty stack is a boundary too, which is
+    // how a region jit_scan measured comes out the same the second time
+    if (i == count && s->depth == 0) {
+        end = count;
+        *guards = s->guard_count;
+    }
+
+    for (u32 k = 0; k < s->touched_count; ++k) {
+        jit->state[s->touched[k]] = Slot_Untouched;
+    }
+
+    return end;
+}
+
+static void emit_region(Buf* b, Arena* scratch, IrInst* code, u32 end, u32* guard_slots, u32 guards) {
+    u32* bail = AllocArray(scratch, u32, guards);
+
+    // mov rcx, qnan; then per slot: mov rax, [rdi + slot*8]; and rax, rcx;
+    // cmp rax, rcx; je bail
+    mov_imm(b, 1, VALUE_QNAN);
+    for (u32 i = 0; i < guards; ++i) {
+        b1(b, 0x48); b1(b, 0x8B); b1(b, 0x87);
+        b4(b, guard_slots[i] * sizeof(Value));
+        b1(b, 0x48); b1(b, 0x21); b1(b, 0xC8);
+        b1(b, 0x48); b1(b, 0x39); b1(b, 0xC8);
+        b1(b, 0x0F); b1(b, 0x84);
+        bail[i] = b->len;
+        b4(b, 0);
+    }
+
+    u32 depth = 0;
+    for (u32 i = 0; i < end; ++i) {
+        emit_inst(b, &code[i], &depth);
+    }
+
+    // mov eax, 1; ret
+    b1(b, 0xB8); b4(b, 1);
+    b1(b, 0xC3);
+
+    // xor eax, eax; ret
+    u32 bail_at = b->len;
+    b1(b, 0x31); b1(b, 0xC0);
+    b1(b, 0xC3);
+
+    for (u32 i = 0; i < guards; ++i) {
+        u32 rel = bail_at - (bail[i] + 4);
+        memcpy(b->data + bail[i], &rel, 4);
+    }
+}
+
+static void state_reserve(Jit* jit, IrSymbols* syms) {
+    if (syms->count > jit->state_cap) {
+        u32 cap = jit->state_cap ? jit->state_cap : 64;
+        while (cap < syms->count) cap *= 2;
+        jit->state = AllocArrayZero(jit->arena, u8, cap);
+        jit->state_cap = cap;
+    }
+}
+
+u32 jit_scan(Jit* jit, Arena* scratch, IrSymbols* syms, IrInst* code, u32 count) {
+    state_reserve(jit, syms);
+
+    u64 start = scratch->pos_u64;
+    Scan s;
+    u32 guards;
+    u32 end = scan_region(jit, scratch, code, count, &s, &guards);
+    arena_set_pos_back(scratch, start);
+
+    return end < JIT_MIN_INSTS ? 0 : end;
+}
+
+void jit_compile(Jit* jit, Arena* scratch, IrSymbols* syms, JitRegion** regions, u32 count) {
+    state_reserve(jit, syms);
+
+    // the pages are only reserved once there's something to put there
+    if (!jit->mem) {
+        void* mem = mmap(0, JIT_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (mem == MAP_FAILED) {
+            for (u32 r = 0; r < count; ++r) regions[r]->count = 0;
+            return;
+        }
+        jit->mem = mem;
+        jit->cap = JIT_SIZE;
+    }
+
+    u64 start = scratch->pos_u64;
+
+    // scan them all first so the buffer can be sized for the whole batch
+    Scan* scans = AllocArray(scratch, Scan, count);
+    u32* guards = AllocArray(scratch, u32, count);
+    u64 size = 0;
+    for (u32 r = 0; r < count; ++r) {
+        JitRegion* region = regions[r];
+        u32 end = scan_region(jit, scratch, region->code, region->count, &scans[r], &guards[r]);
+        if (end != region->count) region->count = 0;
+        if (region->count) {
+            size += 16 + 64 + guards[r] * JIT_GUARD_BYTES + end * JIT_INST_BYTES;
+        }
+    }
+
+    Buf b = { AllocArray(scratch, u8, size), 0 };
+    u32* offsets = AllocArray(scratch, u32, count);
+    usize base = (jit->used + 15) & ~(usize)15;
+    for (u32 r = 0; r < count; ++r) {
+        if (!regions[r]->count) continue;
+
+        // every entry point on 16 bytes, counted from where the batch lands
+        while ((base + b.len) & 15) b1(&b, 0xCC);
+        offsets[r] = b.len;
+        emit_region(&b, scratch, regions[r]->code, regions[r]->count, scans[r].guards, guards[r]);
+    }
+
+    if (!b.len || base + b.len > jit->cap) {
+        for (u32 r = 0; r < count; ++r) regions[r]->count = 0;
+        arena_set_pos_back(scratch, start);
+        return;
+    }
+
+    // one flip to writable and back for the whole batch
+    usize page = page_size();
+    u8* lo = jit->mem + (base & ~(page - 1));
+    u8* hi = jit->mem + ((base + b.len + page - 1) & ~(page - 1));
+
+    if (mprotect(lo, hi - lo, PROT_READ | PROT_WRITE) != 0) {
+        for (u32 r = 0; r < count; ++r) regions[r]->count = 0;
+        arena_set_pos_back(scratch, start);
+        return;
+    }
+    memcpy(jit->mem + base, b.data, b.len);
+    mprotect(lo, hi - lo, PROT_READ | PROT_EXEC);
+    jit->used = base + b.len;
+
+    for (u32 r = 0; r < count; ++r) {
+        if (!regions[r]->count) continue;
+        // ISO C has no object to function pointer cast, go through memcpy
+        u8* entry = jit->mem + base + offsets[r];
+        memcpy(&regions[r]->fn, &entry, sizeof(regions[r]->fn));
+    }
+
+    arena_set_pos_back(scratch, start);
+}
+
+#else
+
+Jit* jit_new(Arena* a) {
+    (void)a;
+    return 0;
+}
+
+void jit_free(Jit* jit) {
+    (void)jit;
+}
+
+u32 jit_scan(Jit* jit, Arena* scratch, IrSymbols* syms, IrInst* code, u32 count) {
+    (void)jit; (void)scratch; (void)syms; (void)code; (void)count;
+    return 0;
+}
+
+void jit_compile(Jit* jit, Arena* scratch, IrSymbols* syms, JitRegion** regions, u32 count) {
+    (void)jit; (void)scratch; (void)syms;
+    for (u32 r = 0; r < count; ++r) regions[r]->count = 0;
+}
+
+#endif
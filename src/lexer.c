@@ -21,6 +21,7 @@ static Token     token_make_string(Lexer* lexer);
 static Token     token_make_number(Lexer* lexer);
 static Token     token_make_ident(Lexer* lexer);
 
+static Token lexer_scan(Lexer* lexer);
 static void lexer_free(Lexer* lexer);
 static void lexer_advance(Lexer* lexer);
 static char lexer_peek_offset(Lexer* lexer, usize offset);
@@ -96,13 +97,13 @@ String token_type_str(TokenType type) {
 }
 
 void token_print(Token t) {
-    printf("Token [Type: %s, Lexeme: %s]\n", token_type_str(t.type).data, t.lexeme.data);
+    printf("Token [Type: %s, Lexeme: %.*s]\n", token_type_str(t.type).data, (int)t.lexeme.len, t.lexeme.data);
 }
 
 void token_loc_print(Token t) {
-    printf("Token [Type: %s, Lexeme: %s] %d:%d\n", 
+    printf("Token [Type: %s, Lexeme: %.*s] %d:%d\n", 
            token_type_str(t.type).data, 
-           t.lexeme.data,
+           (int)t.lexeme.len, t.lexeme.data,
            t.line,
            t.col);
 }
@@ -126,7 +127,7 @@ static TokenType token_get_type(String s) {
     else if (string_eq(string("for"), s)) {
         return Token_For;
     }
-    else if (string_eq(string("Func"), s)) {
+    else if (string_eq(string("func"), s)) {
         return Token_Func;
     }
     else if (string_eq(string("if"), s)) {
@@ -210,30 +211,24 @@ static Token token_make_string(Lexer* lexer) {
 
     lexer_advance(lexer);
 
+    buf.len = buf_ptr;
+    buf.data[buf_ptr] = '\0';
+
     return token_new(Token_String, buf, lexer->line_number, lexer->column);
 }
 
+// The lexeme points straight into the source, number_parse works on the
+// slice so nothing gets copied.
 static Token token_make_number(Lexer* lexer) {
-    usize buf_len = 0;
-    usize src_ptr = lexer->cursor;
-    char c;
-    while ((c = lexer->src.data[src_ptr++]) && 
-        (isdigit(c) || c == '.')) {
-        buf_len++;
-    }
-
-    String buf = string_alloc(lexer->arena, buf_len+1);
-    u64 buf_ptr = 0;
+    u64 start = lexer->cursor - 1;
     bool dec_point = false;
 
-    buf.data[buf_ptr++] = lexer_peek_offset(lexer, -1);
-
     while (!lexer_bound(lexer) &&
     (isdigit(lexer_peek(lexer)) || lexer_peek(lexer) == '.')) {
-        char c = lexer_peek(lexer);
-        if (c == '.') {
+        if (lexer_peek(lexer) == '.') {
+            // a range, 1..10
             if (lexer_peek_offset(lexer, 1) == '.') {
-                return token_new(Token_Number, buf, lexer->line_number, lexer->column);
+                break;
             }
 
             if (dec_point) {
@@ -243,11 +238,11 @@ static Token token_make_number(Lexer* lexer) {
             dec_point = true; 
         } 
 
-        buf.data[buf_ptr++] = c;
         lexer_advance(lexer);
     }
 
-    return token_new(Token_Number, buf, lexer->line_number, lexer->column);
+    String lexeme = { lexer->src.data + start, lexer->cursor - start };
+    return token_new(Token_Number, lexeme, lexer->line_number, lexer->column);
 }
 
 static Token token_make_ident(Lexer* lexer) {
@@ -270,6 +265,7 @@ static Token token_make_ident(Lexer* lexer) {
     }
 
     buf.len = buf_ptr;
+    buf.data[buf_ptr] = '\0';
 
     // return token_new(token_get_type(buf), buf);
 
@@ -287,7 +283,7 @@ static Token token_make_ident(Lexer* lexer) {
 */
 
 Lexer* lexer_new(Arena* a, String src) {
-    Lexer* l = (Lexer*)arena_alloc(a, sizeof(Lexer));
+    Lexer* l = (Lexer*)arena_alloc_tagged(a, sizeof(Lexer), ArenaTag_Lexer);
 
     l->src = src;
     l->cursor = 0;
@@ -335,6 +331,13 @@ static void lexer_advance(Lexer* lexer) {
 }
 
 Token lexer_next_token(Lexer* lexer) {
+    ArenaTag prev_tag = arena_set_tag(lexer->arena, ArenaTag_Lexer);
+    Token t = lexer_scan(lexer);
+    arena_set_tag(lexer->arena, prev_tag);
+    return t;
+}
+
+static Token lexer_scan(Lexer* lexer) {
     if (lexer_bound(lexer)) {
         return token(Token_EOF, lexer->line_number, lexer->column);
     }
@@ -347,14 +350,14 @@ Token lexer_next_token(Lexer* lexer) {
     }
 
     if (isspace(c)) {
-        return lexer_next_token(lexer);
+        return lexer_scan(lexer);
     }
     switch (c) {
         case '#': {
             while (!lexer_bound(lexer) && lexer_peek(lexer) != '\n') {
                 lexer_consume(lexer);
             }
-            return lexer_next_token(lexer);
+            return lexer_scan(lexer);
         }
         case '=': {
             if (lexer_match(lexer, '=')) {
@@ -0,0 +1,286 @@
+#include "include/licm.h"
+#include "include/arena.h"
+#include "include/ast.h"
+#include "include/string.h"
+
+#define LICM_LIST_INIT 8
+
+Licm* licm_new(Arena* a) {
+    return AllocArrayZero(a, Licm, 1);
+}
+
+/*
+*  What the loop assigns
+*/
+
+typedef struct {
+    AstVisitor v;
+    Arena*     a;
+    String*    names;
+    u32        count;
+    u32        cap;
+} AssignVisitor;
+
+static void add_name(AssignVisitor* av, String name) {
+    if (av->count == av->cap) {
+        u32 cap = av->cap ? av->cap * 2 : LICM_LIST_INIT;
+        av->names = arena_realloc(av->a, av->names, sizeof(String) * av->cap, sizeof(String) * cap);
+        av->cap = cap;
+    }
+    av->names[av->count++] = name;
+}
+
+static bool assign_pre(AstVisitor* v, AST* ast) {
+    AssignVisitor* av = (AssignVisitor*)v;
+
+    switch (ast->tag) {
+        case AST_LET: add_name(av, ast->data.AST_LET.ident); break;
+        case AST_FOR: {
+            add_name(av, ast->data.AST_FOR.ident);
+            add_name(av, ast->data.AST_FOR.end_var);
+            break;
+        }
+        // all four share the { ident, expr } layout
+        case AST_ADDEQ: case AST_SUBEQ: case AST_MULEQ: case AST_DIVEQ: {
+            add_name(av, ast->data.AST_ADDEQ.ident);
+            break;
+        }
+        case AST_VASM: {
+            struct AST_VASM* data = &ast->data.AST_VASM;
+            for (u32 i = 0; i < data->var_count; ++i) {
+                if (data->written[i]) add_name(av, data->vars[i]->data.AST_IDENT.ident);
+            }
+            break;
+        }
+        default: break;
+    }
+    return true;
+}
+
+typedef struct {
+    AstVisitor v;
+    bool found;
+} PrintVisitor;
+
+// a vasm block might print too
+static bool print_pre(AstVisitor* v, AST* ast) {
+    PrintVisitor* pv = (PrintVisitor*)v;
+    pv->found |= ast->tag == AST_PRINT || ast->tag == AST_VASM;
+    return !pv->found;
+}
+
+static bool prints(Arena* a, AST* stmt) {
+    PrintVisitor pv = {{print_pre, 0, 0}, false};
+    ast_walk(a, stmt, &pv.v);
+    return pv.found;
+}
+
+/*
+*  Hoisting
+*/
+
+typedef struct {
+    Licm*     l;
+    Arena*    a;
+    String*   assigned;
+    u32       assigned_count;
+    AstList*  out;  // where the lets for the moved expressions go
+} Hoister;
+
+static bool is_leaf(AST* ast) {
+    switch (ast->tag) {
+        case AST_NUMBER: case AST_STR: case AST_BOOL: case AST_NIL: case AST_IDENT: return true;
+        default: return false;
+    }
+}
+
+static void hoist(Hoister* h, AST* ast) {
+    if (is_leaf(ast)) return;
+
+    String name = string_format(h->a, "_licm%u", h->l->temps++);
+    ast_list_push(h->a, h->out, AST_NEW(h->a, AST_LET, ast_new(h->a, *ast), name));
+    *ast = (AST){ AST_IDENT, { .AST_IDENT = { name } } };
+}
+
+// Bottom up, true when all of ast can move out. Otherwise the biggest
+// parts of it that can have moved out already.
+static bool scan(Hoister* h, AST* ast);
+
+static void scan_part(Hoister* h, AST* ast) {
+    if (scan(h, ast)) hoist(h, ast);
+}
+
+static bool scan(Hoister* h, AST* ast) {
+    switch (ast->tag) {
+        case AST_NUMBER: case AST_STR: case AST_BOOL: case AST_NIL: return true;
+        case AST_IDENT: {
+            for (u32 i = 0; i < h->assigned_count; ++i) {
+                if (string_eq(h->assigned[i], ast->data.AST_IDENT.ident)) return false;
+            }
+            return true;
+        }
+        case AST_EQ: case AST_NEQ: case AST_GT: case AST_GTE: case AST_LT: case AST_LTE:
+        case AST_NOT: case AST_AND: case AST_OR:
+        case AST_ADD: case AST_SUB: case AST_MUL: case AST_DIV: case AST_NEGATE:
+        case AST_INDEX: case AST_LEN: break;
+        // an array literal is a new array every time, only its items move
+        default: {
+            for (u32 i = 0; i < ast_child_count(ast); ++i) {
+                scan_part(h, *ast_child(ast, i));
+            }
+            return false;
+        }
+    }
+
+    // one or two operands
+    bool moves[2];
+    bool all = true;
+    u32 count = ast_child_count(ast);
+    for (u32 i = 0; i < count; ++i) {
+        moves[i] = scan(h, *ast_child(ast, i));
+        all &= moves[i];
+    }
+    if (all) return true;
+
+    for (u32 i = 0; i < count; ++i) {
+        if (moves[i]) hoist(h, *ast_child(ast, i));
+    }
+    return false;
+}
+
+// The statements that run every time around, up to the first one that
+// might print. Only an if's condition and a loop's bounds, not what's in
+// them.
+static void scan_body(Hoister* h, AST** body, u32 count) {
+    for (u32 i = 0; i < count; ++i) {
+        AST* stmt = body[i];
+
+        switch (stmt->tag) {
+            case AST_LET:   scan_part(h, stmt->data.AST_LET.expr); break;
+            case AST_PRINT: scan_part(h, stmt->data.AST_PRINT.expr); break;
+            case AST_IF:    scan_part(h, stmt->data.AST_IF.expr); break;
+            case AST_WHILE: scan_part(h, stmt->data.AST_WHILE.expr); break;
+            case AST_FOR: {
+                scan_part(h, stmt->data.AST_FOR.start);
+                scan_part(h, stmt->data.AST_FOR.end);
+                break;
+            }
+            // all four share the { ident, expr } layout
+            case AST_ADDEQ: case AST_SUBEQ: case AST_MULEQ: case AST_DIVEQ: {
+                scan_part(h, stmt->data.AST_ADDEQ.expr);
+                break;
+            }
+            default: break;
+        }
+
+        if (prints(h->a, stmt)) return;
+    }
+}
+
+static bool runs_once_at_least(AST* loop) {
+    AST* start = loop->data.AST_FOR.start;
+    AST* end = loop->data.AST_FOR.end;
+    return start->tag == AST_NUMBER && end->tag == AST_NUMBER &&
+           start->data.AST_NUMBER.val < end->data.AST_NUMBER.val;
+}
+
+// bounds run once anyway, a for gets its own before the check so they
+// don't run twice
+static AST* bind_bound(Licm* l, Arena* a, AST** bound, AstList* out) {
+    if (!is_leaf(*bound)) {
+        String name = string_format(a, "_licm%u", l->temps++);
+        ast_list_push(a, out, AST_NEW(a, AST_LET, *bound, name));
+        *bound = AST_NEW(a, AST_IDENT, name);
+    }
+    return ast_clone(a, *bound);
+}
+
+static void licm_loop(Licm* l, Arena* a, AST* loop, AstList* out) {
+    AssignVisitor av = {{assign_pre, 0, 0}, a, 0, 0, 0};
+    ast_walk(a, loop, &av.v);
+
+    AstList inside = {0};
+    Hoister h = { l, a, av.names, av.count, out };
+
+    AST** body;
+    u32 count;
+    if (loop->tag == AST_WHILE) {
+        scan_part(&h, loop->data.AST_WHILE.expr);
+        body = loop->data.AST_WHILE.body;
+        count = loop->data.AST_WHILE.stmt_count;
+    } else {
+        body = loop->data.AST_FOR.body;
+        count = loop->data.AST_FOR.stmt_count;
+    }
+
+    h.out = &inside;
+    scan_body(&h, body, count);
+
+    if (!inside.count) {
+        ast_list_push(a, out, loop);
+        return;
+    }
+
+    AST* check;
+    if (loop->tag == AST_WHILE) {
+        check = ast_clone(a, loop->data.AST_WHILE.expr);
+    } else if (runs_once_at_least(loop)) {
+        check = 0;
+    } else {
+        struct AST_FOR* data = &loop->data.AST_FOR;
+        AST* start = bind_bound(l, a, &data->start, out);
+        AST* end = bind_bound(l, a, &data->end, out);
+        check = AST_NEW(a, AST_LT, start, end);
+    }
+
+    ast_list_push(a, &inside, loop);
+    if (!check) {
+        for (u32 i = 0; i < inside.count; ++i) {
+            ast_list_push(a, out, inside.stmts[i]);
+        }
+        return;
+    }
+    ast_list_push(a, out, AST_NEW(a, AST_IF, check, inside.stmts, inside.count, 0, 0));
+}
+
+// inner loops first, what they move out lands in the outer loop's body
+// where the outer loop can take it further
+void licm_stmts(Licm* l, Arena* a, AST*** stmts, u32* count) {
+    AstList out = {0};
+
+    for (u32 i = 0; i < *count; ++i) {
+        AST* stmt = (*stmts)[i];
+
+        switch (stmt->tag) {
+            case AST_IF: {
+                struct AST_IF* data = &stmt->data.AST_IF;
+                licm_stmts(l, a, &data->body, &data->stmt_count);
+                licm_stmts(l, a, &data->else_body, &data->else_count);
+                ast_list_push(a, &out, stmt);
+                break;
+            }
+            case AST_FOR: {
+                struct AST_FOR* data = &stmt->data.AST_FOR;
+                licm_stmts(l, a, &data->body, &data->stmt_count);
+                licm_loop(l, a, stmt, &out);
+                break;
+            }
+            case AST_WHILE: {
+                struct AST_WHILE* data = &stmt->data.AST_WHILE;
+                licm_stmts(l, a, &data->body, &data->stmt_count);
+                licm_loop(l, a, stmt, &out);
+                break;
+            }
+            default: ast_list_push(a, &out, stmt); break;
+        }
+    }
+
+    *stmts = out.stmts;
+    *count = out.count;
+}
+
+void licm_program(Licm* l, Arena* a, AST* program) {
+    struct AST_PROGRAM* data = &program->data.AST_PROGRAM;
+    licm_stmts(l, a, &data->body, &data->stmt_count);
+    data->stmt_cap = data->stmt_count;
+}
@@ -1,34 +1,120 @@
 #include "include/arena.h"
 #include "include/defines.h"
 #include "include/ast.h"
+#include "include/cgen.h"
+#include "include/cse.h"
+#include "include/dce.h"
 #include "include/err.h"
+#include "include/gas.h"
+#include "include/inline.h"
+#include "include/interp.h"
+#include "include/ir.h"
 #include "include/lexer.h"
+#include "include/licm.h"
 #include "include/parser.h"
+#include "include/sra.h"
+#include "include/ssa.h"
+#include "include/stats.h"
 #include "include/string.h"
+#include "include/vm.h"
 #include <stdio.h>
 #include <stdlib.h>
 
+// the .mv text or native assembly with --asm, --c works on the AST instead
+static void emit_ir(IrProgram* ir, Gas* gas, Cgen* cgen, FILE* f) {
+    if (cgen) return;
+
+    if (gas) {
+        gas_emit(gas, ir);
+    } else {
+        ir_emit(ir, f);
+    }
+}
+
+// Output goes to a temporary next to the real file and only replaces it once
+// everything is written, so an error halfway leaves the old one alone
+static char* partial_output = 0;
+
+static void drop_partial_output(void) {
+    if (partial_output) remove(partial_output);
+}
+
 int main(int argc, char** argv) {
     bool run = false;
-    Arena* arena = arena_new();
+    bool debug = false;
+    bool stats_json = false;
+    bool stream = false;
+    bool tree = false;
+    bool jit = false;
+    bool native = false;
+    bool c_out = false;
 
     if (argc < 2) {
-        arena_free(arena);
-        puts("Usage: mc [program].m");
+        puts("Usage: mc [program].m [db | -r | output] [--stats[=json]] [--stream] [--tree | --jit] [--asm | --c]");
         return 5;
     }
+
+    String output_file = {0};
+    for (i32 i = 2; i < argc; ++i) {
+        String arg = string(argv[i]);
+        if (string_eq(arg, string("db"))) {
+            debug = true;
+        } 
+        else if (string_eq(arg, string("-r"))) {
+            run = true;
+        }
+        else if (string_eq(arg, string("--stats"))) {
+            stats.enabled = true;
+        }
+        else if (string_eq(arg, string("--stats=json"))) {
+            stats.enabled = true;
+            stats_json = true;
+        }
+        else if (string_eq(arg, string("--stream"))) {
+            stream = true;
+        }
+        else if (string_eq(arg, string("--tree"))) {
+            tree = true;
+        }
+        else if (string_eq(arg, string("--jit"))) {
+            jit = true;
+        }
+        else if (string_eq(arg, string("--asm"))) {
+            native = true;
+        }
+        else if (string_eq(arg, string("--c"))) {
+            c_out = true;
+        }
+        else {
+            output_file = arg;
+        }
+    }
+
+#ifdef BLAZE_NO_STATS
+    if (stats.enabled) {
+        fprintf(stderr, "--stats: this build was compiled with BLAZE_NO_STATS\n");
+        stats.enabled = false;
+    }
+#endif
     
+    STATS_BEGIN(read_start);
+
     String filepath = string(argv[1]);
     
     FILE* f = fopen(filepath.data, "rb");
     if (!f) {
-        arena_free(arena);
         err("Failed to open file", 0, 0);
     }
     
     fseek(f, 0L, SEEK_END);
     usize sz = ftell(f);
     rewind(f);
+
+    Arena* arena = arena_new_sized(ARENA_DEFAULT_SIZE + sz * ARENA_SRC_FACTOR);
+    
+    if (stats.enabled) {
+        arena_enable_telemetry(arena);
+    }
     
     String src = string_alloc(arena, sz);
 
@@ -36,44 +122,228 @@ int main(int argc, char** argv) {
     fread(src.data, sizeof(char), src.len, f);
     
     fclose(f);
+
+    STATS_END(Phase_Read, read_start);
+    STATS_ADD(bytes, sz);
     
+    // -r runs in process, the .mv only gets written when asked for
+    bool emit = !run || output_file.data;
+
+    if (!output_file.data) {
+        output_file = string_substring(arena, 
+                                       string(argv[1]), 
+                                       0, 
+                                       string(argv[1]).len-1);
+        
+        output_file = string_concat(arena, output_file, string(native ? "s" : c_out ? "c" : "mv"));
+    }
+
+    // the debug dump wants the whole tree around
+    if (debug) {
+        stream = false;
+    }
+
+    // symbols outlive every statement, so streaming keeps them apart from
+    // the arena that gets rewound. Both sizes are only where they start,
+    // the arenas grow as needed
+    Arena* sym_arena = stream ? arena_new_sized(ARENA_DEFAULT_SIZE + sz * 8) : arena;
+
+    STATS_BEGIN(parse_start);
+
     Lexer* lexer = lexer_new(arena, src);
     
-    Parser* parser = parser_new(lexer);
-    
-    parser_parse(parser);
-    
-    String output_file = string_substring(arena, 
-                                          string(argv[1]), 
-                                          0, 
-                                          string(argv[1]).len-1);
-    
-    output_file = string_concat(arena, output_file, string("mv"));
+    Parser* parser = parser_new(lexer, sym_arena);
+
+    STATS_END(Phase_Parse, parse_start);
+
+    IrProgram ir = { .syms = ir_symbols_new(sym_arena) };
+    Inliner* inliner = inliner_new(sym_arena);
+    Sra* sra = sra_new(sym_arena, stream);
+    Ssa* ssa = ssa_new(sym_arena);
+    Dce* dce = dce_new(sym_arena, stream);
+    Licm* licm = licm_new(sym_arena);
+    Cse* cse = cse_new(sym_arena);
+
+    Interp* interp = run && tree ? interp_new(stdout) : 0;
+    Vm* vm = run && !tree ? vm_new(ir.syms, stdout) : 0;
+    if (vm && jit) {
+        vm_enable_jit(vm);
+    }
+
+    Gas* gas = 0;
+    Cgen* cgen = 0;
+    String temp_file = {0};
+    if (emit) {
+        temp_file = string_concat(arena, output_file, string(".tmp"));
+        f = fopen(temp_file.data, "w");
+        if (!f) {
+            err("Failed to open output file", 0, 0);
+        }
+        partial_output = temp_file.data;
+        atexit(drop_partial_output);
+
+        if (native) {
+            gas = gas_new(sym_arena, ir.syms, f);
+        } else if (c_out) {
+            cgen = cgen_new(sym_arena, f);
+        } else {
+            ir_emit_header(f);
+        }
+    }
     
-    if (argc >= 3) {
-        if (string_eq(string(argv[2]), string("db"))) {
-            ast_print(parser->ast, parser->var_map);
+    if (stream) {
+        ir_lower_begin(arena, &ir);
+        if (emit) emit_ir(&ir, gas, cgen, f);
+
+        // parse, emit and forget one statement at a time so memory stays
+        // bounded by the biggest statement instead of the whole program
+        u32 index = 0;
+        for (;;) {
+            u64 checkpoint = arena->pos_u64;
+            ir.code = 0;
+            ir.count = ir.cap = 0;
+
+            STATS_BEGIN(stmt_parse_start);
+            AST* stmt = parser_parse_stmt(parser);
+            STATS_END(Phase_Parse, stmt_parse_start);
+
+            if (!stmt) break;
+
+            // a declaration turns into nothing, a statement with calls into
+            // the inlined bodies followed by the statement
+            STATS_BEGIN(stmt_emit_start);
+            STATS_BEGIN(inline_start);
+            u32 count;
+            AST** stmts = inliner_stmt(inliner, arena, stmt, &count);
+            STATS_PASS_END("inline", inline_start);
+
+            STATS_BEGIN(sra_start);
+            sra_stmts(sra, arena, &stmts, &count);
+            STATS_PASS_END("sra", sra_start);
+
+            STATS_BEGIN(sccp_start);
+            ssa_stmts(ssa, arena, stmts, count);
+            STATS_PASS_END("sccp", sccp_start);
+
+            STATS_BEGIN(dce_start);
+            dce_stmts(dce, arena, &stmts, &count);
+            STATS_PASS_END("dce", dce_start);
+
+            STATS_BEGIN(licm_start);
+            licm_stmts(licm, arena, &stmts, &count);
+            STATS_PASS_END("licm", licm_start);
+
+            STATS_BEGIN(cse_start);
+            cse_stmts(cse, arena, &stmts, &count);
+            STATS_PASS_END("cse", cse_start);
+
+            for (u32 k = 0; k < count; ++k) {
+                ir_lower_stmt(arena, &ir, stmts[k], parser->var_map, index++);
+                if (cgen) cgen_stmt(cgen, arena, stmts[k]);
+            }
+            if (emit) emit_ir(&ir, gas, cgen, f);
+            STATS_END(Phase_Emit, stmt_emit_start);
+
+            STATS_BEGIN(stmt_run_start);
+            for (u32 k = 0; interp && k < count; ++k) {
+                interp_run(interp, arena, stmts[k]);
+            }
+            if (vm) vm_run(vm, arena, &ir);
+            STATS_END(Phase_Run, stmt_run_start);
+
+            if (stats.enabled) {
+                ast_count(arena, stmt, stats.ast_nodes);
+            }
+
+            parser_rewind(parser, checkpoint);
+        }
+
+        ir.code = 0;
+        ir.count = ir.cap = 0;
+        ir_lower_end(arena, &ir);
+        if (emit) emit_ir(&ir, gas, cgen, f);
+    } 
+    else {
+        STATS_BEGIN(program_parse_start);
+        parser_parse(parser);
+        STATS_END(Phase_Parse, program_parse_start);
+
+        STATS_BEGIN(inline_start);
+        inliner_program(inliner, arena, parser->ast);
+        STATS_PASS_END("inline", inline_start);
+
+        STATS_BEGIN(sra_start);
+        sra_program(sra, arena, parser->ast);
+        STATS_PASS_END("sra", sra_start);
+
+        STATS_BEGIN(sccp_start);
+        ssa_program(ssa, arena, parser->ast);
+        STATS_PASS_END("sccp", sccp_start);
+
+        STATS_BEGIN(dce_start);
+        dce_program(dce, arena, parser->ast);
+        STATS_PASS_END("dce", dce_start);
+
+        STATS_BEGIN(licm_start);
+        licm_program(licm, arena, parser->ast);
+        STATS_PASS_END("licm", licm_start);
+
+        STATS_BEGIN(cse_start);
+        cse_program(cse, arena, parser->ast);
+        STATS_PASS_END("cse", cse_start);
+
+        if (debug) {
+            ast_print(arena, parser->ast, parser->var_map);
             printf("\n");
         } 
-        else if (string_eq(string(argv[2]), string("-r"))) {
-            run = true;
+
+        STATS_BEGIN(emit_start);
+        ir_lower(arena, &ir, parser->ast, parser->var_map);
+        if (emit) emit_ir(&ir, gas, cgen, f);
+        if (cgen) {
+            struct AST_PROGRAM* program = &parser->ast->data.AST_PROGRAM;
+            for (u32 i = 0; i < program->stmt_count; ++i) {
+                cgen_stmt(cgen, arena, program->body[i]);
+            }
         }
-        else {
-            output_file = string(argv[2]);
+        STATS_END(Phase_Emit, emit_start);
+
+        STATS_BEGIN(run_start);
+        if (interp) interp_run(interp, arena, parser->ast);
+        if (vm) vm_run(vm, arena, &ir);
+        STATS_END(Phase_Run, run_start);
+    }
+
+    if (emit) {
+        if (gas) gas_finish(gas);
+        if (cgen) cgen_finish(cgen);
+        bool failed = ferror(f);
+        if (fclose(f) != 0 || failed || rename(temp_file.data, output_file.data) != 0) {
+            err("Failed to write output file", 0, 0);
         }
+        partial_output = 0;
     }
 
-    f = fopen(output_file.data, "w");
-    
-    ast_emit(parser->ast, parser->var_map, f);
-    
-    fclose(f);
-    
     if (run) {
-        String cmd = string_concat(arena, string("mvi "), output_file);
-        system(cmd.data);
+        fflush(stdout);
+    }
+    if (interp) interp_free(interp);
+    if (vm) vm_free(vm);
+
+    if (stats.enabled) {
+        stats.symbols = parser->var_map->count;
+        stats.scalarized = sra->split;
+        stats.folded_nodes = ssa->folded;
+        stats.dead_nodes = dce->removed;
+        stats.shared_nodes = cse->shared;
+        ast_count(arena, parser->ast, stats.ast_nodes);
+        stats_print(stderr, stats_json, arena);
     }
 
+    if (sym_arena != arena) {
+        arena_free(sym_arena);
+    }
+    
     arena_free(arena);
     return 0;
 }
@@ -0,0 +1,393 @@
+#include "include/number.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Three tiers, cheapest first:
+//
+//   1. digits are read 8 at a time with SWAR, integers end right there
+//   2. Clinger: mantissa <= 2^53 and |exp| <= 22 is one exact multiply or
+//      divide by a power of ten
+//   3. Eisel-Lemire: one or two 64x64 multiplies against a 128 bit
+//      truncated power of five, correctly rounded or it says it can't tell
+//
+// Whatever is left (more than 19 significant digits, subnormals, the
+// ambiguous halfway cases) goes to strtod on a copy. Data files basically
+// never get there.
+
+#define POW5_MIN -342
+#define POW5_MAX 308
+
+// more than enough bits for 2^1718 / 5^342, the biggest table entry needs
+#define BIG_BITS  1792
+#define BIG_LIMBS (BIG_BITS / 32 + 1)
+
+typedef struct {
+    u64 hi;
+    u64 lo;
+} U128;
+
+typedef struct {
+    u32 limb[BIG_LIMBS];
+    u32 count;
+} Big;
+
+// normalized so the top bit of hi is set, built on the first literal that
+// needs Eisel-Lemire
+static U128 pow5[POW5_MAX - POW5_MIN + 1];
+static bool pow5_ready = false;
+
+static const f64 pow10_exact[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+/*
+*  Power of five table
+*/
+
+static void big_trim(Big* b) {
+    while (b->count > 0 && b->limb[b->count-1] == 0) b->count--;
+}
+
+static void big_mul_small(Big* b, u32 m) {
+    u64 carry = 0;
+    for (u32 i = 0; i < b->count; ++i) {
+        u64 v = (u64)b->limb[i] * m + carry;
+        b->limb[i] = (u32)v;
+        carry = v >> 32;
+    }
+    if (carry) b->limb[b->count++] = (u32)carry;
+}
+
+static void big_div_small(Big* b, u32 d) {
+    u64 rem = 0;
+    for (u32 i = b->count; i-- > 0;) {
+        u64 v = (rem << 32) | b->limb[i];
+        b->limb[i] = (u32)(v / d);
+        rem = v % d;
+    }
+    big_trim(b);
+}
+
+static void big_shr(Big* dst, const Big* src, u32 shift) {
+    u32 limbs = shift / 32;
+    u32 bits = shift % 32;
+
+    dst->count = 0;
+    for (u32 i = limbs; i < src->count; ++i) {
+        u64 v = src->limb[i] >> bits;
+        if (bits && i + 1 < src->count) v |= (u64)src->limb[i+1] << (32 - bits);
+        dst->limb[dst->count++] = (u32)v;
+    }
+    big_trim(dst);
+}
+
+static void big_add1(Big* b) {
+    for (u32 i = 0; i < b->count; ++i) {
+        if (++b->limb[i] != 0) return;
+    }
+    b->limb[b->count++] = 1;
+}
+
+static u32 big_bitlen(const Big* b) {
+    if (b->count == 0) return 0;
+    return b->count * 32 - __builtin_clz(b->limb[b->count-1]);
+}
+
+// 64 bits of b starting at bit pos, bits below zero read as zeros
+static u64 big_bits64(const Big* b, i32 pos) {
+    u64 r = 0;
+    for (i32 i = 63; i >= 0; --i) {
+        i32 bit = pos + i;
+        r <<= 1;
+        if (bit >= 0 && (u32)bit < b->count * 32) {
+            r |= (b->limb[bit / 32] >> (bit % 32)) & 1;
+        }
+    }
+    return r;
+}
+
+// the top 128 bits, shifted up when b is shorter than that
+static U128 big_top128(const Big* b) {
+    i32 len = big_bitlen(b);
+    U128 r = { big_bits64(b, len - 64), big_bits64(b, len - 128) };
+    return r;
+}
+
+// Same entries as the table in Lemire's paper. For 5^q with q >= 0 the
+// top 128 bits. For q < 0 a reciprocal rounded up, 2^b / 5^-q + 1 with b
+// picked so it has at least 128 significant bits, truncated to 128.
+static void pow5_build(void) {
+    // p = 5^k and d = floor(2^BIG_BITS / 5^k), both walked up one k at a
+    // time. floor(d / 2^s) is still the exact floor of the quotient.
+    static Big p, d, c;
+    memset(&p, 0, sizeof(p));
+    memset(&d, 0, sizeof(d));
+    p.limb[0] = 1;
+    p.count = 1;
+    d.limb[BIG_BITS / 32] = 1u << (BIG_BITS % 32);
+    d.count = BIG_LIMBS;
+
+    for (i32 k = 0; k <= -POW5_MIN; ++k) {
+        if (k <= POW5_MAX) {
+            pow5[k - POW5_MIN] = big_top128(&p);
+        }
+
+        if (k > 0) {
+            u32 z = big_bitlen(&p);
+            u32 b = k <= 27 ? z + 127 : 2 * z + 128;
+            big_shr(&c, &d, BIG_BITS - b);
+            big_add1(&c);
+            pow5[-k - POW5_MIN] = big_top128(&c);
+        }
+
+        big_mul_small(&p, 5);
+        big_div_small(&d, 5);
+    }
+
+    pow5_ready = true;
+}
+
+/*
+*  Parsing
+*/
+
+static U128 mul64(u64 a, u64 b) {
+    u64 a_lo = (u32)a, a_hi = a >> 32;
+    u64 b_lo = (u32)b, b_hi = b >> 32;
+
+    u64 ll = a_lo * b_lo;
+    u64 lh = a_lo * b_hi;
+    u64 hl = a_hi * b_lo;
+    u64 hh = a_hi * b_hi;
+
+    u64 mid = (ll >> 32) + (u32)lh + (u32)hl;
+    U128 r;
+    r.lo = (mid << 32) | (u32)ll;
+    r.hi = hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+    return r;
+}
+
+static u64 load8(const char* p) {
+    u64 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// little endian, the byte at p ends up lowest
+static bool is_eight_digits(u64 v) {
+    return ((v & 0xF0F0F0F0F0F0F0F0ull) |
+            (((v + 0x0606060606060606ull) & 0xF0F0F0F0F0F0F0F0ull) >> 4))
+            == 0x3333333333333333ull;
+}
+
+static u32 parse_eight_digits(u64 v) {
+    const u64 mask = 0x000000FF000000FFull;
+    const u64 mul1 = 100 + (1000000ull << 32);
+    const u64 mul2 = 1 + (10000ull << 32);
+
+    v -= 0x3030303030303030ull;
+    v = (v * 10) + (v >> 8);
+    v = (((v & mask) * mul1) + (((v >> 16) & mask) * mul2)) >> 32;
+    return (u32)v;
+}
+
+static bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static const char* parse_digits(const char* p, const char* end, u64* w) {
+    while (end - p >= 8 && is_eight_digits(load8(p))) {
+        *w = *w * 100000000 + parse_eight_digits(load8(p));
+        p += 8;
+    }
+    while (p < end && is_digit(*p)) {
+        *w = *w * 10 + (u64)(*p - '0');
+        p++;
+    }
+    return p;
+}
+
+// w * 10^q for w != 0, false when the result can't be decided this way
+static bool eisel_lemire(u64 w, i64 q, f64* out) {
+    if (q < POW5_MIN) {
+        *out = 0.0;
+        return true;
+    }
+    if (q > POW5_MAX) {
+        u64 inf = 0x7FF0000000000000ull;
+        memcpy(out, &inf, sizeof(*out));
+        return true;
+    }
+    if (!pow5_ready) pow5_build();
+
+    U128 f = pow5[q - POW5_MIN];
+    i64 exponent = (((152170 + 65536) * q) >> 16) + 1024 + 63;
+    i32 lz = __builtin_clzll(w);
+    w <<= lz;
+
+    U128 product = mul64(w, f.hi);
+    u64 upper = product.hi;
+    u64 lower = product.lo;
+
+    // the low bits of the first product might be off, bring in the rest
+    // of the power and give up if it's still ambiguous
+    if ((upper & 0x1FF) == 0x1FF && lower + w < lower) {
+        U128 second = mul64(w, f.lo);
+        u64 middle = lower + second.hi;
+        if (middle < lower) upper++;
+        if (middle + 1 == 0 && (upper & 0x1FF) == 0x1FF && second.lo + w < second.lo) {
+            return false;
+        }
+        lower = middle;
+    }
+
+    u64 upperbit = upper >> 63;
+    u64 mantissa = upper >> (upperbit + 9);
+    lz += (i32)(1 ^ upperbit);
+
+    // exactly halfway between two doubles
+    if (lower == 0 && (upper & 0x1FF) == 0 && (mantissa & 3) == 1) {
+        return false;
+    }
+
+    mantissa += mantissa & 1;
+    mantissa >>= 1;
+    if (mantissa >= (1ull << 53)) {
+        mantissa = 1ull << 52;
+        lz--;
+    }
+    mantissa &= ~(1ull << 52);
+
+    i64 real_exponent = exponent - lz;
+    if (real_exponent < 1 || real_exponent > 2046) {
+        return false;
+    }
+
+    u64 bits = mantissa | ((u64)real_exponent << 52);
+    memcpy(out, &bits, sizeof(*out));
+    return true;
+}
+
+static f64 slow_parse(const char* p, u64 len) {
+    char buf[128];
+    char* s = len < sizeof(buf) ? buf : malloc(len + 1);
+    memcpy(s, p, len);
+    s[len] = '\0';
+
+    f64 val = strtod(s, 0);
+    if (s != buf) free(s);
+    return val;
+}
+
+Number number_parse(String s) {
+    Number n = {0};
+    const char* p = s.data;
+    const char* end = s.data + s.len;
+
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        neg = *p == '-';
+        p++;
+    }
+
+    const char* digits = p;
+    u64 w = 0;
+    p = parse_digits(p, end, &w);
+    u64 digit_count = p - digits;
+
+    i64 exp = 0;
+    bool is_int = true;
+    if (p < end && *p == '.') {
+        const char* frac = ++p;
+        p = parse_digits(p, end, &w);
+        exp = -(p - frac);
+        digit_count += p - frac;
+        is_int = false;
+    }
+
+    if (digit_count == 0) {
+        return n;
+    }
+
+    // only taken when at least one digit follows, "1e" is just the 1
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char* e = p + 1;
+        bool exp_neg = false;
+        if (e < end && (*e == '-' || *e == '+')) {
+            exp_neg = *e == '-';
+            e++;
+        }
+        if (e < end && is_digit(*e)) {
+            i64 x = 0;
+            while (e < end && is_digit(*e)) {
+                if (x < 100000) x = x * 10 + (*e - '0');
+                e++;
+            }
+            exp += exp_neg ? -x : x;
+            is_int = false;
+            p = e;
+        }
+    }
+
+    n.len = p - s.data;
+
+    // w wrapped around if there were more than 19 digits past the leading
+    // zeros
+    u64 zeros = 0;
+    for (const char* c = digits; c < p && (*c == '0' || *c == '.'); ++c) {
+        zeros += *c == '0';
+    }
+    bool many_digits = digit_count - zeros > 19;
+
+    if (is_int && !many_digits && w <= (u64)INT64_MAX + neg) {
+        n.is_int = true;
+        n.i = neg ? (i64)(0 - w) : (i64)w;
+        n.val = neg ? -(f64)w : (f64)w;
+        return n;
+    }
+
+    f64 val;
+    if (many_digits) {
+        val = slow_parse(digits, p - digits);
+    }
+    else if (w == 0) {
+        val = 0.0;
+    }
+    else if (w <= (1ull << 53) && exp >= -22 && exp <= 22) {
+        val = (f64)w;
+        val = exp < 0 ? val / pow10_exact[-exp] : val * pow10_exact[exp];
+    }
+    else if (!eisel_lemire(w, exp, &val)) {
+        val = slow_parse(digits, p - digits);
+    }
+
+    n.val = neg ? -val : val;
+    return n;
+}
+
+/*
+*  Formatting
+*/
+
+// Past 2^53 every double is whole. The runtimes have the same test
+// written out, they don't link against this.
+static bool is_whole(f64 n) {
+    if (!(n > -1e21 && n < 1e21)) return false;
+    return n <= -9007199254740992.0 || n >= 9007199254740992.0 || n == (f64)(i64)n;
+}
+
+u64 number_format(char* buf, f64 n) {
+    if (is_whole(n)) {
+        return snprintf(buf, NUMBER_FMT_LEN, "%.0f", n);
+    }
+
+    i32 len = 0;
+    for (i32 prec = 1; prec <= 17; ++prec) {
+        len = snprintf(buf, NUMBER_FMT_LEN, "%.*g", prec, n);
+        if (strtod(buf, 0) == n) break;
+    }
+    return len;
+}
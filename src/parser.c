@@ -2,11 +2,18 @@
 #include "include/arena.h"
 #include "include/ast.h"
 #include "include/hashmap.h"
+#include "include/ir.h"
 #include "include/lexer.h"
+#include "include/number.h"
 #include "include/string.h"
 #include "include/err.h"
+#include "include/stats.h"
 #include <assert.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 static u64 err_line = 0;
 static u64 err_col = 0;
@@ -19,6 +26,7 @@ err(msg, err_line, err_col);\
 } while (0)
 
 static Precedence precedence_lookup[TokenTypeCount] = {
+    [Token_Range] = Precedence_Range,
     [Token_Or] = Precedence_Or,
     [Token_And] = Precedence_And,
     [Token_NotEq] = Precedence_EqCmp,
@@ -34,21 +42,59 @@ static Precedence precedence_lookup[TokenTypeCount] = {
     [Token_Slash] = Precedence_Factor,
 };
 
+static u32 infix_tag[TokenTypeCount] = {
+    [Token_Range] = AST_RANGE,
+    [Token_Or] = AST_OR,
+    [Token_And] = AST_AND,
+    [Token_NotEq] = AST_NEQ,
+    [Token_DoubleEq] = AST_EQ,
+    [Token_Greater] = AST_GT,
+    [Token_GreaterEq] = AST_GTE,
+    [Token_Less] = AST_LT,
+    [Token_LessEq] = AST_LTE,
+    [Token_Plus] = AST_ADD,
+    [Token_Dash] = AST_SUB,
+    [Token_Star] = AST_MUL,
+    [Token_Slash] = AST_DIV,
+};
+
+#define EXPR_STACK_INIT 64
+
 static AST* parse_stmt(Parser* p);
 static AST* parse_expr(Parser* p, Precedence prev_prec);
-static AST* parse_infix_expr(Parser* p, Token operator, AST* left);
 static AST* parse_number(Parser* p);
+static AST* parse_array(Parser* p);
+static AST* parse_call(Parser* p, Token token);
 static AST* parse_terminal_expr(Parser* p);
+static AST* parse_typed_expr(Parser* p, u32 record);
 
-Parser* parser_new(Lexer* lexer) {
-    Parser* p = arena_alloc(lexer->arena, sizeof(Parser));
+Parser* parser_new(Lexer* lexer, Arena* types) {
+    Parser* p = arena_alloc_tagged(lexer->arena, sizeof(Parser), ArenaTag_Parser);
     p->arena = lexer->arena;
     p->lexer = lexer;
 
     AST ast = {.tag=AST_PROGRAM, .data.AST_PROGRAM={.stmt_count=0}};
     p->ast = ast_new(p->arena, ast);
 
+    ArenaTag prev_tag = arena_set_tag(p->arena, ArenaTag_Parser);
     p->var_map = hashmap_new(p->arena);
+
+    p->op_count = 0;
+    p->op_cap = EXPR_STACK_INIT;
+    p->ops = AllocArray(p->arena, ExprOp, p->op_cap);
+
+    p->val_count = 0;
+    p->val_cap = EXPR_STACK_INIT;
+    p->vals = AllocArray(p->arena, AST*, p->val_cap);
+    arena_set_tag(p->arena, prev_tag);
+
+    p->types = types;
+    p->records = 0;
+    p->record_count = p->record_cap = 0;
+    p->record_vars = 0;
+    p->record_var_count = p->record_var_cap = 0;
+    p->record_funcs = 0;
+    p->record_func_count = p->record_func_cap = 0;
     
     parser_advance(p);
     parser_advance(p);
@@ -60,33 +106,800 @@ void parser_free(Parser* p) {
     arena_free(p->arena);
 }
 
+// { stmt; stmt; ... }, same as the top level
+static AST** parse_block(Parser* p, u32* count) {
+    if (p->curr.type != Token_LCurly) {
+        ParserErr(p, p->curr, "Expected '{'");
+    }
+    parser_advance(p);
+
+    AST** body = 0;
+    u32 cap = 0;
+    *count = 0;
+    while (p->curr.type != Token_RCurly) {
+        if (p->curr.type == Token_EOF) {
+            ParserErr(p, p->curr, "Expected '}'");
+        }
+
+        AST* stmt = parse_stmt(p);
+        // a ';' after a block is allowed but not needed
+        if (!ast_ends_with_block(stmt) || p->curr.type == Token_Semicolon) {
+            if (p->curr.type != Token_Semicolon) {
+                ParserErr(p, p->prev, "Expected Semicolon");
+            }
+            parser_advance(p);
+        }
+
+        if (*count == cap) {
+            u32 new_cap = cap ? cap * 2 : 8;
+            body = arena_realloc(p->arena, body, sizeof(AST*) * cap, sizeof(AST*) * new_cap);
+            cap = new_cap;
+        }
+        body[(*count)++] = stmt;
+    }
+    parser_advance(p);
+
+    return body;
+}
+
+/*
+*  Records
+*/
+
+// names have to outlive the statement they came from
+static String keep(Parser* p, String s) {
+    String copy = string_alloc(p->types, s.len);
+    memcpy(copy.data, s.data, s.len);
+    copy.data[s.len] = '\0';
+    return copy;
+}
+
+static u32 record_find(Parser* p, String name) {
+    for (u32 i = 0; i < p->record_count; ++i) {
+        if (string_eq(p->records[i].name, name)) return i;
+    }
+    return RECORD_NONE;
+}
+
+// the latest binding of a name wins
+static u32 record_var_find(Parser* p, String name) {
+    for (u32 i = p->record_var_count; i-- > 0;) {
+        if (string_eq(p->record_vars[i].name, name)) return p->record_vars[i].record;
+    }
+    return RECORD_NONE;
+}
+
+static RecordFunc* record_func_find(Parser* p, String name) {
+    for (u32 i = p->record_func_count; i-- > 0;) {
+        if (string_eq(p->record_funcs[i].name, name)) return &p->record_funcs[i];
+    }
+    return 0;
+}
+
+static void record_var_push(Parser* p, String name, u32 record) {
+    if (p->record_var_count == p->record_var_cap) {
+        u32 cap = p->record_var_cap ? p->record_var_cap * 2 : 16;
+        p->record_vars = arena_realloc(p->types, p->record_vars,
+                                       sizeof(RecordVar) * p->record_var_cap,
+                                       sizeof(RecordVar) * cap);
+        p->record_var_cap = cap;
+    }
+    p->record_vars[p->record_var_count++] = (RecordVar){keep(p, name), record};
+}
+
+// Field loads skip every check, so a name holding a record keeps holding
+// that record. Anything else would have p.x index into whatever took its
+// place the next time around a loop.
+static void bind_record(Parser* p, Token at, String name, u32 record) {
+    u32 prev = record_var_find(p, name);
+    if (prev == record) return;
+    if (prev != RECORD_NONE) {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "'%.*s' holds a %.*s, it can't be rebound to anything else",
+                 (int)name.len, name.data, (int)p->records[prev].name.len, p->records[prev].name.data);
+        ParserErr(p, at, msg);
+    }
+    record_var_push(p, name, record);
+}
+
+// The record an expression statically holds: a name bound to one, or a
+// field of one that is a record itself
+static u32 record_of(Parser* p, AST* ast) {
+    if (ast->tag == AST_IDENT) {
+        return record_var_find(p, ast->data.AST_IDENT.ident);
+    }
+    if (ast->tag == AST_INDEX && ast->data.AST_INDEX.unchecked &&
+        ast->data.AST_INDEX.right->tag == AST_NUMBER) {
+        u32 record = record_of(p, ast->data.AST_INDEX.left);
+        if (record != RECORD_NONE) {
+            return p->records[record].field_records[ast->data.AST_INDEX.right->data.AST_NUMBER.i];
+        }
+    }
+    return RECORD_NONE;
+}
+
+// Num, Str, Bool and Nil, Ptr which is a Num, or a declared record
+static u32 parse_type_name(Parser* p, VarType* type) {
+    if (p->curr.type != Token_Ident) {
+        ParserErr(p, p->curr, "Expected a type");
+    }
+    String name = p->curr.lexeme;
+    parser_advance(p);
+
+    *type = TypeNil;
+    if (string_eq(name, string("Num")) || string_eq(name, string("Ptr"))) {
+        *type = TypeNum;
+    }
+    else if (string_eq(name, string("Str"))) {
+        *type = TypeStr;
+    }
+    else if (string_eq(name, string("Bool"))) {
+        *type = TypeBool;
+    }
+    else if (!string_eq(name, string("Nil"))) {
+        u32 record = record_find(p, name);
+        if (record == RECORD_NONE) {
+            char msg[128];
+            snprintf(msg, sizeof(msg), "Unknown type '%.*s'", (int)name.len, name.data);
+            ParserErr(p, p->prev, msg);
+        }
+        return record;
+    }
+    return RECORD_NONE;
+}
+
+// type Name { field: Type, ... }, only at the top level. It only exists
+// while parsing, nothing of it makes it into the tree.
+static void parse_type(Parser* p) {
+    parser_advance(p);
+
+    if (p->curr.type != Token_Ident) {
+        ParserErr(p, p->curr, "Expected a type name");
+    }
+    if (record_find(p, p->curr.lexeme) != RECORD_NONE) {
+        ParserErr(p, p->curr, "Type is already declared");
+    }
+    Record record = {keep(p, p->curr.lexeme), 0, 0, 0};
+    parser_advance(p);
+
+    if (p->curr.type != Token_LCurly) {
+        ParserErr(p, p->curr, "Expected '{'");
+    }
+    parser_advance(p);
+
+    u32 cap = 0;
+    while (p->curr.type != Token_RCurly) {
+        if (record.field_count) {
+            if (p->curr.type != Token_Comma) {
+                ParserErr(p, p->curr, "Expected ',' or '}'");
+            }
+            parser_advance(p);
+            if (p->curr.type == Token_RCurly) break;
+        }
+
+        if (p->curr.type != Token_Ident || p->next.type != Token_Colon) {
+            ParserErr(p, p->curr, "Expected 'field: Type'");
+        }
+        for (u32 i = 0; i < record.field_count; ++i) {
+            if (string_eq(record.fields[i], p->curr.lexeme)) {
+                ParserErr(p, p->curr, "Field is already declared");
+            }
+        }
+        String field = keep(p, p->curr.lexeme);
+        parser_advance(p);
+        parser_advance(p);
+
+        VarType type;
+        u32 field_record = parse_type_name(p, &type);
+
+        if (record.field_count == cap) {
+            u32 new_cap = cap ? cap * 2 : 4;
+            record.fields = arena_realloc(p->types, record.fields, sizeof(String) * cap, sizeof(String) * new_cap);
+            record.field_records = arena_realloc(p->types, record.field_records, sizeof(u32) * cap, sizeof(u32) * new_cap);
+            cap = new_cap;
+        }
+        record.fields[record.field_count] = field;
+        record.field_records[record.field_count++] = field_record;
+    }
+    parser_advance(p);
+
+    if (p->curr.type == Token_Semicolon) {
+        parser_advance(p);
+    }
+
+    if (p->record_count == p->record_cap) {
+        u32 new_cap = p->record_cap ? p->record_cap * 2 : 8;
+        p->records = arena_realloc(p->types, p->records, sizeof(Record) * p->record_cap, sizeof(Record) * new_cap);
+        p->record_cap = new_cap;
+    }
+    p->records[p->record_count++] = record;
+}
+
+// {a, b, ...} with one item per field in order. The braces don't say which
+// record they make, so it has to be known from where the literal is.
+static AST* parse_record(Parser* p, u32 record) {
+    Record* r = &p->records[record];
+    Token open = p->curr;
+    parser_advance(p);
+
+    AST** items = AllocArray(p->arena, AST*, r->field_count);
+    u32 count = 0;
+    while (p->curr.type != Token_RCurly) {
+        if (count) {
+            if (p->curr.type != Token_Comma) {
+                ParserErr(p, p->curr, "Expected ',' or '}'");
+            }
+            parser_advance(p);
+        }
+        if (count == r->field_count) {
+            char msg[128];
+            snprintf(msg, sizeof(msg), "Too many fields for a %.*s", (int)r->name.len, r->name.data);
+            ParserErr(p, p->curr, msg);
+        }
+
+        items[count] = parse_typed_expr(p, r->field_records[count]);
+        count++;
+    }
+    parser_advance(p);
+
+    if (count != r->field_count) {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "A %.*s has %u fields, got %u",
+                 (int)r->name.len, r->name.data, r->field_count, count);
+        ParserErr(p, open, msg);
+    }
+
+    return AST_NEW(p->arena, AST_ARRAY, items, count);
+}
+
+// An expression that has to hold the given record, RECORD_NONE for any
+// expression. That's where a record literal can go.
+static AST* parse_typed_expr(Parser* p, u32 record) {
+    if (record == RECORD_NONE) {
+        return parse_expr(p, Precedence_Min);
+    }
+    if (p->curr.type == Token_LCurly) {
+        return parse_record(p, record);
+    }
+
+    Token at = p->curr;
+    AST* expr = parse_expr(p, Precedence_Min);
+    if (record_of(p, expr) != record) {
+        Record* r = &p->records[record];
+        char msg[128];
+        snprintf(msg, sizeof(msg), "Expected a %.*s", (int)r->name.len, r->name.data);
+        ParserErr(p, at, msg);
+    }
+    return expr;
+}
+
+// expr.field on whatever is on top of the operand stack, an unchecked load
+// from the field's slot
+static void parse_field(Parser* p) {
+    parser_advance(p);
+
+    if (p->curr.type != Token_Ident) {
+        ParserErr(p, p->curr, "Expected a field name");
+    }
+
+    AST* target = p->vals[p->val_count - 1];
+    u32 record = record_of(p, target);
+    if (record == RECORD_NONE) {
+        ParserErr(p, p->curr, "Only records have fields");
+    }
+
+    Record* r = &p->records[record];
+    u32 field = 0;
+    while (field < r->field_count && !string_eq(r->fields[field], p->curr.lexeme)) {
+        field++;
+    }
+    if (field == r->field_count) {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "A %.*s has no field '%.*s'", (int)r->name.len, r->name.data,
+                 (int)p->curr.lexeme.len, p->curr.lexeme.data);
+        ParserErr(p, p->curr, msg);
+    }
+    parser_advance(p);
+
+    AST* index = AST_NEW(p->arena, AST_NUMBER, (f64)field, (i64)field, true);
+    p->vals[p->val_count - 1] = AST_NEW(p->arena, AST_INDEX, target, index, true);
+}
+
+typedef struct {
+    AstVisitor v;
+    String ident;
+    String arr;
+    bool   mark;
+    bool   assigned;
+} BoundsVisitor;
+
+static bool bounds_pre(AstVisitor* v, AST* ast) {
+    BoundsVisitor* bv = (BoundsVisitor*)v;
+
+    if (!bv->mark) {
+        bv->assigned |= ast_assigns_to(ast, bv->ident) || ast_assigns_to(ast, bv->arr);
+        return !bv->assigned;
+    }
+
+    if (ast->tag == AST_INDEX) {
+        struct AST_INDEX* data = &ast->data.AST_INDEX;
+        if (data->left->tag == AST_IDENT && string_eq(data->left->data.AST_IDENT.ident, bv->arr) &&
+            data->right->tag == AST_IDENT && string_eq(data->right->data.AST_IDENT.ident, bv->ident)) {
+            data->unchecked = true;
+        }
+    }
+    return true;
+}
+
+// In for i : n..len w with a whole n >= 0, i is a whole number in
+// [0, len w) all through the body as long as the body assigns neither i
+// nor w, arrays never change size. Every w[i] in there can skip its
+// bounds check.
+static void prove_bounds(Parser* p, AST* loop) {
+    struct AST_FOR* data = &loop->data.AST_FOR;
+    AST* start = data->start;
+    AST* end = data->end;
+
+    if (start->tag != AST_NUMBER || !start->data.AST_NUMBER.is_int || start->data.AST_NUMBER.i < 0 ||
+        end->tag != AST_LEN || end->data.AST_LEN.expr->tag != AST_IDENT) {
+        return;
+    }
+
+    BoundsVisitor bv = {{bounds_pre, 0, 0}, data->ident, end->data.AST_LEN.expr->data.AST_IDENT.ident, false, false};
+    for (u32 i = 0; i < data->stmt_count && !bv.assigned; ++i) {
+        ast_walk(p->arena, data->body[i], &bv.v);
+    }
+    if (bv.assigned) return;
+
+    bv.mark = true;
+    for (u32 i = 0; i < data->stmt_count; ++i) {
+        ast_walk(p->arena, data->body[i], &bv.v);
+    }
+}
+
+// for i : a..b { ... }, the range never exists at run time, it just gives
+// the loop its bounds
+static AST* parse_for(Parser* p) {
+    parser_advance(p);
+
+    if (p->curr.type != Token_Ident || p->next.type != Token_Colon) {
+        ParserErr(p, p->curr, "Expected 'for ident : range'");
+    }
+    Token at = p->curr;
+    String ident = p->curr.lexeme;
+    parser_advance(p);
+    parser_advance(p);
+
+    bind_record(p, at, ident, RECORD_NONE);
+
+    AST* range = parse_expr(p, Precedence_Min);
+    if (range->tag != AST_RANGE) {
+        ParserErr(p, p->prev, "Expected a range to loop over");
+    }
+
+    hashmap_insert(p->var_map, ident, TypeNum);
+
+    // not a valid identifier, so it can't clash with anything in the source
+    String end_var = string_format(p->arena, "_end%u", p->fors++);
+
+    AST* stmt = AST_NEW(p->arena, AST_FOR, ident, end_var,
+                        range->data.AST_RANGE.left, range->data.AST_RANGE.right, 0, 0);
+    stmt->data.AST_FOR.body = parse_block(p, &stmt->data.AST_FOR.stmt_count);
+
+    prove_bounds(p, stmt);
+    return stmt;
+}
+
+// while expr { body }
+static AST* parse_while(Parser* p) {
+    parser_advance(p);
+
+    AST* expr = parse_expr(p, Precedence_Min);
+    AST* stmt = AST_NEW(p->arena, AST_WHILE, expr, 0, 0);
+    stmt->data.AST_WHILE.body = parse_block(p, &stmt->data.AST_WHILE.stmt_count);
+    return stmt;
+}
+
+// if expr { body } elif expr { body } else { body }, with the elif parsed
+// as an if of its own that makes up the whole else
+static AST* parse_if(Parser* p) {
+    parser_advance(p);
+
+    AST* expr = parse_expr(p, Precedence_Min);
+    AST* stmt = AST_NEW(p->arena, AST_IF, expr, 0, 0, 0, 0);
+    struct AST_IF* data = &stmt->data.AST_IF;
+    data->body = parse_block(p, &data->stmt_count);
+
+    if (p->curr.type == Token_Elif) {
+        data->else_body = AllocArray(p->arena, AST*, 1);
+        data->else_body[0] = parse_if(p);
+        data->else_count = 1;
+    }
+    else if (p->curr.type == Token_Else) {
+        parser_advance(p);
+        data->else_body = parse_block(p, &data->else_count);
+    }
+    return stmt;
+}
+
+// func name a b: Type { body }, the parameters are bare names with an
+// optional type. Parameters that take a record hold it all through the
+// body and nowhere else.
+static AST* parse_func(Parser* p) {
+    parser_advance(p);
+
+    if (p->curr.type != Token_Ident) {
+        ParserErr(p, p->curr, "Expected a function name");
+    }
+    String name = p->curr.lexeme;
+    parser_advance(p);
+
+    if (p->record_func_count == p->record_func_cap) {
+        u32 new_cap = p->record_func_cap ? p->record_func_cap * 2 : 8;
+        p->record_funcs = arena_realloc(p->types, p->record_funcs,
+                                        sizeof(RecordFunc) * p->record_func_cap,
+                                        sizeof(RecordFunc) * new_cap);
+        p->record_func_cap = new_cap;
+    }
+    RecordFunc func = {keep(p, name), 0, 0};
+    u32 vars = p->record_var_count;
+
+    String* params = 0;
+    u32 count = 0;
+    u32 cap = 0;
+    while (p->curr.type == Token_Ident) {
+        if (count == cap) {
+            u32 new_cap = cap ? cap * 2 : 4;
+            params = arena_realloc(p->arena, params, sizeof(String) * cap, sizeof(String) * new_cap);
+            func.param_records = arena_realloc(p->types, func.param_records, sizeof(u32) * cap, sizeof(u32) * new_cap);
+            cap = new_cap;
+        }
+        params[count] = p->curr.lexeme;
+        parser_advance(p);
+
+        u32 record = RECORD_NONE;
+        if (p->curr.type == Token_Colon) {
+            parser_advance(p);
+            VarType type;
+            record = parse_type_name(p, &type);
+        }
+        func.param_records[count++] = record;
+    }
+    func.param_count = count;
+
+    // known before the body, so it can call itself with a literal
+    p->record_funcs[p->record_func_count++] = func;
+    for (u32 i = 0; i < count; ++i) {
+        if (func.param_records[i] != RECORD_NONE || record_var_find(p, params[i]) != RECORD_NONE) {
+            record_var_push(p, params[i], func.param_records[i]);
+        }
+    }
+
+    AST* stmt = AST_NEW(p->arena, AST_FUNC, name, params, count, 0, 0);
+    stmt->data.AST_FUNC.body = parse_block(p, &stmt->data.AST_FUNC.stmt_count);
+
+    p->record_var_count = vars;
+    return stmt;
+}
+
+/*
+*  Vasm
+*/
+
+// vasm "push {x}", "push 2", "iadd", "pop {x}"
+//
+// Every string is one VM instruction, checked here so a typo is a compile
+// error with a line number and not something the VM trips over later.
+// {name} is a variable from the program and becomes a child of the node,
+// so the passes see what the block reads and writes like anything else.
+// A bare name is the block's own scratch, renamed so it can't clash with
+// the program's names or the compiler's. There's no way to jump, and the
+// stack has to end up the way the block found it.
+
+typedef struct {
+    Parser* p;
+    Token   at;     // the string being parsed, where errors point
+    u64     pos;
+
+    AST**   vars;
+    bool*   written;
+    u32     var_count;
+    u32     var_cap;
+    i64     depth;  // values the block left on the stack so far
+} VasmParser;
+
+#define VasmErr(vp, what) do {\
+char msg[128];\
+snprintf(msg, sizeof(msg), "%s in vasm \"%.*s\"", what, (int)(vp)->at.lexeme.len, (vp)->at.lexeme.data);\
+ParserErr((vp)->p, (vp)->at, msg);\
+} while (0)
+
+static bool vasm_is_name(String word) {
+    if (!word.len || !isalpha((u8)word.data[0])) return false;
+    for (u64 i = 1; i < word.len; ++i) {
+        if (!isalnum((u8)word.data[i]) && word.data[i] != '_') return false;
+    }
+    return true;
+}
+
+// the next space separated word, empty at the end of the line
+static String vasm_word(VasmParser* vp) {
+    String line = vp->at.lexeme;
+    while (vp->pos < line.len && isspace((u8)line.data[vp->pos])) vp->pos++;
+
+    u64 start = vp->pos;
+    while (vp->pos < line.len && !isspace((u8)line.data[vp->pos])) vp->pos++;
+    return (String){ line.data + start, vp->pos - start };
+}
+
+static void vasm_var(VasmParser* vp, String name, bool write) {
+    if (vp->var_count == vp->var_cap) {
+        u32 cap = vp->var_cap ? vp->var_cap * 2 : 4;
+        vp->vars = arena_realloc(vp->p->arena, vp->vars, sizeof(AST*) * vp->var_cap, sizeof(AST*) * cap);
+        vp->written = arena_realloc(vp->p->arena, vp->written, vp->var_cap, cap);
+        vp->var_cap = cap;
+    }
+    vp->vars[vp->var_count] = AST_NEW(vp->p->arena, AST_IDENT, name);
+    vp->written[vp->var_count++] = write;
+}
+
+// a number, {name} or a scratch name
+static VasmArg vasm_operand(VasmParser* vp, String word, bool write) {
+    VasmArg arg = {0};
+    if (!word.len) VasmErr(vp, "Missing operand");
+
+    if (word.data[0] == '{' && word.data[word.len-1] == '}') {
+        String name = { word.data + 1, word.len - 2 };
+        if (!vasm_is_name(name)) VasmErr(vp, "Expected a variable name in {}");
+
+        arg.kind = VasmArg_Var;
+        arg.var = vp->var_count;
+        vasm_var(vp, string_format(vp->p->arena, "%.*s", (int)name.len, name.data), write);
+        return arg;
+    }
+    if (vasm_is_name(word)) {
+        arg.kind = VasmArg_Name;
+        arg.name = string_format(vp->p->arena, "_vasm_%.*s", (int)word.len, word.data);
+        return arg;
+    }
+
+    Number n = number_parse(word);
+    if (!n.len || n.len != word.len) VasmErr(vp, "Expected a number or a name");
+    if (write) VasmErr(vp, "Can't assign to a number");
+
+    arg.kind = VasmArg_Num;
+    arg.num = n.val;
+    arg.i = n.i;
+    arg.is_int = n.is_int;
+    return arg;
+}
+
+static const struct {
+    const char* name;
+    IrOp        op;
+} vasm_ops[] = {
+    {"push", Ir_Push}, {"str", Ir_Str}, {"pop", Ir_Pop}, {"del", Ir_Del},
+    {"swap", Ir_Swap}, {"add", Ir_Add}, {"sub", Ir_Sub}, {"mult", Ir_Mult},
+    {"div", Ir_Div}, {"iadd", Ir_IAdd}, {"isub", Ir_ISub}, {"imult", Ir_IMult},
+    {"arr", Ir_Array}, {"index", Ir_Index}, {"uindex", Ir_IndexU}, {"len", Ir_Len},
+    {"print", Ir_Print}, {"call", Ir_Call},
+};
+
+static void vasm_call(VasmParser* vp, VasmInst* inst) {
+    String fn = vasm_word(vp);
+    inst->fn = IrFnCount;
+    for (u32 i = 0; i < IrFnCount; ++i) {
+        if (string_eq(fn, string((char*)ir_fn_str(i)))) inst->fn = i;
+    }
+    if (inst->fn == IrFnCount) VasmErr(vp, "Unknown function");
+
+    u32 arity = inst->fn == IrFn_Not || inst->fn == IrFn_PrintStr ? 1 : 2;
+    String word = vasm_word(vp);
+    while (word.len && !string_eq(word, string("|"))) {
+        if (inst->argc == arity) VasmErr(vp, "Too many arguments");
+        inst->args[inst->argc++] = vasm_operand(vp, word, false);
+        word = vasm_word(vp);
+    }
+    if (inst->argc != arity) VasmErr(vp, "Too few arguments");
+
+    if (word.len) {
+        if (inst->fn == IrFn_PrintStr) VasmErr(vp, "print_str has nothing to assign");
+        inst->has_dst = true;
+        inst->dst = vasm_operand(vp, vasm_word(vp), true);
+    }
+}
+
+// what the instruction takes off the stack and puts back
+static void vasm_stack(VasmInst* inst, u32* pops, u32* pushes) {
+    *pops = 0;
+    *pushes = 0;
+    switch ((IrOp)inst->op) {
+        case Ir_Push: case Ir_Int: case Ir_Load: case Ir_Str: *pushes = 1; break;
+        case Ir_Pop: *pops = 1; break;
+        case Ir_Swap: *pops = 2; *pushes = 2; break;
+        case Ir_Add: case Ir_Sub: case Ir_Mult: case Ir_Div:
+        case Ir_IAdd: case Ir_ISub: case Ir_IMult:
+        case Ir_Index: case Ir_IndexU: *pops = 2; *pushes = 1; break;
+        case Ir_Len: *pops = 1; *pushes = 1; break;
+        case Ir_Array: *pops = inst->count; *pushes = 1; break;
+        case Ir_Call: *pushes = !inst->has_dst && inst->fn != IrFn_PrintStr; break;
+        default: break;
+    }
+}
+
+static VasmInst vasm_inst(VasmParser* vp) {
+    VasmInst inst = {0};
+    vp->pos = 0;
+
+    String mnemonic = vasm_word(vp);
+    if (!mnemonic.len) VasmErr(vp, "Expected an instruction");
+    inst.op = IrOpCount;
+    for (u32 i = 0; i < sizeof(vasm_ops) / sizeof(vasm_ops[0]); ++i) {
+        if (string_eq(mnemonic, string((char*)vasm_ops[i].name))) inst.op = vasm_ops[i].op;
+    }
+    if (string_eq(mnemonic, string("jmp")) || string_eq(mnemonic, string("jmpf")) ||
+        string_eq(mnemonic, string("stop"))) {
+        VasmErr(vp, "Can't jump");
+    }
+    if (inst.op == IrOpCount) VasmErr(vp, "Unknown instruction");
+
+    switch (inst.op) {
+        case Ir_Push: {
+            inst.args[0] = vasm_operand(vp, vasm_word(vp), false);
+            inst.argc = 1;
+            if (inst.args[0].kind != VasmArg_Num) inst.op = Ir_Load;
+            else if (inst.args[0].is_int) inst.op = Ir_Int;
+            break;
+        }
+        case Ir_Pop: case Ir_Del: case Ir_Print: {
+            inst.args[0] = vasm_operand(vp, vasm_word(vp), inst.op == Ir_Pop);
+            inst.argc = 1;
+            if (inst.args[0].kind == VasmArg_Num) VasmErr(vp, "Expected a name");
+            if (inst.op == Ir_Del && inst.args[0].kind == VasmArg_Var) {
+                VasmErr(vp, "Only the block's own names can be deleted");
+            }
+            break;
+        }
+        // the rest of the line is the literal, escapes and all
+        case Ir_Str: {
+            String line = vp->at.lexeme;
+            while (vp->pos < line.len && isspace((u8)line.data[vp->pos])) vp->pos++;
+            u64 end = line.len;
+            while (end > vp->pos && isspace((u8)line.data[end-1])) end--;
+
+            if (end - vp->pos < 2 || line.data[vp->pos] != '"' || line.data[end-1] != '"' ||
+                memchr(line.data + vp->pos + 1, '"', end - vp->pos - 2)) {
+                VasmErr(vp, "Expected a string literal");
+            }
+            inst.str = string_format(vp->p->arena, "%.*s", (int)(end - vp->pos - 2), line.data + vp->pos + 1);
+            vp->pos = line.len;
+            break;
+        }
+        case Ir_Array: {
+            String word = vasm_word(vp);
+            Number n = number_parse(word);
+            if (!word.len || n.len != word.len || !n.is_int || n.i < 0 || n.i > UINT32_MAX) {
+                VasmErr(vp, "Expected a count");
+            }
+            inst.count = (u32)n.i;
+            break;
+        }
+        case Ir_Call: vasm_call(vp, &inst); break;
+        default: break;
+    }
+
+    if (vasm_word(vp).len) VasmErr(vp, "Unexpected operand");
+
+    u32 pops, pushes;
+    vasm_stack(&inst, &pops, &pushes);
+    if (vp->depth < pops) VasmErr(vp, "Pops more than the block pushed");
+    vp->depth += (i64)pushes - pops;
+    return inst;
+}
+
+// vasm "line", "line", ...
+static AST* parse_vasm(Parser* p) {
+    parser_advance(p);
+
+    VasmParser vp = {0};
+    vp.p = p;
+
+    VasmInst* code = 0;
+    u32 count = 0;
+    u32 cap = 0;
+    do {
+        if (count) parser_advance(p);
+        if (p->curr.type != Token_String) {
+            ParserErr(p, p->curr, "Expected a vasm string");
+        }
+
+        vp.at = p->curr;
+        if (count == cap) {
+            u32 new_cap = cap ? cap * 2 : 8;
+            code = arena_realloc(p->arena, code, sizeof(VasmInst) * cap, sizeof(VasmInst) * new_cap);
+            cap = new_cap;
+        }
+        code[count++] = vasm_inst(&vp);
+        parser_advance(p);
+    } while (p->curr.type == Token_Comma);
+
+    if (vp.depth) VasmErr(&vp, "Stack isn't left the way the block found it");
+
+    return AST_NEW(p->arena, AST_VASM, code, count, vp.vars, vp.written, vp.var_count);
+}
+
 static AST* parse_stmt(Parser* p) {
-    AST* stmt = arena_alloc(p->arena, sizeof(AST));
+    if (p->curr.type == Token_For) {
+        return parse_for(p);
+    }
+    if (p->curr.type == Token_While) {
+        return parse_while(p);
+    }
+    if (p->curr.type == Token_If) {
+        return parse_if(p);
+    }
+    if (p->curr.type == Token_Func) {
+        return parse_func(p);
+    }
+    if (p->curr.type == Token_Type) {
+        ParserErr(p, p->curr, "Types can only be declared at the top level");
+    }
+    if (p->curr.type == Token_Return) {
+        parser_advance(p);
+        AST* expr = p->curr.type == Token_Semicolon
+            ? AST_NEW(p->arena, AST_NIL, 0)
+            : parse_expr(p, Precedence_Min);
+        return AST_NEW(p->arena, AST_RETURN, expr);
+    }
+
+    // vasm is a keyword in statements the way print is, followed by its
+    // strings so the name is still free for anything else
+    if (p->curr.type == Token_Ident && p->next.type == Token_String &&
+        string_eq(p->curr.lexeme, string("vasm"))) {
+        return parse_vasm(p);
+    }
+
+    AST* stmt = arena_alloc_tagged(p->arena, sizeof(AST), ArenaTag_AST);
 
     if (p->curr.type == Token_Let) {
         parser_advance(p); 
 
-        if (p->curr.type == Token_Ident && p->next.type == Token_Eq) {
+        if (p->curr.type == Token_Ident && (p->next.type == Token_Eq || p->next.type == Token_Colon)) {
             stmt->tag = AST_LET;
             struct AST_LET* data = &stmt->data.AST_LET;
             data->ident = p->curr.lexeme;
+            Token at = p->curr;
 
-            parser_advance(p); 
             parser_advance(p); 
 
+            // let name: Type = expr, without the type it's guessed
             VarType type = TypeNil;
-            switch (p->curr.type) {
-                case Token_Nil: break;
-                case Token_String: type = TypeStr; break;
-                case Token_Number: type = TypeNum; break;
-                case Token_True:
-                case Token_False: type = TypeBool; break;
-                default: break;
+            u32 record = RECORD_NONE;
+            bool typed = p->curr.type == Token_Colon;
+            if (typed) {
+                parser_advance(p);
+                record = parse_type_name(p, &type);
+                if (p->curr.type != Token_Eq) {
+                    ParserErr(p, p->curr, "Expected '='");
+                }
+            }
+            parser_advance(p); 
+
+            if (!typed) {
+                switch (p->curr.type) {
+                    case Token_Nil: break;
+                    case Token_String: type = TypeStr; break;
+                    case Token_Number: type = TypeNum; break;
+                    case Token_True:
+                    case Token_False: type = TypeBool; break;
+                    default: break;
+                }
             }
 
             hashmap_insert(p->var_map, data->ident, type);
                 
-            data->expr = parse_expr(p, Precedence_Min);
+            data->expr = parse_typed_expr(p, record);
+            bind_record(p, at, data->ident, typed ? record : record_of(p, data->expr));
         } 
     } 
     else if (p->curr.type == Token_Ident) {
@@ -98,6 +911,12 @@ static AST* parse_stmt(Parser* p) {
             stmt->data.AST_PRINT.expr = parse_expr(p, Precedence_Min);
         }
         else {
+            bool compound = p->next.type == Token_PlusEq || p->next.type == Token_MinusEq ||
+                            p->next.type == Token_MultEq || p->next.type == Token_DivEq;
+            if (compound && record_var_find(p, p->curr.lexeme) != RECORD_NONE) {
+                ParserErr(p, p->curr, "A record can only be assigned with let");
+            }
+
             switch (p->next.type) {
                 case Token_PlusEq: {
                     parser_advance(p);
@@ -135,7 +954,8 @@ static AST* parse_stmt(Parser* p) {
                     stmt->data.AST_DIVEQ.expr = parse_expr(p, Precedence_Min);
                     break;
                 }
-                default: token_print(p->curr); ParserErr(p, p->curr, "Not Implemented #0");
+                // a bare expression, most likely a call
+                default: return parse_expr(p, Precedence_Min);
             } 
         }
     }
@@ -146,12 +966,98 @@ static AST* parse_stmt(Parser* p) {
     return stmt;
 }
 
+// integers that fit an i64 stay exact, anything else is a double
 static AST* parse_number(Parser* p) {
-    AST* num = AST_NEW(p->arena, AST_NUMBER, atof(p->curr.lexeme.data));
+    Number n = number_parse(p->curr.lexeme);
+    AST* num = AST_NEW(p->arena, AST_NUMBER, n.val, n.i, n.is_int);
     parser_advance(p);
     return num;
 }
 
+// [a, b, ...], the items can be any expression
+static AST* parse_array(Parser* p) {
+    parser_advance(p);
+
+    AST** items = 0;
+    u32 count = 0;
+    u32 cap = 0;
+    while (p->curr.type != Token_RBrace) {
+        if (count) {
+            if (p->curr.type != Token_Comma) {
+                ParserErr(p, p->curr, "Expected ',' or ']'");
+            }
+            parser_advance(p);
+        }
+
+        AST* item = parse_expr(p, Precedence_Min);
+        if (count == cap) {
+            u32 new_cap = cap ? cap * 2 : 8;
+            items = arena_realloc(p->arena, items, sizeof(AST*) * cap, sizeof(AST*) * new_cap);
+            cap = new_cap;
+        }
+        items[count++] = item;
+    }
+    parser_advance(p);
+
+    return AST_NEW(p->arena, AST_ARRAY, items, count);
+}
+
+// A name is called when an argument follows it right away, nothing else
+// can come after a name there. A call without arguments needs its ().
+static bool starts_call(Parser* p) {
+    switch (p->curr.type) {
+        case Token_LParen: case Token_Number: case Token_String: case Token_Ident:
+        case Token_True: case Token_False: case Token_Nil: return true;
+        default: return false;
+    }
+}
+
+// A { right after a name is a block, unless the name is a function whose
+// first parameter is a record
+static bool takes_literal(Parser* p, String name) {
+    if (p->curr.type != Token_LCurly) return false;
+    RecordFunc* func = record_func_find(p, name);
+    return func && func->param_count && func->param_records[0] != RECORD_NONE;
+}
+
+// name(a, b) or name a, b. Without parentheses the arguments run to the
+// end of the expression, so f a, g b, c is f(a, g(b, c)).
+static AST* parse_call(Parser* p, Token token) {
+    String name = token.lexeme;
+    bool parens = p->curr.type == Token_LParen;
+    if (parens) parser_advance(p);
+
+    // a function declared with record parameters takes literals for them
+    RecordFunc* func = record_func_find(p, name);
+
+    AST** args = 0;
+    u32 count = 0;
+    u32 cap = 0;
+    while (!parens || p->curr.type != Token_RParen) {
+        if (count) {
+            if (p->curr.type != Token_Comma) {
+                if (!parens) break;
+                ParserErr(p, p->curr, "Expected ',' or ')'");
+            }
+            parser_advance(p);
+        }
+
+        u32 record = func && count < func->param_count ? func->param_records[count] : RECORD_NONE;
+        AST* arg = parse_typed_expr(p, record);
+        if (count == cap) {
+            u32 new_cap = cap ? cap * 2 : 4;
+            args = arena_realloc(p->arena, args, sizeof(AST*) * cap, sizeof(AST*) * new_cap);
+            cap = new_cap;
+        }
+        args[count++] = arg;
+    }
+    if (parens) parser_advance(p);
+
+    return AST_NEW(p->arena, AST_CALL, name, args, count, token);
+}
+
+// Everything in here is a leaf: prefix operators and parentheses are
+// handled by the operator stack in parse_expr
 static AST* parse_terminal_expr(Parser* p) {
     AST* ret = 0;
     switch (p->curr.type) {
@@ -159,24 +1065,6 @@ static AST* parse_terminal_expr(Parser* p) {
             ret = parse_number(p);
             break;
         }
-        case Token_LParen: {
-            parser_advance(p);
-            ret = parse_expr(p, Precedence_Min);
-            if (p->curr.type == Token_RParen) {
-                parser_advance(p);
-            }
-            break;
-        }
-        case Token_Dash: {
-            parser_advance(p);
-            ret = AST_NEW(p->arena, AST_NEGATE, parse_terminal_expr(p));
-            break;
-        }
-        case Token_Bang: {
-            parser_advance(p);
-            ret = AST_NEW(p->arena, AST_NOT, parse_terminal_expr(p));
-            break;
-        }
         case Token_Nil: {
             parser_advance(p);
             ret = AST_NEW(p->arena, AST_NIL, 0);
@@ -189,7 +1077,9 @@ static AST* parse_terminal_expr(Parser* p) {
         }
         case Token_Ident: {
             parser_advance(p);
-            ret = AST_NEW(p->arena, AST_IDENT, p->prev.lexeme);
+            ret = starts_call(p) || takes_literal(p, p->prev.lexeme)
+                ? parse_call(p, p->prev)
+                : AST_NEW(p->arena, AST_IDENT, p->prev.lexeme);
             break;
         }
         case Token_True: {
@@ -202,138 +1092,281 @@ static AST* parse_terminal_expr(Parser* p) {
             ret = AST_NEW(p->arena, AST_BOOL, 0);
             break;
         }
+        case Token_LBrace: {
+            ret = parse_array(p);
+            break;
+        }
         default: token_loc_print(p->curr); assert(0 && "Unknown Terminal Expr");
     }
 
     return ret;
 }
 
-static AST* parse_infix_expr(Parser* p, Token op, AST* left) {
-    AST* node = arena_alloc(p->arena, sizeof(AST));
-    switch (op.type) {
-        case Token_Plus:{
-            node->tag = AST_ADD;
+static void push_op(Parser* p, ExprOpKind kind, TokenType type) {
+    if (p->op_count == p->op_cap) {
+        p->ops = arena_realloc(p->arena, p->ops,
+                               sizeof(ExprOp) * p->op_cap,
+                               sizeof(ExprOp) * p->op_cap * 2);
+        p->op_cap *= 2;
+    }
+
+    p->ops[p->op_count++] = (ExprOp){kind, type, precedence_lookup[type]};
+}
+
+static void push_val(Parser* p, AST* val) {
+    if (p->val_count == p->val_cap) {
+        p->vals = arena_realloc(p->arena, p->vals,
+                                sizeof(AST*) * p->val_cap,
+                                sizeof(AST*) * p->val_cap * 2);
+        p->val_cap *= 2;
+    }
+
+    p->vals[p->val_count++] = val;
+}
+
+// expr[index] on whatever is on top of the operand stack. Indexing a range
+// is just start + index, nothing gets checked against the end.
+static void parse_index(Parser* p) {
+    parser_advance(p);
+
+    AST* index = parse_expr(p, Precedence_Min);
+    if (p->curr.type != Token_RBrace) {
+        ParserErr(p, p->curr, "Expected ']'");
+    }
+    parser_advance(p);
+
+    AST* target = p->vals[p->val_count - 1];
+    if (target->tag == AST_RANGE) {
+        p->vals[p->val_count - 1] = AST_NEW(p->arena, AST_ADD, target->data.AST_RANGE.left, index);
+    } else {
+        p->vals[p->val_count - 1] = AST_NEW(p->arena, AST_INDEX, target, index, false);
+    }
+}
+
+// Pops the top operator and folds it into the operand stack
+static void reduce(Parser* p) {
+    ExprOp op = p->ops[--p->op_count];
+
+    switch (op.kind) {
+        case ExprOp_Paren: return;
+        case ExprOp_Prefix: {
+            AST* expr = p->vals[p->val_count - 1];
+            p->vals[p->val_count - 1] = 
+                op.type == Token_Dash ? AST_NEW(p->arena, AST_NEGATE, expr) :
+                op.type == Token_Bang ? AST_NEW(p->arena, AST_NOT, expr) :
+                                        AST_NEW(p->arena, AST_LEN, expr);
+            return;
+        }
+        case ExprOp_Infix: {
+            AST* right = p->vals[--p->val_count];
+            AST* left = p->vals[p->val_count - 1];
+
+            // every binary node shares the { left, right } layout
+            AST* node = arena_alloc_tagged(p->arena, sizeof(AST), ArenaTag_AST);
+            node->tag = infix_tag[op.type];
             node->data.AST_ADD.left = left;
-            node->data.AST_ADD.right = parse_expr(p, 
-                                        precedence_lookup[op.type]);
-            return node;
-        }
-        case Token_Dash:{
-            node->tag = AST_SUB;
-            node->data.AST_SUB.left = left;
-            node->data.AST_SUB.right = parse_expr(p,
-                                        precedence_lookup[op.type]);
-            return node;
-        }
-        case Token_Star:{
-            node->tag = AST_MUL;
-            node->data.AST_MUL.left = left;
-            node->data.AST_MUL.right = parse_expr(p, 
-                                        precedence_lookup[op.type]);
-            return node;
-        }
-        case Token_Slash:{
-            node->tag = AST_DIV;
-            node->data.AST_DIV.left = left;
-            node->data.AST_DIV.right = parse_expr(p, 
-                                        precedence_lookup[op.type]);
-            return node;
-        }
-        case Token_DoubleEq: {
-            node->tag = AST_EQ;
-            node->data.AST_EQ.left = left;
-            node->data.AST_EQ.right = parse_expr(p, 
-                                       precedence_lookup[op.type]);
-            return node;
-        }
-        case Token_NotEq: {
-            node->tag = AST_NEQ;
-            node->data.AST_NEQ.left = left;
-            node->data.AST_NEQ.right = parse_expr(p, 
-                                       precedence_lookup[op.type]);
-            return node;
-        }
-        case Token_Greater: {
-            node->tag = AST_GT;
-            node->data.AST_GT.left = left;
-            node->data.AST_GT.right = parse_expr(p, 
-                                       precedence_lookup[op.type]);
-            return node;
-        }
-        case Token_GreaterEq: {
-            node->tag = AST_GTE;
-            node->data.AST_GTE.left = left;
-            node->data.AST_GTE.right = parse_expr(p, 
-                                       precedence_lookup[op.type]);
-            return node;
-        }
-        case Token_Less: {
-            node->tag = AST_LT;
-            node->data.AST_LT.left = left;
-            node->data.AST_LT.right = parse_expr(p, 
-                                       precedence_lookup[op.type]);
-            return node;
-        }
-        case Token_LessEq: {
-            node->tag = AST_LTE;
-            node->data.AST_LTE.left = left;
-            node->data.AST_LTE.right = parse_expr(p, 
-                                       precedence_lookup[op.type]);
-            return node;
-        }
-        case Token_And: {
-            node->tag = AST_AND;
-            node->data.AST_AND.left = left;
-            node->data.AST_AND.right = parse_expr(p, 
-                                       precedence_lookup[op.type]);
-            return node;
-        }
-        case Token_Or: {
-            node->tag = AST_OR;
-            node->data.AST_OR.left = left;
-            node->data.AST_OR.right = parse_expr(p, 
-                                       precedence_lookup[op.type]);
-            return node;
-        }
-        default: token_loc_print(p->curr); assert(0 && "Not Implemented #1");
+            node->data.AST_ADD.right = right;
+            p->vals[p->val_count - 1] = node;
+            return;
+        }
     }
 }
 
+// Precedence climbing over explicit stacks. Infix operators bind left to
+// right, tighter precedence first, prefix -, ! and len only take the operand
+// right in front of them, and an unclosed ( closes at the end of the
+// expression.
 static AST* parse_expr(Parser* p, Precedence prev_prec) {
-    AST* lhs = parse_terminal_expr(p);
+    usize op_base = p->op_count;
+    usize val_base = p->val_count;
+    usize parens = 0;
+
+    for (;;) {
+        // len is a keyword in expressions the way print is in statements
+        while (p->curr.type == Token_Dash || 
+               p->curr.type == Token_Bang ||
+               p->curr.type == Token_LParen ||
+               (p->curr.type == Token_Ident && string_eq(p->curr.lexeme, string("len")))) {
+            if (p->curr.type == Token_LParen) {
+                push_op(p, ExprOp_Paren, p->curr.type);
+                parens++;
+            } else {
+                push_op(p, ExprOp_Prefix, p->curr.type);
+            }
+            parser_advance(p);
+        }
 
-    Token curr_op = p->curr;
-    Precedence curr_prec = precedence_lookup[curr_op.type];
+        push_val(p, parse_terminal_expr(p));
 
-    while (curr_prec != Precedence_Min) {
-        if (prev_prec >= curr_prec) {
-            break;
-        } else {
+        for (;;) {
+            while (p->curr.type == Token_LBrace || p->curr.type == Token_Dot) {
+                if (p->curr.type == Token_LBrace) {
+                    parse_index(p);
+                } else {
+                    parse_field(p);
+                }
+            }
+
+            while (p->op_count > op_base && p->ops[p->op_count-1].kind == ExprOp_Prefix) {
+                reduce(p);
+            }
+
+            if (parens == 0 || p->curr.type != Token_RParen) break;
+
+            while (p->ops[p->op_count-1].kind != ExprOp_Paren) {
+                reduce(p);
+            }
+            reduce(p);
+            parens--;
             parser_advance(p);
-            lhs = parse_infix_expr(p, curr_op, lhs);
-            curr_op = p->curr;
-            curr_prec = precedence_lookup[curr_op.type];
         }
+
+        Precedence prec = precedence_lookup[p->curr.type];
+        if (prec == Precedence_Min || (parens == 0 && prec <= prev_prec)) {
+            break;
+        }
+
+        if (!infix_tag[p->curr.type]) {
+            token_loc_print(p->curr);
+            ParserErr(p, p->curr, "Not Implemented #1");
+        }
+
+        while (p->op_count > op_base && 
+               p->ops[p->op_count-1].kind == ExprOp_Infix &&
+               p->ops[p->op_count-1].prec >= prec) {
+            reduce(p);
+        }
+
+        push_op(p, ExprOp_Infix, p->curr.type);
+        parser_advance(p);
     }
 
-    return lhs;
+    while (p->op_count > op_base) {
+        reduce(p);
+    }
+
+    assert(p->val_count == val_base + 1);
+    return p->vals[--p->val_count];
 }
 
 void parser_advance(Parser* p) {
     p->prev = p->curr;
     p->curr = p->next;
+
+    STATS_BEGIN(lex_start);
     p->next = lexer_next_token(p->lexer);
+    STATS_END(Phase_Lex, lex_start);
+    STATS_ADD(tokens, p->next.type != Token_EOF);
 }
 
-void parser_parse(Parser* p) {
-    struct AST_PROGRAM* stmt_list = &p->ast->data.AST_PROGRAM;
-    while (p->curr.type != Token_EOF && stmt_list->stmt_count < 15) {
-        p->ast->data.AST_PROGRAM.body[stmt_list->stmt_count++] = parse_stmt(p);
-         
+// Parses the next top level statement, NULL once the input runs out
+AST* parser_parse_stmt(Parser* p) {
+    ArenaTag prev_tag = arena_set_tag(p->arena, ArenaTag_Parser);
+
+    while (p->curr.type == Token_Type) {
+        parse_type(p);
+    }
+
+    if (p->curr.type == Token_EOF) {
+        arena_set_tag(p->arena, prev_tag);
+        return 0;
+    }
+
+    AST* stmt = parse_stmt(p);
+
+    if (!ast_ends_with_block(stmt) || p->curr.type == Token_Semicolon) {
         if (p->curr.type != Token_Semicolon) {
             ParserErr(p, p->prev, "Expected Semicolon");
         }
 
         parser_advance(p);
     }
+
+    arena_set_tag(p->arena, prev_tag);
+    return stmt;
+}
+
+void parser_parse(Parser* p) {
+    ArenaTag prev_tag = arena_set_tag(p->arena, ArenaTag_Parser);
+
+    struct AST_PROGRAM* stmt_list = &p->ast->data.AST_PROGRAM;
+    AST* stmt;
+    while ((stmt = parser_parse_stmt(p))) {
+        if (stmt_list->stmt_count == stmt_list->stmt_cap) {
+            u32 cap = stmt_list->stmt_cap ? stmt_list->stmt_cap * 2 : 16;
+            stmt_list->body = arena_realloc(p->arena, stmt_list->body,
+                                            sizeof(AST*) * stmt_list->stmt_cap,
+                                            sizeof(AST*) * cap);
+            stmt_list->stmt_cap = cap;
+        }
+
+        stmt_list->body[stmt_list->stmt_count++] = stmt;
+    }
+
+    arena_set_tag(p->arena, prev_tag);
+}
+
+// Throws away everything allocated since pos. The lookahead tokens were
+// lexed while parsing the last statement, so their lexemes get copied back
+// on top of pos. Rewinding keeps the chunks around, but the copies can land
+// on a lexeme that hasn't moved yet, so they go through a buffer first.
+void parser_rewind(Parser* p, u64 pos) {
+    Arena* a = p->arena;
+    if (pos >= a->pos_u64) {
+        return;
+    }
+
+    Token* tokens[] = { &p->prev, &p->curr, &p->next };
+    Token* moved[3];
+    u32 moved_count = 0;
+    u64 total = 0;
+    for (u32 i = 0; i < 3; ++i) {
+        u64 at = arena_pos_of(a, tokens[i]->lexeme.data);
+        if (at == ARENA_NO_POS || at < pos) {
+            continue;
+        }
+
+        moved[moved_count++] = tokens[i];
+        total += tokens[i]->lexeme.len + 1;
+    }
+
+    // the expression stacks are empty between statements, so stacks that
+    // grew past the checkpoint just get a fresh spot
+    u64 ops_at = arena_pos_of(a, p->ops);
+    u64 vals_at = arena_pos_of(a, p->vals);
+    bool new_ops = ops_at != ARENA_NO_POS && ops_at >= pos;
+    bool new_vals = vals_at != ARENA_NO_POS && vals_at >= pos;
+
+    char small[256];
+    char* buf = total <= sizeof(small) ? small : malloc(total);
+    if (!buf) {
+        err("Failed to allocate lexeme buffer", 0, 0);
+    }
+
+    char* write = buf;
+    for (u32 i = 0; i < moved_count; ++i) {
+        memcpy(write, moved[i]->lexeme.data, moved[i]->lexeme.len + 1);
+        write += moved[i]->lexeme.len + 1;
+    }
+
+    arena_set_pos_back(a, pos);
+
+    char* read = buf;
+    for (u32 i = 0; i < moved_count; ++i) {
+        Token* t = moved[i];
+        t->lexeme.data = arena_alloc(a, t->lexeme.len + 1);
+        memcpy(t->lexeme.data, read, t->lexeme.len + 1);
+        read += t->lexeme.len + 1;
+    }
+
+    if (buf != small) {
+        free(buf);
+    }
+
+    if (new_ops) {
+        p->ops = AllocArray(a, ExprOp, p->op_cap);
+    }
+    if (new_vals) {
+        p->vals = AllocArray(a, AST*, p->val_cap);
+    }
 }
@@ -0,0 +1,276 @@
+#include "include/sra.h"
+#include "include/arena.h"
+#include "include/ast.h"
+#include "include/ir.h"
+#include "include/string.h"
+#include <string.h>
+
+Sra* sra_new(Arena* a, bool stream) {
+    Sra* s = AllocArrayZero(a, Sra, 1);
+    s->stream = stream;
+    return s;
+}
+
+/*
+*  Escapes
+*/
+
+typedef struct {
+    u32     len;      // slots, from the first literal bound to it
+    u64     reach;    // highest constant index read, plus one
+    bool    bound;
+    bool    escapes;
+    String* slots;    // a name per slot once it's split
+} Aggregate;
+
+typedef struct {
+    AstVisitor v;
+    Sra*       s;
+    Arena*     a;
+    IrSymbols* names;
+    Aggregate* aggs;  // by slot, NULL while the names are collected
+} Analysis;
+
+static Aggregate* agg_of(Analysis* an, String name) {
+    u32 slot = ir_symbol(an->names, name);
+    return an->aggs ? &an->aggs[slot] : 0;
+}
+
+// a literal index that's a whole number, -1 otherwise
+static i64 const_index(AST* ast) {
+    if (ast->tag != AST_NUMBER || !ast->data.AST_NUMBER.is_int || ast->data.AST_NUMBER.i < 0) {
+        return -1;
+    }
+    return ast->data.AST_NUMBER.i;
+}
+
+static bool escape_pre(AstVisitor* v, AST* ast) {
+    Analysis* an = (Analysis*)v;
+
+    switch (ast->tag) {
+        case AST_LET: {
+            struct AST_LET* data = &ast->data.AST_LET;
+            Aggregate* agg = agg_of(an, data->ident);
+            if (!agg) return true;
+
+            if (data->expr->tag != AST_ARRAY) {
+                agg->escapes = true;
+            } else if (!agg->bound) {
+                agg->bound = true;
+                agg->len = data->expr->data.AST_ARRAY.count;
+            } else if (agg->len != data->expr->data.AST_ARRAY.count) {
+                agg->escapes = true;
+            }
+            return true;
+        }
+        // all four share the { ident, expr } layout
+        case AST_ADDEQ: case AST_SUBEQ: case AST_MULEQ: case AST_DIVEQ: {
+            Aggregate* agg = agg_of(an, ast->data.AST_ADDEQ.ident);
+            if (agg) agg->escapes = true;
+            return true;
+        }
+        case AST_FOR: {
+            Aggregate* agg = agg_of(an, ast->data.AST_FOR.ident);
+            if (agg) agg->escapes = true;
+            return true;
+        }
+        // x[k] and len x don't let x out, the name isn't visited
+        case AST_INDEX: {
+            struct AST_INDEX* data = &ast->data.AST_INDEX;
+            i64 k = const_index(data->right);
+            if (data->left->tag != AST_IDENT || k < 0) return true;
+
+            Aggregate* agg = agg_of(an, data->left->data.AST_IDENT.ident);
+            if (agg && (u64)k >= agg->reach) agg->reach = k + 1;
+            return false;
+        }
+        case AST_LEN: {
+            AST* expr = ast->data.AST_LEN.expr;
+            if (expr->tag != AST_IDENT) return true;
+            agg_of(an, expr->data.AST_IDENT.ident);
+            return false;
+        }
+        case AST_IDENT: {
+            Aggregate* agg = agg_of(an, ast->data.AST_IDENT.ident);
+            if (agg) agg->escapes = true;
+            return true;
+        }
+        default: return true;
+    }
+}
+
+/*
+*  Splitting
+*/
+
+static Aggregate* split_of(Analysis* an, String name) {
+    i32 slot = ir_symbol_find(an->names, name);
+    return slot >= 0 && an->aggs[slot].slots ? &an->aggs[slot] : 0;
+}
+
+typedef struct {
+    AstVisitor v;
+    Analysis*  an;
+} ReplaceVisitor;
+
+// x[k] becomes x's k'th name and len x its length, in place
+static void replace_post(AstVisitor* v, AST* ast) {
+    Analysis* an = ((ReplaceVisitor*)v)->an;
+
+    if (ast->tag == AST_INDEX && ast->data.AST_INDEX.left->tag == AST_IDENT) {
+        Aggregate* agg = split_of(an, ast->data.AST_INDEX.left->data.AST_IDENT.ident);
+        if (!agg) return;
+        String name = agg->slots[ast->data.AST_INDEX.right->data.AST_NUMBER.i];
+        *ast = (AST){AST_IDENT, {.AST_IDENT = (struct AST_IDENT){name}}};
+    }
+    else if (ast->tag == AST_LEN && ast->data.AST_LEN.expr->tag == AST_IDENT) {
+        Aggregate* agg = split_of(an, ast->data.AST_LEN.expr->data.AST_IDENT.ident);
+        if (!agg) return;
+        *ast = (AST){AST_NUMBER, {.AST_NUMBER = (struct AST_NUMBER){agg->len, agg->len, true}}};
+    }
+}
+
+static void replace(Analysis* an, AST* ast) {
+    ReplaceVisitor rv = {{0, 0, replace_post}, an};
+    ast_walk(an->a, ast, &rv.v);
+}
+
+typedef struct {
+    AstVisitor v;
+    String     name;
+    bool       found;
+} ReadsVisitor;
+
+static bool reads_pre(AstVisitor* v, AST* ast) {
+    ReadsVisitor* rv = (ReadsVisitor*)v;
+    if (ast->tag == AST_IDENT && string_eq(ast->data.AST_IDENT.ident, rv->name)) {
+        rv->found = true;
+    }
+    return !rv->found;
+}
+
+static AST* let_ident(Arena* a, String name, AST* expr) {
+    return AST_NEW(a, AST_LET, expr, name);
+}
+
+// let x = {a, b} becomes a let per slot. When the items read x itself they
+// all get worked out first, so no slot is read after it was overwritten.
+static void split_let(Analysis* an, AST* stmt, AstList* out) {
+    struct AST_LET* data = &stmt->data.AST_LET;
+    Aggregate* agg = split_of(an, data->ident);
+    struct AST_ARRAY* arr = &data->expr->data.AST_ARRAY;
+
+    ReadsVisitor rv = {{reads_pre, 0, 0}, data->ident, false};
+    for (u32 k = 0; k < arr->count && !rv.found; ++k) {
+        ast_walk(an->a, arr->items[k], &rv.v);
+    }
+
+    for (u32 k = 0; k < arr->count; ++k) {
+        replace(an, arr->items[k]);
+    }
+
+    if (!rv.found) {
+        for (u32 k = 0; k < arr->count; ++k) {
+            ast_list_push(an->a, out, let_ident(an->a, agg->slots[k], arr->items[k]));
+        }
+        return;
+    }
+
+    u32 id = an->s->temps++;
+    for (u32 k = 0; k < arr->count; ++k) {
+        String temp = string_format(an->a, "_sra%u_%u", id, k);
+        ast_list_push(an->a, out, let_ident(an->a, temp, arr->items[k]));
+        arr->items[k] = AST_NEW(an->a, AST_IDENT, temp);
+    }
+    for (u32 k = 0; k < arr->count; ++k) {
+        ast_list_push(an->a, out, let_ident(an->a, agg->slots[k], arr->items[k]));
+    }
+}
+
+static void sra_body(Analysis* an, AST*** stmts, u32* count) {
+    AstList out = {0};
+
+    for (u32 i = 0; i < *count; ++i) {
+        AST* stmt = (*stmts)[i];
+        switch (stmt->tag) {
+            case AST_LET: {
+                if (split_of(an, stmt->data.AST_LET.ident)) {
+                    split_let(an, stmt, &out);
+                    continue;
+                }
+                replace(an, stmt->data.AST_LET.expr);
+                break;
+            }
+            case AST_ADDEQ: case AST_SUBEQ: case AST_MULEQ: case AST_DIVEQ: {
+                replace(an, stmt->data.AST_ADDEQ.expr);
+                break;
+            }
+            case AST_PRINT: replace(an, stmt->data.AST_PRINT.expr); break;
+            case AST_IF: {
+                struct AST_IF* data = &stmt->data.AST_IF;
+                replace(an, data->expr);
+                sra_body(an, &data->body, &data->stmt_count);
+                sra_body(an, &data->else_body, &data->else_count);
+                break;
+            }
+            case AST_WHILE: {
+                struct AST_WHILE* data = &stmt->data.AST_WHILE;
+                replace(an, data->expr);
+                sra_body(an, &data->body, &data->stmt_count);
+                break;
+            }
+            case AST_FOR: {
+                struct AST_FOR* data = &stmt->data.AST_FOR;
+                replace(an, data->start);
+                replace(an, data->end);
+                sra_body(an, &data->body, &data->stmt_count);
+                break;
+            }
+            default: replace(an, stmt); break;
+        }
+        ast_list_push(an->a, &out, stmt);
+    }
+
+    *stmts = out.stmts;
+    *count = out.count;
+}
+
+void sra_stmts(Sra* s, Arena* a, AST*** stmts, u32* count) {
+    Analysis an = {{escape_pre, 0, 0}, s, a, ir_symbols_new(a), 0};
+
+    // names first, then what happens to each of them
+    for (u32 i = 0; i < *count; ++i) {
+        ast_walk(a, (*stmts)[i], &an.v);
+    }
+    an.aggs = AllocArrayZero(a, Aggregate, an.names->count ? an.names->count : 1);
+    for (u32 i = 0; i < *count; ++i) {
+        ast_walk(a, (*stmts)[i], &an.v);
+    }
+
+    // names made up by the passes start with '_', nothing from the source
+    // does
+    bool any = false;
+    for (u32 slot = 0; slot < an.names->count; ++slot) {
+        Aggregate* agg = &an.aggs[slot];
+        String name = an.names->names[slot];
+        if (!agg->bound || agg->escapes || agg->reach > agg->len || (s->stream && name.data[0] != '_')) {
+            continue;
+        }
+
+        u32 id = s->temps++;
+        agg->slots = AllocArray(a, String, agg->len ? agg->len : 1);
+        for (u32 k = 0; k < agg->len; ++k) {
+            agg->slots[k] = string_format(a, "_sra%u_%u", id, k);
+        }
+        s->split++;
+        any = true;
+    }
+
+    if (any) sra_body(&an, stmts, count);
+}
+
+void sra_program(Sra* s, Arena* a, AST* program) {
+    struct AST_PROGRAM* data = &program->data.AST_PROGRAM;
+    sra_stmts(s, a, &data->body, &data->stmt_count);
+    data->stmt_cap = data->stmt_count;
+}
@@ -0,0 +1,699 @@
+#include <string.h>
+
+#include "include/ssa.h"
+#include "include/arena.h"
+#include "include/ast.h"
+#include "include/ir.h"
+#include "include/string.h"
+
+// most values have a single user, lists start small
+#define SSA_LIST_INIT 2
+
+Ssa* ssa_new(Arena* a) {
+    Ssa* s = AllocArrayZero(a, Ssa, 1);
+    s->arena = a;
+    s->names = ir_symbols_new(a);
+    return s;
+}
+
+static void* grow(Arena* a, void* items, u32* cap, u64 size) {
+    u32 new_cap = *cap ? *cap * 2 : SSA_LIST_INIT;
+    items = arena_realloc(a, items, size * *cap, size * new_cap);
+    *cap = new_cap;
+    return items;
+}
+
+/*
+*  Values and blocks
+*/
+
+// Top is nothing seen yet, Bottom is more than one thing
+typedef enum { Lat_Top, Lat_Const, Lat_Bottom } Lattice;
+
+typedef enum { Ssa_Const, Ssa_Op, Ssa_Phi, Ssa_Opaque, Ssa_Branch } SsaKind;
+
+typedef struct SsaBlock SsaBlock;
+typedef struct SsaValue SsaValue;
+
+typedef struct {
+    SsaValue** items;
+    u32        count;
+    u32        cap;
+} ValueList;
+
+struct SsaBlock {
+    bool       exec;
+    ValueList  deps;    // its own values, phis it feeds and its branch
+    SsaBlock** succs;   // where it always goes on to
+    u32        succ_count;
+    u32        succ_cap;
+};
+
+struct SsaValue {
+    SsaKind    kind;
+    Lattice    lat;
+    AST*       konst;       // the literal once lat is Lat_Const
+    SsaBlock*  block;
+    ValueList  users;
+    bool       queued;
+
+    // Ssa_Op: node says what to do with ops, a branch only uses ops[0]
+    AST*       node;
+    SsaValue*  ops[2];
+    u32        op_count;
+
+    // Ssa_Phi: in[i] when coming from from[i]
+    SsaValue** in;
+    SsaBlock** from;
+    u32        in_count;
+    u32        in_cap;
+
+    // Ssa_Branch
+    SsaBlock*  on_true;
+    SsaBlock*  on_false;
+};
+
+typedef struct {
+    u32       slot;
+    SsaValue* old;
+} Def;
+
+typedef struct {
+    Ssa*       s;
+    Arena*     a;
+    IrSymbols* names;
+    SsaValue** cur;     // per slot what the name holds right now, NULL when unbound
+    u32*       stamp;   // per slot, merging scratch
+    SsaValue** other;
+    u32        slot_cap;
+    u32        stamps;
+
+    // every define, so a body can put things back the way they were
+    Def*       log;
+    u32        log_count;
+    u32        log_cap;
+
+    SsaBlock*  block;   // where code goes right now
+    SsaValue*  opaque;  // the one unknown everything shares
+
+    // expression nodes with the value they compute
+    AST**      nodes;
+    SsaValue** vals;
+    u32        node_count;
+    u32        node_cap;
+
+    SsaBlock** flow;
+    u32        flow_count;
+    u32        flow_cap;
+    ValueList  work;
+} Builder;
+
+static void list_push(Arena* a, ValueList* list, SsaValue* v) {
+    if (list->count == list->cap) list->items = grow(a, list->items, &list->cap, sizeof(SsaValue*));
+    list->items[list->count++] = v;
+}
+
+static SsaBlock* block_new(Builder* b) {
+    return AllocArrayZero(b->a, SsaBlock, 1);
+}
+
+static void block_succ(Builder* b, SsaBlock* from, SsaBlock* to) {
+    if (from->succ_count == from->succ_cap) {
+        from->succs = grow(b->a, from->succs, &from->succ_cap, sizeof(SsaBlock*));
+    }
+    from->succs[from->succ_count++] = to;
+}
+
+static SsaValue* value_new(Builder* b, SsaKind kind) {
+    SsaValue* v = AllocArrayZero(b->a, SsaValue, 1);
+    v->kind = kind;
+    v->block = b->block;
+    if (kind == Ssa_Op || kind == Ssa_Branch) list_push(b->a, &b->block->deps, v);
+    return v;
+}
+
+static SsaValue* value_const(Builder* b, AST* literal) {
+    SsaValue* v = value_new(b, Ssa_Const);
+    v->lat = Lat_Const;
+    v->konst = literal;
+    return v;
+}
+
+static void value_use(Builder* b, SsaValue* user, u32 i, SsaValue* op) {
+    user->ops[i] = op;
+    if (user->op_count <= i) user->op_count = i + 1;
+    // literals and unknowns never change, nobody needs to hear from them
+    if (op->kind != Ssa_Const && op->kind != Ssa_Opaque) list_push(b->a, &op->users, user);
+}
+
+static SsaValue* phi_new(Builder* b, SsaBlock* block) {
+    SsaValue* phi = value_new(b, Ssa_Phi);
+    phi->block = block;
+    list_push(b->a, &block->deps, phi);
+    return phi;
+}
+
+static void phi_add(Builder* b, SsaValue* phi, SsaValue* v, SsaBlock* from) {
+    if (phi->in_count == phi->in_cap) {
+        u32 cap = phi->in_cap;
+        phi->in = grow(b->a, phi->in, &cap, sizeof(SsaValue*));
+        phi->from = grow(b->a, phi->from, &phi->in_cap, sizeof(SsaBlock*));
+    }
+    phi->in[phi->in_count] = v;
+    phi->from[phi->in_count++] = from;
+    if (v->kind != Ssa_Const && v->kind != Ssa_Opaque) list_push(b->a, &v->users, phi);
+    list_push(b->a, &from->deps, phi);
+}
+
+/*
+*  Names
+*/
+
+static SsaValue* value_const(Builder* b, AST* literal);
+
+// A name gets what earlier statements left in it the first time it's
+// seen, so a statement only pays for the names it uses. It's a copy:
+// folded nodes end up pointing at it, and the kept one gets overwritten.
+static void seed(Builder* b, u32 slot) {
+    Ssa* s = b->s;
+    i32 known = ir_symbol_find(s->names, b->names->names[slot]);
+    if (known < 0 || (u32)known >= s->cap || !s->known[known].set) return;
+
+    AST* literal = ast_new(b->a, s->known[known].literal);
+    if (literal->tag == AST_STR) {
+        String str = literal->data.AST_STR.str;
+        literal->data.AST_STR.str = string_alloc(b->a, str.len);
+        memcpy(literal->data.AST_STR.str.data, str.data, str.len + 1);
+    }
+    b->cur[slot] = value_const(b, literal);
+}
+
+static u32 slot_of(Builder* b, String name) {
+    u32 count = b->names->count;
+    u32 slot = ir_symbol(b->names, name);
+    if (slot < b->slot_cap) {
+        if (slot == count) seed(b, slot);
+        return slot;
+    }
+
+    u32 cap = b->slot_cap;
+    while (cap <= slot) cap = cap ? cap * 2 : SSA_LIST_INIT;
+    b->cur = arena_realloc(b->a, b->cur, sizeof(SsaValue*) * b->slot_cap, sizeof(SsaValue*) * cap);
+    b->other = arena_realloc(b->a, b->other, sizeof(SsaValue*) * b->slot_cap, sizeof(SsaValue*) * cap);
+    b->stamp = arena_realloc(b->a, b->stamp, sizeof(u32) * b->slot_cap, sizeof(u32) * cap);
+    memset(b->cur + b->slot_cap, 0, sizeof(SsaValue*) * (cap - b->slot_cap));
+    memset(b->stamp + b->slot_cap, 0, sizeof(u32) * (cap - b->slot_cap));
+    b->slot_cap = cap;
+    if (slot == count) seed(b, slot);
+    return slot;
+}
+
+static void define(Builder* b, u32 slot, SsaValue* v) {
+    if (b->log_count == b->log_cap) b->log = grow(b->a, b->log, &b->log_cap, sizeof(Def));
+    b->log[b->log_count++] = (Def){ slot, b->cur[slot] };
+    b->cur[slot] = v;
+}
+
+// back to how things were when the log was pos long
+static void undo(Builder* b, u32 pos) {
+    while (b->log_count > pos) {
+        Def d = b->log[--b->log_count];
+        b->cur[d.slot] = d.old;
+    }
+}
+
+// the slots defined since pos with what they hold now
+static Def* defined_since(Builder* b, u32 pos, u32* count) {
+    *count = b->log_count - pos;
+    Def* out = AllocArray(b->a, Def, *count ? *count : 1);
+    for (u32 i = 0; i < *count; ++i) {
+        u32 slot = b->log[pos + i].slot;
+        out[i] = (Def){ slot, b->cur[slot] };
+    }
+    return out;
+}
+
+typedef struct {
+    AstVisitor v;
+    Builder*   b;
+    u32*       slots;
+    u32        count;
+    u32        cap;
+} AssignVisitor;
+
+static void add_slot(AssignVisitor* av, String name) {
+    Builder* b = av->b;
+    u32 slot = slot_of(b, name);
+    if (b->stamp[slot] == b->stamps) return;
+    b->stamp[slot] = b->stamps;
+
+    if (av->count == av->cap) av->slots = grow(b->a, av->slots, &av->cap, sizeof(u32));
+    av->slots[av->count++] = slot;
+}
+
+static bool assign_pre(AstVisitor* v, AST* ast) {
+    AssignVisitor* av = (AssignVisitor*)v;
+
+    switch (ast->tag) {
+        case AST_LET: add_slot(av, ast->data.AST_LET.ident); break;
+        case AST_FOR: add_slot(av, ast->data.AST_FOR.ident); break;
+        // all four share the { ident, expr } layout
+        case AST_ADDEQ: case AST_SUBEQ: case AST_MULEQ: case AST_DIVEQ: {
+            add_slot(av, ast->data.AST_ADDEQ.ident);
+            break;
+        }
+        case AST_VASM: {
+            struct AST_VASM* data = &ast->data.AST_VASM;
+            for (u32 i = 0; i < data->var_count; ++i) {
+                if (data->written[i]) add_slot(av, data->vars[i]->data.AST_IDENT.ident);
+            }
+            break;
+        }
+        default: break;
+    }
+    return true;
+}
+
+/*
+*  Building
+*/
+
+static void record(Builder* b, AST* node, SsaValue* v) {
+    if (b->node_count == b->node_cap) {
+        u32 cap = b->node_cap;
+        b->nodes = grow(b->a, b->nodes, &cap, sizeof(AST*));
+        b->vals = grow(b->a, b->vals, &b->node_cap, sizeof(SsaValue*));
+    }
+    b->nodes[b->node_count] = node;
+    b->vals[b->node_count++] = v;
+}
+
+static SsaValue* build_expr(Builder* b, AST* ast) {
+    switch (ast->tag) {
+        case AST_NUMBER: case AST_STR: case AST_BOOL: case AST_NIL: return value_const(b, ast);
+        case AST_IDENT: {
+            u32 slot = slot_of(b, ast->data.AST_IDENT.ident);
+            SsaValue* v = b->cur[slot] ? b->cur[slot] : b->opaque;
+            record(b, ast, v);
+            return v;
+        }
+        case AST_EQ: case AST_NEQ: case AST_GT: case AST_GTE: case AST_LT: case AST_LTE:
+        case AST_NOT: case AST_AND: case AST_OR:
+        case AST_ADD: case AST_SUB: case AST_MUL: case AST_DIV: case AST_NEGATE: {
+            // operands first, so a block's values get visited in order
+            SsaValue* ops[2];
+            u32 count = ast_child_count(ast);
+            for (u32 i = 0; i < count; ++i) {
+                ops[i] = build_expr(b, *ast_child(ast, i));
+            }
+
+            SsaValue* v = value_new(b, Ssa_Op);
+            v->node = ast;
+            for (u32 i = 0; i < count; ++i) {
+                value_use(b, v, i, ops[i]);
+            }
+            record(b, ast, v);
+            return v;
+        }
+        // strings, arrays and len could still be folded, nothing does yet
+        default: {
+            for (u32 i = 0; i < ast_child_count(ast); ++i) {
+                build_expr(b, *ast_child(ast, i));
+            }
+            return b->opaque;
+        }
+    }
+}
+
+static void build_body(Builder* b, AST** body, u32 count);
+
+static void branch(Builder* b, SsaValue* cond, SsaBlock* on_true, SsaBlock* on_false) {
+    SsaValue* br = value_new(b, Ssa_Branch);
+    value_use(b, br, 0, cond);
+    br->on_true = on_true;
+    br->on_false = on_false;
+}
+
+// a name both sides could have changed, bound before the if
+static void join_def(Builder* b, SsaBlock* join, u32 slot, Def t, SsaBlock* t_end, Def e, SsaBlock* e_end) {
+    if (!b->cur[slot]) return;
+    if (t.old == e.old) {
+        if (t.old != b->cur[slot]) define(b, slot, t.old);
+        return;
+    }
+
+    SsaValue* phi = phi_new(b, join);
+    phi_add(b, phi, t.old, t_end);
+    phi_add(b, phi, e.old, e_end);
+    define(b, slot, phi);
+}
+
+static void build_if(Builder* b, struct AST_IF* data) {
+    SsaBlock* then_block = block_new(b);
+    SsaBlock* else_block = block_new(b);
+    SsaBlock* join = block_new(b);
+    branch(b, build_expr(b, data->expr), then_block, else_block);
+
+    u32 pos = b->log_count;
+    u32 then_count, else_count;
+
+    b->block = then_block;
+    build_body(b, data->body, data->stmt_count);
+    SsaBlock* then_end = b->block;
+    Def* then_defs = defined_since(b, pos, &then_count);
+    undo(b, pos);
+
+    b->block = else_block;
+    build_body(b, data->else_body, data->else_count);
+    SsaBlock* else_end = b->block;
+    Def* else_defs = defined_since(b, pos, &else_count);
+    undo(b, pos);
+
+    block_succ(b, then_end, join);
+    block_succ(b, else_end, join);
+    b->block = join;
+
+    // the Def's old says what the slot holds at the end of that side
+    b->stamps += 2;
+    u32 in_else = b->stamps - 1, done = b->stamps;
+    for (u32 i = 0; i < else_count; ++i) {
+        b->stamp[else_defs[i].slot] = in_else;
+        b->other[else_defs[i].slot] = else_defs[i].old;
+    }
+
+    for (u32 i = 0; i < then_count; ++i) {
+        u32 slot = then_defs[i].slot;
+        if (b->stamp[slot] == done) continue;
+        SsaValue* e = b->stamp[slot] == in_else ? b->other[slot] : b->cur[slot];
+        b->stamp[slot] = done;
+        join_def(b, join, slot, (Def){ slot, then_defs[i].old }, then_end, (Def){ slot, e }, else_end);
+    }
+    for (u32 i = 0; i < else_count; ++i) {
+        u32 slot = else_defs[i].slot;
+        if (b->stamp[slot] == done) continue;
+        b->stamp[slot] = done;
+        join_def(b, join, slot, (Def){ slot, b->cur[slot] }, then_end, (Def){ slot, else_defs[i].old }, else_end);
+    }
+}
+
+static void build_loop(Builder* b, AST* loop) {
+    AST** body;
+    u32 count;
+    if (loop->tag == AST_WHILE) {
+        body = loop->data.AST_WHILE.body;
+        count = loop->data.AST_WHILE.stmt_count;
+    } else {
+        // the bounds run once, before anything else
+        build_expr(b, loop->data.AST_FOR.start);
+        build_expr(b, loop->data.AST_FOR.end);
+        body = loop->data.AST_FOR.body;
+        count = loop->data.AST_FOR.stmt_count;
+    }
+
+    b->stamps++;
+    AssignVisitor av = {{assign_pre, 0, 0}, b, 0, 0, 0};
+    ast_walk(b->a, loop, &av.v);
+
+    SsaBlock* entry = b->block;
+    SsaBlock* head = block_new(b);
+    SsaBlock* inside = block_new(b);
+    SsaBlock* exit = block_new(b);
+    block_succ(b, entry, head);
+
+    // names bound before the loop and assigned in it get a phi at the
+    // head, the way back in gets filled once the body is built
+    SsaValue** phis = AllocArrayZero(b->a, SsaValue*, av.count ? av.count : 1);
+    for (u32 i = 0; i < av.count; ++i) {
+        u32 slot = av.slots[i];
+        if (!b->cur[slot]) continue;
+        phis[i] = phi_new(b, head);
+        phi_add(b, phis[i], b->cur[slot], entry);
+        define(b, slot, phis[i]);
+    }
+
+    b->block = head;
+    if (loop->tag == AST_WHILE) {
+        branch(b, build_expr(b, loop->data.AST_WHILE.expr), inside, exit);
+    } else {
+        block_succ(b, head, inside);
+        block_succ(b, head, exit);
+    }
+
+    u32 pos = b->log_count;
+    b->block = inside;
+    if (loop->tag == AST_FOR) define(b, slot_of(b, loop->data.AST_FOR.ident), b->opaque);
+    build_body(b, body, count);
+
+    SsaBlock* end = b->block;
+    block_succ(b, end, head);
+    for (u32 i = 0; i < av.count; ++i) {
+        if (!phis[i]) continue;
+        SsaValue* back = b->cur[av.slots[i]];
+        phi_add(b, phis[i], back ? back : b->opaque, end);
+    }
+    undo(b, pos);
+
+    b->block = exit;
+}
+
+static void build_stmt(Builder* b, AST* stmt) {
+    switch (stmt->tag) {
+        case AST_LET: {
+            SsaValue* v = build_expr(b, stmt->data.AST_LET.expr);
+            define(b, slot_of(b, stmt->data.AST_LET.ident), v);
+            break;
+        }
+        // x op= y is just x = x op y, all four share the { ident, expr } layout
+        case AST_ADDEQ: case AST_SUBEQ: case AST_MULEQ: case AST_DIVEQ: {
+            SsaValue* rhs = build_expr(b, stmt->data.AST_ADDEQ.expr);
+            u32 slot = slot_of(b, stmt->data.AST_ADDEQ.ident);
+
+            SsaValue* v = value_new(b, Ssa_Op);
+            v->node = AST_NEW(b->a, AST_ADD, 0, 0);
+            if (stmt->tag == AST_SUBEQ) v->node->tag = AST_SUB;
+            if (stmt->tag == AST_MULEQ) v->node->tag = AST_MUL;
+            if (stmt->tag == AST_DIVEQ) v->node->tag = AST_DIV;
+            value_use(b, v, 0, b->cur[slot] ? b->cur[slot] : b->opaque);
+            value_use(b, v, 1, rhs);
+            define(b, slot, v);
+            break;
+        }
+        // in the order the block gets to them, what it writes could be
+        // anything
+        case AST_VASM: {
+            struct AST_VASM* data = &stmt->data.AST_VASM;
+            for (u32 i = 0; i < data->var_count; ++i) {
+                if (data->written[i]) {
+                    define(b, slot_of(b, data->vars[i]->data.AST_IDENT.ident), b->opaque);
+                } else {
+                    build_expr(b, data->vars[i]);
+                }
+            }
+            break;
+        }
+        case AST_PRINT: build_expr(b, stmt->data.AST_PRINT.expr); break;
+        case AST_IF:    build_if(b, &stmt->data.AST_IF); break;
+        case AST_WHILE: case AST_FOR: build_loop(b, stmt); break;
+        case AST_FUNC:  break;
+        default: build_expr(b, stmt); break;
+    }
+}
+
+static void build_body(Builder* b, AST** body, u32 count) {
+    for (u32 i = 0; i < count; ++i) {
+        build_stmt(b, body[i]);
+    }
+}
+
+/*
+*  Propagation
+*/
+
+static bool same_const(AST* l, AST* r) {
+    if (l->tag != r->tag) return false;
+
+    switch (l->tag) {
+        case AST_NUMBER: {
+            return l->data.AST_NUMBER.val == r->data.AST_NUMBER.val &&
+                   l->data.AST_NUMBER.is_int == r->data.AST_NUMBER.is_int;
+        }
+        case AST_BOOL: return l->data.AST_BOOL.val == r->data.AST_BOOL.val;
+        case AST_STR:  return string_eq(l->data.AST_STR.str, r->data.AST_STR.str);
+        default:       return true;
+    }
+}
+
+// same as value_truthy
+static bool truthy(AST* ast) {
+    switch (ast->tag) {
+        case AST_NUMBER: return ast->data.AST_NUMBER.val != 0;
+        case AST_BOOL:   return ast->data.AST_BOOL.val;
+        case AST_NIL:    return false;
+        default:         return true;
+    }
+}
+
+static void reach(Builder* b, SsaBlock* block) {
+    if (block->exec) return;
+    block->exec = true;
+    if (b->flow_count == b->flow_cap) b->flow = grow(b->a, b->flow, &b->flow_cap, sizeof(SsaBlock*));
+    b->flow[b->flow_count++] = block;
+}
+
+static void eval_op(Builder* b, SsaValue* v) {
+    AST scratch = *v->node;
+    for (u32 i = 0; i < v->op_count; ++i) {
+        if (v->ops[i]->lat == Lat_Top) return;
+        if (v->ops[i]->lat == Lat_Bottom) {
+            v->lat = Lat_Bottom;
+            return;
+        }
+        *ast_child(&scratch, i) = v->ops[i]->konst;
+    }
+
+    ast_fold_node(&scratch);
+    if (!ast_is_literal(&scratch)) {
+        v->lat = Lat_Bottom;
+        return;
+    }
+    v->lat = Lat_Const;
+    v->konst = ast_new(b->a, scratch);
+}
+
+// only what comes in over a reachable way counts
+static void eval_phi(SsaValue* v) {
+    for (u32 i = 0; i < v->in_count && v->lat != Lat_Bottom; ++i) {
+        SsaValue* in = v->in[i];
+        if (!v->from[i]->exec || in->lat == Lat_Top) continue;
+
+        if (in->lat == Lat_Bottom) {
+            v->lat = Lat_Bottom;
+        } else if (v->lat == Lat_Top) {
+            v->lat = Lat_Const;
+            v->konst = in->konst;
+        } else if (!same_const(v->konst, in->konst)) {
+            v->lat = Lat_Bottom;
+        }
+    }
+}
+
+static void eval_branch(Builder* b, SsaValue* v) {
+    SsaValue* cond = v->ops[0];
+    if (cond->lat == Lat_Top) return;
+
+    if (cond->lat == Lat_Bottom || truthy(cond->konst)) reach(b, v->on_true);
+    if (cond->lat == Lat_Bottom || !truthy(cond->konst)) reach(b, v->on_false);
+}
+
+static void visit(Builder* b, SsaValue* v) {
+    if (!v->block->exec || v->lat == Lat_Bottom) return;
+
+    Lattice old = v->lat;
+    switch (v->kind) {
+        case Ssa_Op:     eval_op(b, v); break;
+        case Ssa_Phi:    eval_phi(v); break;
+        case Ssa_Branch: eval_branch(b, v); return;
+        default: return;
+    }
+    if (v->lat == old) return;
+
+    for (u32 i = 0; i < v->users.count; ++i) {
+        SsaValue* user = v->users.items[i];
+        if (user->queued) continue;
+        user->queued = true;
+        list_push(b->a, &b->work, user);
+    }
+}
+
+static void propagate(Builder* b, SsaBlock* entry) {
+    reach(b, entry);
+
+    while (b->flow_count || b->work.count) {
+        if (b->flow_count) {
+            SsaBlock* block = b->flow[--b->flow_count];
+            for (u32 i = 0; i < block->deps.count; ++i) visit(b, block->deps.items[i]);
+            for (u32 i = 0; i < block->succ_count; ++i) reach(b, block->succs[i]);
+            continue;
+        }
+
+        SsaValue* v = b->work.items[--b->work.count];
+        v->queued = false;
+        visit(b, v);
+    }
+}
+
+/*
+*  Entry
+*/
+
+// over whatever the name held before, a string only gets new room when
+// it doesn't fit the old one
+static void keep(Arena* a, SsaKnown* known, AST* literal) {
+    char* room = known->literal.tag == AST_STR ? known->literal.data.AST_STR.str.data : 0;
+    known->literal = *literal;
+    known->set = true;
+    if (literal->tag != AST_STR) return;
+
+    String str = literal->data.AST_STR.str;
+    if (!room || known->room < str.len + 1) {
+        room = string_alloc(a, str.len).data;
+        known->room = str.len + 1;
+    }
+    memcpy(room, str.data, str.len);
+    room[str.len] = '\0';
+    known->literal.data.AST_STR.str = (String){ room, str.len };
+}
+
+static void fold(Ssa* s, Arena* a, AST** stmts, u32 count, bool remember) {
+    Builder b = {0};
+    b.s = s;
+    b.a = a;
+    b.names = ir_symbols_new(a);
+    b.block = block_new(&b);
+    b.opaque = value_new(&b, Ssa_Opaque);
+    b.opaque->lat = Lat_Bottom;
+
+    SsaBlock* entry = b.block;
+    build_body(&b, stmts, count);
+    propagate(&b, entry);
+
+    for (u32 i = 0; i < b.node_count; ++i) {
+        AST* node = b.nodes[i];
+        SsaValue* v = b.vals[i];
+        if (v->lat != Lat_Const || ast_is_literal(node)) continue;
+        *node = *v->konst;
+        s->folded++;
+    }
+    if (!remember) return;
+
+    for (u32 i = 0; i < b.log_count; ++i) {
+        u32 slot = b.log[i].slot;
+        SsaValue* v = b.cur[slot];
+        u32 known = ir_symbol(s->names, b.names->names[slot]);
+        if (known >= s->cap) {
+            u32 cap = s->cap;
+            while (cap <= known) cap = cap ? cap * 2 : SSA_LIST_INIT;
+            s->known = arena_realloc(s->arena, s->known, sizeof(SsaKnown) * s->cap, sizeof(SsaKnown) * cap);
+            memset(s->known + s->cap, 0, sizeof(SsaKnown) * (cap - s->cap));
+            s->cap = cap;
+        }
+        if (v && v->lat == Lat_Const) {
+            keep(s->arena, &s->known[known], v->konst);
+        } else {
+            s->known[known].set = false;
+        }
+    }
+}
+
+// the statement's arena gets rewound by the caller when streaming
+void ssa_stmts(Ssa* s, Arena* a, AST** stmts, u32 count) {
+    fold(s, a, stmts, count, true);
+}
+
+// nothing comes after a whole program, and nothing built here outlives it
+void ssa_program(Ssa* s, Arena* a, AST* program) {
+    struct AST_PROGRAM* data = &program->data.AST_PROGRAM;
+    u64 start = a->pos_u64;
+    fold(s, a, data->body, data->stmt_count, false);
+    arena_set_pos_back(a, start);
+}
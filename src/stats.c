@@ -0,0 +1,115 @@
+#include "include/stats.h"
+#include "include/ast.h"
+#include <time.h>
+
+Stats stats;
+
+static const char* phase_names[PhaseCount] = {
+    [Phase_Read]  = "read",
+    [Phase_Lex]   = "lex",
+    [Phase_Parse] = "parse",
+    [Phase_Emit]  = "emit",
+    [Phase_Run]   = "run",
+};
+
+u64 stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+}
+
+void stats_pass(const char* name, u64 ns) {
+    for (u32 i = 0; i < stats.pass_count; ++i) {
+        if (stats.pass_names[i] == name) {
+            stats.pass_ns[i] += ns;
+            return;
+        }
+    }
+
+    if (stats.pass_count < STATS_MAX_PASSES) {
+        stats.pass_names[stats.pass_count] = name;
+        stats.pass_ns[stats.pass_count++] = ns;
+    }
+}
+
+static u64 phase_ns(Phase phase) {
+    if (phase == Phase_Parse && stats.phase_ns[Phase_Parse] > stats.phase_ns[Phase_Lex]) {
+        return stats.phase_ns[Phase_Parse] - stats.phase_ns[Phase_Lex];
+    }
+    return stats.phase_ns[phase];
+}
+
+static void stats_print_json(FILE* f, Arena* arena) {
+    fprintf(f, "{\"phases_ns\":{");
+    for (u32 i = 0; i < PhaseCount; ++i) {
+        fprintf(f, "%s\"%s\":%llu", i ? "," : "", phase_names[i],
+                (unsigned long long)phase_ns(i));
+    }
+
+    fprintf(f, "},\"passes_ns\":{");
+    for (u32 i = 0; i < stats.pass_count; ++i) {
+        fprintf(f, "%s\"%s\":%llu", i ? "," : "", stats.pass_names[i],
+                (unsigned long long)stats.pass_ns[i]);
+    }
+
+    fprintf(f, "},\"bytes\":%llu,\"tokens\":%llu,\"symbols\":%llu,"
+               "\"instructions\":%llu,\"out_bytes\":%llu,\"scalarized\":%llu,\"folded_nodes\":%llu,\"dead_nodes\":%llu,\"shared_nodes\":%llu,\"ast_nodes\":{",
+            (unsigned long long)stats.bytes,
+            (unsigned long long)stats.tokens,
+            (unsigned long long)stats.symbols,
+            (unsigned long long)stats.instructions,
+            (unsigned long long)stats.out_bytes,
+            (unsigned long long)stats.scalarized,
+            (unsigned long long)stats.folded_nodes,
+            (unsigned long long)stats.dead_nodes,
+            (unsigned long long)stats.shared_nodes);
+
+    bool first = true;
+    for (u32 tag = 0; tag < AST_TAG_COUNT; ++tag) {
+        if (!stats.ast_nodes[tag]) continue;
+        fprintf(f, "%s\"%s\":%llu", first ? "" : ",", ast_tag_str(tag).data,
+                (unsigned long long)stats.ast_nodes[tag]);
+        first = false;
+    }
+    fprintf(f, "},\"arena\":");
+    arena_report(arena, f, true);
+    fprintf(f, "}\n");
+}
+
+void stats_print(FILE* f, bool json, Arena* arena) {
+    if (json) {
+        stats_print_json(f, arena);
+        return;
+    }
+
+    u64 total = 0;
+    fprintf(f, "-*- Stats -*-\n");
+    for (u32 i = 0; i < PhaseCount; ++i) {
+        fprintf(f, "  %-14s %10.3f ms\n", phase_names[i], phase_ns(i) / 1e6);
+        total += phase_ns(i);
+    }
+    for (u32 i = 0; i < stats.pass_count; ++i) {
+        fprintf(f, "  pass %-9s %10.3f ms\n", stats.pass_names[i], stats.pass_ns[i] / 1e6);
+        total += stats.pass_ns[i];
+    }
+    fprintf(f, "  %-14s %10.3f ms\n", "total", total / 1e6);
+
+    fprintf(f, "  %-14s %10llu\n", "bytes", (unsigned long long)stats.bytes);
+    fprintf(f, "  %-14s %10llu\n", "tokens", (unsigned long long)stats.tokens);
+    fprintf(f, "  %-14s %10llu\n", "symbols", (unsigned long long)stats.symbols);
+    fprintf(f, "  %-14s %10llu\n", "instructions", (unsigned long long)stats.instructions);
+    fprintf(f, "  %-14s %10llu\n", "output bytes", (unsigned long long)stats.out_bytes);
+    fprintf(f, "  %-14s %10llu\n", "scalarized", (unsigned long long)stats.scalarized);
+    fprintf(f, "  %-14s %10llu\n", "folded nodes", (unsigned long long)stats.folded_nodes);
+    fprintf(f, "  %-14s %10llu\n", "dead nodes", (unsigned long long)stats.dead_nodes);
+    fprintf(f, "  %-14s %10llu\n", "shared nodes", (unsigned long long)stats.shared_nodes);
+
+    fprintf(f, "  ast nodes:\n");
+    for (u32 tag = 0; tag < AST_TAG_COUNT; ++tag) {
+        if (!stats.ast_nodes[tag]) continue;
+        fprintf(f, "    %-12s %10llu\n", ast_tag_str(tag).data,
+                (unsigned long long)stats.ast_nodes[tag]);
+    }
+
+    arena_report(arena, f, false);
+}
@@ -1,11 +1,18 @@
 #include "include/string.h"
 #include "include/arena.h"
+#include "include/number.h"
 #include <assert.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
 
+// string allocations belong to whoever is asking, or to the string module
+// when nobody claimed the arena
+static void* string_arena_alloc(Arena* a, u64 size) {
+    return arena_alloc_tagged(a, size, a->tag ? a->tag : ArenaTag_Strings);
+}
+
 String string(char* string_lit) {
     String s;
     s.data = string_lit;
@@ -24,7 +31,7 @@ String string_format(Arena* a, const char* format, ...) {
     va_end(args_copy);
 
     // Allocate a buffer to hold the formatted string
-    char* buffer = (char*)arena_alloc(a, size);
+    char* buffer = (char*)string_arena_alloc(a, size);
 
     // Format the string
     vsnprintf(buffer, size, format, args);
@@ -46,7 +53,7 @@ String string_alloc_str(Arena* a, char* lit) {
 
 String string_alloc(Arena* a, u64 len) {
     String s;
-    s.data = (char*)arena_alloc(a, len+1);
+    s.data = (char*)string_arena_alloc(a, len+1);
     s.len = len;
     return s;
 }
@@ -66,11 +73,12 @@ String string_substring(Arena* a, String str, u64 start, u64 end) {
 }
 
 const char* string_cstr(Arena* a, String str) {
-    char* ptr = (char*)arena_alloc(a, str.len); 
+    char* ptr = (char*)string_arena_alloc(a, str.len+1); 
 
     for (u64 i = 0; i < str.len; ++i) {
         ptr[i] = str.data[i];
     }
+    ptr[str.len] = '\0';
 
     return ptr;
 }
@@ -164,7 +172,7 @@ String string_replace(Arena* a, String str, String needle, String replacement) {
 }
 
 f64 string_to_number(String str) {
-    return atof(str.data);
+    return number_parse(str).val;
 }
 
 bool string_eq(String a, String b) {
@@ -178,3 +186,13 @@ bool string_eq(String a, String b) {
 
     return true;
 }
+
+// FNV-1a, for tables that see a lot of similar names
+u64 string_hash(String s) {
+    u64 h = 0xcbf29ce484222325ull;
+    for (u64 i = 0; i < s.len; ++i) {
+        h ^= (u8)s.data[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
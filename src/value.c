@@ -0,0 +1,148 @@
+#include "include/value.h"
+#include "include/arena.h"
+#include "include/err.h"
+#include "include/number.h"
+#include "include/string.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static String* str_new(Arena* a, u64 len) {
+    String* s = AllocArray(a, String, 1);
+    *s = string_alloc(a, len);
+    s->data[len] = '\0';
+    return s;
+}
+
+Value value_str_lit(Arena* a, String lexeme) {
+    String* s = str_new(a, lexeme.len);
+
+    u64 len = 0;
+    for (u64 i = 0; i < lexeme.len; ++i) {
+        char c = lexeme.data[i];
+        if (c == '\\' && i + 1 < lexeme.len) {
+            switch (lexeme.data[i+1]) {
+                case 'n': c = '\n'; i++; break;
+                case 't': c = '\t'; i++; break;
+                case 'r': c = '\r'; i++; break;
+                case 'b': c = '\b'; i++; break;
+                default: break;
+            }
+        }
+        s->data[len++] = c;
+    }
+
+    s->len = len;
+    s->data[len] = '\0';
+    return value_str(s);
+}
+
+Value value_concat(Arena* a, Value l, Value r) {
+    String* ls = value_as_str(l);
+    String* rs = value_as_str(r);
+
+    String* s = str_new(a, ls->len + rs->len);
+    memcpy(s->data, ls->data, ls->len);
+    memcpy(s->data + ls->len, rs->data, rs->len);
+    return value_str(s);
+}
+
+f64 value_expect_num(Value v, const char* op) {
+    if (!value_is_num(v)) {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "'%s' expects Num, got %s", op, value_type_str(v));
+        err(msg, 0, 0);
+    }
+    return value_as_num(v);
+}
+
+Value value_add(Arena* a, Value l, Value r) {
+    if (value_is_str(l) && value_is_str(r)) {
+        return value_concat(a, l, r);
+    }
+    return value_num(value_expect_num(l, "+") + value_expect_num(r, "+"));
+}
+
+Value value_array(Arena* a, Value* items, u64 len) {
+    Array* arr = arena_alloc(a, sizeof(Array) + sizeof(Value) * len);
+    arr->len = len;
+    memcpy(arr->items, items, sizeof(Value) * len);
+    return value_arr(arr);
+}
+
+Value value_index(Value arr, Value index) {
+    if (!value_is_arr(arr)) {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "Only arrays can be indexed, got %s", value_type_str(arr));
+        err(msg, 0, 0);
+    }
+
+    Array* a = value_as_arr(arr);
+    f64 i = value_expect_num(index, "[]");
+    if (!(i >= 0 && i < (f64)a->len) || i != (f64)(u64)i) {
+        err("Index out of bounds", 0, 0);
+    }
+    return a->items[(u64)i];
+}
+
+Value value_len(Value v) {
+    if (value_is_arr(v)) return value_num((f64)value_as_arr(v)->len);
+    if (value_is_str(v)) return value_num((f64)value_as_str(v)->len);
+
+    char msg[64];
+    snprintf(msg, sizeof(msg), "'len' expects Str or Array, got %s", value_type_str(v));
+    err(msg, 0, 0);
+}
+
+bool value_eq(Value a, Value b) {
+    if (value_is_num(a) && value_is_num(b)) {
+        return value_as_num(a) == value_as_num(b);
+    }
+
+    if (value_is_str(a) && value_is_str(b)) {
+        return string_eq(*value_as_str(a), *value_as_str(b));
+    }
+
+    return a == b;
+}
+
+static void print_num(FILE* f, f64 n) {
+    char buf[NUMBER_FMT_LEN];
+    fwrite(buf, 1, number_format(buf, n), f);
+}
+
+void value_print(FILE* f, Value v) {
+    if (value_is_num(v)) {
+        print_num(f, value_as_num(v));
+    }
+    else if (value_is_str(v)) {
+        String* s = value_as_str(v);
+        fwrite(s->data, 1, s->len, f);
+    }
+    else if (value_is_arr(v)) {
+        Array* a = value_as_arr(v);
+        fputc('[', f);
+        for (u64 i = 0; i < a->len; ++i) {
+            if (i) fputs(", ", f);
+            value_print(f, a->items[i]);
+        }
+        fputc(']', f);
+    }
+    else if (v == VALUE_TRUE) {
+        fputs("true", f);
+    }
+    else if (v == VALUE_FALSE) {
+        fputs("false", f);
+    }
+    else {
+        fputs("nil", f);
+    }
+}
+
+const char* value_type_str(Value v) {
+    if (value_is_num(v))  return "Num";
+    if (value_is_str(v))  return "Str";
+    if (value_is_arr(v))  return "Array";
+    if (value_is_bool(v)) return "Bool";
+    return "Nil";
+}
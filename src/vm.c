@@ -0,0 +1,767 @@
+#include "include/vm.h"
+#include "include/arena.h"
+#include "include/err.h"
+#include "include/ir.h"
+#include "include/jit.h"
+#include "include/string.h"
+#include "include/value.h"
+#include <stdio.h>
+#include <string.h>
+
+// first chunk of the heap, it grows from there
+#define VM_ARENA_SIZE (4 * 1024 * 1024)
+// runs before a loop body is worth compiling. Anything at least half as
+// hot by then goes in the same batch.
+#define VM_JIT_HOT    64
+#define VM_SLOTS_INIT 64
+#define VM_STACK_INIT 256
+
+#define LIKELY(x) __builtin_expect(!!(x), 1)
+
+// X(name, stack effect)
+#define VM_OPS(X)   \
+    X(PushK,   1)   \
+    X(Load,    1)   \
+    X(Store,  -1)   \
+    X(Del,     0)   \
+    X(Swap,    0)   \
+    X(Add,    -1)   \
+    X(Sub,    -1)   \
+    X(RSub,   -1)   \
+    X(Mult,   -1)   \
+    X(Div,    -1)   \
+    X(RDiv,   -1)   \
+    X(IAdd,   -1)   \
+    X(ISub,   -1)   \
+    X(IRSub,  -1)   \
+    X(IMult,  -1)   \
+    X(Neg,     0)   \
+    X(Eq,     -1)   \
+    X(Neq,    -1)   \
+    X(Gt,     -1)   \
+    X(Gte,    -1)   \
+    X(Lt,     -1)   \
+    X(Lte,    -1)   \
+    X(And,    -1)   \
+    X(Or,     -1)   \
+    X(Not,     0)   \
+    X(Array,   1)   \
+    X(Index,  -1)   \
+    X(IndexU, -1)   \
+    X(Len,     0)   \
+    X(AddTo,  -1)   \
+    X(SubTo,  -1)   \
+    X(MultTo, -1)   \
+    X(DivTo,  -1)   \
+    X(Print,   0)   \
+    X(PrintTop,-1)  \
+    X(Call,    0)   \
+    X(Jmp,     0)   \
+    X(JmpF,   -1)   \
+    X(JmpNotLt,-2)  \
+    X(Jit,     0)   \
+    X(Halt,    0)
+
+typedef enum {
+#define X(name, effect) Vm_##name,
+    VM_OPS(X)
+#undef X
+    VmOpCount,
+} VmOp;
+
+static const i32 vm_effect[VmOpCount] = {
+#define X(name, effect) effect,
+    VM_OPS(X)
+#undef X
+};
+
+// A loop body the JIT could take, followed by the VM's own code for it.
+// Until it gets compiled it only counts how often it runs. After, the
+// skip instructions it stands in for only run when one of its guards
+// fails.
+struct VmJit {
+    JitRegion region;
+    u32       runs;
+    u32       skip;
+    u32       vm_at;    // where its Jit instruction is
+    bool      tried;
+};
+
+struct VmInst {
+    void* op;
+    union {
+        Value   k;      // PushK
+        u32     slot;   // Load, Store, Del, Print, *To, Array's count
+        IrInst* ir;     // Call
+        VmJit*  jit;    // Jit
+        VmInst* to;     // Jmp, JmpF, JmpNotLt
+    } as;
+};
+
+Vm* vm_new(IrSymbols* syms, FILE* out) {
+    Arena* a = arena_new_sized(VM_ARENA_SIZE);
+    Vm* vm = AllocArrayZero(a, Vm, 1);
+
+    vm->arena = a;
+    vm->out = out;
+    vm->syms = syms;
+
+    vm->slot_cap = VM_SLOTS_INIT;
+    vm->slots = AllocArrayZero(a, Value, vm->slot_cap);
+    vm->defined = AllocArrayZero(a, bool, vm->slot_cap);
+
+    vm->stack_cap = VM_STACK_INIT;
+    vm->stack = AllocArray(a, Value, vm->stack_cap);
+
+    vm->tmp_a = ir_symbol(syms, string(IR_TMP_A));
+    vm->tmp_b = ir_symbol(syms, string(IR_TMP_B));
+    vm->tmp = ir_symbol(syms, string(IR_TMP));
+    vm->tmp_var = ir_symbol(syms, string(IR_TMP_VAR));
+
+    return vm;
+}
+
+void vm_enable_jit(Vm* vm) {
+    vm->jit = jit_new(vm->arena);
+}
+
+void vm_free(Vm* vm) {
+    if (vm->jit) jit_free(vm->jit);
+    arena_free(vm->arena);
+}
+
+/*
+*  Slow paths
+*/
+
+static Value vm_arg(Vm* vm, IrArg arg) {
+    return arg.imm ? value_num(arg.num) : vm->slots[arg.slot];
+}
+
+static Value vm_cmp(IrFn fn, Value l, Value r) {
+    switch (fn) {
+        case IrFn_Eq:  return value_bool(value_eq(l, r));
+        case IrFn_Neq: return value_bool(!value_eq(l, r));
+        case IrFn_Gt:  return value_bool(value_expect_num(l, ">") >  value_expect_num(r, ">"));
+        case IrFn_Gte: return value_bool(value_expect_num(l, ">=") >= value_expect_num(r, ">="));
+        case IrFn_Lt:  return value_bool(value_expect_num(l, "<") <  value_expect_num(r, "<"));
+        case IrFn_Lte: return value_bool(value_expect_num(l, "<=") <= value_expect_num(r, "<="));
+        case IrFn_And: return value_bool(value_truthy(l) && value_truthy(r));
+        case IrFn_Or:  return value_bool(value_truthy(l) || value_truthy(r));
+        default: break;
+    }
+
+    err("Unreachable comparison", 0, 0);
+}
+
+static Value vm_arith(Vm* vm, IrFn fn, Value l, Value r) {
+    switch (fn) {
+        case IrFn_Add:  return value_add(vm->arena, l, r);
+        case IrFn_Sub:  return value_num(value_expect_num(l, "-") - value_expect_num(r, "-"));
+        case IrFn_Mult: return value_num(value_expect_num(l, "*") * value_expect_num(r, "*"));
+        case IrFn_Div:  return value_num(value_expect_num(l, "/") / value_expect_num(r, "/"));
+        default: break;
+    }
+
+    err("Unreachable arithmetic", 0, 0);
+}
+
+static void vm_print(Vm* vm, Value v) {
+    value_print(vm->out, v);
+    fputc('\n', vm->out);
+}
+
+// anything the fusing in vm_compile didn't catch. Returns whether a value
+// was pushed.
+static bool vm_call(Vm* vm, IrInst* inst, Value* result) {
+    IrFn fn = inst->as.call.fn;
+    Value r = VALUE_NIL;
+
+    switch (fn) {
+        case IrFn_Eq: case IrFn_Neq: case IrFn_Gt: case IrFn_Gte:
+        case IrFn_Lt: case IrFn_Lte: case IrFn_And: case IrFn_Or: {
+            r = vm_cmp(fn, vm_arg(vm, inst->as.call.args[0]), vm_arg(vm, inst->as.call.args[1]));
+            break;
+        }
+        case IrFn_Add: case IrFn_Sub: case IrFn_Mult: case IrFn_Div: {
+            r = vm_arith(vm, fn, vm_arg(vm, inst->as.call.args[0]), vm_arg(vm, inst->as.call.args[1]));
+            break;
+        }
+        case IrFn_Not: {
+            r = value_bool(!value_truthy(vm_arg(vm, inst->as.call.args[0])));
+            break;
+        }
+        case IrFn_PrintStr: {
+            vm_print(vm, vm_arg(vm, inst->as.call.args[0]));
+            return false;
+        }
+        default: err("Unknown function", 0, 0);
+    }
+
+    if (inst->as.call.dst != IR_NO_DST) {
+        vm->slots[inst->as.call.dst] = r;
+        return false;
+    }
+
+    *result = r;
+    return true;
+}
+
+/*
+*  Dispatch
+*/
+
+#define NEXT()   goto *(++ip)->op
+#define PUSH(v)  do { *sp++ = tos; tos = (v); } while (0)
+#define DROP()   (tos = *--sp)
+
+#define NUM_BINOP(name, expr, fn)                                        \
+    op_##name: {                                                         \
+        Value y = tos, x = *--sp;                                        \
+        if (LIKELY(value_is_num(x) && value_is_num(y))) {                \
+            f64 l = value_as_num(x), r = value_as_num(y);                \
+            tos = value_num(expr);                                       \
+        } else {                                                         \
+            tos = fn;                                                    \
+        }                                                                \
+        NEXT();                                                          \
+    }
+
+// the compiler proved both sides are integers, which are Nums here, so
+// there is nothing to check
+#define INT_BINOP(name, expr)                                            \
+    op_##name: {                                                         \
+        f64 r = value_as_num(tos), l = value_as_num(*--sp);              \
+        tos = value_num(expr);                                           \
+        NEXT();                                                          \
+    }
+
+#define NUM_ASSIGN(name, expr, irfn)                                     \
+    op_##name: {                                                         \
+        Value* var = &slots[ip->as.slot];                                \
+        Value y = tos;                                                   \
+        DROP();                                                          \
+        if (LIKELY(value_is_num(*var) && value_is_num(y))) {             \
+            f64 l = value_as_num(*var), r = value_as_num(y);             \
+            *var = value_num(expr);                                      \
+        } else {                                                         \
+            *var = vm_arith(vm, irfn, *var, y);                          \
+        }                                                                \
+        NEXT();                                                          \
+    }
+
+#define CMP(name, irfn)                                                  \
+    op_##name: {                                                         \
+        Value y = tos, x = *--sp;                                        \
+        tos = vm_cmp(irfn, x, y);                                        \
+        NEXT();                                                          \
+    }
+
+#define NUM_CMP(name, op, irfn)                                          \
+    op_##name: {                                                         \
+        Value y = tos, x = *--sp;                                        \
+        if (LIKELY(value_is_num(x) && value_is_num(y))) {                \
+            tos = value_bool(value_as_num(x) op value_as_num(y));        \
+        } else {                                                         \
+            tos = vm_cmp(irfn, x, y);                                    \
+        }                                                                \
+        NEXT();                                                          \
+    }
+
+// Compiles every region of the running program that is hot or getting
+// there and hasn't been tried yet
+static void vm_jit_batch(Vm* vm) {
+    Arena* a = vm->jit_scratch;
+    u64 start = a->pos_u64;
+
+    JitRegion** batch = AllocArray(a, JitRegion*, vm->jit_count);
+    u32 count = 0;
+    for (u32 i = 0; i < vm->jit_count; ++i) {
+        VmJit* r = &vm->jits[i];
+        if (r->tried || r->runs < VM_JIT_HOT / 2) continue;
+
+        r->tried = true;
+        batch[count++] = &r->region;
+    }
+
+    jit_compile(vm->jit, a, vm->syms, batch, count);
+
+    arena_set_pos_back(a, start);
+}
+
+// labels as values and goto * are GNU extensions
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+// Called with code == NULL it only hands out the handler table, which is
+// the one way to get at label addresses from outside the function.
+static void vm_exec(Vm* vm, VmInst* code, void*** table) {
+    static void* labels[VmOpCount] = {
+#define X(name, effect) [Vm_##name] = &&op_##name,
+        VM_OPS(X)
+#undef X
+    };
+
+    if (!code) {
+        *table = labels;
+        return;
+    }
+
+    Value* slots = vm->slots;
+    Value* sp = vm->stack;
+    Value  tos = VALUE_NIL;
+    VmInst* ip = code;
+
+    goto *ip->op;
+
+    op_PushK: PUSH(ip->as.k); NEXT();
+    op_Load:  PUSH(slots[ip->as.slot]); NEXT();
+    op_Store: slots[ip->as.slot] = tos; DROP(); NEXT();
+    op_Del:   slots[ip->as.slot] = VALUE_NIL; NEXT();
+    op_Swap: {
+        Value y = tos;
+        tos = sp[-1];
+        sp[-1] = y;
+        NEXT();
+    }
+
+    // x is below y on the stack. sub and div work top down, the swapped
+    // versions are what the compiler means by l - r and l / r
+    NUM_BINOP(Add,  l + r, value_add(vm->arena, x, y))
+    NUM_BINOP(Sub,  r - l, vm_arith(vm, IrFn_Sub, y, x))
+    NUM_BINOP(RSub, l - r, vm_arith(vm, IrFn_Sub, x, y))
+    NUM_BINOP(Mult, l * r, vm_arith(vm, IrFn_Mult, x, y))
+    NUM_BINOP(Div,  r / l, vm_arith(vm, IrFn_Div, y, x))
+    NUM_BINOP(RDiv, l / r, vm_arith(vm, IrFn_Div, x, y))
+
+    INT_BINOP(IAdd,  l + r)
+    INT_BINOP(ISub,  r - l)
+    INT_BINOP(IRSub, l - r)
+    INT_BINOP(IMult, l * r)
+
+    op_Neg: tos = value_num(-value_expect_num(tos, "-")); NEXT();
+
+    CMP(Eq,  IrFn_Eq)
+    CMP(Neq, IrFn_Neq)
+    NUM_CMP(Gt,  >,  IrFn_Gt)
+    NUM_CMP(Gte, >=, IrFn_Gte)
+    NUM_CMP(Lt,  <,  IrFn_Lt)
+    NUM_CMP(Lte, <=, IrFn_Lte)
+    CMP(And, IrFn_And)
+    CMP(Or,  IrFn_Or)
+
+    op_Not: tos = value_bool(!value_truthy(tos)); NEXT();
+
+    // spill the top so all the items sit in a row, deepest first
+    op_Array: {
+        u32 count = ip->as.slot;
+        if (count == 0) {
+            PUSH(value_array(vm->arena, sp, 0));
+            NEXT();
+        }
+        *sp = tos;
+        sp -= count - 1;
+        tos = value_array(vm->arena, sp, count);
+        NEXT();
+    }
+
+    op_Index: {
+        Value y = tos, x = *--sp;
+        tos = value_index(x, y);
+        NEXT();
+    }
+
+    // the compiler proved the index is a whole number in bounds, which
+    // only holds if it's really an array
+    op_IndexU: {
+        Value y = tos, x = *--sp;
+        tos = LIKELY(value_is_arr(x))
+            ? value_as_arr(x)->items[(u64)value_as_num(y)]
+            : value_index(x, y);
+        NEXT();
+    }
+
+    op_Len: tos = value_len(tos); NEXT();
+
+    NUM_ASSIGN(AddTo,  l + r, IrFn_Add)
+    NUM_ASSIGN(SubTo,  l - r, IrFn_Sub)
+    NUM_ASSIGN(MultTo, l * r, IrFn_Mult)
+    NUM_ASSIGN(DivTo,  l / r, IrFn_Div)
+
+    op_Print:    vm_print(vm, slots[ip->as.slot]); NEXT();
+    op_PrintTop: vm_print(vm, tos); DROP(); NEXT();
+
+    op_Call: {
+        Value r;
+        if (vm_call(vm, ip->as.ir, &r)) PUSH(r);
+        NEXT();
+    }
+
+    op_Jmp: ip = ip->as.to; goto *ip->op;
+    op_JmpF: {
+        bool t = value_truthy(tos);
+        DROP();
+        if (!t) {
+            ip = ip->as.to;
+            goto *ip->op;
+        }
+        NEXT();
+    }
+
+    // the loop condition, i < end without making the bool
+    op_JmpNotLt: {
+        Value y = tos, x = *--sp;
+        DROP();
+        bool lt = LIKELY(value_is_num(x) && value_is_num(y))
+            ? value_as_num(x) < value_as_num(y)
+            : value_truthy(vm_cmp(IrFn_Lt, x, y));
+        if (!lt) {
+            ip = ip->as.to;
+            goto *ip->op;
+        }
+        NEXT();
+    }
+
+    op_Jit: {
+        VmJit* r = ip->as.jit;
+        if (LIKELY(r->region.fn != 0)) {
+            if (LIKELY(r->region.fn(slots))) ip += r->skip;
+        } else if (++r->runs == VM_JIT_HOT) {
+            vm_jit_batch(vm);
+        }
+        NEXT();
+    }
+
+    op_Halt: return;
+}
+
+#pragma GCC diagnostic pop
+
+/*
+*  Compiling IR to threaded code
+*/
+
+static void vm_ensure_slots(Vm* vm) {
+    u32 count = vm->syms->count;
+    if (count <= vm->slot_cap) return;
+
+    u32 cap = vm->slot_cap;
+    while (cap < count) cap *= 2;
+
+    vm->slots = arena_realloc(vm->arena, vm->slots, sizeof(Value) * vm->slot_cap,
+                                                    sizeof(Value) * cap);
+    vm->defined = arena_realloc(vm->arena, vm->defined, sizeof(bool) * vm->slot_cap,
+                                                        sizeof(bool) * cap);
+    memset(vm->defined + vm->slot_cap, 0, sizeof(bool) * (cap - vm->slot_cap));
+    vm->slot_cap = cap;
+}
+
+// Only the compiler names these and it never reads one it didn't just pop,
+// so a store the fuser leaves out can't be missed. Program variables always
+// get their stores.
+static bool is_scratch(Vm* vm, u32 slot) {
+    return slot == vm->tmp_a || slot == vm->tmp_b ||
+           slot == vm->tmp || slot == vm->tmp_var;
+}
+
+static void vm_use(Vm* vm, u32 slot) {
+    if (!vm->defined[slot]) {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "Undefined variable '%s'", vm->syms->names[slot].data);
+        err(msg, 0, 0);
+    }
+}
+
+static bool call_is(IrInst* inst, IrFn fn, i32 dst, u32 argc) {
+    return inst->op == Ir_Call && inst->as.call.fn == fn &&
+           inst->as.call.dst == dst && inst->as.call.argc == argc;
+}
+
+static bool arg_is(IrInst* inst, u32 i, u32 slot) {
+    return !inst->as.call.args[i].imm && inst->as.call.args[i].slot == slot;
+}
+
+// Matches the sequences the lowering pass produces and returns how many IR
+// instructions the superinstruction covers, 0 if nothing matched. Stores
+// into the compiler's own scratch registers get dropped on the way.
+static u32 vm_fuse(Vm* vm, IrInst* code, u32 left, VmOp* op, u32* slot) {
+    IrInst* i0 = &code[0];
+    IrInst* i1 = left > 1 ? &code[1] : 0;
+    IrInst* i2 = left > 2 ? &code[2] : 0;
+    IrInst* i3 = left > 3 ? &code[3] : 0;
+    if (!i1) return 0;
+
+    if (i0->op == Ir_Swap && i1->op == Ir_Sub)  { *op = Vm_RSub; return 2; }
+    if (i0->op == Ir_Swap && i1->op == Ir_Div)  { *op = Vm_RDiv; return 2; }
+    if (i0->op == Ir_Swap && i1->op == Ir_ISub) { *op = Vm_IRSub; return 2; }
+    if (i0->op == Ir_Int && i0->as.i == -1 && (i1->op == Ir_Mult || i1->op == Ir_IMult)) {
+        *op = Vm_Neg;
+        return 2;
+    }
+
+    if (i0->op != Ir_Pop || !is_scratch(vm, i0->as.slot) || !i2) return 0;
+    u32 t = i0->as.slot;
+
+    // pop t, print t, del t
+    if (i2->op == Ir_Del && i2->as.slot == t) {
+        if ((i1->op == Ir_Print && i1->as.slot == t) ||
+            (call_is(i1, IrFn_PrintStr, IR_NO_DST, 1) && arg_is(i1, 0, t))) {
+            *op = Vm_PrintTop;
+            return 3;
+        }
+        if (call_is(i1, IrFn_Not, IR_NO_DST, 1) && arg_is(i1, 0, t)) {
+            *op = Vm_Not;
+            return 3;
+        }
+    }
+
+    // pop t, call Op x t | x
+    static const VmOp assign[IrFnCount] = {
+        [IrFn_Add] = Vm_AddTo, [IrFn_Sub] = Vm_SubTo,
+        [IrFn_Mult] = Vm_MultTo, [IrFn_Div] = Vm_DivTo,
+    };
+    if (i1->op == Ir_Call && assign[i1->as.call.fn] && i1->as.call.argc == 2 &&
+        i1->as.call.dst != IR_NO_DST && arg_is(i1, 1, t) && (u32)i1->as.call.dst != t &&
+        arg_is(i1, 0, (u32)i1->as.call.dst)) {
+        *op = assign[i1->as.call.fn];
+        *slot = i1->as.call.dst;
+        vm_use(vm, *slot);
+        return 2;
+    }
+
+    // pop b, pop a, call cmp a b
+    static const VmOp cmp[IrFnCount] = {
+        [IrFn_Eq] = Vm_Eq, [IrFn_Neq] = Vm_Neq, [IrFn_Gt] = Vm_Gt,
+        [IrFn_Gte] = Vm_Gte, [IrFn_Lt] = Vm_Lt, [IrFn_Lte] = Vm_Lte,
+        [IrFn_And] = Vm_And, [IrFn_Or] = Vm_Or,
+    };
+    if (i1->op == Ir_Pop && is_scratch(vm, i1->as.slot) && i1->as.slot != t &&
+        call_is(i2, IrFn_Lt, IR_NO_DST, 2) && arg_is(i2, 0, i1->as.slot) && arg_is(i2, 1, t) &&
+        i3 && i3->op == Ir_JmpF) {
+        *op = Vm_JmpNotLt;
+        *slot = i3->as.label;
+        return 4;
+    }
+    if (i1->op == Ir_Pop && is_scratch(vm, i1->as.slot) && i1->as.slot != t &&
+        i2->op == Ir_Call && cmp[i2->as.call.fn] && i2->as.call.argc == 2 &&
+        i2->as.call.dst == IR_NO_DST && arg_is(i2, 0, i1->as.slot) && arg_is(i2, 1, t)) {
+        *op = cmp[i2->as.call.fn];
+        return 3;
+    }
+
+    return 0;
+}
+
+static VmInst* vm_compile(Vm* vm, Arena* a, IrProgram* ir, usize* max_depth) {
+    void** table;
+    vm_exec(vm, 0, &table);
+
+    vm_ensure_slots(vm);
+
+    // block ids keep counting across streamed statements, so only the
+    // ones in this program get an entry
+    u32 lo = UINT32_MAX, hi = 0;
+    u32 loop_starts = 0;
+    for (u32 i = 0; i < ir->count; ++i) {
+        if (ir->code[i].op == Ir_JmpF) loop_starts++;
+        if (ir->code[i].op != Ir_Target) continue;
+        loop_starts++;
+        if (ir->code[i].as.label < lo) lo = ir->code[i].as.label;
+        if (ir->code[i].as.label > hi) hi = ir->code[i].as.label;
+    }
+    u32 blocks = lo <= hi ? hi - lo + 1 : 0;
+    u32* targets = AllocArray(a, u32, blocks);
+
+    // What's defined at each jmpf. Loop exits are only reached through
+    // their jmpf, so that's what is defined after the loop and whatever
+    // the body brought in goes out of scope. The jmp from the end of an
+    // if's body to past its else carries what was defined at the if's own
+    // jmpf, the innermost one whose target hasn't come up yet.
+    bool** exits = AllocArrayZero(a, bool*, blocks);
+    u32* open = AllocArray(a, u32, blocks);
+    u32 open_count = 0;
+
+    // Top level statements only ever run once, so only what comes right
+    // after a jump target or a jmpf, the insides of loops and ifs, gets a
+    // Jit instruction. Its own code is compiled as usual right behind it.
+    // Straight line code has none of those and compiles like without --jit.
+    bool jit = vm->jit && loop_starts > 0;
+    VmJit* region = 0;
+    u32 region_end = 0;
+    vm->jit_count = 0;
+    if (jit) {
+        vm->jits = AllocArrayZero(a, VmJit, loop_starts);
+        vm->jit_scratch = a;
+    }
+
+    // at most one Jit instruction in front of each IR instruction
+    VmInst* code = AllocArray(a, VmInst, (jit ? 2 : 1) * ir->count + 1);
+    u32 n = 0;
+    i64 depth = 0;
+    i64 max = 0;
+
+    for (u32 i = 0; i < ir->count;) {
+        if (region && i == region_end) {
+            region->skip = n - region->vm_at - 1;
+            region = 0;
+        }
+
+        if (jit && !region && depth == 0 && i > 0 &&
+            (ir->code[i-1].op == Ir_Target || ir->code[i-1].op == Ir_JmpF)) {
+            u32 covered = jit_scan(vm->jit, a, vm->syms, &ir->code[i], ir->count - i);
+            if (covered) {
+                region = &vm->jits[vm->jit_count++];
+                region->region = (JitRegion){ &ir->code[i], covered, 0 };
+                region->vm_at = n;
+                region_end = i + covered;
+                code[n++] = (VmInst){ table[Vm_Jit], { .jit = region } };
+            }
+        }
+
+        IrInst* inst = &ir->code[i];
+        VmOp op = VmOpCount;
+        u32 slot = 0;
+        VmInst out = {0};
+
+        u32 fused = vm_fuse(vm, inst, ir->count - i, &op, &slot);
+        if (fused) {
+            out.as.slot = slot;
+            i += fused;
+        } else {
+            i++;
+            switch (inst->op) {
+                case Ir_Push: op = Vm_PushK; out.as.k = value_num(inst->as.num); break;
+                case Ir_Int:  op = Vm_PushK; out.as.k = value_num((f64)inst->as.i); break;
+                case Ir_Bool: op = Vm_PushK; out.as.k = value_bool(inst->as.val); break;
+                case Ir_Nil:  op = Vm_PushK; out.as.k = VALUE_NIL; break;
+                case Ir_Str: {
+                    op = Vm_PushK;
+                    out.as.k = value_str_lit(vm->arena, inst->as.str);
+                    break;
+                }
+                case Ir_Load: {
+                    vm_use(vm, inst->as.slot);
+                    op = Vm_Load;
+                    out.as.slot = inst->as.slot;
+                    break;
+                }
+                case Ir_Pop: {
+                    vm->defined[inst->as.slot] = true;
+                    op = Vm_Store;
+                    out.as.slot = inst->as.slot;
+                    break;
+                }
+                case Ir_Del: {
+                    vm->defined[inst->as.slot] = false;
+                    op = Vm_Del;
+                    out.as.slot = inst->as.slot;
+                    break;
+                }
+                case Ir_Print: {
+                    vm_use(vm, inst->as.slot);
+                    op = Vm_Print;
+                    out.as.slot = inst->as.slot;
+                    break;
+                }
+                case Ir_Swap: op = Vm_Swap; break;
+                case Ir_Add:  op = Vm_Add; break;
+                case Ir_Sub:  op = Vm_Sub; break;
+                case Ir_Mult: op = Vm_Mult; break;
+                case Ir_Div:  op = Vm_Div; break;
+                case Ir_IAdd:  op = Vm_IAdd; break;
+                case Ir_ISub:  op = Vm_ISub; break;
+                case Ir_IMult: op = Vm_IMult; break;
+                case Ir_Array: {
+                    op = Vm_Array;
+                    out.as.slot = inst->as.count;
+                    depth -= inst->as.count;
+                    break;
+                }
+                case Ir_Index:  op = Vm_Index; break;
+                case Ir_IndexU: op = Vm_IndexU; break;
+                case Ir_Len:    op = Vm_Len; break;
+                case Ir_Call: {
+                    for (u32 arg = 0; arg < inst->as.call.argc; ++arg) {
+                        if (!inst->as.call.args[arg].imm) vm_use(vm, inst->as.call.args[arg].slot);
+                    }
+                    if (inst->as.call.dst != IR_NO_DST) {
+                        vm->defined[inst->as.call.dst] = true;
+                    } else if (inst->as.call.fn != IrFn_PrintStr) {
+                        depth++;
+                    }
+                    op = Vm_Call;
+                    out.as.ir = inst;
+                    break;
+                }
+                case Ir_Target: {
+                    u32 block = inst->as.label - lo;
+                    targets[block] = n;
+                    if (open_count && open[open_count-1] == block) open_count--;
+                    if (exits[block]) {
+                        memcpy(vm->defined, exits[block], sizeof(bool) * vm->slot_cap);
+                    }
+                    continue;
+                }
+                case Ir_Jmp: {
+                    u32 block = inst->as.label - lo;
+                    if (!exits[block] && open_count) exits[block] = exits[open[open_count-1]];
+                    op = Vm_Jmp;
+                    out.as.slot = inst->as.label;
+                    break;
+                }
+                case Ir_JmpF: op = Vm_JmpF; out.as.slot = inst->as.label; break;
+                case Ir_Label: continue;
+                case Ir_Stop:  op = Vm_Halt; break;
+                default: err("Unknown IR instruction", 0, 0);
+            }
+        }
+
+        if (op == Vm_JmpF || op == Vm_JmpNotLt) {
+            u32 block = out.as.slot - lo;
+            exits[block] = AllocArray(a, bool, vm->slot_cap);
+            memcpy(exits[block], vm->defined, sizeof(bool) * vm->slot_cap);
+            open[open_count++] = block;
+        }
+
+        depth += vm_effect[op];
+        if (depth < 0) err("Stack underflow in bytecode", 0, 0);
+        if (depth > max) max = depth;
+
+        out.op = table[op];
+        code[n++] = out;
+    }
+
+    if (region) {
+        region->skip = n - region->vm_at - 1;
+    }
+
+    code[n].op = table[Vm_Halt];
+
+    for (u32 k = 0; k < n; ++k) {
+        if (code[k].op == table[Vm_Jmp] || code[k].op == table[Vm_JmpF] ||
+            code[k].op == table[Vm_JmpNotLt]) {
+            code[k].as.to = code + targets[code[k].as.slot - lo];
+        }
+    }
+
+    *max_depth = max;
+    return code;
+}
+
+void vm_run(Vm* vm, Arena* scratch, IrProgram* ir) {
+    u64 start = scratch->pos_u64;
+
+    usize depth;
+    VmInst* code = vm_compile(vm, scratch, ir, &depth);
+
+    // the compiler knows how deep the stack gets, so handlers never check.
+    // +1 for the slot the cached top of stack spills into on the first push
+    if (depth + 1 > vm->stack_cap) {
+        vm->stack_cap = depth + 1;
+        vm->stack = AllocArray(vm->arena, Value, vm->stack_cap);
+    }
+
+    vm_exec(vm, code, 0);
+
+    arena_set_pos_back(scratch, start);
+}
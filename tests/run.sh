@@ -0,0 +1,55 @@
+#!/bin/sh
+# Runs every tests/*.bz on each backend and diffs what it prints against
+# tests/<name>.out. A "# skip: --tree --c" line leaves those backends out
+# for programs they reject on purpose.
+#
+#   tests/run.sh bin/blazeit
+
+BIN=${1:-bin/blazeit}
+CC=${CC:-cc}
+DIR=$(dirname "$0")
+RUNTIME="$DIR/../runtime/blaze_rt.c"
+MODES="-r --tree --jit --stream --c --asm"
+
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+pass=0
+fail=0
+
+run_mode() {
+    case $1 in
+        -r)       "$BIN" "$2" -r ;;
+        --stream) "$BIN" "$2" -r --stream ;;
+        --tree)   "$BIN" "$2" -r --tree ;;
+        --jit)    "$BIN" "$2" -r --jit ;;
+        --c)      "$BIN" "$2" "$TMP/prog.c" --c >/dev/null &&
+                  $CC -O2 -std=c99 "$TMP/prog.c" -o "$TMP/prog" -lm &&
+                  "$TMP/prog" ;;
+        --asm)    "$BIN" "$2" "$TMP/prog.s" --asm >/dev/null &&
+                  $CC "$TMP/prog.s" "$RUNTIME" -o "$TMP/prog" &&
+                  "$TMP/prog" ;;
+    esac
+}
+
+for prog in "$DIR"/*.bz; do
+    name=$(basename "$prog" .bz)
+    expected="$DIR/$name.out"
+    skip=$(sed -n 's/^# skip://p' "$prog")
+
+    for mode in $MODES; do
+        case " $skip " in *" $mode "*) continue ;; esac
+
+        run_mode "$mode" "$prog" > "$TMP/out" 2>&1
+        if diff -u "$expected" "$TMP/out" > "$TMP/diff"; then
+            pass=$((pass + 1))
+        else
+            fail=$((fail + 1))
+            echo "FAIL $name $mode"
+            cat "$TMP/diff"
+        fi
+    done
+done
+
+echo "$pass passed, $fail failed"
+[ "$fail" -eq 0 ]